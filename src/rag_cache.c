@@ -0,0 +1,432 @@
+/**
+ * RAG Query Result Cache
+ * Entries live in fixed slots: keys in one dim-float matrix, results in
+ * one blob, and links as slot indices. That gives three structures over
+ * the same slots: an exact-hash chain, one SimHash bucket chain per
+ * table, and the LRU list. A lookup hashes the query. Only on an exact
+ * miss does it project the query onto CACHE_TABLES x CACHE_BITS
+ * hyperplanes and compute cosines for the keys in its buckets. For a
+ * cosine of 0.98 the chance that two queries share a bucket in a table
+ * is about 0.91^8 = 0.47, so eight tables find them with probability
+ * about 0.99.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "rag_cache.h"
+#include "rag_kernels.h"
+
+#define CACHE_TABLES 8
+#define CACHE_BITS 8                // Signature bits per table
+#define CACHE_BUCKETS (1 << CACHE_BITS)
+#define CACHE_SEED 0xcac4e5u
+#define NIL -1
+
+struct cache_entry {
+    uint64_t hash;                  // Query bytes and tag
+    uint64_t expires_us;            // 0: never
+    uint32_t tag;
+    uint32_t visited;               // Lookup stamp, so a key is scored once
+    float norm;
+    uint8_t sig[CACHE_TABLES];
+    int exact_next;
+    int bucket_next[CACHE_TABLES];
+    int lru_prev, lru_next;         // Head is the most recently used
+};
+
+struct rag_cache {
+    int dim;
+    size_t result_size;
+    struct rag_cache_params params;
+    pthread_mutex_t lock;
+
+    struct cache_entry *entries;
+    float *keys;                    // capacity x dim
+    char *results;                  // capacity x result_size
+    size_t used;                    // Slots ever filled; free slots come after
+    int *free_slots;                // Cleared or expired slots to reuse
+    size_t num_free;
+
+    int *exact_heads;
+    size_t exact_mask;
+    float *planes;                  // CACHE_TABLES * CACHE_BITS x dim
+    int *buckets;                   // CACHE_TABLES x CACHE_BUCKETS heads
+    int lru_head, lru_tail;
+    uint32_t stamp;
+
+    struct rag_cache_stats stats;
+};
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static uint64_t hash_key(const float *query, int dim, uint32_t tag) {
+    const unsigned char *p = (const unsigned char *)query;
+    uint64_t h = 14695981039346656037ULL ^ tag;
+    for (size_t i = 0; i < dim * sizeof(float); i++) {
+        h = (h ^ p[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static void signature(const struct rag_cache *c, const float *query, uint8_t *sig) {
+    float proj[CACHE_TABLES * CACHE_BITS];
+    rag_dot_tile(query, 1, c->planes, CACHE_TABLES * CACHE_BITS, c->dim, proj, CACHE_TABLES * CACHE_BITS);
+    for (int t = 0; t < CACHE_TABLES; t++) {
+        sig[t] = 0;
+        for (int b = 0; b < CACHE_BITS; b++) {
+            sig[t] |= (proj[t * CACHE_BITS + b] > 0) << b;
+        }
+    }
+}
+
+static float vector_norm(const float *v, int dim) {
+    return sqrtf(rag_dot(v, v, dim));
+}
+
+struct rag_cache* rag_cache_create(int dim, size_t result_size, const struct rag_cache_params *params) {
+    if (params->capacity == 0 || params->capacity > (size_t)1 << 30) {
+        fprintf(stderr, "Cache capacity must be 1 .. 2^30 entries\n");
+        return NULL;
+    }
+    struct rag_cache *c = calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    c->dim = dim;
+    c->result_size = result_size;
+    c->params = *params;
+    pthread_mutex_init(&c->lock, NULL);
+
+    size_t cap = params->capacity;
+    c->exact_mask = 1;
+    while (c->exact_mask < 2 * cap) c->exact_mask <<= 1;
+    c->exact_mask--;
+    c->entries = malloc(cap * sizeof(struct cache_entry));
+    c->keys = malloc(cap * dim * sizeof(float));
+    c->results = malloc(cap * result_size);
+    c->free_slots = malloc(cap * sizeof(int));
+    c->exact_heads = malloc((c->exact_mask + 1) * sizeof(int));
+    c->planes = malloc((size_t)CACHE_TABLES * CACHE_BITS * dim * sizeof(float));
+    c->buckets = malloc(CACHE_TABLES * CACHE_BUCKETS * sizeof(int));
+    if (!c->entries || !c->keys || !c->results || !c->free_slots || !c->exact_heads ||
+        !c->planes || !c->buckets) {
+        fprintf(stderr, "Failed to allocate a %zu-entry result cache\n", cap);
+        rag_cache_destroy(c);
+        return NULL;
+    }
+
+    // Hyperplane normals; a sum of four uniforms is close enough to
+    // Gaussian for the signature to be rotation-invariant in practice
+    unsigned int seed = CACHE_SEED;
+    for (size_t i = 0; i < (size_t)CACHE_TABLES * CACHE_BITS * dim; i++) {
+        float x = 0;
+        for (int j = 0; j < 4; j++) x += (float)rand_r(&seed) / RAND_MAX - 0.5f;
+        c->planes[i] = x;
+    }
+    rag_cache_clear(c);
+    return c;
+}
+
+void rag_cache_destroy(struct rag_cache *c) {
+    if (!c) return;
+    pthread_mutex_destroy(&c->lock);
+    free(c->entries);
+    free(c->keys);
+    free(c->results);
+    free(c->free_slots);
+    free(c->exact_heads);
+    free(c->planes);
+    free(c->buckets);
+    free(c);
+}
+
+void rag_cache_clear(struct rag_cache *c) {
+    pthread_mutex_lock(&c->lock);
+    for (size_t i = 0; i <= c->exact_mask; i++) c->exact_heads[i] = NIL;
+    for (int i = 0; i < CACHE_TABLES * CACHE_BUCKETS; i++) c->buckets[i] = NIL;
+    c->used = 0;
+    c->num_free = 0;
+    c->lru_head = c->lru_tail = NIL;
+    c->stats.entries = 0;
+    pthread_mutex_unlock(&c->lock);
+}
+
+static void lru_unlink(struct rag_cache *c, int slot) {
+    struct cache_entry *e = &c->entries[slot];
+    if (e->lru_prev != NIL) c->entries[e->lru_prev].lru_next = e->lru_next;
+    else c->lru_head = e->lru_next;
+    if (e->lru_next != NIL) c->entries[e->lru_next].lru_prev = e->lru_prev;
+    else c->lru_tail = e->lru_prev;
+}
+
+static void lru_push_front(struct rag_cache *c, int slot) {
+    struct cache_entry *e = &c->entries[slot];
+    e->lru_prev = NIL;
+    e->lru_next = c->lru_head;
+    if (c->lru_head != NIL) c->entries[c->lru_head].lru_prev = slot;
+    c->lru_head = slot;
+    if (c->lru_tail == NIL) c->lru_tail = slot;
+}
+
+// Remove slot from the singly linked chain starting at *head
+static void chain_unlink(struct rag_cache *c, int *head, int slot, int table) {
+    while (*head != slot) {
+        struct cache_entry *e = &c->entries[*head];
+        head = table < 0 ? &e->exact_next : &e->bucket_next[table];
+    }
+    struct cache_entry *e = &c->entries[slot];
+    *head = table < 0 ? e->exact_next : e->bucket_next[table];
+}
+
+static void remove_entry(struct rag_cache *c, int slot) {
+    struct cache_entry *e = &c->entries[slot];
+    chain_unlink(c, &c->exact_heads[e->hash & c->exact_mask], slot, -1);
+    if (c->params.near_threshold > 0) {
+        for (int t = 0; t < CACHE_TABLES; t++) {
+            chain_unlink(c, &c->buckets[t * CACHE_BUCKETS + e->sig[t]], slot, t);
+        }
+    }
+    lru_unlink(c, slot);
+    c->free_slots[c->num_free++] = slot;
+    c->stats.entries--;
+}
+
+static int expired(const struct cache_entry *e, uint64_t now) {
+    return e->expires_us != 0 && now >= e->expires_us;
+}
+
+// Hit bookkeeping; the caller holds the lock
+static void take_hit(struct rag_cache *c, int slot, void *result) {
+    lru_unlink(c, slot);
+    lru_push_front(c, slot);
+    memcpy(result, c->results + slot * c->result_size, c->result_size);
+}
+
+static int find_exact(struct rag_cache *c, const float *query, uint32_t tag, uint64_t hash) {
+    for (int s = c->exact_heads[hash & c->exact_mask]; s != NIL; s = c->entries[s].exact_next) {
+        const struct cache_entry *e = &c->entries[s];
+        if (e->hash == hash && e->tag == tag &&
+            memcmp(c->keys + (size_t)s * c->dim, query, c->dim * sizeof(float)) == 0) {
+            return s;
+        }
+    }
+    return NIL;
+}
+
+int rag_cache_lookup(struct rag_cache *c, const float *query, uint32_t tag,
+                     void *result, float *similarity) {
+    uint64_t hash = hash_key(query, c->dim, tag);
+    uint64_t now = c->params.ttl_ms ? now_us() : 0;
+
+    pthread_mutex_lock(&c->lock);
+    c->stats.lookups++;
+    int slot = find_exact(c, query, tag, hash);
+    if (slot != NIL && expired(&c->entries[slot], now)) {
+        remove_entry(c, slot);
+        c->stats.expired++;
+        slot = NIL;
+    }
+    if (slot != NIL) {
+        take_hit(c, slot, result);
+        c->stats.exact_hits++;
+        pthread_mutex_unlock(&c->lock);
+        if (similarity) *similarity = 1.0f;
+        return RAG_CACHE_EXACT;
+    }
+    if (c->params.near_threshold <= 0 || c->stats.entries == 0) {
+        pthread_mutex_unlock(&c->lock);
+        return RAG_CACHE_MISS;
+    }
+
+    // Near-duplicates: the most similar key across this query's buckets
+    uint8_t sig[CACHE_TABLES];
+    signature(c, query, sig);
+    float norm = vector_norm(query, c->dim);
+    float best = c->params.near_threshold;
+    int best_slot = NIL;
+    uint32_t stamp = ++c->stamp;
+    for (int t = 0; t < CACHE_TABLES && norm > 0; t++) {
+        int s = c->buckets[t * CACHE_BUCKETS + sig[t]];
+        while (s != NIL) {
+            struct cache_entry *e = &c->entries[s];
+            int next = e->bucket_next[t];
+            if (e->visited != stamp && e->tag == tag) {
+                e->visited = stamp;
+                if (expired(e, now)) {
+                    remove_entry(c, s);
+                    c->stats.expired++;
+                } else if (e->norm > 0) {
+                    float cos = rag_dot(query, c->keys + (size_t)s * c->dim, c->dim) / (norm * e->norm);
+                    if (cos > best) {
+                        best = cos;
+                        best_slot = s;
+                    }
+                }
+            }
+            s = next;
+        }
+    }
+    if (best_slot != NIL) {
+        take_hit(c, best_slot, result);
+        c->stats.near_hits++;
+        pthread_mutex_unlock(&c->lock);
+        if (similarity) *similarity = best;
+        return RAG_CACHE_NEAR;
+    }
+    pthread_mutex_unlock(&c->lock);
+    return RAG_CACHE_MISS;
+}
+
+void rag_cache_insert(struct rag_cache *c, const float *query, uint32_t tag, const void *result) {
+    uint64_t hash = hash_key(query, c->dim, tag);
+    uint64_t expires = c->params.ttl_ms ? now_us() + c->params.ttl_ms * 1000ULL : 0;
+    uint8_t sig[CACHE_TABLES];
+    if (c->params.near_threshold > 0) {
+        signature(c, query, sig);
+    }
+    float norm = vector_norm(query, c->dim);
+
+    pthread_mutex_lock(&c->lock);
+    int slot = find_exact(c, query, tag, hash);
+    if (slot != NIL) {
+        // Refresh in place
+        c->entries[slot].expires_us = expires;
+        memcpy(c->results + slot * c->result_size, result, c->result_size);
+        lru_unlink(c, slot);
+        lru_push_front(c, slot);
+        pthread_mutex_unlock(&c->lock);
+        return;
+    }
+
+    if (c->num_free > 0) {
+        slot = c->free_slots[--c->num_free];
+    } else if (c->used < c->params.capacity) {
+        slot = c->used++;
+    } else {
+        slot = c->lru_tail;
+        remove_entry(c, slot);
+        c->num_free--;              // remove_entry freed exactly this slot
+        c->stats.evictions++;
+    }
+
+    struct cache_entry *e = &c->entries[slot];
+    e->hash = hash;
+    e->expires_us = expires;
+    e->tag = tag;
+    e->visited = 0;
+    e->norm = norm;
+    memcpy(c->keys + (size_t)slot * c->dim, query, c->dim * sizeof(float));
+    memcpy(c->results + slot * c->result_size, result, c->result_size);
+
+    int *head = &c->exact_heads[hash & c->exact_mask];
+    e->exact_next = *head;
+    *head = slot;
+    if (c->params.near_threshold > 0) {
+        memcpy(e->sig, sig, sizeof(sig));
+        for (int t = 0; t < CACHE_TABLES; t++) {
+            head = &c->buckets[t * CACHE_BUCKETS + sig[t]];
+            e->bucket_next[t] = *head;
+            *head = slot;
+        }
+    }
+    lru_push_front(c, slot);
+    c->stats.entries++;
+    pthread_mutex_unlock(&c->lock);
+}
+
+void rag_cache_stats(struct rag_cache *c, struct rag_cache_stats *stats) {
+    pthread_mutex_lock(&c->lock);
+    *stats = c->stats;
+    pthread_mutex_unlock(&c->lock);
+}
+
+static void random_unit(float *v, int dim, unsigned int *seed) {
+    float norm = 0;
+    for (int i = 0; i < dim; i++) {
+        v[i] = (float)rand_r(seed) / RAND_MAX * 2.0f - 1.0f;
+        norm += v[i] * v[i];
+    }
+    norm = sqrtf(norm);
+    for (int i = 0; i < dim; i++) v[i] /= norm;
+}
+
+static int check(const char *name, int ok) {
+    printf("  %-34s %s\n", name, ok ? "ok" : "FAIL");
+    return !ok;
+}
+
+int rag_cache_self_test(void) {
+    enum { DIM = 128, NUM_KEYS = 64 };
+    struct rag_cache_params params = { NUM_KEYS, 0, 0.95f };
+    struct rag_cache *c = rag_cache_create(DIM, sizeof(int), &params);
+    float *keys = malloc(NUM_KEYS * DIM * sizeof(float));
+    if (!c || !keys) {
+        fprintf(stderr, "Self-test allocation failed\n");
+        rag_cache_destroy(c);
+        free(keys);
+        return 1;
+    }
+
+    printf("Result cache self-test:\n");
+    int failures = 0, value, hits = 0;
+    unsigned int seed = 2468;
+    for (int i = 0; i < NUM_KEYS; i++) {
+        random_unit(keys + i * DIM, DIM, &seed);
+        rag_cache_insert(c, keys + i * DIM, 10, &i);
+    }
+
+    int ok = 1;
+    for (int i = 0; i < NUM_KEYS && ok; i++) {
+        ok = rag_cache_lookup(c, keys + i * DIM, 10, &value, NULL) == RAG_CACHE_EXACT && value == i;
+    }
+    failures += check("exact hits", ok);
+    failures += check("other tag misses", rag_cache_lookup(c, keys, 5, &value, NULL) == RAG_CACHE_MISS);
+
+    // A small perturbation keeps cosine near 0.99; a fresh vector is near 0
+    float probe[DIM], noise[DIM];
+    for (int i = 0; i < NUM_KEYS; i++) {
+        random_unit(noise, DIM, &seed);
+        for (int d = 0; d < DIM; d++) probe[d] = keys[i * DIM + d] + 0.1f * noise[d];
+        float sim;
+        hits += rag_cache_lookup(c, probe, 10, &value, &sim) == RAG_CACHE_NEAR && value == i && sim > 0.95f;
+    }
+    failures += check("near-duplicate hits (>= 90%)", hits >= NUM_KEYS * 9 / 10);
+    random_unit(probe, DIM, &seed);
+    failures += check("unrelated query misses", rag_cache_lookup(c, probe, 10, &value, NULL) == RAG_CACHE_MISS);
+
+    // Key 1 is the least recently used after touching key 0 .. : one more
+    // insert must evict exactly it
+    for (int i = 0; i < NUM_KEYS; i++) {
+        if (i != 1) rag_cache_lookup(c, keys + i * DIM, 10, &value, NULL);
+    }
+    rag_cache_insert(c, probe, 10, &value);
+    struct rag_cache_stats stats;
+    rag_cache_stats(c, &stats);
+    failures += check("LRU evicts the coldest entry",
+                      rag_cache_lookup(c, keys + DIM, 10, &value, NULL) != RAG_CACHE_EXACT &&
+                      rag_cache_lookup(c, keys, 10, &value, NULL) == RAG_CACHE_EXACT &&
+                      stats.evictions == 1 && stats.entries == NUM_KEYS);
+    rag_cache_destroy(c);
+
+    params.ttl_ms = 1;
+    c = rag_cache_create(DIM, sizeof(int), &params);
+    if (c) {
+        rag_cache_insert(c, keys, 10, &value);
+        usleep(3000);
+        int miss = rag_cache_lookup(c, keys, 10, &value, NULL) == RAG_CACHE_MISS;
+        rag_cache_stats(c, &stats);
+        failures += check("TTL expires entries", miss && stats.expired == 1 && stats.entries == 0);
+    } else {
+        failures++;
+    }
+    rag_cache_destroy(c);
+    free(keys);
+    return failures;
+}
@@ -0,0 +1,57 @@
+#ifndef RAG_CACHE_H
+#define RAG_CACHE_H
+
+// Query result cache in front of the vector search. Exact repeats are
+// found by hashing the query bytes. Near-duplicates (cosine above a
+// threshold) are found through SimHash buckets: a query is compared only
+// against cached keys that share a random-hyperplane signature in at
+// least one table. Entries expire after a TTL; beyond capacity the
+// least recently used one is evicted. All calls are thread-safe.
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct rag_cache_params {
+    size_t capacity;            // Entries
+    uint32_t ttl_ms;            // 0: entries never expire
+    float near_threshold;       // Cosine for a near-duplicate hit; 0 = exact only
+};
+
+#define RAG_CACHE_DEFAULT_NEAR 0.98f
+
+enum rag_cache_hit {
+    RAG_CACHE_MISS = 0,
+    RAG_CACHE_EXACT,
+    RAG_CACHE_NEAR,
+};
+
+struct rag_cache_stats {
+    uint64_t lookups;
+    uint64_t exact_hits;
+    uint64_t near_hits;
+    uint64_t expired;           // Entries dropped by the TTL
+    uint64_t evictions;         // Entries dropped by the LRU bound
+    size_t entries;
+};
+
+struct rag_cache;
+
+// Entries hold a copy of a dim-float query and result_size result bytes
+struct rag_cache* rag_cache_create(int dim, size_t result_size, const struct rag_cache_params *params);
+void rag_cache_destroy(struct rag_cache *cache);
+
+// Results are cached per tag (e.g. top_k), which must match exactly. On
+// a hit the result is copied out and, if similarity is non-NULL, the
+// key's cosine to query is stored. Returns an enum rag_cache_hit.
+int rag_cache_lookup(struct rag_cache *cache, const float *query, uint32_t tag,
+                     void *result, float *similarity);
+void rag_cache_insert(struct rag_cache *cache, const float *query, uint32_t tag, const void *result);
+
+// Drop every entry, e.g. after the database changes; stats are kept
+void rag_cache_clear(struct rag_cache *cache);
+void rag_cache_stats(struct rag_cache *cache, struct rag_cache_stats *stats);
+
+// Exact and near hits, tags, LRU and TTL; returns the number of failures
+int rag_cache_self_test(void);
+
+#endif // RAG_CACHE_H
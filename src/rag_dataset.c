@@ -0,0 +1,488 @@
+/**
+ * RAG Benchmark Datasets
+ * Vector i takes its generator state from outputs [32i, 32i + 32) of a
+ * splitmix64 sequence started at the seed, so any range of vectors can
+ * be generated on its own. Each xoshiro256** output gives two elements,
+ * bits 8-31 and 40-63 as 24-bit integers centred on zero, in the order a
+ * 32-bit shift of the 64-bit lanes leaves them:
+ * - scalar:  8 lanes in a loop
+ * - AVX2:    2 x 4 lanes, rotates as shift pairs
+ * - AVX-512: 8 lanes, native rotates
+ * The norm is summed over those integers exactly, and each element is
+ * scaled with one float rounding, so every kernel writes the same bits.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "rag_dataset.h"
+#include "rag_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RAG_X86 1
+#endif
+
+#define GEN_LANES 8
+#define GEN_ROUND (2 * GEN_LANES)          // Elements per step of all lanes
+#define GEN_CENTRE (1 << 23)
+#define READ_CHUNK (1 << 20)               // Bytes per pread
+
+struct gen_state {
+    uint64_t s[4][GEN_LANES];
+};
+
+// Write rounds x GEN_ROUND elements in [-2^23, 2^23)
+typedef void (*gen_fn)(struct gen_state *g, int32_t *out, int rounds);
+
+static uint64_t splitmix64(uint64_t *z) {
+    uint64_t x = (*z += 0x9E3779B97F4A7C15ULL);
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static void seed_vector(uint64_t seed, size_t i, struct gen_state *g) {
+    uint64_t z = seed + (uint64_t)i * (4 * GEN_LANES) * 0x9E3779B97F4A7C15ULL;
+    for (int w = 0; w < 4; w++) {
+        for (int l = 0; l < GEN_LANES; l++) g->s[w][l] = splitmix64(&z);
+    }
+}
+
+static inline uint64_t rotl(uint64_t x, int k) {
+    return x << k | x >> (64 - k);
+}
+
+static void gen_scalar(struct gen_state *g, int32_t *out, int rounds) {
+    for (int r = 0; r < rounds; r++, out += GEN_ROUND) {
+        for (int l = 0; l < GEN_LANES; l++) {
+            uint64_t s0 = g->s[0][l], s1 = g->s[1][l], s2 = g->s[2][l], s3 = g->s[3][l];
+            uint64_t x = rotl(s1 * 5, 7) * 9;
+            uint64_t t = s1 << 17;
+            s2 ^= s0;
+            s3 ^= s1;
+            s1 ^= s2;
+            s0 ^= s3;
+            s2 ^= t;
+            s3 = rotl(s3, 45);
+            g->s[0][l] = s0;
+            g->s[1][l] = s1;
+            g->s[2][l] = s2;
+            g->s[3][l] = s3;
+            out[2 * l] = (int32_t)((uint32_t)x >> 8) - GEN_CENTRE;
+            out[2 * l + 1] = (int32_t)((uint32_t)(x >> 32) >> 8) - GEN_CENTRE;
+        }
+    }
+}
+
+#ifdef RAG_X86
+
+__attribute__((target("avx2")))
+static inline __m256i rotl_avx2(__m256i x, int k) {
+    return _mm256_or_si256(_mm256_slli_epi64(x, k), _mm256_srli_epi64(x, 64 - k));
+}
+
+// One step of 4 lanes; x * 5 and x * 9 as shift-adds (AVX2 has no
+// 64-bit multiply)
+__attribute__((target("avx2")))
+static inline __m256i xoshiro_avx2(__m256i *s) {
+    __m256i s1x5 = _mm256_add_epi64(_mm256_slli_epi64(s[1], 2), s[1]);
+    __m256i r = rotl_avx2(s1x5, 7);
+    __m256i x = _mm256_add_epi64(_mm256_slli_epi64(r, 3), r);
+    __m256i t = _mm256_slli_epi64(s[1], 17);
+    s[2] = _mm256_xor_si256(s[2], s[0]);
+    s[3] = _mm256_xor_si256(s[3], s[1]);
+    s[1] = _mm256_xor_si256(s[1], s[2]);
+    s[0] = _mm256_xor_si256(s[0], s[3]);
+    s[2] = _mm256_xor_si256(s[2], t);
+    s[3] = rotl_avx2(s[3], 45);
+    return _mm256_sub_epi32(_mm256_srli_epi32(x, 8), _mm256_set1_epi32(GEN_CENTRE));
+}
+
+__attribute__((target("avx2")))
+static void gen_avx2(struct gen_state *g, int32_t *out, int rounds) {
+    __m256i lo[4], hi[4];
+    for (int w = 0; w < 4; w++) {
+        lo[w] = _mm256_loadu_si256((const __m256i *)g->s[w]);
+        hi[w] = _mm256_loadu_si256((const __m256i *)(g->s[w] + 4));
+    }
+    for (int r = 0; r < rounds; r++, out += GEN_ROUND) {
+        _mm256_storeu_si256((__m256i *)out, xoshiro_avx2(lo));
+        _mm256_storeu_si256((__m256i *)(out + 8), xoshiro_avx2(hi));
+    }
+    for (int w = 0; w < 4; w++) {
+        _mm256_storeu_si256((__m256i *)g->s[w], lo[w]);
+        _mm256_storeu_si256((__m256i *)(g->s[w] + 4), hi[w]);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void gen_avx512(struct gen_state *g, int32_t *out, int rounds) {
+    __m512i s0 = _mm512_loadu_si512(g->s[0]), s1 = _mm512_loadu_si512(g->s[1]);
+    __m512i s2 = _mm512_loadu_si512(g->s[2]), s3 = _mm512_loadu_si512(g->s[3]);
+    const __m512i centre = _mm512_set1_epi32(GEN_CENTRE);
+    for (int r = 0; r < rounds; r++, out += GEN_ROUND) {
+        __m512i r7 = _mm512_rol_epi64(_mm512_add_epi64(_mm512_slli_epi64(s1, 2), s1), 7);
+        __m512i x = _mm512_add_epi64(_mm512_slli_epi64(r7, 3), r7);
+        __m512i t = _mm512_slli_epi64(s1, 17);
+        s2 = _mm512_xor_si512(s2, s0);
+        s3 = _mm512_xor_si512(s3, s1);
+        s1 = _mm512_xor_si512(s1, s2);
+        s0 = _mm512_xor_si512(s0, s3);
+        s2 = _mm512_xor_si512(s2, t);
+        s3 = _mm512_rol_epi64(s3, 45);
+        _mm512_storeu_si512(out, _mm512_sub_epi32(_mm512_srli_epi32(x, 8), centre));
+    }
+    _mm512_storeu_si512(g->s[0], s0);
+    _mm512_storeu_si512(g->s[1], s1);
+    _mm512_storeu_si512(g->s[2], s2);
+    _mm512_storeu_si512(g->s[3], s3);
+}
+
+#endif // RAG_X86
+
+// The generator follows the similarity kernel (so --kernel applies)
+static gen_fn gen_kernel(int isa) {
+#ifdef RAG_X86
+    if (isa >= RAG_ISA_AVX512) return gen_avx512;
+    if (isa >= RAG_ISA_AVX2) return gen_avx2;
+#else
+    (void)isa;
+#endif
+    return gen_scalar;
+}
+
+static int generate(gen_fn gen, uint64_t seed, size_t first, size_t n, int dim, float *out, size_t stride) {
+    if (dim < 1 || dim > RAG_DATASET_MAX_DIM) {
+        fprintf(stderr, "Generated vectors take 1 to %d dimensions, not %d\n", RAG_DATASET_MAX_DIM, dim);
+        return -1;
+    }
+    int32_t raw[RAG_DATASET_MAX_DIM + GEN_ROUND];
+    int rounds = (dim + GEN_ROUND - 1) / GEN_ROUND;
+    for (size_t i = 0; i < n; i++) {
+        struct gen_state g;
+        seed_vector(seed, first + i, &g);
+        gen(&g, raw, rounds);
+
+        int64_t norm2 = 0;
+        for (int d = 0; d < dim; d++) norm2 += (int64_t)raw[d] * raw[d];
+        float scale = norm2 ? (float)(1.0 / sqrt((double)norm2)) : 0.0f;
+        float *v = out + i * stride;
+        for (int d = 0; d < dim; d++) v[d] = (float)raw[d] * scale;
+    }
+    return 0;
+}
+
+int rag_dataset_generate(uint64_t seed, size_t first, size_t n, int dim, float *out, size_t stride) {
+    return generate(gen_kernel(rag_kernels_active()), seed, first, n, dim, out, stride);
+}
+
+uint64_t rag_dataset_seed(uint64_t seed, uint64_t stream) {
+    if (stream == 0) return seed;
+    uint64_t z = seed ^ stream * 0xD1B54A32D192ED03ULL;
+    return splitmix64(&z);
+}
+
+// Vector files
+
+enum { VECS_FLOAT, VECS_BYTE, VECS_INT };
+
+struct rag_vecs {
+    int fd;
+    int type;
+    int dim;
+    size_t count;
+    size_t record;                  // Bytes per record, header included
+    char *path;
+};
+
+struct rag_vecs* rag_vecs_open(const char *path) {
+    static const struct { const char *ext; int type; size_t size; } types[] = {
+        { ".fvecs", VECS_FLOAT, sizeof(float) }, { ".bvecs", VECS_BYTE, 1 }, { ".ivecs", VECS_INT, sizeof(int32_t) }
+    };
+    const char *ext = strrchr(path, '.');
+    int t = 0, n = sizeof(types) / sizeof(types[0]);
+    while (t < n && !(ext && strcmp(ext, types[t].ext) == 0)) t++;
+    if (t == n) {
+        fprintf(stderr, "%s: expected a .fvecs, .bvecs or .ivecs file\n", path);
+        return NULL;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    int32_t dim = 0;
+    if (fstat(fd, &st) < 0 || pread(fd, &dim, sizeof(dim), 0) != sizeof(dim) ||
+        dim < 1 || dim > RAG_DATASET_MAX_DIM) {
+        fprintf(stderr, "%s: no vectors, or a dimension outside 1 to %d\n", path, RAG_DATASET_MAX_DIM);
+        close(fd);
+        return NULL;
+    }
+    size_t record = sizeof(int32_t) + dim * types[t].size;
+    if ((size_t)st.st_size % record != 0) {
+        fprintf(stderr, "%s: %lld bytes is not a whole number of %d-dimensional records\n",
+                path, (long long)st.st_size, dim);
+        close(fd);
+        return NULL;
+    }
+
+    struct rag_vecs *v = calloc(1, sizeof(*v));
+    if (!v || !(v->path = strdup(path))) {
+        free(v);
+        close(fd);
+        return NULL;
+    }
+    v->fd = fd;
+    v->type = types[t].type;
+    v->dim = dim;
+    v->record = record;
+    v->count = st.st_size / record;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return v;
+}
+
+void rag_vecs_close(struct rag_vecs *v) {
+    if (!v) return;
+    close(v->fd);
+    free(v->path);
+    free(v);
+}
+
+int rag_vecs_dim(const struct rag_vecs *v) {
+    return v->dim;
+}
+
+size_t rag_vecs_count(const struct rag_vecs *v) {
+    return v->count;
+}
+
+// Read records in chunks and hand each one's values to convert
+static int read_records(struct rag_vecs *v, size_t first, size_t n, void *out, size_t stride,
+                        void (*convert)(const struct rag_vecs *v, const void *values, void *row, size_t width)) {
+    if (first > v->count || n > v->count - first) {
+        fprintf(stderr, "%s: records %zu-%zu past the %zu it holds\n", v->path, first, first + n, v->count);
+        return -1;
+    }
+    size_t per_chunk = READ_CHUNK / v->record ? READ_CHUNK / v->record : 1;
+    char *chunk = malloc(per_chunk * v->record);
+    if (!chunk) return -1;
+
+    int ret = 0;
+    for (size_t done = 0; ret == 0 && done < n; ) {
+        size_t batch = n - done < per_chunk ? n - done : per_chunk;
+        size_t bytes = batch * v->record, got = 0;
+        off_t offset = (off_t)((first + done) * v->record);
+        while (got < bytes) {
+            ssize_t r = pread(v->fd, chunk + got, bytes - got, offset + got);
+            if (r <= 0) {
+                fprintf(stderr, "%s: read failed: %s\n", v->path, r < 0 ? strerror(errno) : "end of file");
+                ret = -1;
+                break;
+            }
+            got += r;
+        }
+        for (size_t i = 0; ret == 0 && i < batch; i++) {
+            const char *rec = chunk + i * v->record;
+            int32_t dim;
+            memcpy(&dim, rec, sizeof(dim));
+            if (dim != v->dim) {
+                fprintf(stderr, "%s: record %zu has dimension %d, not %d\n", v->path, first + done + i, dim, v->dim);
+                ret = -1;
+                break;
+            }
+            convert(v, rec + sizeof(int32_t), out, stride);
+            out = (char *)out + stride;
+        }
+        done += batch;
+    }
+    free(chunk);
+    return ret;
+}
+
+static void convert_floats(const struct rag_vecs *v, const void *values, void *row, size_t width) {
+    float *out = row;
+    if (v->type == VECS_FLOAT) {
+        memcpy(out, values, v->dim * sizeof(float));
+    } else {
+        const uint8_t *bytes = values;
+        for (int d = 0; d < v->dim; d++) out[d] = bytes[d];
+    }
+    memset(out + v->dim, 0, (width / sizeof(float) - v->dim) * sizeof(float));
+}
+
+static void convert_ids(const struct rag_vecs *v, const void *values, void *row, size_t width) {
+    int *out = row;
+    size_t n = width / sizeof(int), copy = n < (size_t)v->dim ? n : (size_t)v->dim;
+    memcpy(out, values, copy * sizeof(int));
+    for (size_t i = copy; i < n; i++) out[i] = -1;
+}
+
+int rag_vecs_read(struct rag_vecs *v, size_t first, size_t n, float *out, size_t stride) {
+    if (v->type == VECS_INT || stride < (size_t)v->dim) {
+        fprintf(stderr, "%s: not float vectors of at most %zu dimensions\n", v->path, stride);
+        return -1;
+    }
+    return read_records(v, first, n, out, stride * sizeof(float), convert_floats);
+}
+
+int rag_vecs_read_ids(struct rag_vecs *v, size_t first, size_t n, int *out, size_t stride) {
+    if (v->type != VECS_INT) {
+        fprintf(stderr, "%s: not an ivecs file\n", v->path);
+        return -1;
+    }
+    return read_records(v, first, n, out, stride * sizeof(int), convert_ids);
+}
+
+// Self-test
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int write_vecs(const char *path, int type, int dim, int count) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+    int ok = 1;
+    for (int i = 0; ok && i < count; i++) {
+        ok = fwrite(&dim, sizeof(dim), 1, f) == 1;
+        for (int d = 0; ok && d < dim; d++) {
+            int32_t x = i * 1000 + d;
+            float fx = x * 0.5f;
+            uint8_t b = (uint8_t)(i + d);
+            ok = type == VECS_FLOAT ? fwrite(&fx, sizeof(fx), 1, f) == 1
+               : type == VECS_BYTE ? fwrite(&b, 1, 1, f) == 1 : fwrite(&x, sizeof(x), 1, f) == 1;
+        }
+    }
+    return fclose(f) == 0 && ok ? 0 : -1;
+}
+
+static int file_self_test(void) {
+    static const char *exts[] = { "fvecs", "bvecs", "ivecs" };
+    enum { DIM = 5, COUNT = 3000, FIRST = 1234, N = 700, WIDTH = 8 };
+    float *rows = malloc(N * WIDTH * sizeof(float));
+    int *ids = malloc(N * WIDTH * sizeof(int));
+    int failures = 0;
+    char path[64];
+
+    for (int type = 0; type < 3; type++) {
+        snprintf(path, sizeof(path), "/tmp/rag_dataset_self_test.%d.%s", (int)getpid(), exts[type]);
+        struct rag_vecs *v = write_vecs(path, type, DIM, COUNT) == 0 ? rag_vecs_open(path) : NULL;
+        int bad = !v || !rows || !ids || rag_vecs_dim(v) != DIM || rag_vecs_count(v) != COUNT;
+        if (!bad && type == VECS_INT) {
+            // Wider rows are padded with -1, narrower ones keep the nearest
+            bad = rag_vecs_read_ids(v, FIRST, N, ids, WIDTH) < 0;
+            for (int i = 0; !bad && i < N; i++) {
+                for (int d = 0; !bad && d < WIDTH; d++) {
+                    bad = ids[i * WIDTH + d] != (d < DIM ? (FIRST + i) * 1000 + d : -1);
+                }
+            }
+            bad = bad || rag_vecs_read_ids(v, COUNT - 1, 1, ids, 2) < 0 || ids[0] != (COUNT - 1) * 1000 ||
+                  ids[1] != (COUNT - 1) * 1000 + 1;
+        } else if (!bad) {
+            bad = rag_vecs_read(v, FIRST, N, rows, WIDTH) < 0;
+            for (int i = 0; !bad && i < N; i++) {
+                for (int d = 0; !bad && d < WIDTH; d++) {
+                    float want = d >= DIM ? 0.0f : type == VECS_FLOAT ? ((FIRST + i) * 1000 + d) * 0.5f
+                                                                       : (float)(uint8_t)(FIRST + i + d);
+                    bad = rows[i * WIDTH + d] != want;
+                }
+            }
+        }
+        // Reads past the end fail
+        bad = bad || rag_vecs_read(v, COUNT - 10, 11, rows, WIDTH) == 0;
+        printf("  %s round trip %s\n", exts[type], bad ? "FAIL" : "ok");
+        failures += bad;
+        rag_vecs_close(v);
+
+        // A truncated file is refused
+        if (type == VECS_FLOAT) {
+            bad = truncate(path, 4 + DIM * 4 + 3) < 0 || (v = rag_vecs_open(path)) != NULL;
+            rag_vecs_close(v);
+            printf("  truncated file refused %s\n", bad ? "FAIL" : "ok");
+            failures += bad;
+        }
+        unlink(path);
+    }
+    free(rows);
+    free(ids);
+    return failures;
+}
+
+int rag_dataset_self_test(void) {
+    enum { N = 64, SPLIT = 23 };
+    static const int dims[] = { 1, 15, 100, 768 };
+    int failures = 0;
+    float *want = malloc(N * 768 * sizeof(float));
+    float *got = malloc(N * 768 * sizeof(float));
+
+    printf("Dataset self-test:\n");
+    if (!want || !got) {
+        free(want);
+        free(got);
+        return 1;
+    }
+
+    // Every kernel writes the scalar kernel's bits, in any split
+    for (size_t d = 0; d < sizeof(dims) / sizeof(dims[0]); d++) {
+        int dim = dims[d], bad = generate(gen_scalar, 7, 1000, N, dim, want, dim) < 0;
+        for (int isa = 0; !bad && isa < RAG_ISA_COUNT; isa++) {
+            if (!rag_isa_supported(isa)) continue;
+            bad = generate(gen_kernel(isa), 7, 1000, SPLIT, dim, got, dim) < 0 ||
+                  generate(gen_kernel(isa), 7, 1000 + SPLIT, N - SPLIT, dim, got + SPLIT * dim, dim) < 0 ||
+                  memcmp(want, got, (size_t)N * dim * sizeof(float)) != 0;
+        }
+        printf("  dim %-4d same vectors from every kernel and split %s\n", dim, bad ? "FAIL" : "ok");
+        failures += bad;
+    }
+
+    // Unit norms, elements spread over [-1, 1], and other seeds differ
+    int bad = generate(gen_scalar, 7, 0, N, 768, want, 768) < 0 ||
+              generate(gen_scalar, rag_dataset_seed(7, 1), 0, N, 768, got, 768) < 0;
+    double mean = 0, mean_abs = 0;
+    for (int i = 0; !bad && i < N; i++) {
+        double norm2 = 0;
+        for (int d = 0; d < 768; d++) {
+            float x = want[i * 768 + d];
+            norm2 += x * x;
+            mean += x;
+            mean_abs += fabsf(x);
+        }
+        bad = fabs(norm2 - 1) > 1e-5;
+    }
+    // A uniform [-1, 1] element has mean |x| 1/2, and the vector a norm
+    // of about sqrt(dim / 3)
+    mean = mean / (N * 768) * sqrt(768 / 3.0);
+    mean_abs = mean_abs / (N * 768) * sqrt(768 / 3.0);
+    bad = bad || fabs(mean) > 0.01 || fabs(mean_abs - 0.5) > 0.01 || memcmp(want, got, 768 * sizeof(float)) == 0 ||
+          rag_dataset_seed(7, 0) != 7 || rag_dataset_seed(7, 1) == rag_dataset_seed(7, 2);
+    printf("  unit norms, centred, seeds independent %s\n", bad ? "FAIL" : "ok");
+    failures += bad;
+    failures += file_self_test();
+
+    // Generation rate for a 768-dimensional database
+    const int rate_n = 20000;
+    float *db = malloc((size_t)rate_n * 768 * sizeof(float));
+    for (int isa = 0; db && isa < RAG_ISA_COUNT; isa++) {
+        if (!rag_isa_supported(isa) || (isa > 0 && gen_kernel(isa) == gen_kernel(isa - 1))) continue;
+        double start = now_sec();
+        generate(gen_kernel(isa), 1, 0, rate_n, 768, db, 768);
+        double elapsed = now_sec() - start;
+        printf("  %-7s %8.0f K vectors/s  %6.2f GB/s\n", rag_isa_name(isa), rate_n / elapsed / 1e3,
+               rate_n * 768 * sizeof(float) / elapsed / 1e9);
+    }
+    free(db);
+    free(want);
+    free(got);
+    return failures;
+}
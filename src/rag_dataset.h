@@ -0,0 +1,49 @@
+#ifndef RAG_DATASET_H
+#define RAG_DATASET_H
+
+// Benchmark data: seeded synthetic vectors, and the vector files that
+// public ANN benchmarks ship. Generated vector i is a function of the
+// seed and i alone, so a database is the same whichever threads or
+// kernel (--kernel) produced it, and runs with one seed compare. Its
+// elements are uniform in [-1, 1) before normalization to unit length,
+// drawn from 8 interleaved xoshiro256** streams that SIMD steps together.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RAG_DATASET_DEFAULT_SEED 42
+#define RAG_DATASET_MAX_DIM 4096
+
+// Write vectors [first, first + n) of the seed's dataset, dim floats each
+// and stride floats apart; fails only if dim is out of range
+int rag_dataset_generate(uint64_t seed, size_t first, size_t n, int dim, float *out, size_t stride);
+
+// A seed for another dataset derived from seed, e.g. queries or a second
+// database: stream 0 is seed itself
+uint64_t rag_dataset_seed(uint64_t seed, uint64_t stream);
+
+// .fvecs, .bvecs and .ivecs files (the format of SIFT1M, GIST1M and
+// Deep1B): every record is a little-endian int32 dimension followed by
+// that many float32, uint8 or int32 values. The type comes from the
+// extension. Ground truth files are ivecs: row q lists query q's nearest
+// base ids, nearest first.
+struct rag_vecs;
+
+struct rag_vecs* rag_vecs_open(const char *path);
+void rag_vecs_close(struct rag_vecs *v);
+
+int rag_vecs_dim(const struct rag_vecs *v);
+size_t rag_vecs_count(const struct rag_vecs *v);
+
+// Read records [first, first + n) as float rows stride floats apart,
+// zeroing each row past the file's dimension. Safe from several threads.
+int rag_vecs_read(struct rag_vecs *v, size_t first, size_t n, float *out, size_t stride);
+
+// As rag_vecs_read, for the integer rows of an ivecs file
+int rag_vecs_read_ids(struct rag_vecs *v, size_t first, size_t n, int *out, size_t stride);
+
+// The same vectors from every kernel and split, unit norms, and a round
+// trip through each file type; returns the number of failures
+int rag_dataset_self_test(void);
+
+#endif // RAG_DATASET_H
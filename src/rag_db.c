@@ -0,0 +1,237 @@
+/**
+ * RAG Vector Database File
+ * Open validates the header and every extent against the file size, and
+ * checks that the metadata blob ends in a NUL. No further parsing
+ * happens: embeddings, metadata and sections are used in place from a
+ * shared read-only mapping. That makes cold start independent of
+ * database size, and several processes share one page-cache copy.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rag_db.h"
+
+struct rag_db {
+    const uint8_t *base;
+    size_t size;
+    const struct rag_db_header *header;
+    const uint64_t *meta_offsets;   // num_vectors + 1
+    const char *meta_blob;
+    size_t meta_blob_size;
+};
+
+static uint64_t align_up(uint64_t x, uint64_t align) {
+    return (x + align - 1) / align * align;
+}
+
+static int extent_ok(uint64_t offset, uint64_t size, size_t file_size) {
+    return offset <= file_size && size <= file_size - offset;
+}
+
+struct rag_db* rag_db_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct rag_db_header)) {
+        fprintf(stderr, "%s: not a vector database (too small)\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    struct rag_db *db = calloc(1, sizeof(*db));
+    if (!db) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    db->base = base;
+    db->size = st.st_size;
+    db->header = base;
+
+    const struct rag_db_header *h = db->header;
+    if (memcmp(h->magic, RAG_DB_MAGIC, sizeof(h->magic)) != 0 || h->version != RAG_DB_VERSION) {
+        fprintf(stderr, "%s: not a version %d vector database\n", path, RAG_DB_VERSION);
+        goto fail;
+    }
+    if (h->dim == 0 || h->num_vectors > db->size / ((uint64_t)h->dim * sizeof(float)) ||
+        h->embeddings_offset % RAG_DB_ALIGN != 0 ||
+        h->embeddings_size != h->num_vectors * h->dim * sizeof(float) ||
+        !extent_ok(h->embeddings_offset, h->embeddings_size, db->size) ||
+        h->metadata_offset % sizeof(uint64_t) != 0 ||
+        !extent_ok(h->metadata_offset, h->metadata_size, db->size) ||
+        h->metadata_size < (h->num_vectors + 1) * sizeof(uint64_t) ||
+        h->num_sections > RAG_DB_MAX_SECTIONS) {
+        fprintf(stderr, "%s: corrupt or truncated header\n", path);
+        goto fail;
+    }
+    for (uint32_t s = 0; s < h->num_sections; s++) {
+        if (!extent_ok(h->sections[s].offset, h->sections[s].size, db->size)) {
+            fprintf(stderr, "%s: section %u extends past the end of the file\n", path, s);
+            goto fail;
+        }
+    }
+
+    db->meta_offsets = (const uint64_t *)(db->base + h->metadata_offset);
+    db->meta_blob = (const char *)(db->meta_offsets + h->num_vectors + 1);
+    db->meta_blob_size = h->metadata_size - (h->num_vectors + 1) * sizeof(uint64_t);
+    if (db->meta_blob_size == 0 || db->meta_blob[db->meta_blob_size - 1] != '\0') {
+        fprintf(stderr, "%s: corrupt metadata\n", path);
+        goto fail;
+    }
+
+    // Start reading the embeddings in the background; the first scan
+    // then finds most pages cached instead of faulting them in one by one
+    madvise((void *)(db->base + h->embeddings_offset), h->embeddings_size, MADV_WILLNEED);
+    return db;
+
+fail:
+    rag_db_close(db);
+    return NULL;
+}
+
+void rag_db_close(struct rag_db *db) {
+    if (!db) return;
+    munmap((void *)db->base, db->size);
+    free(db);
+}
+
+size_t rag_db_count(const struct rag_db *db) {
+    return db->header->num_vectors;
+}
+
+int rag_db_dim(const struct rag_db *db) {
+    return db->header->dim;
+}
+
+const float *rag_db_embeddings(const struct rag_db *db) {
+    return (const float *)(db->base + db->header->embeddings_offset);
+}
+
+const char *rag_db_metadata(const struct rag_db *db, size_t i) {
+    uint64_t offset = db->meta_offsets[i];
+    return offset < db->meta_blob_size ? db->meta_blob + offset : "";
+}
+
+const void *rag_db_section(const struct rag_db *db, uint32_t type, size_t *size) {
+    for (uint32_t s = 0; s < db->header->num_sections; s++) {
+        if (db->header->sections[s].type == type) {
+            if (size) *size = db->header->sections[s].size;
+            return db->base + db->header->sections[s].offset;
+        }
+    }
+    return NULL;
+}
+
+const void *rag_db_mapping(const struct rag_db *db, size_t *size) {
+    if (size) *size = db->size;
+    return db->base;
+}
+
+static int pad_to(FILE *f, uint64_t offset) {
+    long pos = ftell(f);
+    if (pos < 0 || (uint64_t)pos > offset) return -1;
+    for (uint64_t i = pos; i < offset; i++) {
+        if (fputc(0, f) == EOF) return -1;
+    }
+    return 0;
+}
+
+int rag_db_write(const char *path, const float *embeddings, size_t n, int dim,
+                 rag_db_metadata_fn metadata, void *ctx,
+                 const struct rag_db_section_writer *sections, int num_sections) {
+    if (num_sections > RAG_DB_MAX_SECTIONS) {
+        fprintf(stderr, "At most %d database sections\n", RAG_DB_MAX_SECTIONS);
+        return -1;
+    }
+
+    // Lay out every part first so the header can go out in one write
+    struct rag_db_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, RAG_DB_MAGIC, sizeof(h.magic));
+    h.version = RAG_DB_VERSION;
+    h.dim = dim;
+    h.num_vectors = n;
+    h.embeddings_offset = align_up(sizeof(h), RAG_DB_ALIGN);
+    h.embeddings_size = (uint64_t)n * dim * sizeof(float);
+    h.metadata_offset = align_up(h.embeddings_offset + h.embeddings_size, sizeof(uint64_t));
+
+    uint64_t blob_size = 0;
+    for (size_t i = 0; i < n; i++) blob_size += strlen(metadata(ctx, i)) + 1;
+    if (blob_size == 0) blob_size = 1;      // A lone NUL keeps the blob valid
+    h.metadata_size = (n + 1) * sizeof(uint64_t) + blob_size;
+
+    uint64_t end = h.metadata_offset + h.metadata_size;
+    h.num_sections = num_sections;
+    for (int s = 0; s < num_sections; s++) {
+        h.sections[s].type = sections[s].type;
+        h.sections[s].offset = align_up(end, RAG_DB_ALIGN);
+        h.sections[s].size = sections[s].size;
+        end = h.sections[s].offset + h.sections[s].size;
+    }
+
+    size_t tmp_len = strlen(path) + 5;
+    char *tmp = malloc(tmp_len);
+    if (!tmp) return -1;
+    snprintf(tmp, tmp_len, "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        perror(tmp);
+        free(tmp);
+        return -1;
+    }
+
+    int ret = -1;
+    if (fwrite(&h, sizeof(h), 1, f) != 1 || pad_to(f, h.embeddings_offset) < 0 ||
+        fwrite(embeddings, sizeof(float), (size_t)n * dim, f) != (size_t)n * dim) {
+        goto out;
+    }
+
+    if (pad_to(f, h.metadata_offset) < 0) goto out;
+    uint64_t offset = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (fwrite(&offset, sizeof(offset), 1, f) != 1) goto out;
+        offset += strlen(metadata(ctx, i)) + 1;
+    }
+    if (fwrite(&offset, sizeof(offset), 1, f) != 1) goto out;
+    for (size_t i = 0; i < n; i++) {
+        const char *s = metadata(ctx, i);
+        if (fwrite(s, 1, strlen(s) + 1, f) != strlen(s) + 1) goto out;
+    }
+    if (n == 0 && fputc(0, f) == EOF) goto out;
+
+    for (int s = 0; s < num_sections; s++) {
+        if (pad_to(f, h.sections[s].offset) < 0 || sections[s].write(sections[s].obj, f) < 0 ||
+            (uint64_t)ftell(f) != h.sections[s].offset + h.sections[s].size) {
+            fprintf(stderr, "Failed to write database section %d\n", sections[s].type);
+            goto out;
+        }
+    }
+    ret = 0;
+
+out:
+    if (fclose(f) != 0) ret = -1;
+    if (ret == 0 && rename(tmp, path) < 0) {
+        perror(path);
+        ret = -1;
+    }
+    if (ret < 0) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        unlink(tmp);
+    }
+    free(tmp);
+    return ret;
+}
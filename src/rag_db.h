@@ -0,0 +1,82 @@
+#ifndef RAG_DB_H
+#define RAG_DB_H
+
+// On-disk vector database, mmap'ed read-only at startup so a cold start
+// costs a page-table setup instead of regenerating or parsing vectors.
+// Layout (native byte order, every part at a known offset so a remote
+// reader can fetch any of it with one RDMA READ of the mapping):
+//
+//   0                  struct rag_db_header, padded to a page
+//   embeddings_offset  num_vectors x dim floats, page aligned
+//   metadata_offset    (num_vectors + 1) uint64 offsets into the blob,
+//                      then the blob of NUL-terminated strings
+//   sections           optional index images (e.g. IVF), page aligned
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define RAG_DB_MAGIC "RAGVDB\0\1"
+#define RAG_DB_VERSION 1
+#define RAG_DB_ALIGN 4096
+#define RAG_DB_MAX_SECTIONS 8
+
+enum rag_db_section_type {
+    RAG_DB_SECTION_IVF = 1,
+};
+
+struct rag_db_section_entry {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct rag_db_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t dim;
+    uint64_t num_vectors;
+    uint64_t embeddings_offset;
+    uint64_t embeddings_size;
+    uint64_t metadata_offset;
+    uint64_t metadata_size;
+    uint32_t num_sections;
+    uint32_t reserved;
+    struct rag_db_section_entry sections[RAG_DB_MAX_SECTIONS];
+};
+
+struct rag_db;
+
+struct rag_db* rag_db_open(const char *path);
+void rag_db_close(struct rag_db *db);
+
+size_t rag_db_count(const struct rag_db *db);
+int rag_db_dim(const struct rag_db *db);
+const float *rag_db_embeddings(const struct rag_db *db);
+const char *rag_db_metadata(const struct rag_db *db, size_t i);
+
+// An optional section's bytes, or NULL if the file has none of type
+const void *rag_db_section(const struct rag_db *db, uint32_t type, size_t *size);
+
+// The whole file mapping, e.g. to register as one memory region
+const void *rag_db_mapping(const struct rag_db *db, size_t *size);
+
+// Writing: metadata(ctx, i) returns vector i's string; each section
+// writes exactly size bytes to f
+typedef const char *(*rag_db_metadata_fn)(void *ctx, size_t i);
+
+struct rag_db_section_writer {
+    uint32_t type;
+    size_t size;
+    int (*write)(const void *obj, FILE *f);
+    const void *obj;
+};
+
+// Write to path.tmp and rename over path, so readers never see a
+// partial file; returns -1 on failure
+int rag_db_write(const char *path, const float *embeddings, size_t n, int dim,
+                 rag_db_metadata_fn metadata, void *ctx,
+                 const struct rag_db_section_writer *sections, int num_sections);
+
+#endif // RAG_DB_H
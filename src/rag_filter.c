@@ -0,0 +1,483 @@
+/**
+ * RAG Attribute Filters
+ * Every column is a dense array indexed by vector id. Integer columns
+ * hold int64 values plus a bitset of ids that have one. Keyword columns
+ * hold a uint32 dictionary code per id, with 0 meaning no value. A
+ * filter is compiled one clause at a time, 64 ids per output word. A
+ * word that earlier clauses already cleared is skipped, so it is cheap
+ * to put the most selective clause first. Keyword matching is a table
+ * lookup on the code, so an IN list costs the same as a single value.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include "rag_filter.h"
+
+#define ATTR_NAME_MAX 32
+#define FILTER_MAX_VALUES 16        // Values in one name=v1|v2|.. clause
+#define DICT_MIN_SLOTS 64
+
+struct attr_column {
+    char name[ATTR_NAME_MAX];
+    int type;
+    int64_t *ints;
+    uint64_t *present;              // Integer columns: ids with a value
+    uint32_t *codes;                // Keyword columns: 0 = no value
+
+    // Keyword dictionary: code c names strings[c - 1]; slots is an open
+    // addressing table of codes keyed by string hash
+    char **strings;
+    uint32_t num_strings, max_strings;
+    uint32_t *slots;
+    uint32_t num_slots;
+};
+
+struct rag_attrs {
+    struct attr_column columns[RAG_ATTR_MAX_COLUMNS];
+    int num_columns;
+    size_t count;                   // Ids covered: 1 + the largest id set
+    size_t capacity;                // Ids allocated in every column
+};
+
+enum { OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE };
+
+struct clause {
+    const struct attr_column *column;
+    int op;
+    int num_values;
+    int64_t values[FILTER_MAX_VALUES];  // Integers, or keyword codes (0: unknown string)
+    unsigned char *code_match;          // Keyword columns: per-code verdict
+};
+
+static size_t words_for(size_t bits) {
+    return (bits + 63) / 64;
+}
+
+static uint64_t hash_string(const char *s) {
+    uint64_t h = 14695981039346656037ULL;
+    for (; *s; s++) h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+    return h;
+}
+
+struct rag_attrs* rag_attrs_create(void) {
+    return calloc(1, sizeof(struct rag_attrs));
+}
+
+static void column_free(struct attr_column *c) {
+    free(c->ints);
+    free(c->present);
+    free(c->codes);
+    for (uint32_t i = 0; i < c->num_strings; i++) free(c->strings[i]);
+    free(c->strings);
+    free(c->slots);
+}
+
+void rag_attrs_destroy(struct rag_attrs *a) {
+    if (!a) return;
+    for (int i = 0; i < a->num_columns; i++) column_free(&a->columns[i]);
+    free(a);
+}
+
+// Grow a zero-filled array from old to new elements
+static int grow(void **array, size_t elem, size_t old, size_t new) {
+    char *p = realloc(*array, new * elem);
+    if (!p) return -1;
+    memset(p + old * elem, 0, (new - old) * elem);
+    *array = p;
+    return 0;
+}
+
+static int column_reserve(struct attr_column *c, size_t old, size_t capacity) {
+    if (c->type == RAG_ATTR_INT) {
+        return grow((void **)&c->ints, sizeof(int64_t), old, capacity) < 0 ||
+               grow((void **)&c->present, sizeof(uint64_t), words_for(old), words_for(capacity)) < 0 ? -1 : 0;
+    }
+    return grow((void **)&c->codes, sizeof(uint32_t), old, capacity);
+}
+
+static int reserve(struct rag_attrs *a, size_t id) {
+    if (id < a->capacity) return 0;
+    size_t capacity = a->capacity ? a->capacity : 1024;
+    while (capacity <= id) capacity *= 2;
+    for (int i = 0; i < a->num_columns; i++) {
+        if (column_reserve(&a->columns[i], a->capacity, capacity) < 0) {
+            fprintf(stderr, "Failed to grow attribute columns\n");
+            return -1;
+        }
+    }
+    a->capacity = capacity;
+    return 0;
+}
+
+int rag_attrs_add_column(struct rag_attrs *a, const char *name, int type) {
+    if (a->num_columns == RAG_ATTR_MAX_COLUMNS || strlen(name) >= ATTR_NAME_MAX ||
+        rag_attrs_column(a, name) >= 0 || (type != RAG_ATTR_INT && type != RAG_ATTR_KEYWORD)) {
+        fprintf(stderr, "Cannot add attribute column '%s'\n", name);
+        return -1;
+    }
+    struct attr_column *c = &a->columns[a->num_columns];
+    memset(c, 0, sizeof(*c));
+    strcpy(c->name, name);
+    c->type = type;
+    if (a->capacity && column_reserve(c, 0, a->capacity) < 0) {
+        column_free(c);
+        return -1;
+    }
+    return a->num_columns++;
+}
+
+int rag_attrs_column(const struct rag_attrs *a, const char *name) {
+    for (int i = 0; i < a->num_columns; i++) {
+        if (strcmp(a->columns[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+int rag_attrs_set_int(struct rag_attrs *a, int column, size_t id, int64_t value) {
+    if (column < 0 || column >= a->num_columns || a->columns[column].type != RAG_ATTR_INT ||
+        reserve(a, id) < 0) {
+        return -1;
+    }
+    struct attr_column *c = &a->columns[column];
+    c->ints[id] = value;
+    c->present[id / 64] |= 1ULL << (id % 64);
+    if (id >= a->count) a->count = id + 1;
+    return 0;
+}
+
+// Code of value, 0 if it is not in the dictionary
+static uint32_t dict_find(const struct attr_column *c, const char *value) {
+    if (!c->num_slots) return 0;
+    for (uint32_t i = hash_string(value) & (c->num_slots - 1);; i = (i + 1) & (c->num_slots - 1)) {
+        uint32_t code = c->slots[i];
+        if (code == 0 || strcmp(c->strings[code - 1], value) == 0) return code;
+    }
+}
+
+static void dict_place(struct attr_column *c, uint32_t code) {
+    uint32_t i = hash_string(c->strings[code - 1]) & (c->num_slots - 1);
+    while (c->slots[i]) i = (i + 1) & (c->num_slots - 1);
+    c->slots[i] = code;
+}
+
+// Code of value, added to the dictionary if new; 0 on failure
+static uint32_t dict_add(struct attr_column *c, const char *value) {
+    uint32_t code = dict_find(c, value);
+    if (code) return code;
+
+    // Keep the table at most half full
+    if (2 * (c->num_strings + 1) > c->num_slots) {
+        uint32_t num_slots = c->num_slots ? 2 * c->num_slots : DICT_MIN_SLOTS;
+        uint32_t *slots = calloc(num_slots, sizeof(uint32_t));
+        if (!slots) return 0;
+        free(c->slots);
+        c->slots = slots;
+        c->num_slots = num_slots;
+        for (uint32_t s = 1; s <= c->num_strings; s++) dict_place(c, s);
+    }
+    if (c->num_strings == c->max_strings) {
+        uint32_t max = c->max_strings ? 2 * c->max_strings : 16;
+        char **strings = realloc(c->strings, max * sizeof(char *));
+        if (!strings) return 0;
+        c->strings = strings;
+        c->max_strings = max;
+    }
+    char *copy = strdup(value);
+    if (!copy) return 0;
+    c->strings[c->num_strings++] = copy;
+    dict_place(c, c->num_strings);
+    return c->num_strings;
+}
+
+int rag_attrs_set_keyword(struct rag_attrs *a, int column, size_t id, const char *value) {
+    if (column < 0 || column >= a->num_columns || a->columns[column].type != RAG_ATTR_KEYWORD ||
+        reserve(a, id) < 0) {
+        return -1;
+    }
+    struct attr_column *c = &a->columns[column];
+    uint32_t code = dict_add(c, value);
+    if (!code) {
+        fprintf(stderr, "Failed to grow the '%s' dictionary\n", c->name);
+        return -1;
+    }
+    c->codes[id] = code;
+    if (id >= a->count) a->count = id + 1;
+    return 0;
+}
+
+size_t rag_attrs_count(const struct rag_attrs *a) {
+    return a->count;
+}
+
+size_t rag_attrs_memory(const struct rag_attrs *a) {
+    size_t bytes = sizeof(*a);
+    for (int i = 0; i < a->num_columns; i++) {
+        const struct attr_column *c = &a->columns[i];
+        if (c->type == RAG_ATTR_INT) {
+            bytes += a->capacity * sizeof(int64_t) + words_for(a->capacity) * sizeof(uint64_t);
+        } else {
+            bytes += a->capacity * sizeof(uint32_t) + c->num_slots * sizeof(uint32_t);
+            for (uint32_t s = 0; s < c->num_strings; s++) bytes += strlen(c->strings[s]) + 1;
+        }
+    }
+    return bytes;
+}
+
+// Parsing
+
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s)) s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) *--end = '\0';
+    return s;
+}
+
+static int parse_int(const char *s, int64_t *value) {
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 10);
+    if (errno || end == s || *end) return -1;
+    *value = v;
+    return 0;
+}
+
+static int parse_clause(const struct rag_attrs *a, char *text, struct clause *c) {
+    char *op = strpbrk(text, "<>=!");
+    if (!op) {
+        fprintf(stderr, "Filter clause '%s' has no operator\n", text);
+        return -1;
+    }
+    char *value = op + 1;
+    switch (*op) {
+    case '=': c->op = OP_EQ; break;
+    case '!': c->op = OP_NE; break;
+    case '<': c->op = OP_LT; break;
+    default:  c->op = OP_GT; break;
+    }
+    if (*value == '=') {
+        if (c->op == OP_LT) c->op = OP_LE;
+        else if (c->op == OP_GT) c->op = OP_GE;
+        value++;
+    } else if (c->op == OP_NE) {
+        fprintf(stderr, "Filter clause '%s': expected '!='\n", text);
+        return -1;
+    }
+    *op = '\0';
+    char *name = trim(text);
+    value = trim(value);
+
+    int column = rag_attrs_column(a, name);
+    if (column < 0) {
+        fprintf(stderr, "Filter: unknown attribute '%s'\n", name);
+        return -1;
+    }
+    c->column = &a->columns[column];
+    int keyword = c->column->type == RAG_ATTR_KEYWORD;
+    if (keyword && c->op != OP_EQ && c->op != OP_NE) {
+        fprintf(stderr, "Filter: '%s' is a keyword; only = and != apply\n", name);
+        return -1;
+    }
+
+    // Values; only equality takes a list
+    c->num_values = 0;
+    char *save, *v = strtok_r(value, "|", &save);
+    for (; v; v = strtok_r(NULL, "|", &save)) {
+        v = trim(v);
+        if (c->num_values == FILTER_MAX_VALUES || (c->num_values > 0 && c->op != OP_EQ) || !*v) {
+            fprintf(stderr, "Filter: bad value list for '%s'\n", name);
+            return -1;
+        }
+        if (keyword) {
+            c->values[c->num_values++] = dict_find(c->column, v);
+        } else if (parse_int(v, &c->values[c->num_values++]) < 0) {
+            fprintf(stderr, "Filter: '%s' is not an integer for '%s'\n", v, name);
+            return -1;
+        }
+    }
+    if (c->num_values == 0) {
+        fprintf(stderr, "Filter: no value for '%s'\n", name);
+        return -1;
+    }
+
+    // Keyword verdicts per code; code 0 (no value) never matches
+    if (keyword) {
+        c->code_match = calloc(c->column->num_strings + 1, 1);
+        if (!c->code_match) return -1;
+        if (c->op == OP_NE) memset(c->code_match + 1, 1, c->column->num_strings);
+        for (int i = 0; i < c->num_values; i++) {
+            if (c->values[i]) c->code_match[c->values[i]] = c->op == OP_EQ;
+        }
+    }
+    return 0;
+}
+
+static inline int int_matches(const struct clause *c, int64_t x) {
+    switch (c->op) {
+    case OP_EQ:
+        for (int i = 0; i < c->num_values; i++) {
+            if (x == c->values[i]) return 1;
+        }
+        return 0;
+    case OP_NE: return x != c->values[0];
+    case OP_LT: return x < c->values[0];
+    case OP_LE: return x <= c->values[0];
+    case OP_GT: return x > c->values[0];
+    default:    return x >= c->values[0];
+    }
+}
+
+// AND clause c into bits for ids [0, count)
+static void apply_clause(const struct clause *c, uint64_t *bits, size_t count) {
+    const struct attr_column *col = c->column;
+    for (size_t w = 0; w < words_for(count); w++) {
+        if (!bits[w]) continue;
+        size_t base = w * 64;
+        int n = count - base < 64 ? count - base : 64;
+        uint64_t word = 0;
+        if (col->type == RAG_ATTR_KEYWORD) {
+            for (int j = 0; j < n; j++) {
+                word |= (uint64_t)c->code_match[col->codes[base + j]] << j;
+            }
+        } else {
+            word = col->present[w];
+            for (int j = 0; j < n; j++) {
+                if (!int_matches(c, col->ints[base + j])) word &= ~(1ULL << j);
+            }
+        }
+        bits[w] &= word;
+    }
+}
+
+struct rag_filter* rag_filter_compile(const struct rag_attrs *a, const char *expr) {
+    if (strlen(expr) >= RAG_FILTER_MAX_EXPR) {
+        fprintf(stderr, "Filter longer than %d characters\n", RAG_FILTER_MAX_EXPR - 1);
+        return NULL;
+    }
+    char text[RAG_FILTER_MAX_EXPR];
+    strcpy(text, expr);
+
+    struct rag_filter *f = calloc(1, sizeof(*f));
+    if (!f) return NULL;
+    f->num_bits = a->count;
+    f->bits = malloc((words_for(a->count) + 1) * sizeof(uint64_t));
+    if (!f->bits) {
+        free(f);
+        return NULL;
+    }
+    memset(f->bits, 0xff, words_for(a->count) * sizeof(uint64_t));
+    if (a->count % 64) f->bits[a->count / 64] = (1ULL << (a->count % 64)) - 1;
+
+    int clauses = 0;
+    char *save, *part = strtok_r(text, ",", &save);
+    for (; part; part = strtok_r(NULL, ",", &save)) {
+        struct clause c = { 0 };
+        int ret = parse_clause(a, part, &c);
+        if (ret == 0) apply_clause(&c, f->bits, a->count);
+        free(c.code_match);
+        if (ret < 0) {
+            rag_filter_destroy(f);
+            return NULL;
+        }
+        clauses++;
+    }
+    if (clauses == 0) {
+        fprintf(stderr, "Empty filter\n");
+        rag_filter_destroy(f);
+        return NULL;
+    }
+    for (size_t w = 0; w < words_for(a->count); w++) f->count += __builtin_popcountll(f->bits[w]);
+    return f;
+}
+
+void rag_filter_destroy(struct rag_filter *f) {
+    if (!f) return;
+    free(f->bits);
+    free(f);
+}
+
+// ---------------------------------------------------------------------------
+// Self-test
+// ---------------------------------------------------------------------------
+
+static int check(const char *name, int ok) {
+    printf("  %-34s %s\n", name, ok ? "ok" : "FAIL");
+    return !ok;
+}
+
+// Test table: id i has year 2000 + i % 10 (unset when i % 11 == 0) and
+// tenant "t<i % 7>" (unset when i % 13 == 0)
+static int has_year(size_t i) { return i % 11 != 0; }
+static int has_tenant(size_t i) { return i % 13 != 0; }
+static int year_of(size_t i) { return 2000 + i % 10; }
+
+static int ref_tenant3(size_t i) { return has_tenant(i) && i % 7 == 3; }
+static int ref_tenant_in(size_t i) { return has_tenant(i) && (i % 7 == 1 || i % 7 == 5); }
+static int ref_not_tenant0(size_t i) { return has_tenant(i) && i % 7 != 0; }
+static int ref_range(size_t i) { return has_year(i) && year_of(i) >= 2003 && year_of(i) < 2007; }
+static int ref_both(size_t i) { return ref_tenant_in(i) && has_year(i) && year_of(i) > 2004; }
+static int ref_none(size_t i) { (void)i; return 0; }
+
+int rag_filter_self_test(void) {
+    enum { NUM_IDS = 5000 };
+    static const struct {
+        const char *expr;
+        int (*reference)(size_t);
+    } cases[] = {
+        { "tenant=t3", ref_tenant3 },
+        { " tenant = t1 | t5 ", ref_tenant_in },
+        { "tenant!=t0", ref_not_tenant0 },
+        { "year>=2003,year<2007", ref_range },
+        { "tenant=t1|t5,year>2004", ref_both },
+        { "tenant=nobody", ref_none },
+        { "year=1999|2010", ref_none },
+    };
+    static const char *bad[] = { "", "year", "year>>3", "nosuch=1", "year=abc", "tenant<t3", "year<1|2" };
+
+    struct rag_attrs *a = rag_attrs_create();
+    int year = a ? rag_attrs_add_column(a, "year", RAG_ATTR_INT) : -1;
+    int tenant = a ? rag_attrs_add_column(a, "tenant", RAG_ATTR_KEYWORD) : -1;
+    if (year < 0 || tenant < 0) {
+        rag_attrs_destroy(a);
+        return 1;
+    }
+
+    printf("Attribute filter self-test:\n");
+    int failures = 0, ok = 1;
+    char name[16];
+    for (size_t i = 0; i < NUM_IDS && ok; i++) {
+        snprintf(name, sizeof(name), "t%zu", i % 7);
+        if (has_year(i)) ok = rag_attrs_set_int(a, year, i, year_of(i)) == 0;
+        if (has_tenant(i) && ok) ok = rag_attrs_set_keyword(a, tenant, i, name) == 0;
+    }
+    failures += check("columns load", ok && rag_attrs_count(a) == NUM_IDS);
+
+    for (size_t t = 0; t < sizeof(cases) / sizeof(cases[0]); t++) {
+        struct rag_filter *f = rag_filter_compile(a, cases[t].expr);
+        size_t expected = 0;
+        ok = f != NULL;
+        for (size_t i = 0; ok && i < NUM_IDS + 100; i++) {
+            int want = i < NUM_IDS && cases[t].reference(i);
+            expected += want;
+            ok = rag_filter_allows(f, i) == want;
+        }
+        ok = ok && f->count == expected;
+        char label[64];
+        snprintf(label, sizeof(label), "%s (%zu ids)", cases[t].expr, expected);
+        failures += check(label, ok);
+        rag_filter_destroy(f);
+    }
+
+    ok = 1;
+    fprintf(stderr, "(Expected filter errors follow)\n");
+    for (size_t t = 0; t < sizeof(bad) / sizeof(bad[0]); t++) {
+        struct rag_filter *f = rag_filter_compile(a, bad[t]);
+        ok &= f == NULL;
+        rag_filter_destroy(f);
+    }
+    failures += check("malformed filters rejected", ok);
+    rag_attrs_destroy(a);
+    return failures;
+}
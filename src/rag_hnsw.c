@@ -0,0 +1,551 @@
+/**
+ * RAG HNSW Index
+ * Malkov & Yashunin's layered proximity graph. Each node draws a top
+ * layer from an exponential distribution; a query descends greedily
+ * through the sparse upper layers and runs a best-first search with an
+ * ef-sized result list on layer 0.
+ *
+ * Construction is parallel: workers claim nodes from a shared counter
+ * and insert them concurrently. Each node's link list has a spinlock
+ * that is taken when the list is read or rewritten during the build.
+ * A node that raises the top layer holds the entry lock for its whole
+ * insertion. Queries on a finished index take no locks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "rag_hnsw.h"
+#include "rag_kernels.h"
+#include "rag_topk.h"
+#include "rag_pool.h"
+
+#define HNSW_MAX_LEVEL 16
+#define HNSW_MAX_M 64
+#define HNSW_SEED 0x5eed5eedULL
+
+struct rag_hnsw {
+    const float *vectors;
+    size_t n;
+    int dim;
+    int M, M0;
+    int ef_construction;
+    int ef_search;
+
+    int *levels;                // Top layer of each node
+    int *links0;                // n x (1 + M0): count, then neighbour ids
+    int **links;                // Layers 1..level: level x (1 + M), NULL at level 0
+
+    int entry;
+    int max_level;
+    pthread_mutex_t entry_lock;
+    pthread_spinlock_t *locks;
+};
+
+struct rag_hnsw_scratch {
+    unsigned *visited;          // visited[i] == epoch marks node i as seen
+    unsigned epoch;
+
+    int cap;                    // Result list capacity (ef)
+    float *w_scores;
+    int *w_ids;
+
+    int c_size, c_cap;          // Candidates, a max-heap on score
+    float *c_scores;
+    int *c_ids;
+
+    long distances;
+};
+
+static inline const float *node_vector(const struct rag_hnsw *h, int id) {
+    return h->vectors + (size_t)id * h->dim;
+}
+
+static inline float similarity(const struct rag_hnsw *h, struct rag_hnsw_scratch *s,
+                               const float *query, int id) {
+    s->distances++;
+    return rag_dot(query, node_vector(h, id), h->dim);
+}
+
+// [count, ids...] of node id on one layer
+static inline int *node_links(const struct rag_hnsw *h, int id, int level) {
+    if (level == 0) return h->links0 + (size_t)id * (1 + h->M0);
+    return h->links[id] + (size_t)(level - 1) * (1 + h->M);
+}
+
+static inline int max_links(const struct rag_hnsw *h, int level) {
+    return level == 0 ? h->M0 : h->M;
+}
+
+// Deterministic per-node layer, so a build is reproducible at any
+// thread count
+static int random_level(size_t id, double mult) {
+    unsigned long long z = HNSW_SEED + (id + 1) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+
+    double u = ((z >> 11) + 1.0) / 9007199254740993.0;    // (0, 1]
+    int level = (int)(-log(u) * mult);
+    return level < HNSW_MAX_LEVEL ? level : HNSW_MAX_LEVEL;
+}
+
+// Scratch
+
+struct rag_hnsw_scratch* rag_hnsw_scratch_create(const struct rag_hnsw *h) {
+    struct rag_hnsw_scratch *s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    s->visited = calloc(h->n, sizeof(unsigned));
+    if (!s->visited) {
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void rag_hnsw_scratch_destroy(struct rag_hnsw_scratch *s) {
+    if (!s) return;
+    free(s->visited);
+    free(s->w_scores);
+    free(s->w_ids);
+    free(s->c_scores);
+    free(s->c_ids);
+    free(s);
+}
+
+long rag_hnsw_scratch_distances(const struct rag_hnsw_scratch *s) {
+    return s->distances;
+}
+
+static int scratch_reserve(struct rag_hnsw_scratch *s, int ef) {
+    if (ef <= s->cap) return 0;
+    float *scores = realloc(s->w_scores, ef * sizeof(float));
+    if (scores) s->w_scores = scores;
+    int *ids = realloc(s->w_ids, ef * sizeof(int));
+    if (ids) s->w_ids = ids;
+    if (!scores || !ids) return -1;
+    s->cap = ef;
+    return 0;
+}
+
+static void new_epoch(struct rag_hnsw_scratch *s, size_t n) {
+    if (++s->epoch == 0) {
+        memset(s->visited, 0, n * sizeof(unsigned));
+        s->epoch = 1;
+    }
+}
+
+static int candidate_push(struct rag_hnsw_scratch *s, float score, int id) {
+    if (s->c_size == s->c_cap) {
+        int cap = s->c_cap ? s->c_cap * 2 : 256;
+        float *scores = realloc(s->c_scores, cap * sizeof(float));
+        if (scores) s->c_scores = scores;
+        int *ids = realloc(s->c_ids, cap * sizeof(int));
+        if (ids) s->c_ids = ids;
+        if (!scores || !ids) return -1;
+        s->c_cap = cap;
+    }
+
+    int i = s->c_size++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (s->c_scores[parent] >= score) break;
+        s->c_scores[i] = s->c_scores[parent];
+        s->c_ids[i] = s->c_ids[parent];
+        i = parent;
+    }
+    s->c_scores[i] = score;
+    s->c_ids[i] = id;
+    return 0;
+}
+
+static void candidate_pop(struct rag_hnsw_scratch *s, float *score, int *id) {
+    *score = s->c_scores[0];
+    *id = s->c_ids[0];
+
+    float last = s->c_scores[--s->c_size];
+    int last_id = s->c_ids[s->c_size];
+    int i = 0;
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= s->c_size) break;
+        if (child + 1 < s->c_size && s->c_scores[child + 1] > s->c_scores[child]) child++;
+        if (s->c_scores[child] <= last) break;
+        s->c_scores[i] = s->c_scores[child];
+        s->c_ids[i] = s->c_ids[child];
+        i = child;
+    }
+    s->c_scores[i] = last;
+    s->c_ids[i] = last_id;
+}
+
+// Copy a node's links, under its lock while the graph is being built
+static int read_links(const struct rag_hnsw *h, int id, int level, int locked, int *out) {
+    if (locked) pthread_spin_lock(&h->locks[id]);
+    int *links = node_links(h, id, level);
+    int count = links[0];
+    memcpy(out, links + 1, count * sizeof(int));
+    if (locked) pthread_spin_unlock(&h->locks[id]);
+    return count;
+}
+
+static inline int node_allowed(const uint64_t *allowed, int id) {
+    return (allowed[id / 64] >> (id % 64)) & 1;
+}
+
+// Greedy walk to the single best node on one layer
+static int greedy_closest(const struct rag_hnsw *h, struct rag_hnsw_scratch *s,
+                          const float *query, int entry, float *entry_score,
+                          int level, int locked) {
+    int buf[2 * HNSW_MAX_M];
+    int changed = 1;
+
+    while (changed) {
+        changed = 0;
+        int count = read_links(h, entry, level, locked, buf);
+        for (int i = 0; i < count; i++) {
+            float score = similarity(h, s, query, buf[i]);
+            if (score > *entry_score) {
+                *entry_score = score;
+                entry = buf[i];
+                changed = 1;
+            }
+        }
+    }
+    return entry;
+}
+
+// Best-first search of one layer from a single entry point. Leaves the
+// best ef nodes in the scratch result arrays as a min-heap (topk). With
+// an allowed bitset, only allowed nodes enter the results but every node
+// is still expanded, so the walk crosses regions the filter excludes.
+static int search_layer(const struct rag_hnsw *h, struct rag_hnsw_scratch *s,
+                        const float *query, int entry, float entry_score,
+                        int ef, int level, int locked, const uint64_t *allowed,
+                        struct rag_topk *topk) {
+    int buf[2 * HNSW_MAX_M];
+    if (scratch_reserve(s, ef) < 0) {
+        return -1;
+    }
+
+    new_epoch(s, h->n);
+    s->c_size = 0;
+    rag_topk_init(topk, ef, s->w_scores, s->w_ids);
+
+    s->visited[entry] = s->epoch;
+    if (!allowed || node_allowed(allowed, entry)) rag_topk_push(topk, entry_score, entry);
+    candidate_push(s, entry_score, entry);
+
+    while (s->c_size > 0) {
+        float score;
+        int id;
+        candidate_pop(s, &score, &id);
+        if (score < rag_topk_threshold(topk)) break;
+
+        int count = read_links(h, id, level, locked, buf);
+        for (int i = 0; i < count; i++) {
+            if (i + 1 < count) __builtin_prefetch(node_vector(h, buf[i + 1]));
+            int next = buf[i];
+            if (s->visited[next] == s->epoch) continue;
+            s->visited[next] = s->epoch;
+
+            float next_score = similarity(h, s, query, next);
+            if (next_score > rag_topk_threshold(topk)) {
+                if (!allowed || node_allowed(allowed, next)) rag_topk_push(topk, next_score, next);
+                if (candidate_push(s, next_score, next) < 0) break;
+            }
+        }
+    }
+    return 0;
+}
+
+// Neighbour selection heuristic: take candidates best-first and keep one
+// only if it is more similar to the base than to every kept neighbour,
+// which favours links in diverse directions. Candidates must be sorted
+// best-first; returns the number kept at the front of ids.
+static int select_neighbours(const struct rag_hnsw *h, struct rag_hnsw_scratch *s,
+                             float *scores, int *ids, int count, int max) {
+    int kept = 0;
+
+    for (int i = 0; i < count && kept < max; i++) {
+        const float *candidate = node_vector(h, ids[i]);
+        int good = 1;
+        for (int j = 0; j < kept; j++) {
+            s->distances++;
+            if (rag_dot(candidate, node_vector(h, ids[j]), h->dim) > scores[i]) {
+                good = 0;
+                break;
+            }
+        }
+        if (good) {
+            scores[kept] = scores[i];
+            ids[kept] = ids[i];
+            kept++;
+        }
+    }
+    return kept;
+}
+
+static void sort_best_first(float *scores, int *ids, int count) {
+    for (int i = 1; i < count; i++) {
+        float score = scores[i];
+        int id = ids[i];
+        int j = i;
+        while (j > 0 && scores[j - 1] < score) {
+            scores[j] = scores[j - 1];
+            ids[j] = ids[j - 1];
+            j--;
+        }
+        scores[j] = score;
+        ids[j] = id;
+    }
+}
+
+// Add a link from node to new_id, pruning with the heuristic when full
+static void add_link(struct rag_hnsw *h, struct rag_hnsw_scratch *s, int node, int new_id, int level) {
+    int max = max_links(h, level);
+    float scores[2 * HNSW_MAX_M + 1];
+    int ids[2 * HNSW_MAX_M + 1];
+
+    pthread_spin_lock(&h->locks[node]);
+    int *links = node_links(h, node, level);
+    int count = links[0];
+
+    for (int i = 0; i < count; i++) {
+        if (links[1 + i] == new_id) {
+            pthread_spin_unlock(&h->locks[node]);
+            return;
+        }
+    }
+
+    if (count < max) {
+        links[1 + count] = new_id;
+        links[0] = count + 1;
+    } else {
+        const float *base = node_vector(h, node);
+        for (int i = 0; i < count; i++) {
+            ids[i] = links[1 + i];
+            scores[i] = similarity(h, s, base, ids[i]);
+        }
+        ids[count] = new_id;
+        scores[count] = similarity(h, s, base, new_id);
+        sort_best_first(scores, ids, count + 1);
+
+        int kept = select_neighbours(h, s, scores, ids, count + 1, max);
+        memcpy(links + 1, ids, kept * sizeof(int));
+        links[0] = kept;
+    }
+    pthread_spin_unlock(&h->locks[node]);
+}
+
+static void insert_node(struct rag_hnsw *h, struct rag_hnsw_scratch *s, int id) {
+    const float *query = node_vector(h, id);
+    int level = h->levels[id];
+
+    pthread_mutex_lock(&h->entry_lock);
+    int entry = h->entry;
+    int top = h->max_level;
+    int raises_top = level > top;
+    if (!raises_top) {
+        pthread_mutex_unlock(&h->entry_lock);
+    }
+
+    float entry_score = similarity(h, s, query, entry);
+    for (int lc = top; lc > level; lc--) {
+        entry = greedy_closest(h, s, query, entry, &entry_score, lc, 1);
+    }
+
+    float scores[2 * HNSW_MAX_M + 1];
+    int ids[2 * HNSW_MAX_M + 1];
+    for (int lc = (level < top ? level : top); lc >= 0; lc--) {
+        struct rag_topk found;
+        if (search_layer(h, s, query, entry, entry_score, h->ef_construction, lc, 1, NULL, &found) < 0) {
+            break;
+        }
+        int count = rag_topk_finish(&found);
+
+        // The closest result seeds the next layer down
+        entry = found.ids[0];
+        entry_score = found.scores[0];
+
+        // Prune from at most 2*M0 candidates; the heuristic rarely looks further
+        int max = max_links(h, lc);
+        int pool = count < (int)(sizeof(ids) / sizeof(int)) ? count : (int)(sizeof(ids) / sizeof(int));
+        memcpy(scores, found.scores, pool * sizeof(float));
+        memcpy(ids, found.ids, pool * sizeof(int));
+        int kept = select_neighbours(h, s, scores, ids, pool, max);
+
+        pthread_spin_lock(&h->locks[id]);
+        int *links = node_links(h, id, lc);
+        memcpy(links + 1, ids, kept * sizeof(int));
+        links[0] = kept;
+        pthread_spin_unlock(&h->locks[id]);
+
+        for (int i = 0; i < kept; i++) {
+            add_link(h, s, ids[i], id, lc);
+        }
+    }
+
+    if (raises_top) {
+        h->entry = id;
+        h->max_level = level;
+        pthread_mutex_unlock(&h->entry_lock);
+    }
+}
+
+struct build_job {
+    struct rag_hnsw *h;
+    struct rag_hnsw_scratch **scratch;
+    size_t next;
+};
+
+static void build_task(void *arg, int worker, int num_workers) {
+    struct build_job *job = arg;
+    (void)num_workers;
+
+    while (1) {
+        size_t id = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (id >= job->h->n) break;
+        insert_node(job->h, job->scratch[worker], id);
+    }
+}
+
+struct rag_hnsw* rag_hnsw_build(const float *vectors, size_t n, int dim,
+                                const struct rag_hnsw_params *params, struct rag_pool *pool) {
+    if (n == 0 || params->M < 2 || params->M > HNSW_MAX_M) {
+        fprintf(stderr, "HNSW needs at least one vector and M in 2-%d\n", HNSW_MAX_M);
+        return NULL;
+    }
+
+    struct rag_hnsw *h = calloc(1, sizeof(*h));
+    if (!h) return NULL;
+    h->vectors = vectors;
+    h->n = n;
+    h->dim = dim;
+    h->M = params->M;
+    h->M0 = 2 * params->M;
+    h->ef_construction = params->ef_construction > h->M0 ? params->ef_construction : h->M0;
+    h->ef_search = params->ef_search > 0 ? params->ef_search : RAG_HNSW_DEFAULT_EF_SEARCH;
+    pthread_mutex_init(&h->entry_lock, NULL);
+
+    h->levels = malloc(n * sizeof(int));
+    h->links0 = calloc(n * (1 + h->M0), sizeof(int));
+    h->links = calloc(n, sizeof(int *));
+    h->locks = malloc(n * sizeof(pthread_spinlock_t));
+    if (!h->levels || !h->links0 || !h->links || !h->locks) {
+        fprintf(stderr, "Failed to allocate HNSW graph for %zu vectors\n", n);
+        free((void *)h->locks);
+        h->locks = NULL;
+        rag_hnsw_destroy(h);
+        return NULL;
+    }
+    for (size_t i = 0; i < n; i++) {
+        pthread_spin_init(&h->locks[i], PTHREAD_PROCESS_PRIVATE);
+    }
+
+    double mult = 1.0 / log(h->M);
+    for (size_t i = 0; i < n; i++) {
+        h->levels[i] = random_level(i, mult);
+        if (h->levels[i] > 0) {
+            h->links[i] = calloc(h->levels[i] * (1 + h->M), sizeof(int));
+            if (!h->links[i]) {
+                fprintf(stderr, "Failed to allocate HNSW upper layers\n");
+                rag_hnsw_destroy(h);
+                return NULL;
+            }
+        }
+    }
+
+    int workers = pool ? rag_pool_size(pool) : 1;
+    struct build_job job = { h, calloc(workers, sizeof(struct rag_hnsw_scratch *)), 1 };
+    int ok = job.scratch != NULL;
+    for (int w = 0; ok && w < workers; w++) {
+        job.scratch[w] = rag_hnsw_scratch_create(h);
+        ok = job.scratch[w] != NULL;
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to allocate HNSW build state\n");
+    } else {
+        // Node 0 is the first entry point; everything else is inserted
+        h->entry = 0;
+        h->max_level = h->levels[0];
+        if (workers > 1) {
+            rag_pool_run(pool, build_task, &job);
+        } else {
+            build_task(&job, 0, 1);
+        }
+    }
+
+    for (int w = 0; job.scratch && w < workers; w++) {
+        rag_hnsw_scratch_destroy(job.scratch[w]);
+    }
+    free(job.scratch);
+    if (!ok) {
+        rag_hnsw_destroy(h);
+        return NULL;
+    }
+    return h;
+}
+
+void rag_hnsw_destroy(struct rag_hnsw *h) {
+    if (!h) return;
+    if (h->links) {
+        for (size_t i = 0; i < h->n; i++) free(h->links[i]);
+    }
+    if (h->locks) {
+        for (size_t i = 0; i < h->n; i++) pthread_spin_destroy(&h->locks[i]);
+    }
+    pthread_mutex_destroy(&h->entry_lock);
+    free(h->levels);
+    free(h->links0);
+    free(h->links);
+    free((void *)h->locks);
+    free(h);
+}
+
+int rag_hnsw_search(const struct rag_hnsw *h, struct rag_hnsw_scratch *s,
+                    const float *query, int k, int ef, float *scores, int *ids) {
+    return rag_hnsw_search_filtered(h, s, query, k, ef, NULL, scores, ids);
+}
+
+int rag_hnsw_search_filtered(const struct rag_hnsw *h, struct rag_hnsw_scratch *s,
+                             const float *query, int k, int ef, const uint64_t *allowed,
+                             float *scores, int *ids) {
+    if (ef <= 0) ef = h->ef_search;
+    if (ef < k) ef = k;
+
+    int entry = h->entry;
+    float entry_score = similarity(h, s, query, entry);
+    for (int lc = h->max_level; lc > 0; lc--) {
+        entry = greedy_closest(h, s, query, entry, &entry_score, lc, 0);
+    }
+
+    struct rag_topk found;
+    if (search_layer(h, s, query, entry, entry_score, ef, 0, 0, allowed, &found) < 0) {
+        return 0;
+    }
+    int count = rag_topk_finish(&found);
+    if (count > k) count = k;
+    memcpy(scores, found.scores, count * sizeof(float));
+    memcpy(ids, found.ids, count * sizeof(int));
+    return count;
+}
+
+int rag_hnsw_ef_search(const struct rag_hnsw *h) {
+    return h->ef_search;
+}
+
+int rag_hnsw_max_level(const struct rag_hnsw *h) {
+    return h->max_level;
+}
+
+size_t rag_hnsw_memory(const struct rag_hnsw *h) {
+    size_t bytes = h->n * ((1 + h->M0) * sizeof(int) + sizeof(int) + sizeof(int *) +
+                           sizeof(pthread_spinlock_t));
+    for (size_t i = 0; i < h->n; i++) {
+        bytes += h->levels[i] * (1 + h->M) * sizeof(int);
+    }
+    return bytes;
+}
@@ -0,0 +1,55 @@
+#ifndef RAG_HNSW_H
+#define RAG_HNSW_H
+
+// Hierarchical Navigable Small World graph over the embedding block.
+// Similarity is the dot product from rag_kernels (vectors are unit
+// length). The index references the vectors, it does not copy them.
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct rag_pool;
+
+struct rag_hnsw_params {
+    int M;                  // Links per node on upper layers; 2*M on layer 0
+    int ef_construction;    // Candidate list size while inserting
+    int ef_search;          // Default candidate list size for queries
+};
+
+#define RAG_HNSW_DEFAULT_M 16
+#define RAG_HNSW_DEFAULT_EF_CONSTRUCTION 200
+#define RAG_HNSW_DEFAULT_EF_SEARCH 64
+
+struct rag_hnsw;
+
+// Per-thread search state (visited marks and candidate lists)
+struct rag_hnsw_scratch;
+
+// Insert all n vectors, spread over pool's workers (pool may be NULL)
+struct rag_hnsw* rag_hnsw_build(const float *vectors, size_t n, int dim,
+                                const struct rag_hnsw_params *params, struct rag_pool *pool);
+void rag_hnsw_destroy(struct rag_hnsw *h);
+
+struct rag_hnsw_scratch* rag_hnsw_scratch_create(const struct rag_hnsw *h);
+void rag_hnsw_scratch_destroy(struct rag_hnsw_scratch *s);
+
+// Best k neighbours of query, best-first; ef <= 0 uses the index default.
+// Returns the count written to scores/ids.
+int rag_hnsw_search(const struct rag_hnsw *h, struct rag_hnsw_scratch *s,
+                    const float *query, int k, int ef, float *scores, int *ids);
+
+// As rag_hnsw_search, but only ids whose bit is set in allowed (one bit
+// per vector) are returned. Disallowed nodes are still traversed; a very
+// selective filter is cheaper as an exact scan of the allowed ids.
+int rag_hnsw_search_filtered(const struct rag_hnsw *h, struct rag_hnsw_scratch *s,
+                             const float *query, int k, int ef, const uint64_t *allowed,
+                             float *scores, int *ids);
+
+// Similarity evaluations made through s since it was created
+long rag_hnsw_scratch_distances(const struct rag_hnsw_scratch *s);
+
+int rag_hnsw_ef_search(const struct rag_hnsw *h);
+int rag_hnsw_max_level(const struct rag_hnsw *h);
+size_t rag_hnsw_memory(const struct rag_hnsw *h);
+
+#endif // RAG_HNSW_H
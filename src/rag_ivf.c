@@ -0,0 +1,465 @@
+/**
+ * RAG IVF Index
+ * Training is Lloyd's k-means on unit vectors (spherical: centroids are
+ * renormalised each round) over a random sample. The assignment step is
+ * the expensive part. It runs on the worker pool with the tile kernel,
+ * which scores a block of vectors against every centroid at once.
+ * After training, every vector is assigned and the database is
+ * counting-sorted into per-list arrays.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "rag_ivf.h"
+#include "rag_kernels.h"
+#include "rag_topk.h"
+#include "rag_pool.h"
+
+#define IVF_ASSIGN_BLOCK 16     // Vectors per tile against all centroids
+#define IVF_SCAN_BLOCK 256
+#define IVF_SEED 0x1f5eedu
+#define IVF_IMAGE_ALIGN 64
+
+struct rag_ivf {
+    size_t n;
+    int dim;
+    int nlist;
+    int nprobe;
+
+    float *centroids;           // nlist x dim, unit length
+    size_t *offsets;            // List l is [offsets[l], offsets[l + 1])
+    float *vectors;             // n x dim in list order
+    int *ids;                   // Original id of each vector in list order
+    int borrowed;               // Arrays point into a loaded image
+    size_t vectors_offset;      // Of the vectors within a loaded image
+};
+
+// Image: this header, then the arrays at these offsets
+struct ivf_image_header {
+    uint64_t n;
+    uint32_t dim;
+    uint32_t nlist;
+    uint32_t nprobe;
+    uint32_t reserved;
+};
+
+struct ivf_image_layout {
+    size_t centroids, offsets, ids, vectors, size;
+};
+
+_Static_assert(sizeof(size_t) == sizeof(uint64_t), "IVF images store size_t list offsets");
+_Static_assert(sizeof(struct ivf_image_header) <= RAG_IVF_IMAGE_HEADER, "IVF image header size");
+
+struct assign_job {
+    const float *vectors;
+    size_t n;
+    int dim;
+    const float *centroids;
+    int nlist;
+    int *assign;
+    int failed;
+};
+
+static void assign_task(void *arg, int worker, int num_workers) {
+    struct assign_job *job = arg;
+    size_t begin, end;
+
+    rag_pool_range(job->n, worker, num_workers, &begin, &end);
+    float *scores = malloc((size_t)IVF_ASSIGN_BLOCK * job->nlist * sizeof(float));
+    if (!scores) {
+        job->failed = 1;
+        return;
+    }
+
+    for (size_t base = begin; base < end; base += IVF_ASSIGN_BLOCK) {
+        int len = end - base < IVF_ASSIGN_BLOCK ? end - base : IVF_ASSIGN_BLOCK;
+        rag_dot_tile(job->vectors + base * job->dim, len, job->centroids, job->nlist,
+                     job->dim, scores, job->nlist);
+        for (int r = 0; r < len; r++) {
+            const float *row = scores + (size_t)r * job->nlist;
+            int best = 0;
+            for (int c = 1; c < job->nlist; c++) {
+                if (row[c] > row[best]) best = c;
+            }
+            job->assign[base + r] = best;
+        }
+    }
+    free(scores);
+}
+
+// Nearest centroid of every vector
+static int assign_all(const float *vectors, size_t n, int dim, const float *centroids,
+                      int nlist, int *assign, struct rag_pool *pool) {
+    struct assign_job job = { vectors, n, dim, centroids, nlist, assign, 0 };
+    if (pool && rag_pool_size(pool) > 1) {
+        rag_pool_run(pool, assign_task, &job);
+    } else {
+        assign_task(&job, 0, 1);
+    }
+    return job.failed ? -1 : 0;
+}
+
+static void normalize(float *v, int dim) {
+    double norm = 0;
+    for (int i = 0; i < dim; i++) norm += (double)v[i] * v[i];
+    if (norm == 0) return;
+    float scale = 1.0 / sqrt(norm);
+    for (int i = 0; i < dim; i++) v[i] *= scale;
+}
+
+static int train(struct rag_ivf *ivf, const float *vectors, const struct rag_ivf_params *params,
+                 struct rag_pool *pool) {
+    size_t n = ivf->n;
+    int dim = ivf->dim;
+    unsigned int seed = IVF_SEED;
+
+    size_t sample_n = params->train_sample > 0 ? (size_t)params->train_sample : (size_t)256 * ivf->nlist;
+    if (sample_n > n) sample_n = n;
+
+    // A shuffled prefix of the ids is the sample; its first nlist
+    // entries seed the centroids
+    int *order = malloc(n * sizeof(int));
+    if (!order) return -1;
+    for (size_t i = 0; i < n; i++) order[i] = i;
+    for (size_t i = 0; i < sample_n; i++) {
+        size_t j = i + (size_t)rand_r(&seed) % (n - i);
+        int tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    const float *sample = vectors;
+    float *sample_copy = NULL;
+    if (sample_n < n) {
+        sample_copy = malloc(sample_n * dim * sizeof(float));
+        if (!sample_copy) {
+            free(order);
+            return -1;
+        }
+        for (size_t i = 0; i < sample_n; i++) {
+            memcpy(sample_copy + i * dim, vectors + (size_t)order[i] * dim, dim * sizeof(float));
+        }
+        sample = sample_copy;
+    }
+
+    for (int c = 0; c < ivf->nlist; c++) {
+        memcpy(ivf->centroids + (size_t)c * dim, vectors + (size_t)order[c] * dim, dim * sizeof(float));
+    }
+
+    int *assign = malloc(sample_n * sizeof(int));
+    float *sums = malloc((size_t)ivf->nlist * dim * sizeof(float));
+    size_t *counts = malloc(ivf->nlist * sizeof(size_t));
+    int ret = (assign && sums && counts) ? 0 : -1;
+
+    for (int iter = 0; ret == 0 && iter < params->train_iters; iter++) {
+        if (assign_all(sample, sample_n, dim, ivf->centroids, ivf->nlist, assign, pool) < 0) {
+            ret = -1;
+            break;
+        }
+
+        memset(sums, 0, (size_t)ivf->nlist * dim * sizeof(float));
+        memset(counts, 0, ivf->nlist * sizeof(size_t));
+        for (size_t i = 0; i < sample_n; i++) {
+            float *sum = sums + (size_t)assign[i] * dim;
+            const float *v = sample + i * dim;
+            for (int d = 0; d < dim; d++) sum[d] += v[d];
+            counts[assign[i]]++;
+        }
+
+        for (int c = 0; c < ivf->nlist; c++) {
+            float *centroid = ivf->centroids + (size_t)c * dim;
+            if (counts[c] == 0) {
+                // Reseed an empty cluster from a random sample vector
+                memcpy(centroid, sample + (size_t)(rand_r(&seed) % sample_n) * dim, dim * sizeof(float));
+            } else {
+                memcpy(centroid, sums + (size_t)c * dim, dim * sizeof(float));
+                normalize(centroid, dim);
+            }
+        }
+    }
+
+    free(order);
+    free(sample_copy);
+    free(assign);
+    free(sums);
+    free(counts);
+    return ret;
+}
+
+struct rag_ivf* rag_ivf_build(const float *vectors, size_t n, int dim,
+                              const struct rag_ivf_params *params, struct rag_pool *pool) {
+    if (n == 0) {
+        fprintf(stderr, "IVF needs at least one vector\n");
+        return NULL;
+    }
+
+    struct rag_ivf *ivf = calloc(1, sizeof(*ivf));
+    if (!ivf) return NULL;
+    ivf->n = n;
+    ivf->dim = dim;
+    ivf->nlist = params->nlist > 0 ? params->nlist : (int)(4 * sqrt((double)n));
+    if (ivf->nlist < 1) ivf->nlist = 1;
+    if ((size_t)ivf->nlist > n) ivf->nlist = n;
+    ivf->nprobe = params->nprobe > 0 ? params->nprobe : RAG_IVF_DEFAULT_NPROBE;
+
+    ivf->centroids = malloc((size_t)ivf->nlist * dim * sizeof(float));
+    ivf->offsets = calloc(ivf->nlist + 1, sizeof(size_t));
+    ivf->ids = malloc(n * sizeof(int));
+    if (posix_memalign((void **)&ivf->vectors, 64, n * dim * sizeof(float))) {
+        ivf->vectors = NULL;
+    }
+    int *assign = malloc(n * sizeof(int));
+    if (!ivf->centroids || !ivf->offsets || !ivf->ids || !ivf->vectors || !assign) {
+        fprintf(stderr, "Failed to allocate IVF index for %zu vectors\n", n);
+        goto fail;
+    }
+
+    if (train(ivf, vectors, params, pool) < 0 ||
+        assign_all(vectors, n, dim, ivf->centroids, ivf->nlist, assign, pool) < 0) {
+        fprintf(stderr, "IVF training failed\n");
+        goto fail;
+    }
+
+    // Counting sort into contiguous posting lists
+    for (size_t i = 0; i < n; i++) ivf->offsets[assign[i] + 1]++;
+    for (int c = 0; c < ivf->nlist; c++) ivf->offsets[c + 1] += ivf->offsets[c];
+    size_t *fill = malloc(ivf->nlist * sizeof(size_t));
+    if (!fill) goto fail;
+    memcpy(fill, ivf->offsets, ivf->nlist * sizeof(size_t));
+    for (size_t i = 0; i < n; i++) {
+        size_t pos = fill[assign[i]]++;
+        memcpy(ivf->vectors + pos * dim, vectors + i * dim, dim * sizeof(float));
+        ivf->ids[pos] = i;
+    }
+    free(fill);
+    free(assign);
+    return ivf;
+
+fail:
+    free(assign);
+    rag_ivf_destroy(ivf);
+    return NULL;
+}
+
+void rag_ivf_destroy(struct rag_ivf *ivf) {
+    if (!ivf) return;
+    if (ivf->borrowed) {
+        free(ivf);
+        return;
+    }
+    free(ivf->centroids);
+    free(ivf->offsets);
+    free(ivf->vectors);
+    free(ivf->ids);
+    free(ivf);
+}
+
+int rag_ivf_probe(const struct rag_ivf *ivf, const float *query, int nprobe, int *lists) {
+    if (nprobe <= 0) nprobe = ivf->nprobe;
+    if (nprobe > ivf->nlist) nprobe = ivf->nlist;
+
+    // Centroid scores, then the probe lists' scores
+    float *buf = malloc((ivf->nlist + nprobe) * sizeof(float));
+    if (!buf) return 0;
+    rag_dot_tile(query, 1, ivf->centroids, ivf->nlist, ivf->dim, buf, ivf->nlist);
+    struct rag_topk probe;
+    rag_topk_init(&probe, nprobe, buf + ivf->nlist, lists);
+    rag_topk_push_block(&probe, buf, ivf->nlist, 0);
+    nprobe = rag_topk_finish(&probe);
+    free(buf);
+    return nprobe;
+}
+
+int rag_ivf_search(const struct rag_ivf *ivf, const float *query, int k, int nprobe,
+                   float *scores, int *ids, size_t *scanned) {
+    return rag_ivf_search_filtered(ivf, query, k, nprobe, NULL, scores, ids, scanned);
+}
+
+int rag_ivf_search_filtered(const struct rag_ivf *ivf, const float *query, int k, int nprobe,
+                            const uint64_t *allowed, float *scores, int *ids, size_t *scanned) {
+    int *probe_ids = malloc((nprobe > 0 ? nprobe : ivf->nprobe) * sizeof(int));
+    if (!probe_ids) return 0;
+    nprobe = rag_ivf_probe(ivf, query, nprobe, probe_ids);
+
+    // Candidates are tracked by position in list order (consecutive
+    // within a list, so the block filter applies) and mapped back after
+    struct rag_topk topk;
+    rag_topk_init(&topk, k, scores, ids);
+    float block[IVF_SCAN_BLOCK];
+    size_t total = 0;
+    for (int p = 0; p < nprobe; p++) {
+        int list = probe_ids[p];
+        size_t begin = ivf->offsets[list], end = ivf->offsets[list + 1];
+        for (size_t base = begin; base < end; base += IVF_SCAN_BLOCK) {
+            int len = end - base < IVF_SCAN_BLOCK ? end - base : IVF_SCAN_BLOCK;
+            for (int j = 0; j < len; j++) {
+                int id = ivf->ids[base + j];
+                if (allowed && !((allowed[id / 64] >> (id % 64)) & 1)) {
+                    block[j] = -__builtin_inff();
+                    continue;
+                }
+                block[j] = rag_dot(query, ivf->vectors + (base + j) * ivf->dim, ivf->dim);
+                total++;
+            }
+            rag_topk_push_block(&topk, block, len, base);
+        }
+    }
+    free(probe_ids);
+
+    int count = rag_topk_finish(&topk);
+    for (int i = 0; i < count; i++) {
+        ids[i] = ivf->ids[ids[i]];
+    }
+    if (scanned) *scanned = total;
+    return count;
+}
+
+int rag_ivf_nlist(const struct rag_ivf *ivf) {
+    return ivf->nlist;
+}
+
+int rag_ivf_nprobe(const struct rag_ivf *ivf) {
+    return ivf->nprobe;
+}
+
+int rag_ivf_dim(const struct rag_ivf *ivf) {
+    return ivf->dim;
+}
+
+size_t rag_ivf_count(const struct rag_ivf *ivf) {
+    return ivf->n;
+}
+
+const float *rag_ivf_list(const struct rag_ivf *ivf, int list, const int **ids, size_t *count) {
+    size_t begin = ivf->offsets[list];
+    *count = ivf->offsets[list + 1] - begin;
+    if (ids) *ids = ivf->ids + begin;
+    return ivf->vectors + begin * ivf->dim;
+}
+
+size_t rag_ivf_memory(const struct rag_ivf *ivf) {
+    return ivf->n * (ivf->dim * sizeof(float) + sizeof(int)) +
+           (size_t)ivf->nlist * (ivf->dim * sizeof(float) + sizeof(size_t)) + sizeof(size_t);
+}
+
+static size_t image_align(size_t x) {
+    return (x + IVF_IMAGE_ALIGN - 1) / IVF_IMAGE_ALIGN * IVF_IMAGE_ALIGN;
+}
+
+static void image_layout(size_t n, int dim, int nlist, struct ivf_image_layout *l) {
+    l->centroids = image_align(sizeof(struct ivf_image_header));
+    l->offsets = image_align(l->centroids + (size_t)nlist * dim * sizeof(float));
+    l->ids = image_align(l->offsets + (nlist + 1) * sizeof(size_t));
+    l->vectors = image_align(l->ids + n * sizeof(int));
+    l->size = l->vectors + n * dim * sizeof(float);
+}
+
+size_t rag_ivf_image_size(const struct rag_ivf *ivf) {
+    struct ivf_image_layout l;
+    image_layout(ivf->n, ivf->dim, ivf->nlist, &l);
+    return l.size;
+}
+
+// Zero-fill from *pos up to offset, then write size bytes of data
+static int write_part(FILE *f, size_t *pos, size_t offset, const void *data, size_t size) {
+    for (; *pos < offset; (*pos)++) {
+        if (fputc(0, f) == EOF) return -1;
+    }
+    if (fwrite(data, 1, size, f) != size) return -1;
+    *pos += size;
+    return 0;
+}
+
+int rag_ivf_write_image(const struct rag_ivf *ivf, FILE *f) {
+    struct ivf_image_layout l;
+    image_layout(ivf->n, ivf->dim, ivf->nlist, &l);
+    struct ivf_image_header h = { ivf->n, ivf->dim, ivf->nlist, ivf->nprobe, 0 };
+    size_t pos = 0;
+
+    if (write_part(f, &pos, 0, &h, sizeof(h)) < 0 ||
+        write_part(f, &pos, l.centroids, ivf->centroids, (size_t)ivf->nlist * ivf->dim * sizeof(float)) < 0 ||
+        write_part(f, &pos, l.offsets, ivf->offsets, (ivf->nlist + 1) * sizeof(size_t)) < 0 ||
+        write_part(f, &pos, l.ids, ivf->ids, ivf->n * sizeof(int)) < 0 ||
+        write_part(f, &pos, l.vectors, ivf->vectors, ivf->n * ivf->dim * sizeof(float)) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Checks the header against the whole image's size; returns 0 if it is
+// not a valid header
+static int check_header(const struct ivf_image_header *h, size_t image_size,
+                        struct ivf_image_layout *l) {
+    if (image_size < sizeof(*h) || h->dim == 0 || h->nlist == 0 || h->nlist > h->n ||
+        h->n > image_size / ((size_t)h->dim * sizeof(float))) {
+        fprintf(stderr, "Corrupt IVF image\n");
+        return 0;
+    }
+    image_layout(h->n, h->dim, h->nlist, l);
+    if (l->size > image_size) {
+        fprintf(stderr, "Truncated IVF image\n");
+        return 0;
+    }
+    return 1;
+}
+
+size_t rag_ivf_image_head_size(const void *header, size_t image_size) {
+    struct ivf_image_layout l;
+    return check_header(header, image_size, &l) ? l.vectors : 0;
+}
+
+// With head_only, image holds just the part before the list vectors
+static struct rag_ivf* load_image(const void *image, size_t image_size, int nprobe, int head_only) {
+    const struct ivf_image_header *h = image;
+    struct ivf_image_layout l;
+    if (!check_header(h, image_size, &l)) {
+        return NULL;
+    }
+
+    struct rag_ivf *ivf = calloc(1, sizeof(*ivf));
+    if (!ivf) return NULL;
+    const char *base = image;
+    ivf->n = h->n;
+    ivf->dim = h->dim;
+    ivf->nlist = h->nlist;
+    ivf->nprobe = nprobe > 0 ? nprobe : h->nprobe > 0 ? (int)h->nprobe : RAG_IVF_DEFAULT_NPROBE;
+    ivf->centroids = (float *)(base + l.centroids);
+    ivf->offsets = (size_t *)(base + l.offsets);
+    ivf->ids = (int *)(base + l.ids);
+    ivf->vectors = head_only ? NULL : (float *)(base + l.vectors);
+    ivf->vectors_offset = l.vectors;
+    ivf->borrowed = 1;
+
+    // Searches trust the list bounds and ids, so check them once here
+    int ok = ivf->offsets[0] == 0 && ivf->offsets[ivf->nlist] == ivf->n;
+    for (int c = 0; ok && c < ivf->nlist; c++) {
+        ok = ivf->offsets[c] <= ivf->offsets[c + 1];
+    }
+    for (size_t i = 0; ok && i < ivf->n; i++) {
+        ok = ivf->ids[i] >= 0 && (size_t)ivf->ids[i] < ivf->n;
+    }
+    if (!ok) {
+        fprintf(stderr, "Corrupt IVF image lists\n");
+        free(ivf);
+        return NULL;
+    }
+    return ivf;
+}
+
+struct rag_ivf* rag_ivf_load(const void *image, size_t size, int nprobe) {
+    return load_image(image, size, nprobe, 0);
+}
+
+struct rag_ivf* rag_ivf_load_head(const void *head, size_t image_size, int nprobe) {
+    return load_image(head, image_size, nprobe, 1);
+}
+
+size_t rag_ivf_list_extent(const struct rag_ivf *ivf, int list, const int **ids, size_t *count) {
+    size_t begin = ivf->offsets[list];
+    *count = ivf->offsets[list + 1] - begin;
+    if (ids) *ids = ivf->ids + begin;
+    return ivf->vectors_offset + begin * ivf->dim * sizeof(float);
+}
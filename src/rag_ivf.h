@@ -0,0 +1,80 @@
+#ifndef RAG_IVF_H
+#define RAG_IVF_H
+
+// Inverted-file index: a spherical k-means coarse quantizer splits the
+// database into nlist clusters and each cluster's vectors are copied
+// into one contiguous posting list, so a remote reader can fetch a
+// whole list with a single RDMA READ. Queries scan the nprobe lists
+// whose centroids are most similar.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct rag_pool;
+
+struct rag_ivf_params {
+    int nlist;              // Clusters; <= 0 picks 4 * sqrt(n)
+    int nprobe;             // Default lists scanned per query
+    int train_iters;        // k-means iterations
+    int train_sample;       // Vectors used for training; <= 0 uses 256 per list
+};
+
+#define RAG_IVF_DEFAULT_NPROBE 8
+#define RAG_IVF_DEFAULT_ITERS 10
+
+struct rag_ivf;
+
+// Train the quantizer and bucket all n vectors, spread over pool's
+// workers (pool may be NULL)
+struct rag_ivf* rag_ivf_build(const float *vectors, size_t n, int dim,
+                              const struct rag_ivf_params *params, struct rag_pool *pool);
+void rag_ivf_destroy(struct rag_ivf *ivf);
+
+// Best k neighbours of query, best-first; nprobe <= 0 uses the index
+// default. Safe to call from several threads. Returns the count written,
+// and if scanned is non-NULL the number of vectors scored.
+int rag_ivf_search(const struct rag_ivf *ivf, const float *query, int k, int nprobe,
+                   float *scores, int *ids, size_t *scanned);
+
+// As rag_ivf_search, scoring only ids whose bit is set in allowed (one
+// bit per vector); the others cost an id lookup, not a dot product
+int rag_ivf_search_filtered(const struct rag_ivf *ivf, const float *query, int k, int nprobe,
+                            const uint64_t *allowed, float *scores, int *ids, size_t *scanned);
+
+int rag_ivf_nlist(const struct rag_ivf *ivf);
+int rag_ivf_dim(const struct rag_ivf *ivf);
+size_t rag_ivf_count(const struct rag_ivf *ivf);     // Vectors indexed
+int rag_ivf_nprobe(const struct rag_ivf *ivf);      // Default lists per query
+
+// The nprobe (<= 0: default) lists whose centroids are most similar to
+// query, best-first; returns the count written to lists
+int rag_ivf_probe(const struct rag_ivf *ivf, const float *query, int nprobe, int *lists);
+
+// One posting list: count vectors of dim floats, contiguous, with their
+// original ids
+const float *rag_ivf_list(const struct rag_ivf *ivf, int list, const int **ids, size_t *count);
+
+size_t rag_ivf_memory(const struct rag_ivf *ivf);
+
+// Persistence as one flat image: header, centroids, list offsets, ids
+// and list-ordered vectors, each 64-byte aligned. rag_ivf_load uses the
+// image in place, so it (e.g. a mapped database section) must outlive
+// the index. nprobe <= 0 keeps the stored default.
+size_t rag_ivf_image_size(const struct rag_ivf *ivf);
+int rag_ivf_write_image(const struct rag_ivf *ivf, FILE *f);
+struct rag_ivf* rag_ivf_load(const void *image, size_t size, int nprobe);
+
+// Remote readers fetch the image head (everything before the list
+// vectors) once, then single lists. rag_ivf_image_head_size takes the
+// first RAG_IVF_IMAGE_HEADER bytes and returns 0 if they are not a valid
+// header for an image of image_size bytes. An index loaded from a head
+// can probe and locate lists but not search.
+#define RAG_IVF_IMAGE_HEADER 64
+size_t rag_ivf_image_head_size(const void *header, size_t image_size);
+struct rag_ivf* rag_ivf_load_head(const void *head, size_t image_size, int nprobe);
+
+// Byte offset of a list's vectors within a loaded image, with their ids
+size_t rag_ivf_list_extent(const struct rag_ivf *ivf, int list, const int **ids, size_t *count);
+
+#endif // RAG_IVF_H
@@ -0,0 +1,480 @@
+/**
+ * RAG Similarity Kernels
+ * Dot products over float32 embeddings with several independent
+ * accumulators per variant so the FMA latency chain is hidden:
+ * - scalar:  4 accumulators, portable fallback
+ * - SSE4:    4 x 4 lanes
+ * - AVX2:    4 x 8 lanes with FMA
+ * - AVX-512: 4 x 16 lanes with FMA, masked tail
+ *
+ * Tile kernels score a block of queries against a block of vectors like a
+ * small GEMM: a register-blocked micro-kernel (4 queries x 4 vectors for
+ * AVX-512, 2 x 4 for AVX2) loads each vector slice once for several
+ * queries, so one pass over the database serves the whole batch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "rag_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RAG_X86 1
+#endif
+
+static float dot_scalar(const float *a, const float *b, int dim) {
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int i = 0;
+
+    for (; i + 4 <= dim; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < dim; i++) {
+        s0 += a[i] * b[i];
+    }
+
+    return (s0 + s1) + (s2 + s3);
+}
+
+#ifdef RAG_X86
+__attribute__((target("sse4.1")))
+static float dot_sse4(const float *a, const float *b, int dim) {
+    __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+    __m128 acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+    int i = 0;
+
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+        acc2 = _mm_add_ps(acc2, _mm_mul_ps(_mm_loadu_ps(a + i + 8), _mm_loadu_ps(b + i + 8)));
+        acc3 = _mm_add_ps(acc3, _mm_mul_ps(_mm_loadu_ps(a + i + 12), _mm_loadu_ps(b + i + 12)));
+    }
+    for (; i + 4 <= dim; i += 4) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+
+    __m128 acc = _mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3));
+    acc = _mm_hadd_ps(acc, acc);
+    acc = _mm_hadd_ps(acc, acc);
+    float sum = _mm_cvtss_f32(acc);
+
+    for (; i < dim; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static float dot_avx2(const float *a, const float *b, int dim) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    int i = 0;
+
+    for (; i + 32 <= dim; i += 32) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+    }
+    for (; i + 8 <= dim; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+
+    __m256 acc = _mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3));
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    half = _mm_hadd_ps(half, half);
+    half = _mm_hadd_ps(half, half);
+    float sum = _mm_cvtss_f32(half);
+
+    for (; i < dim; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+__attribute__((target("avx512f")))
+static float dot_avx512(const float *a, const float *b, int dim) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps(), acc3 = _mm512_setzero_ps();
+    int i = 0;
+
+    for (; i + 64 <= dim; i += 64) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+        acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 32), _mm512_loadu_ps(b + i + 32), acc2);
+        acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 48), _mm512_loadu_ps(b + i + 48), acc3);
+    }
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    }
+    if (i < dim) {
+        __mmask16 mask = (__mmask16)((1u << (dim - i)) - 1);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i),
+                               _mm512_maskz_loadu_ps(mask, b + i), acc1);
+    }
+
+    __m512 acc = _mm512_add_ps(_mm512_add_ps(acc0, acc1), _mm512_add_ps(acc2, acc3));
+    return _mm512_reduce_add_ps(acc);
+}
+#endif
+
+// Tiles without a micro-kernel score pair by pair
+static void tile_by_dot(rag_dot_fn dot, const float *queries, int nq,
+                        const float *vectors, int nv, int dim, float *scores, int ld) {
+    for (int q = 0; q < nq; q++) {
+        for (int v = 0; v < nv; v++) {
+            scores[(size_t)q * ld + v] = dot(queries + (size_t)q * dim, vectors + (size_t)v * dim, dim);
+        }
+    }
+}
+
+static void dot_tile_scalar(const float *queries, int nq, const float *vectors, int nv,
+                            int dim, float *scores, int ld) {
+    tile_by_dot(dot_scalar, queries, nq, vectors, nv, dim, scores, ld);
+}
+
+#ifdef RAG_X86
+static void dot_tile_sse4(const float *queries, int nq, const float *vectors, int nv,
+                          int dim, float *scores, int ld) {
+    tile_by_dot(dot_sse4, queries, nq, vectors, nv, dim, scores, ld);
+}
+
+__attribute__((target("avx2,fma")))
+static inline float hsum_avx2(__m256 v) {
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    half = _mm_hadd_ps(half, half);
+    half = _mm_hadd_ps(half, half);
+    return _mm_cvtss_f32(half);
+}
+
+// 2 queries x 4 vectors: 8 accumulators, 6 loads per 8 FMAs
+__attribute__((target("avx2,fma")))
+static void micro_2x4_avx2(const float *q, const float *v, int dim, float *scores, int ld) {
+    const float *q0 = q, *q1 = q + dim;
+    const float *v0 = v, *v1 = v + dim, *v2 = v + 2 * dim, *v3 = v + 3 * dim;
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c02 = _mm256_setzero_ps(), c03 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c12 = _mm256_setzero_ps(), c13 = _mm256_setzero_ps();
+    int i = 0;
+
+    for (; i + 8 <= dim; i += 8) {
+        __m256 a0 = _mm256_loadu_ps(q0 + i), a1 = _mm256_loadu_ps(q1 + i);
+        __m256 b = _mm256_loadu_ps(v0 + i);
+        c00 = _mm256_fmadd_ps(a0, b, c00); c10 = _mm256_fmadd_ps(a1, b, c10);
+        b = _mm256_loadu_ps(v1 + i);
+        c01 = _mm256_fmadd_ps(a0, b, c01); c11 = _mm256_fmadd_ps(a1, b, c11);
+        b = _mm256_loadu_ps(v2 + i);
+        c02 = _mm256_fmadd_ps(a0, b, c02); c12 = _mm256_fmadd_ps(a1, b, c12);
+        b = _mm256_loadu_ps(v3 + i);
+        c03 = _mm256_fmadd_ps(a0, b, c03); c13 = _mm256_fmadd_ps(a1, b, c13);
+    }
+
+    float out[2][4] = {
+        { hsum_avx2(c00), hsum_avx2(c01), hsum_avx2(c02), hsum_avx2(c03) },
+        { hsum_avx2(c10), hsum_avx2(c11), hsum_avx2(c12), hsum_avx2(c13) },
+    };
+    for (; i < dim; i++) {
+        out[0][0] += q0[i] * v0[i]; out[0][1] += q0[i] * v1[i];
+        out[0][2] += q0[i] * v2[i]; out[0][3] += q0[i] * v3[i];
+        out[1][0] += q1[i] * v0[i]; out[1][1] += q1[i] * v1[i];
+        out[1][2] += q1[i] * v2[i]; out[1][3] += q1[i] * v3[i];
+    }
+    memcpy(scores, out[0], sizeof(out[0]));
+    memcpy(scores + ld, out[1], sizeof(out[1]));
+}
+
+__attribute__((target("avx2,fma")))
+static void dot_tile_avx2(const float *queries, int nq, const float *vectors, int nv,
+                          int dim, float *scores, int ld) {
+    int q = 0;
+    for (; q + 2 <= nq; q += 2) {
+        const float *qrow = queries + (size_t)q * dim;
+        float *out = scores + (size_t)q * ld;
+        int v = 0;
+        for (; v + 4 <= nv; v += 4) {
+            micro_2x4_avx2(qrow, vectors + (size_t)v * dim, dim, out + v, ld);
+        }
+        tile_by_dot(dot_avx2, qrow, 2, vectors + (size_t)v * dim, nv - v, dim, out + v, ld);
+    }
+    tile_by_dot(dot_avx2, queries + (size_t)q * dim, nq - q, vectors, nv, dim,
+                scores + (size_t)q * ld, ld);
+}
+
+#define FMA_ROW4(c0, c1, c2, c3, a)                                  \
+    do {                                                             \
+        c0 = _mm512_fmadd_ps(a, b0, c0); c1 = _mm512_fmadd_ps(a, b1, c1); \
+        c2 = _mm512_fmadd_ps(a, b2, c2); c3 = _mm512_fmadd_ps(a, b3, c3); \
+    } while (0)
+
+// 4 queries x 4 vectors: 16 accumulators, 8 loads per 16 FMAs
+__attribute__((target("avx512f")))
+static void micro_4x4_avx512(const float *q, const float *v, int dim, float *scores, int ld) {
+    __m512 c00 = _mm512_setzero_ps(), c01 = _mm512_setzero_ps(), c02 = _mm512_setzero_ps(), c03 = _mm512_setzero_ps();
+    __m512 c10 = _mm512_setzero_ps(), c11 = _mm512_setzero_ps(), c12 = _mm512_setzero_ps(), c13 = _mm512_setzero_ps();
+    __m512 c20 = _mm512_setzero_ps(), c21 = _mm512_setzero_ps(), c22 = _mm512_setzero_ps(), c23 = _mm512_setzero_ps();
+    __m512 c30 = _mm512_setzero_ps(), c31 = _mm512_setzero_ps(), c32 = _mm512_setzero_ps(), c33 = _mm512_setzero_ps();
+    int i = 0;
+
+    for (; i < dim; i += 16) {
+        // The final partial slice loads zeros beyond dim
+        __mmask16 mask = dim - i >= 16 ? 0xFFFF : (__mmask16)((1u << (dim - i)) - 1);
+        __m512 b0 = _mm512_maskz_loadu_ps(mask, v + i);
+        __m512 b1 = _mm512_maskz_loadu_ps(mask, v + dim + i);
+        __m512 b2 = _mm512_maskz_loadu_ps(mask, v + 2 * dim + i);
+        __m512 b3 = _mm512_maskz_loadu_ps(mask, v + 3 * dim + i);
+        FMA_ROW4(c00, c01, c02, c03, _mm512_maskz_loadu_ps(mask, q + i));
+        FMA_ROW4(c10, c11, c12, c13, _mm512_maskz_loadu_ps(mask, q + dim + i));
+        FMA_ROW4(c20, c21, c22, c23, _mm512_maskz_loadu_ps(mask, q + 2 * dim + i));
+        FMA_ROW4(c30, c31, c32, c33, _mm512_maskz_loadu_ps(mask, q + 3 * dim + i));
+    }
+
+    scores[0] = _mm512_reduce_add_ps(c00); scores[1] = _mm512_reduce_add_ps(c01);
+    scores[2] = _mm512_reduce_add_ps(c02); scores[3] = _mm512_reduce_add_ps(c03);
+    scores += ld;
+    scores[0] = _mm512_reduce_add_ps(c10); scores[1] = _mm512_reduce_add_ps(c11);
+    scores[2] = _mm512_reduce_add_ps(c12); scores[3] = _mm512_reduce_add_ps(c13);
+    scores += ld;
+    scores[0] = _mm512_reduce_add_ps(c20); scores[1] = _mm512_reduce_add_ps(c21);
+    scores[2] = _mm512_reduce_add_ps(c22); scores[3] = _mm512_reduce_add_ps(c23);
+    scores += ld;
+    scores[0] = _mm512_reduce_add_ps(c30); scores[1] = _mm512_reduce_add_ps(c31);
+    scores[2] = _mm512_reduce_add_ps(c32); scores[3] = _mm512_reduce_add_ps(c33);
+}
+
+__attribute__((target("avx512f")))
+static void dot_tile_avx512(const float *queries, int nq, const float *vectors, int nv,
+                            int dim, float *scores, int ld) {
+    int q = 0;
+    for (; q + 4 <= nq; q += 4) {
+        const float *qrow = queries + (size_t)q * dim;
+        float *out = scores + (size_t)q * ld;
+        int v = 0;
+        for (; v + 4 <= nv; v += 4) {
+            micro_4x4_avx512(qrow, vectors + (size_t)v * dim, dim, out + v, ld);
+        }
+        tile_by_dot(dot_avx512, qrow, 4, vectors + (size_t)v * dim, nv - v, dim, out + v, ld);
+    }
+    tile_by_dot(dot_avx512, queries + (size_t)q * dim, nq - q, vectors, nv, dim,
+                scores + (size_t)q * ld, ld);
+}
+#endif
+
+static const char *isa_names[RAG_ISA_COUNT] = { "scalar", "sse4", "avx2", "avx512" };
+
+static int active_isa = RAG_ISA_SCALAR;
+rag_dot_fn rag_dot = dot_scalar;
+rag_dot_tile_fn rag_dot_tile = dot_tile_scalar;
+
+const char *rag_isa_name(int isa) {
+    return (isa >= 0 && isa < RAG_ISA_COUNT) ? isa_names[isa] : "unknown";
+}
+
+int rag_isa_supported(int isa) {
+    switch (isa) {
+        case RAG_ISA_SCALAR:
+            return 1;
+#ifdef RAG_X86
+        case RAG_ISA_SSE4:
+            return __builtin_cpu_supports("sse4.1");
+        case RAG_ISA_AVX2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        case RAG_ISA_AVX512:
+            return __builtin_cpu_supports("avx512f");
+#endif
+        default:
+            return 0;
+    }
+}
+
+rag_dot_fn rag_dot_kernel(int isa) {
+    if (!rag_isa_supported(isa)) return NULL;
+
+    switch (isa) {
+#ifdef RAG_X86
+        case RAG_ISA_SSE4:   return dot_sse4;
+        case RAG_ISA_AVX2:   return dot_avx2;
+        case RAG_ISA_AVX512: return dot_avx512;
+#endif
+        default:             return dot_scalar;
+    }
+}
+
+rag_dot_tile_fn rag_dot_tile_kernel(int isa) {
+    if (!rag_isa_supported(isa)) return NULL;
+
+    switch (isa) {
+#ifdef RAG_X86
+        case RAG_ISA_SSE4:   return dot_tile_sse4;
+        case RAG_ISA_AVX2:   return dot_tile_avx2;
+        case RAG_ISA_AVX512: return dot_tile_avx512;
+#endif
+        default:             return dot_tile_scalar;
+    }
+}
+
+int rag_kernels_init(const char *force) {
+#ifdef RAG_X86
+    __builtin_cpu_init();
+#endif
+
+    int isa = -1;
+    if (force) {
+        for (int i = 0; i < RAG_ISA_COUNT; i++) {
+            if (strcmp(force, isa_names[i]) == 0) isa = i;
+        }
+        if (isa < 0 || !rag_isa_supported(isa)) {
+            fprintf(stderr, "Kernel '%s' is unknown or not supported by this CPU\n", force);
+            return -1;
+        }
+    } else {
+        for (isa = RAG_ISA_COUNT - 1; isa > RAG_ISA_SCALAR; isa--) {
+            if (rag_isa_supported(isa)) break;
+        }
+    }
+
+    active_isa = isa;
+    rag_dot = rag_dot_kernel(isa);
+    rag_dot_tile = rag_dot_tile_kernel(isa);
+    return isa;
+}
+
+int rag_kernels_active(void) {
+    return active_isa;
+}
+
+// Self-test
+
+static double dot_reference(const float *a, const float *b, int dim) {
+    double sum = 0;
+    for (int i = 0; i < dim; i++) {
+        sum += (double)a[i] * b[i];
+    }
+    return sum;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Tile kernel against the reference over micro-kernel edges and tails;
+// db holds at least 16 x 769 + 9 x 769 random floats
+static int tile_self_test(int isa, const float *db) {
+    static const int sizes[] = { 1, 2, 3, 4, 5, 8, 9 };
+    static const int dims[] = { 5, 17, 768, 769 };
+    const int ld = 11;
+    rag_dot_tile_fn fn = rag_dot_tile_kernel(isa);
+    float scores[9 * 11];
+    int bad = 0;
+
+    for (size_t d = 0; d < sizeof(dims) / sizeof(dims[0]); d++) {
+        for (size_t a = 0; a < sizeof(sizes) / sizeof(sizes[0]); a++) {
+            for (size_t b = 0; b < sizeof(sizes) / sizeof(sizes[0]); b++) {
+                int dim = dims[d], nq = sizes[a], nv = sizes[b];
+                const float *queries = db, *vectors = db + 16 * 769;
+                fn(queries, nq, vectors, nv, dim, scores, ld);
+                for (int q = 0; q < nq; q++) {
+                    for (int v = 0; v < nv; v++) {
+                        const float *x = queries + (size_t)q * dim, *y = vectors + (size_t)v * dim;
+                        double ref = dot_reference(x, y, dim);
+                        double scale = sqrt(dot_reference(x, x, dim) * dot_reference(y, y, dim));
+                        if (fabs(scores[q * ld + v] - ref) > 1e-5 * scale + 1e-6) {
+                            if (!bad) {
+                                printf("  %-7s TILE MISMATCH %dx%d dim=%d at (%d,%d)\n",
+                                       rag_isa_name(isa), nq, nv, dim, q, v);
+                            }
+                            bad++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return bad;
+}
+
+int rag_kernels_self_test(void) {
+    // Odd sizes exercise every tail path; +1 offsets break 64-byte alignment
+    static const int dims[] = { 1, 3, 4, 7, 15, 16, 17, 31, 33, 63, 64, 65, 127, 384, 768, 1000, 1536 };
+    const int max_dim = 1536;
+    const int bench_dim = 768, bench_vectors = 20000;
+    int failures = 0;
+
+    float *a = malloc((max_dim + 1) * sizeof(float));
+    float *b = malloc((max_dim + 1) * sizeof(float));
+    float *db = malloc((size_t)bench_vectors * bench_dim * sizeof(float));
+    if (!a || !b || !db) {
+        fprintf(stderr, "Self-test allocation failed\n");
+        free(a); free(b); free(db);
+        return 1;
+    }
+
+    unsigned int seed = 12345;
+    for (int i = 0; i < max_dim + 1; i++) {
+        a[i] = (float)rand_r(&seed) / RAND_MAX * 2.0f - 1.0f;
+        b[i] = (float)rand_r(&seed) / RAND_MAX * 2.0f - 1.0f;
+    }
+    for (size_t i = 0; i < (size_t)bench_vectors * bench_dim; i++) {
+        db[i] = (float)rand_r(&seed) / RAND_MAX * 2.0f - 1.0f;
+    }
+
+    printf("Similarity kernel self-test:\n");
+    for (int isa = 0; isa < RAG_ISA_COUNT; isa++) {
+        rag_dot_fn fn = rag_dot_kernel(isa);
+        if (!fn) {
+            printf("  %-7s not supported by this CPU\n", rag_isa_name(isa));
+            continue;
+        }
+
+        int bad = 0;
+        for (size_t d = 0; d < sizeof(dims) / sizeof(dims[0]); d++) {
+            for (int off = 0; off <= 1; off++) {
+                int dim = dims[d];
+                double ref = dot_reference(a + off, b + off, dim);
+                double scale = sqrt(dot_reference(a + off, a + off, dim) *
+                                    dot_reference(b + off, b + off, dim));
+                double err = fabs(fn(a + off, b + off, dim) - ref);
+                if (err > 1e-5 * scale + 1e-6) {
+                    printf("  %-7s MISMATCH dim=%d offset=%d: got %.7f want %.7f\n",
+                           rag_isa_name(isa), dim, off, fn(a + off, b + off, dim), ref);
+                    bad++;
+                }
+            }
+        }
+        bad += tile_self_test(isa, db);
+        failures += bad;
+
+        // Throughput over a database that does not fit in cache
+        volatile float sink = 0;
+        double start = now_sec();
+        int passes = 0;
+        do {
+            for (int v = 0; v < bench_vectors; v++) {
+                sink += fn(a, db + (size_t)v * bench_dim, bench_dim);
+            }
+            passes++;
+        } while (now_sec() - start < 0.2);
+        double elapsed = now_sec() - start;
+        double dots = (double)passes * bench_vectors;
+        (void)sink;
+
+        printf("  %-7s %s  %7.1f M dot/s  %6.2f GFLOP/s  %6.2f GB/s%s\n",
+               rag_isa_name(isa), bad ? "FAIL" : "ok  ",
+               dots / elapsed / 1e6, dots * bench_dim * 2 / elapsed / 1e9,
+               dots * bench_dim * sizeof(float) / elapsed / 1e9,
+               isa == active_isa ? "  (selected)" : "");
+    }
+
+    free(a);
+    free(b);
+    free(db);
+    return failures;
+}
@@ -0,0 +1,42 @@
+#ifndef RAG_KERNELS_H
+#define RAG_KERNELS_H
+
+// Similarity kernels for the RAG vector server. Every instruction-set
+// variant is compiled into the binary and one is picked at startup from
+// cpuid, so the same build runs on any x86-64 host.
+
+enum rag_isa {
+    RAG_ISA_SCALAR = 0,
+    RAG_ISA_SSE4,
+    RAG_ISA_AVX2,      // AVX2 + FMA
+    RAG_ISA_AVX512,    // AVX-512F
+    RAG_ISA_COUNT
+};
+
+typedef float (*rag_dot_fn)(const float *a, const float *b, int dim);
+
+// scores[q * ld + v] = dot(queries row q, vectors row v) for an
+// nq x nv tile; rows are dim floats apart
+typedef void (*rag_dot_tile_fn)(const float *queries, int nq, const float *vectors, int nv,
+                                int dim, float *scores, int ld);
+
+// Selected kernels; valid after rag_kernels_init()
+extern rag_dot_fn rag_dot;
+extern rag_dot_tile_fn rag_dot_tile;
+
+// Pick the best supported kernel, or the one named by force ("scalar",
+// "sse4", "avx2", "avx512"). Returns the chosen enum rag_isa, -1 if
+// force is unknown or not supported by this CPU.
+int rag_kernels_init(const char *force);
+int rag_kernels_active(void);
+
+const char *rag_isa_name(int isa);
+int rag_isa_supported(int isa);
+rag_dot_fn rag_dot_kernel(int isa);
+rag_dot_tile_fn rag_dot_tile_kernel(int isa);
+
+// Check every supported kernel against a double-precision reference and
+// time it over a small database; returns the number of failures
+int rag_kernels_self_test(void);
+
+#endif // RAG_KERNELS_H
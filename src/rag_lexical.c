@@ -0,0 +1,652 @@
+/**
+ * RAG Lexical Index
+ * Building tokenizes every document once, records (term, document,
+ * frequency) triples in document order and counting-sorts them by term,
+ * so each term's documents come out ascending. Postings are then packed
+ * block by block. A block stores one header word with the bit widths of
+ * its id gaps and of its frequencies minus one, then the gaps and the
+ * frequencies, each packed vertically: value i goes in lane i % 4 at
+ * position i / 4. That way four consecutive words unpack into four
+ * consecutive values with one shift and one mask, as in the SIMD-BP128
+ * scheme. A short last block (all of a rare term's postings) is
+ * variable-byte coded instead.
+ *
+ * Search is term-at-a-time. Each query term's blocks are decoded and
+ * added into per-document accumulators, and the touched documents are
+ * then selected into a top-k. The BM25 length normalisation is
+ * precomputed per document.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "rag_lexical.h"
+#include "rag_topk.h"
+
+#define TERM_MAX 32                 // Longer terms are truncated
+#define DICT_MIN_SLOTS 1024
+#define BM25_K1 1.2f
+#define BM25_B 0.75f
+
+struct term_info {
+    uint32_t name;                  // Offset in the name pool
+    uint32_t df;                    // Documents containing the term
+    size_t offset;                  // First packed word
+    float idf;
+};
+
+struct rag_lexical {
+    size_t n;
+    char *names;
+    size_t names_size, names_cap;
+    struct term_info *terms;
+    uint32_t num_terms, max_terms;
+    uint32_t *slots;                // Term index + 1; 0 = empty
+    uint32_t num_slots;
+    uint32_t *packed;
+    size_t num_packed;
+    float *norm;                    // k1 * (1 - b + b * length / avg_length)
+    size_t postings;
+    double avg_length;
+};
+
+struct rag_lexical_scratch {
+    float *acc;
+    uint32_t *mark;                 // acc[i] is live when mark[i] == epoch
+    uint32_t epoch;
+    uint32_t *touched;
+};
+
+// Build-time posting, before packing
+struct triple {
+    uint32_t term;
+    uint32_t doc;
+    uint32_t tf;
+};
+
+// Next term at *p, lower-cased into term; returns its length, 0 at the end
+static int next_term(const char **p, char term[TERM_MAX]) {
+    const char *s = *p;
+    while (*s && !isalnum((unsigned char)*s)) s++;
+    int len = 0;
+    for (; isalnum((unsigned char)*s); s++) {
+        if (len < TERM_MAX - 1) term[len++] = tolower((unsigned char)*s);
+    }
+    term[len] = '\0';
+    *p = s;
+    return len;
+}
+
+static uint64_t hash_term(const char *s) {
+    uint64_t h = 14695981039346656037ULL;
+    for (; *s; s++) h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+    return h;
+}
+
+// Slot holding term, or the empty slot where it would go
+static uint32_t dict_slot(const struct rag_lexical *ix, const char *term) {
+    uint32_t i = hash_term(term) & (ix->num_slots - 1);
+    while (ix->slots[i] && strcmp(ix->names + ix->terms[ix->slots[i] - 1].name, term) != 0) {
+        i = (i + 1) & (ix->num_slots - 1);
+    }
+    return i;
+}
+
+// Term index + 1, or 0 if the term is not in the index
+static uint32_t dict_find(const struct rag_lexical *ix, const char *term) {
+    return ix->slots[dict_slot(ix, term)];
+}
+
+// Term index, adding the term if new; -1 on allocation failure
+static long dict_add(struct rag_lexical *ix, const char *term) {
+    uint32_t slot = dict_slot(ix, term);
+    if (ix->slots[slot]) return ix->slots[slot] - 1;
+
+    // Keep the table at most half full
+    if (2 * (ix->num_terms + 1) > ix->num_slots) {
+        uint32_t *slots = calloc(2 * ix->num_slots, sizeof(uint32_t));
+        if (!slots) return -1;
+        free(ix->slots);
+        ix->slots = slots;
+        ix->num_slots *= 2;
+        for (uint32_t t = 0; t < ix->num_terms; t++) {
+            ix->slots[dict_slot(ix, ix->names + ix->terms[t].name)] = t + 1;
+        }
+        slot = dict_slot(ix, term);
+    }
+    if (ix->num_terms == ix->max_terms) {
+        uint32_t max = ix->max_terms ? 2 * ix->max_terms : 1024;
+        struct term_info *terms = realloc(ix->terms, max * sizeof(*terms));
+        if (!terms) return -1;
+        ix->terms = terms;
+        ix->max_terms = max;
+    }
+    size_t len = strlen(term) + 1;
+    if (ix->names_size + len > ix->names_cap) {
+        size_t cap = ix->names_cap ? 2 * ix->names_cap : 16384;
+        char *names = realloc(ix->names, cap);
+        if (!names) return -1;
+        ix->names = names;
+        ix->names_cap = cap;
+    }
+    memcpy(ix->names + ix->names_size, term, len);
+    memset(&ix->terms[ix->num_terms], 0, sizeof(struct term_info));
+    ix->terms[ix->num_terms].name = ix->names_size;
+    ix->names_size += len;
+    ix->slots[slot] = ++ix->num_terms;
+    return ix->num_terms - 1;
+}
+
+static int bit_width(uint32_t x) {
+    return x ? 32 - __builtin_clz(x) : 0;
+}
+
+// Pack RAG_LEXICAL_BLOCK values of w bits into 4 * w words
+static void pack_block(const uint32_t *in, int w, uint32_t *out) {
+    memset(out, 0, 4 * w * sizeof(uint32_t));
+    for (int i = 0; i < RAG_LEXICAL_BLOCK; i++) {
+        size_t bit = (size_t)(i / 4) * w;
+        int lane = i % 4, shift = bit % 32;
+        out[bit / 32 * 4 + lane] |= in[i] << shift;
+        if (shift + w > 32) out[(bit / 32 + 1) * 4 + lane] |= in[i] >> (32 - shift);
+    }
+}
+
+static void unpack_block(const uint32_t *in, int w, uint32_t *out) {
+    if (w == 0) {
+        memset(out, 0, RAG_LEXICAL_BLOCK * sizeof(uint32_t));
+        return;
+    }
+#ifdef __SSE2__
+    // All four lanes sit at the same bit offset, so one shift serves four values
+    const __m128i mask = _mm_set1_epi32(w == 32 ? -1 : (int)((1u << w) - 1));
+    const __m128i *src = (const __m128i *)in;
+    __m128i cur = _mm_loadu_si128(src++);
+    int shift = 0;
+    for (int i = 0; i < RAG_LEXICAL_BLOCK / 4; i++) {
+        __m128i v = _mm_srl_epi32(cur, _mm_cvtsi32_si128(shift));
+        shift += w;
+        if (shift > 32) {
+            // The value straddles two words
+            cur = _mm_loadu_si128(src++);
+            shift -= 32;
+            v = _mm_or_si128(v, _mm_sll_epi32(cur, _mm_cvtsi32_si128(w - shift)));
+        } else if (shift == 32 && i + 1 < RAG_LEXICAL_BLOCK / 4) {
+            cur = _mm_loadu_si128(src++);
+            shift = 0;
+        }
+        _mm_storeu_si128((__m128i *)(out + 4 * i), _mm_and_si128(v, mask));
+    }
+#else
+    uint32_t mask = w == 32 ? ~0u : (1u << w) - 1;
+    for (int i = 0; i < RAG_LEXICAL_BLOCK; i++) {
+        size_t bit = (size_t)(i / 4) * w;
+        int lane = i % 4, shift = bit % 32;
+        uint32_t v = in[bit / 32 * 4 + lane] >> shift;
+        if (shift + w > 32) v |= in[(bit / 32 + 1) * 4 + lane] << (32 - shift);
+        out[i] = v & mask;
+    }
+#endif
+}
+
+// Variable-byte code: 7 bits a byte, low first, high bit set on all but the last
+static size_t put_varint(uint8_t *out, uint32_t v) {
+    size_t len = 0;
+    for (; v >= 0x80; v >>= 7) {
+        if (out) out[len] = (uint8_t)(v | 0x80);
+        len++;
+    }
+    if (out) out[len] = (uint8_t)v;
+    return len + 1;
+}
+
+static const uint8_t *get_varint(const uint8_t *in, uint32_t *v) {
+    uint32_t x = 0;
+    int shift = 0;
+    while (*in & 0x80) {
+        x |= (uint32_t)(*in++ & 0x7f) << shift;
+        shift += 7;
+    }
+    *v = x | (uint32_t)*in++ << shift;
+    return in;
+}
+
+// Pack a term's postings into out and return the words taken; with out
+// NULL, only count them
+static size_t pack_term(const struct triple *p, size_t df, uint32_t *out) {
+    uint32_t gaps[RAG_LEXICAL_BLOCK], tfs[RAG_LEXICAL_BLOCK];
+    uint32_t prev = 0;
+    size_t words = 0;
+    size_t b = 0;
+    for (; df - b >= RAG_LEXICAL_BLOCK; b += RAG_LEXICAL_BLOCK) {
+        uint32_t max_gap = 0, max_tf = 0;
+        for (size_t j = b; j < b + RAG_LEXICAL_BLOCK; j++) {
+            gaps[j - b] = p[j].doc - prev;
+            tfs[j - b] = p[j].tf - 1;
+            if (gaps[j - b] > max_gap) max_gap = gaps[j - b];
+            if (tfs[j - b] > max_tf) max_tf = tfs[j - b];
+            prev = p[j].doc;
+        }
+        int wg = bit_width(max_gap), wt = bit_width(max_tf);
+        if (out) {
+            out[words] = wg | wt << 8;
+            pack_block(gaps, wg, out + words + 1);
+            pack_block(tfs, wt, out + words + 1 + 4 * wg);
+        }
+        words += 1 + 4 * (wg + wt);
+    }
+
+    // The short last block, padded to a word
+    uint8_t *tail = out ? (uint8_t *)(out + words) : NULL;
+    size_t bytes = 0;
+    for (; b < df; b++) {
+        bytes += put_varint(tail ? tail + bytes : NULL, p[b].doc - prev);
+        bytes += put_varint(tail ? tail + bytes : NULL, p[b].tf - 1);
+        prev = p[b].doc;
+    }
+    if (tail) memset(tail + bytes, 0, (bytes + 3) / 4 * 4 - bytes);
+    return words + (bytes + 3) / 4;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+struct rag_lexical* rag_lexical_build(rag_text_fn text, void *ctx, size_t n) {
+    struct rag_lexical *ix = calloc(1, sizeof(*ix));
+    uint32_t *doc_terms = NULL, *lengths = NULL;
+    struct triple *triples = NULL, *sorted = NULL;
+    size_t num_triples = 0, max_triples = 0, max_doc_terms = 0;
+    size_t *starts = NULL;
+    int ok = 0;
+    if (!ix) return NULL;
+    ix->n = n;
+    ix->num_slots = DICT_MIN_SLOTS;
+    ix->slots = calloc(ix->num_slots, sizeof(uint32_t));
+    ix->norm = malloc((n ? n : 1) * sizeof(float));
+    lengths = calloc(n ? n : 1, sizeof(uint32_t));
+    if (!ix->slots || !ix->norm || !lengths) goto out;
+
+    // Tokenize: each document's term ids, sorted, become (term, doc, tf)
+    char term[TERM_MAX];
+    uint64_t total_length = 0;
+    for (size_t i = 0; i < n; i++) {
+        const char *p = text(ctx, i);
+        size_t count = 0;
+        while (p && next_term(&p, term)) {
+            long t = dict_add(ix, term);
+            if (t < 0) goto out;
+            if (count == max_doc_terms) {
+                max_doc_terms = max_doc_terms ? 2 * max_doc_terms : 256;
+                uint32_t *grown = realloc(doc_terms, max_doc_terms * sizeof(uint32_t));
+                if (!grown) goto out;
+                doc_terms = grown;
+            }
+            doc_terms[count++] = t;
+        }
+        lengths[i] = count;
+        total_length += count;
+        qsort(doc_terms, count, sizeof(uint32_t), compare_u32);
+        for (size_t j = 0; j < count;) {
+            size_t run = j;
+            while (run < count && doc_terms[run] == doc_terms[j]) run++;
+            if (num_triples == max_triples) {
+                max_triples = max_triples ? 2 * max_triples : 4096;
+                struct triple *grown = realloc(triples, max_triples * sizeof(*triples));
+                if (!grown) goto out;
+                triples = grown;
+            }
+            triples[num_triples++] = (struct triple) { doc_terms[j], i, run - j };
+            ix->terms[doc_terms[j]].df++;
+            j = run;
+        }
+    }
+    ix->postings = num_triples;
+    ix->avg_length = n ? total_length / (double)n : 0;
+    for (size_t i = 0; i < n; i++) {
+        ix->norm[i] = BM25_K1 * (1 - BM25_B + BM25_B * (ix->avg_length > 0 ? lengths[i] / ix->avg_length : 0));
+    }
+
+    // Group by term; documents stay in order within a term
+    starts = malloc((ix->num_terms + 1) * sizeof(size_t));
+    sorted = malloc((num_triples ? num_triples : 1) * sizeof(*sorted));
+    if (!starts || !sorted) goto out;
+    starts[0] = 0;
+    for (uint32_t t = 0; t < ix->num_terms; t++) starts[t + 1] = starts[t] + ix->terms[t].df;
+    for (size_t j = 0; j < num_triples; j++) sorted[starts[triples[j].term]++] = triples[j];
+    free(triples);
+    triples = NULL;
+
+    // Pack every term's postings into one array
+    size_t offset = 0;
+    for (uint32_t t = 0, first = 0; t < ix->num_terms; first += ix->terms[t++].df) {
+        struct term_info *ti = &ix->terms[t];
+        ti->offset = offset;
+        ti->idf = logf(1 + (n - ti->df + 0.5f) / (ti->df + 0.5f));
+        offset += pack_term(sorted + first, ti->df, NULL);
+    }
+    ix->num_packed = offset;
+    ix->packed = malloc((offset ? offset : 1) * sizeof(uint32_t));
+    if (!ix->packed) goto out;
+    for (uint32_t t = 0, first = 0; t < ix->num_terms; first += ix->terms[t++].df) {
+        pack_term(sorted + first, ix->terms[t].df, ix->packed + ix->terms[t].offset);
+    }
+    ok = 1;
+
+out:
+    free(doc_terms);
+    free(lengths);
+    free(triples);
+    free(sorted);
+    free(starts);
+    if (!ok) {
+        fprintf(stderr, "Failed to build the lexical index\n");
+        rag_lexical_destroy(ix);
+        return NULL;
+    }
+    return ix;
+}
+
+void rag_lexical_destroy(struct rag_lexical *ix) {
+    if (!ix) return;
+    free(ix->names);
+    free(ix->terms);
+    free(ix->slots);
+    free(ix->packed);
+    free(ix->norm);
+    free(ix);
+}
+
+struct rag_lexical_scratch* rag_lexical_scratch_create(const struct rag_lexical *ix) {
+    struct rag_lexical_scratch *s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    size_t n = ix->n ? ix->n : 1;
+    s->acc = malloc(n * sizeof(float));
+    s->mark = calloc(n, sizeof(uint32_t));
+    s->touched = malloc(n * sizeof(uint32_t));
+    if (!s->acc || !s->mark || !s->touched) {
+        rag_lexical_scratch_destroy(s);
+        return NULL;
+    }
+    return s;
+}
+
+void rag_lexical_scratch_destroy(struct rag_lexical_scratch *s) {
+    if (!s) return;
+    free(s->acc);
+    free(s->mark);
+    free(s->touched);
+    free(s);
+}
+
+int rag_lexical_search(const struct rag_lexical *ix, struct rag_lexical_scratch *s,
+                       const char *query, int k, const uint64_t *allowed,
+                       float *scores, int *ids) {
+    // Distinct query terms the index knows
+    uint32_t terms[RAG_LEXICAL_MAX_TERMS];
+    int num_terms = 0;
+    char term[TERM_MAX];
+    while (num_terms < RAG_LEXICAL_MAX_TERMS && next_term(&query, term)) {
+        uint32_t t = dict_find(ix, term);
+        int seen = 0;
+        for (int i = 0; i < num_terms && t; i++) seen |= terms[i] == t - 1;
+        if (t && !seen) terms[num_terms++] = t - 1;
+    }
+
+    if (++s->epoch == 0) {
+        memset(s->mark, 0, ix->n * sizeof(uint32_t));
+        s->epoch = 1;
+    }
+    size_t touched = 0;
+    uint32_t gaps[RAG_LEXICAL_BLOCK], tfs[RAG_LEXICAL_BLOCK];
+    for (int q = 0; q < num_terms; q++) {
+        const struct term_info *ti = &ix->terms[terms[q]];
+        const uint32_t *in = ix->packed + ti->offset;
+        uint32_t doc = 0;
+        for (size_t done = 0; done < ti->df; done += RAG_LEXICAL_BLOCK) {
+            int len = RAG_LEXICAL_BLOCK;
+            if (ti->df - done >= RAG_LEXICAL_BLOCK) {
+                int wg = in[0] & 0xff, wt = in[0] >> 8;
+                unpack_block(in + 1, wg, gaps);
+                unpack_block(in + 1 + 4 * wg, wt, tfs);
+                in += 1 + 4 * (wg + wt);
+            } else {
+                len = ti->df - done;
+                const uint8_t *tail = (const uint8_t *)in;
+                for (int j = 0; j < len; j++) {
+                    tail = get_varint(tail, &gaps[j]);
+                    tail = get_varint(tail, &tfs[j]);
+                }
+            }
+            for (int j = 0; j < len; j++) {
+                doc += gaps[j];
+                if (allowed && !((allowed[doc / 64] >> (doc % 64)) & 1)) continue;
+                float tf = tfs[j] + 1.0f;
+                if (s->mark[doc] != s->epoch) {
+                    s->mark[doc] = s->epoch;
+                    s->acc[doc] = 0;
+                    s->touched[touched++] = doc;
+                }
+                s->acc[doc] += ti->idf * tf * (BM25_K1 + 1) / (tf + ix->norm[doc]);
+            }
+        }
+    }
+
+    struct rag_topk topk;
+    rag_topk_init(&topk, k, scores, ids);
+    for (size_t i = 0; i < touched; i++) {
+        rag_topk_push(&topk, s->acc[s->touched[i]], s->touched[i]);
+    }
+    return rag_topk_finish(&topk);
+}
+
+void rag_lexical_stats(const struct rag_lexical *ix, struct rag_lexical_stats *stats) {
+    stats->docs = ix->n;
+    stats->terms = ix->num_terms;
+    stats->postings = ix->postings;
+    stats->posting_bytes = ix->num_packed * sizeof(uint32_t);
+    stats->bytes = stats->posting_bytes + ix->names_size + ix->num_terms * sizeof(struct term_info) +
+                   ix->num_slots * sizeof(uint32_t) + ix->n * sizeof(float);
+    stats->avg_length = ix->avg_length;
+}
+
+struct fused {
+    int id;
+    float score;
+};
+
+static int compare_fused_id(const void *a, const void *b) {
+    int x = ((const struct fused *)a)->id, y = ((const struct fused *)b)->id;
+    return x < y ? -1 : x > y;
+}
+
+int rag_rrf_fuse(const int *const *lists, const int *counts, int num_lists, int k,
+                 float *scores, int *ids) {
+    size_t total = 0;
+    for (int l = 0; l < num_lists; l++) total += counts[l];
+    struct fused *all = malloc((total ? total : 1) * sizeof(*all));
+    if (!all) return 0;
+
+    size_t m = 0;
+    for (int l = 0; l < num_lists; l++) {
+        for (int r = 0; r < counts[l]; r++) {
+            if (lists[l][r] >= 0) all[m++] = (struct fused) { lists[l][r], 1.0f / (RAG_RRF_K + r + 1) };
+        }
+    }
+    qsort(all, m, sizeof(*all), compare_fused_id);
+
+    struct rag_topk topk;
+    rag_topk_init(&topk, k, scores, ids);
+    for (size_t i = 0; i < m;) {
+        size_t j = i;
+        float sum = 0;
+        for (; j < m && all[j].id == all[i].id; j++) sum += all[j].score;
+        rag_topk_push(&topk, sum, all[i].id);
+        i = j;
+    }
+    free(all);
+    return rag_topk_finish(&topk);
+}
+
+// ---------------------------------------------------------------------------
+// Self-test
+// ---------------------------------------------------------------------------
+
+#define TEST_DOCS 600
+#define TEST_VOCAB 40
+
+static int check(const char *name, int ok) {
+    printf("  %-34s %s\n", name, ok ? "ok" : "FAIL");
+    return !ok;
+}
+
+static char test_text[TEST_DOCS][160];
+
+static const char *test_doc(void *ctx, size_t i) {
+    (void)ctx;
+    return test_text[i];
+}
+
+// Words w0..w39, skewed so the first few appear in most documents and
+// span several posting blocks
+static void make_corpus(unsigned int seed) {
+    for (int i = 0; i < TEST_DOCS; i++) {
+        int len = 0, words = 1 + rand_r(&seed) % 14;
+        for (int w = 0; w < words; w++) {
+            int r = rand_r(&seed) % TEST_VOCAB;
+            int word = r * r / TEST_VOCAB;
+            len += snprintf(test_text[i] + len, sizeof(test_text[i]) - len, "%sW%d", w ? ", " : "", word);
+        }
+    }
+}
+
+// Occurrences of word in document i
+static int count_word(int i, const char *word) {
+    int n = 0;
+    const char *p = test_text[i];
+    char term[TERM_MAX];
+    while (next_term(&p, term)) n += strcmp(term, word) == 0;
+    return n;
+}
+
+static int doc_length(int i) {
+    int n = 0;
+    const char *p = test_text[i];
+    char term[TERM_MAX];
+    while (next_term(&p, term)) n++;
+    return n;
+}
+
+// BM25 straight from the definition
+static void reference_scores(const char words[][TERM_MAX], int num_words, const uint64_t *allowed, float *ref) {
+    double avg = 0;
+    for (int i = 0; i < TEST_DOCS; i++) avg += doc_length(i);
+    avg /= TEST_DOCS;
+    for (int i = 0; i < TEST_DOCS; i++) ref[i] = 0;
+    for (int w = 0; w < num_words; w++) {
+        int df = 0;
+        for (int i = 0; i < TEST_DOCS; i++) df += count_word(i, words[w]) > 0;
+        double idf = log(1 + (TEST_DOCS - df + 0.5) / (df + 0.5));
+        for (int i = 0; i < TEST_DOCS; i++) {
+            int tf = count_word(i, words[w]);
+            if (!tf || (allowed && !((allowed[i / 64] >> (i % 64)) & 1))) continue;
+            ref[i] += idf * tf * (BM25_K1 + 1) / (tf + BM25_K1 * (1 - BM25_B + BM25_B * doc_length(i) / avg));
+        }
+    }
+}
+
+int rag_lexical_self_test(void) {
+    int failures = 0;
+    unsigned int seed = 0x1e71ca1u;
+    printf("Lexical index self-test:\n");
+
+    // Every width round-trips through the packed layout
+    uint32_t values[RAG_LEXICAL_BLOCK], packed[4 * 32 + 4], out[RAG_LEXICAL_BLOCK];
+    int ok = 1;
+    for (int w = 0; w <= 32; w++) {
+        for (int i = 0; i < RAG_LEXICAL_BLOCK; i++) {
+            uint32_t v = (uint32_t)rand_r(&seed) << 16 ^ rand_r(&seed);
+            values[i] = w == 32 ? v : v & ((1u << w) - 1);
+        }
+        pack_block(values, w, packed);
+        unpack_block(packed, w, out);
+        ok &= memcmp(values, out, sizeof(values)) == 0;
+    }
+    failures += check("bit packing, widths 0-32", ok);
+
+    make_corpus(seed);
+    struct rag_lexical *ix = rag_lexical_build(test_doc, NULL, TEST_DOCS);
+    struct rag_lexical_scratch *s = ix ? rag_lexical_scratch_create(ix) : NULL;
+    if (!s) {
+        rag_lexical_destroy(ix);
+        return failures + 1;
+    }
+    struct rag_lexical_stats stats;
+    rag_lexical_stats(ix, &stats);
+    size_t postings = 0;
+    for (int i = 0; i < TEST_DOCS; i++) {
+        for (int w = 0; w < TEST_VOCAB; w++) {
+            char word[8];
+            snprintf(word, sizeof(word), "w%d", w);
+            postings += count_word(i, word) > 0;
+        }
+    }
+    failures += check("dictionary and postings", stats.postings == postings && stats.terms <= TEST_VOCAB);
+
+    // Scores against the definition, with and without an id filter
+    static const char *queries[] = { "w0", "W3 w17", "w1, w1 w25 unknown", "w39 w38 w2" };
+    uint64_t even[TEST_DOCS / 64 + 1];
+    for (size_t i = 0; i < sizeof(even) / sizeof(even[0]); i++) even[i] = 0x5555555555555555ULL;
+    float ref[TEST_DOCS], scores[TEST_DOCS];
+    int ids[TEST_DOCS];
+    for (int filtered = 0; filtered < 2; filtered++) {
+        ok = 1;
+        for (size_t q = 0; q < sizeof(queries) / sizeof(queries[0]); q++) {
+            char words[RAG_LEXICAL_MAX_TERMS][TERM_MAX];
+            int num_words = 0;
+            const char *p = queries[q];
+            char term[TERM_MAX];
+            while (next_term(&p, term)) {
+                int dup = 0;
+                for (int w = 0; w < num_words; w++) dup |= strcmp(words[w], term) == 0;
+                if (!dup) strcpy(words[num_words++], term);
+            }
+            const uint64_t *allowed = filtered ? even : NULL;
+            reference_scores((const char (*)[TERM_MAX])words, num_words, allowed, ref);
+            int count = rag_lexical_search(ix, s, queries[q], 20, allowed, scores, ids);
+            int matching = 0;
+            float best_missed = 0;
+            for (int i = 0; i < TEST_DOCS; i++) matching += ref[i] > 0;
+            ok &= count == (matching < 20 ? matching : 20);
+            for (int i = 0; i < count; i++) {
+                ok &= fabsf(ref[ids[i]] - scores[i]) < 1e-4f * (1 + ref[ids[i]]);
+                ok &= !filtered || ids[i] % 2 == 0;
+                ok &= i == 0 || scores[i] <= scores[i - 1];
+                ref[ids[i]] = 0;
+            }
+            for (int i = 0; i < TEST_DOCS; i++) {
+                if (ref[i] > best_missed) best_missed = ref[i];
+            }
+            ok &= count == 0 || best_missed <= scores[count - 1] + 1e-4f;
+        }
+        failures += check(filtered ? "BM25 top-20, even ids only" : "BM25 top-20 vs. definition", ok);
+    }
+    rag_lexical_scratch_destroy(s);
+    rag_lexical_destroy(ix);
+
+    // 3 ranks high in both lists, so it beats 1, which leads only one
+    const int a[] = { 1, 3, 5 }, b[] = { 3, 4, -1 };
+    const int *lists[] = { a, b };
+    const int counts[] = { 3, 3 };
+    int count = rag_rrf_fuse(lists, counts, 2, 10, scores, ids);
+    ok = count == 4 && ids[0] == 3 && ids[1] == 1 &&
+         fabsf(scores[0] - (1.0f / 62 + 1.0f / 61)) < 1e-6f;
+    failures += check("reciprocal rank fusion", ok);
+    return failures;
+}
@@ -0,0 +1,62 @@
+#ifndef RAG_LEXICAL_H
+#define RAG_LEXICAL_H
+
+// Lexical retrieval for hybrid search: a BM25 inverted index over each
+// vector's text (its metadata), and reciprocal rank fusion to merge a
+// lexical and a vector ranking. Terms are lower-cased runs of ASCII
+// letters and digits. A term's postings (ascending ids and their term
+// frequencies) are stored as id gaps in blocks of RAG_LEXICAL_BLOCK,
+// bit-packed at each block's widest value in the 4-lane layout that
+// SSE2 unpacks 4 values per instruction; a short last block is
+// variable-byte coded.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RAG_LEXICAL_BLOCK 128
+#define RAG_LEXICAL_MAX_TERMS 32    // Query terms scored; the rest are ignored
+#define RAG_RRF_K 60                // Rank offset from the original RRF paper
+
+struct rag_lexical;
+
+// Per-thread score accumulators
+struct rag_lexical_scratch;
+
+// Same shape as rag_db_metadata_fn: text(ctx, i) is document i's text
+typedef const char *(*rag_text_fn)(void *ctx, size_t i);
+
+struct rag_lexical* rag_lexical_build(rag_text_fn text, void *ctx, size_t n);
+void rag_lexical_destroy(struct rag_lexical *ix);
+
+struct rag_lexical_scratch* rag_lexical_scratch_create(const struct rag_lexical *ix);
+void rag_lexical_scratch_destroy(struct rag_lexical_scratch *s);
+
+// Best k documents for the query text by BM25 (k1 = 1.2, b = 0.75),
+// best-first. With allowed (one bit per id), other ids are not scored.
+// Returns the count written.
+int rag_lexical_search(const struct rag_lexical *ix, struct rag_lexical_scratch *s,
+                       const char *query, int k, const uint64_t *allowed,
+                       float *scores, int *ids);
+
+struct rag_lexical_stats {
+    size_t docs;
+    size_t terms;
+    size_t postings;
+    size_t bytes;                   // Postings, dictionary and document lengths
+    size_t posting_bytes;           // Packed postings alone
+    double avg_length;              // Terms per document
+};
+
+void rag_lexical_stats(const struct rag_lexical *ix, struct rag_lexical_stats *stats);
+
+// Reciprocal rank fusion: an id scores the sum of 1 / (RAG_RRF_K + rank)
+// over the lists it appears in, ranks counting from 1. Writes the best k
+// best-first and returns the count.
+int rag_rrf_fuse(const int *const *lists, const int *counts, int num_lists, int k,
+                 float *scores, int *ids);
+
+// Packing round trips, BM25 against a direct computation and fusion;
+// returns the number of failures
+int rag_lexical_self_test(void);
+
+#endif // RAG_LEXICAL_H
@@ -0,0 +1,235 @@
+/**
+ * RAG Worker Pool
+ * Fork-join over a fixed set of pinned threads. A job is published by
+ * bumping a generation counter; the caller runs worker 0 itself and
+ * waits for the rest, so a query costs one wake-up, not thread creation.
+ * The caller is pinned to worker 0's CPU only for the length of a run:
+ * threads it starts between runs (service, compactor, benchmark clients)
+ * keep its own affinity mask.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include "rag_pool.h"
+
+struct rag_worker {
+    int index;
+    int cpu;
+    pthread_t thread;
+    struct rag_pool *pool;
+};
+
+struct rag_pool {
+    int size;
+    struct rag_worker *workers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned long generation;
+    int pending;
+    int shutdown;
+
+    rag_task_fn fn;
+    void *arg;
+};
+
+static void pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void* worker_thread(void *arg) {
+    struct rag_worker *worker = arg;
+    struct rag_pool *pool = worker->pool;
+    unsigned long seen = 0;
+
+    if (worker->cpu >= 0) {
+        pin_to_cpu(worker->cpu);
+    }
+
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->shutdown) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->shutdown) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        seen = pool->generation;
+        rag_task_fn fn = pool->fn;
+        void *fn_arg = pool->arg;
+        pthread_mutex_unlock(&pool->lock);
+
+        fn(fn_arg, worker->index, pool->size);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+struct rag_pool* rag_pool_create(int num_threads, int pin) {
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE];
+    int num_cpus = 0;
+
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int c = 0; c < CPU_SETSIZE; c++) {
+            if (CPU_ISSET(c, &allowed)) cpus[num_cpus++] = c;
+        }
+    }
+    if (num_threads <= 0) {
+        num_threads = num_cpus > 0 ? num_cpus : 1;
+    }
+
+    struct rag_pool *pool = calloc(1, sizeof(*pool));
+    if (!pool) return NULL;
+    pool->workers = calloc(num_threads, sizeof(struct rag_worker));
+    if (!pool->workers) {
+        free(pool);
+        return NULL;
+    }
+    pool->size = num_threads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (int i = 0; i < num_threads; i++) {
+        struct rag_worker *worker = &pool->workers[i];
+        worker->index = i;
+        worker->pool = pool;
+        worker->cpu = (pin && num_cpus > 0) ? cpus[i % num_cpus] : -1;
+    }
+
+    // Worker 0 is whoever calls rag_pool_run()
+    for (int i = 1; i < num_threads; i++) {
+        if (pthread_create(&pool->workers[i].thread, NULL, worker_thread, &pool->workers[i]) != 0) {
+            fprintf(stderr, "Failed to create search worker %d\n", i);
+            pool->size = i;
+            break;
+        }
+    }
+
+    return pool;
+}
+
+void rag_pool_run(struct rag_pool *pool, rag_task_fn fn, void *arg) {
+    // Run worker 0 on its CPU, then give the caller its own mask back
+    cpu_set_t saved;
+    int cpu = pool->workers[0].cpu, restore = 0;
+    if (cpu >= 0 && pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved) == 0 &&
+        !(CPU_COUNT(&saved) == 1 && CPU_ISSET(cpu, &saved))) {
+        pin_to_cpu(cpu);
+        restore = 1;
+    }
+
+    if (pool->size > 1) {
+        pthread_mutex_lock(&pool->lock);
+        pool->fn = fn;
+        pool->arg = arg;
+        pool->pending = pool->size - 1;
+        pool->generation++;
+        pthread_cond_broadcast(&pool->start);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    fn(arg, 0, pool->size);
+
+    if (pool->size > 1) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->pending > 0) {
+            pthread_cond_wait(&pool->done, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    if (restore) {
+        pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+    }
+}
+
+int rag_pool_size(const struct rag_pool *pool) {
+    return pool->size;
+}
+
+void rag_pool_destroy(struct rag_pool *pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 1; i < pool->size; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool);
+}
+
+// Self-test
+
+struct affinity_probe {
+    cpu_set_t seen;                 // Worker 0's mask during a run
+    int cpu;                        // ... and where it ran
+};
+
+static void probe_task(void *arg, int worker, int num_workers) {
+    struct affinity_probe *probe = arg;
+    (void)num_workers;
+    if (worker != 0) return;
+    pthread_getaffinity_np(pthread_self(), sizeof(probe->seen), &probe->seen);
+    probe->cpu = sched_getcpu();
+}
+
+int rag_pool_self_test(void) {
+    cpu_set_t before, after;
+    struct affinity_probe probe;
+    int failures = 0;
+
+    printf("Worker pool self-test:\n");
+    if (pthread_getaffinity_np(pthread_self(), sizeof(before), &before) != 0) {
+        printf("  affinity not readable, skipped\n");
+        return 0;
+    }
+    struct rag_pool *pool = rag_pool_create(2, 1);
+    if (!pool) {
+        fprintf(stderr, "Self-test setup failed\n");
+        return 1;
+    }
+
+    // Creating a pinned pool leaves the caller's mask alone
+    int bad = pthread_getaffinity_np(pthread_self(), sizeof(after), &after) != 0 ||
+              !CPU_EQUAL(&before, &after);
+    printf("  caller mask kept by create %s\n", bad ? "FAIL" : "ok");
+    failures += bad;
+
+    // A run puts worker 0 on its CPU, then restores the mask
+    memset(&probe, 0, sizeof(probe));
+    probe.cpu = -1;
+    rag_pool_run(pool, probe_task, &probe);
+    bad = CPU_COUNT(&probe.seen) != 1 || !CPU_ISSET(pool->workers[0].cpu, &probe.seen) ||
+          probe.cpu != pool->workers[0].cpu ||
+          pthread_getaffinity_np(pthread_self(), sizeof(after), &after) != 0 || !CPU_EQUAL(&before, &after);
+    printf("  worker 0 pinned for the run only %s\n", bad ? "FAIL" : "ok");
+    failures += bad;
+
+    rag_pool_destroy(pool);
+    return failures;
+}
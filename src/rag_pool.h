@@ -0,0 +1,35 @@
+#ifndef RAG_POOL_H
+#define RAG_POOL_H
+
+// Persistent fork-join worker pool for the RAG vector server. Workers
+// are created once and pinned one per CPU, so a shard touched first by
+// worker i stays on worker i's NUMA node for the life of the process.
+
+#include <stddef.h>
+
+struct rag_pool;
+
+// fn runs once on every worker; the calling thread acts as worker 0
+typedef void (*rag_task_fn)(void *arg, int worker, int num_workers);
+
+// num_threads <= 0 uses every CPU in the process affinity mask
+struct rag_pool* rag_pool_create(int num_threads, int pin);
+void rag_pool_destroy(struct rag_pool *pool);
+
+// Run fn on all workers and wait for every one to return. With pinning,
+// the caller runs worker 0 on its CPU and gets its own mask back after.
+void rag_pool_run(struct rag_pool *pool, rag_task_fn fn, void *arg);
+int rag_pool_size(const struct rag_pool *pool);
+
+// Contiguous share [*begin, *end) of n items for one worker
+static inline void rag_pool_range(size_t n, int worker, int num_workers,
+                                  size_t *begin, size_t *end) {
+    *begin = n * worker / num_workers;
+    *end = n * (worker + 1) / num_workers;
+}
+
+// Pinning leaves callers' affinity as it was; returns the number of
+// failures
+int rag_pool_self_test(void);
+
+#endif // RAG_POOL_H
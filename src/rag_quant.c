@@ -0,0 +1,1020 @@
+/**
+ * RAG Quantized Storage
+ *
+ * int8: each vector is scaled by its largest magnitude to [-127, 127].
+ * A query is quantized the same way, so a score is
+ * scale_q * scale_v * sum(q_i * v_i) over int8 codes with an int32
+ * accumulator. VNNI's vpdpbusd multiplies unsigned by signed bytes. The
+ * query is therefore offset to q + 128, and 128 * sum(v) (stored per
+ * vector) is subtracted afterwards. AVX2 widens to int16 and uses
+ * vpmaddwd, which cannot saturate.
+ *
+ * PQ: every dsub-wide slice of a vector is replaced by the id of its
+ * nearest of 256 centroids (k-means per subspace). For a query, an ADC
+ * table holds the dot product of each query slice with every centroid,
+ * and a vector's score is the sum of m table lookups. Codes are stored
+ * transposed in blocks of 16 vectors, so one 16-byte load yields the
+ * gather indices for 16 vectors.
+ *
+ * fp16 / bf16: vectors are rounded to nearest-even 16-bit floats and
+ * widened back in registers (vcvtph2ps for fp16, a 16-bit shift for
+ * bf16), so the scan reads half the bytes of the float store but still
+ * accumulates in float32 against the unrounded query.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "rag_quant.h"
+#include "rag_kernels.h"
+#include "rag_topk.h"
+#include "rag_pool.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RAG_X86 1
+#endif
+
+#define QUANT_SCAN_BLOCK 256
+#define PQ_KSUB 256
+#define PQ_BLOCK 16             // Vectors per transposed code block
+#define PQ_TRAIN_ITERS 8
+#define PQ_TRAIN_SAMPLE 10000
+#define PQ_SEED 0x9c0deu
+
+enum quant_kernel {
+    QUANT_SCALAR = 0,
+    QUANT_AVX2,
+    QUANT_AVX512,               // int8 additionally needs VNNI + BW
+};                              // AVX2 fp16 additionally needs F16C
+
+static const char *kernel_names[] = { "scalar", "avx2", "avx512" };
+
+struct rag_quant {
+    int type;
+    size_t n;
+    int dim;
+    int kernel;
+
+    // int8
+    int8_t *codes;              // n x dim
+    float *scales;              // Per vector: max |x| / 127
+    int32_t *sums;              // Per vector: sum of codes, for the VNNI offset
+
+    // PQ
+    int m, dsub;
+    float *centroids;           // m x 256 x dsub
+    uint8_t *pq_codes;          // ceil(n / 16) blocks of m x 16
+
+    // fp16 / bf16
+    uint16_t *halves;           // n x dim
+};
+
+// Kernel selection follows the similarity kernel (so --kernel applies)
+
+static int pick_kernel(int type) {
+    int isa = rag_kernels_active();
+#ifdef RAG_X86
+    if (isa >= RAG_ISA_AVX512) {
+        if (type != RAG_QUANT_INT8) return QUANT_AVX512;
+        if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni")) {
+            return QUANT_AVX512;
+        }
+    }
+    if (isa >= RAG_ISA_AVX2 && (type != RAG_QUANT_FP16 || __builtin_cpu_supports("f16c"))) {
+        return QUANT_AVX2;
+    }
+#else
+    (void)isa;
+    (void)type;
+#endif
+    return QUANT_SCALAR;
+}
+
+// int8 dot products
+
+static int32_t dot_i8_scalar(const int8_t *a, const int8_t *b, int dim) {
+    int32_t sum = 0;
+    for (int i = 0; i < dim; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+#ifdef RAG_X86
+__attribute__((target("avx2")))
+static int32_t dot_i8_avx2(const int8_t *a, const int8_t *b, int dim) {
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    int i = 0;
+
+    for (; i + 32 <= dim; i += 32) {
+        __m256i a0 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(a + i)));
+        __m256i b0 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(b + i)));
+        __m256i a1 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(a + i + 16)));
+        __m256i b1 = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(b + i + 16)));
+        acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(a0, b0));
+        acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(a1, b1));
+    }
+
+    __m256i acc = _mm256_add_epi32(acc0, acc1);
+    __m128i half = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    half = _mm_hadd_epi32(half, half);
+    half = _mm_hadd_epi32(half, half);
+    int32_t sum = _mm_cvtsi128_si32(half);
+
+    for (; i < dim; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+// sum((a + 128) * b) for a already offset to unsigned
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static int32_t dot_u8i8_vnni(const uint8_t *a, const int8_t *b, int dim) {
+    __m512i acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512();
+    int i = 0;
+
+    for (; i + 128 <= dim; i += 128) {
+        acc0 = _mm512_dpbusd_epi32(acc0, _mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        acc1 = _mm512_dpbusd_epi32(acc1, _mm512_loadu_si512(a + i + 64), _mm512_loadu_si512(b + i + 64));
+    }
+    for (; i < dim; i += 64) {
+        __mmask64 mask = dim - i >= 64 ? ~0ULL : (1ULL << (dim - i)) - 1;
+        acc0 = _mm512_dpbusd_epi32(acc0, _mm512_maskz_loadu_epi8(mask, a + i),
+                                   _mm512_maskz_loadu_epi8(mask, b + i));
+    }
+    return _mm512_reduce_add_epi32(_mm512_add_epi32(acc0, acc1));
+}
+#endif
+
+// Quantize to [-127, 127]; returns the scale back to float units
+static float quantize_i8(const float *x, int dim, int8_t *out) {
+    float max = 0;
+    for (int i = 0; i < dim; i++) {
+        if (fabsf(x[i]) > max) max = fabsf(x[i]);
+    }
+    if (max == 0) {
+        memset(out, 0, dim);
+        return 0;
+    }
+    float inv = 127.0f / max;
+    for (int i = 0; i < dim; i++) {
+        out[i] = (int8_t)lrintf(x[i] * inv);
+    }
+    return max / 127.0f;
+}
+
+// Scores of vectors [begin, begin + len) against a quantized query
+static void int8_scores(const struct rag_quant *q, const int8_t *qs8, const uint8_t *qu8,
+                        float qscale, size_t begin, int len, float *out) {
+    int dim = q->dim;
+    for (int j = 0; j < len; j++) {
+        size_t i = begin + j;
+        const int8_t *v = q->codes + i * dim;
+        int32_t dot;
+#ifdef RAG_X86
+        if (q->kernel == QUANT_AVX512) {
+            dot = dot_u8i8_vnni(qu8, v, dim) - 128 * q->sums[i];
+        } else if (q->kernel == QUANT_AVX2) {
+            dot = dot_i8_avx2(qs8, v, dim);
+        } else
+#endif
+        {
+            (void)qu8;
+            dot = dot_i8_scalar(qs8, v, dim);
+        }
+        out[j] = qscale * q->scales[i] * dot;
+    }
+}
+
+// 16-bit floats. The scalar conversions are bit-exact with F16C
+// (round to nearest even, subnormals kept) so every kernel scores the
+// same stored values.
+
+static float half_to_float(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    int exp = (h >> 10) & 0x1F;
+    uint32_t mant = h & 0x3FF, bits;
+
+    if (exp == 0x1F) {
+        bits = sign | 0x7F800000 | (mant << 13);
+    } else if (exp == 0 && mant == 0) {
+        bits = sign;
+    } else {
+        if (exp == 0) {
+            // Subnormal: normalise into a float exponent
+            exp = 1;
+            while (!(mant & 0x400)) {
+                mant <<= 1;
+                exp--;
+            }
+            mant &= 0x3FF;
+        }
+        bits = sign | (uint32_t)(exp + 112) << 23 | mant << 13;
+    }
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static uint16_t float_to_half(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint16_t sign = (x >> 16) & 0x8000;
+    x &= 0x7FFFFFFF;
+
+    if (x > 0x7F800000) return sign | 0x7E00 | ((x >> 13) & 0x3FF);    // NaN stays NaN
+    if (x >= 0x477FF000) return sign | 0x7C00;     // Rounds past 65504
+    if (x < 0x38800000) {
+        // Half subnormal, in units of 2^-24
+        if (x <= 0x33000000) return sign;
+        int shift = 126 - (int)(x >> 23);
+        uint32_t m = (x & 0x7FFFFF) | 0x800000;
+        uint32_t r = m >> shift, rem = m & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (r & 1))) r++;
+        return sign | r;
+    }
+    uint32_t r = (x >> 13) - (112 << 10), rem = x & 0x1FFF;
+    if (rem > 0x1000 || (rem == 0x1000 && (r & 1))) r++;   // A carry bumps the exponent
+    return sign | r;
+}
+
+static float bf16_to_float(uint16_t b) {
+    uint32_t bits = (uint32_t)b << 16;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static uint16_t float_to_bf16(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    if ((x & 0x7FFFFFFF) > 0x7F800000) return (x >> 16) | 0x40;
+    x += 0x7FFF + ((x >> 16) & 1);
+    return x >> 16;
+}
+
+static float dot_f16_scalar(const float *q, const uint16_t *v, int dim) {
+    float sum = 0;
+    for (int i = 0; i < dim; i++) sum += q[i] * half_to_float(v[i]);
+    return sum;
+}
+
+static float dot_bf16_scalar(const float *q, const uint16_t *v, int dim) {
+    float sum = 0;
+    for (int i = 0; i < dim; i++) sum += q[i] * bf16_to_float(v[i]);
+    return sum;
+}
+
+#ifdef RAG_X86
+__attribute__((target("avx2")))
+static inline __m256 bf16x8_avx2(const uint16_t *v) {
+    __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)v));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16));
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static float dot_f16_avx2(const float *q, const uint16_t *v, int dim) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    int i = 0;
+
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i),
+                               _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(v + i))), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i + 8),
+                               _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(v + i + 8))), acc1);
+    }
+
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    half = _mm_hadd_ps(half, half);
+    half = _mm_hadd_ps(half, half);
+    float sum = _mm_cvtss_f32(half);
+
+    for (; i < dim; i++) sum += q[i] * half_to_float(v[i]);
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static float dot_bf16_avx2(const float *q, const uint16_t *v, int dim) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    int i = 0;
+
+    for (; i + 16 <= dim; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i), bf16x8_avx2(v + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(q + i + 8), bf16x8_avx2(v + i + 8), acc1);
+    }
+
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    half = _mm_hadd_ps(half, half);
+    half = _mm_hadd_ps(half, half);
+    float sum = _mm_cvtss_f32(half);
+
+    for (; i < dim; i++) sum += q[i] * bf16_to_float(v[i]);
+    return sum;
+}
+
+__attribute__((target("avx512f")))
+static float dot_f16_avx512(const float *q, const uint16_t *v, int dim) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    int i = 0;
+
+    for (; i + 32 <= dim; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i),
+                               _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(v + i))), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i + 16),
+                               _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(v + i + 16))), acc1);
+    }
+    float sum = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+
+    for (; i < dim; i++) sum += q[i] * half_to_float(v[i]);
+    return sum;
+}
+
+__attribute__((target("avx512f")))
+static float dot_bf16_avx512(const float *q, const uint16_t *v, int dim) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    int i = 0;
+
+    for (; i + 32 <= dim; i += 32) {
+        __m512i lo = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(v + i)));
+        __m512i hi = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(v + i + 16)));
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i), _mm512_castsi512_ps(_mm512_slli_epi32(lo, 16)), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(q + i + 16), _mm512_castsi512_ps(_mm512_slli_epi32(hi, 16)), acc1);
+    }
+    float sum = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+
+    for (; i < dim; i++) sum += q[i] * bf16_to_float(v[i]);
+    return sum;
+}
+#endif
+
+static float dot_half(int type, int kernel, const float *q, const uint16_t *v, int dim) {
+#ifdef RAG_X86
+    if (kernel == QUANT_AVX512) {
+        return type == RAG_QUANT_FP16 ? dot_f16_avx512(q, v, dim) : dot_bf16_avx512(q, v, dim);
+    }
+    if (kernel == QUANT_AVX2) {
+        return type == RAG_QUANT_FP16 ? dot_f16_avx2(q, v, dim) : dot_bf16_avx2(q, v, dim);
+    }
+#endif
+    (void)kernel;
+    return type == RAG_QUANT_FP16 ? dot_f16_scalar(q, v, dim) : dot_bf16_scalar(q, v, dim);
+}
+
+// PQ ADC
+
+static void adc_block_scalar(const float *table, const uint8_t *block, int m, float *out) {
+    for (int v = 0; v < PQ_BLOCK; v++) {
+        float sum = 0;
+        for (int j = 0; j < m; j++) {
+            sum += table[j * PQ_KSUB + block[j * PQ_BLOCK + v]];
+        }
+        out[v] = sum;
+    }
+}
+
+#ifdef RAG_X86
+__attribute__((target("avx2")))
+static void adc_block_avx2(const float *table, const uint8_t *block, int m, float *out) {
+    __m256 lo = _mm256_setzero_ps(), hi = _mm256_setzero_ps();
+    for (int j = 0; j < m; j++) {
+        const float *t = table + j * PQ_KSUB;
+        __m128i codes = _mm_loadu_si128((const __m128i *)(block + j * PQ_BLOCK));
+        lo = _mm256_add_ps(lo, _mm256_i32gather_ps(t, _mm256_cvtepu8_epi32(codes), 4));
+        hi = _mm256_add_ps(hi, _mm256_i32gather_ps(t, _mm256_cvtepu8_epi32(_mm_srli_si128(codes, 8)), 4));
+    }
+    _mm256_storeu_ps(out, lo);
+    _mm256_storeu_ps(out + 8, hi);
+}
+
+__attribute__((target("avx512f")))
+static void adc_block_avx512(const float *table, const uint8_t *block, int m, float *out) {
+    __m512 acc = _mm512_setzero_ps();
+    for (int j = 0; j < m; j++) {
+        __m512i idx = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(block + j * PQ_BLOCK)));
+        acc = _mm512_add_ps(acc, _mm512_i32gather_ps(idx, table + j * PQ_KSUB, 4));
+    }
+    _mm512_storeu_ps(out, acc);
+}
+#endif
+
+static void adc_block(int kernel, const float *table, const uint8_t *block, int m, float *out) {
+#ifdef RAG_X86
+    if (kernel == QUANT_AVX512) {
+        adc_block_avx512(table, block, m, out);
+        return;
+    }
+    if (kernel == QUANT_AVX2) {
+        adc_block_avx2(table, block, m, out);
+        return;
+    }
+#endif
+    (void)kernel;
+    adc_block_scalar(table, block, m, out);
+}
+
+// Nearest of 256 centroids to a dsub-wide slice by
+// |c|^2 - 2 x.c. Centroids are passed transposed (dsub x 256) so lanes
+// run across centroids; norms holds each centroid's squared norm. Ties
+// go to the lowest index in every variant.
+static int nearest_scalar(const float *x, const float *transposed, const float *norms, int dsub) {
+    float dist[PQ_KSUB];
+    memcpy(dist, norms, sizeof(dist));
+    for (int d = 0; d < dsub; d++) {
+        float xd = -2.0f * x[d];
+        const float *row = transposed + d * PQ_KSUB;
+        for (int c = 0; c < PQ_KSUB; c++) dist[c] += xd * row[c];
+    }
+
+    int best = 0;
+    for (int c = 1; c < PQ_KSUB; c++) {
+        if (dist[c] < dist[best]) best = c;
+    }
+    return best;
+}
+
+#ifdef RAG_X86
+// Lowest index among lanes holding the minimum
+static int lowest_min_lane(const float *best, const int *idx, int lanes) {
+    int pick = 0;
+    for (int l = 1; l < lanes; l++) {
+        if (best[l] < best[pick] || (best[l] == best[pick] && idx[l] < idx[pick])) pick = l;
+    }
+    return idx[pick];
+}
+
+__attribute__((target("avx2,fma")))
+static int nearest_avx2(const float *x, const float *transposed, const float *norms, int dsub) {
+    __m256 best = _mm256_set1_ps(INFINITY);
+    __m256i best_idx = _mm256_setzero_si256();
+    __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    for (int c = 0; c < PQ_KSUB; c += 8) {
+        __m256 dist = _mm256_loadu_ps(norms + c);
+        for (int d = 0; d < dsub; d++) {
+            dist = _mm256_fmadd_ps(_mm256_set1_ps(-2.0f * x[d]),
+                                   _mm256_loadu_ps(transposed + d * PQ_KSUB + c), dist);
+        }
+        __m256 lt = _mm256_cmp_ps(dist, best, _CMP_LT_OQ);
+        best = _mm256_blendv_ps(best, dist, lt);
+        best_idx = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(best_idx),
+                                                        _mm256_castsi256_ps(idx), lt));
+        idx = _mm256_add_epi32(idx, _mm256_set1_epi32(8));
+    }
+
+    float lanes[8];
+    int lane_idx[8];
+    _mm256_storeu_ps(lanes, best);
+    _mm256_storeu_si256((__m256i *)lane_idx, best_idx);
+    return lowest_min_lane(lanes, lane_idx, 8);
+}
+
+__attribute__((target("avx512f")))
+static int nearest_avx512(const float *x, const float *transposed, const float *norms, int dsub) {
+    __m512 best = _mm512_set1_ps(INFINITY);
+    __m512i best_idx = _mm512_setzero_si512();
+    __m512i idx = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+    for (int c = 0; c < PQ_KSUB; c += 16) {
+        __m512 dist = _mm512_loadu_ps(norms + c);
+        for (int d = 0; d < dsub; d++) {
+            dist = _mm512_fmadd_ps(_mm512_set1_ps(-2.0f * x[d]),
+                                   _mm512_loadu_ps(transposed + d * PQ_KSUB + c), dist);
+        }
+        __mmask16 lt = _mm512_cmp_ps_mask(dist, best, _CMP_LT_OQ);
+        best = _mm512_mask_mov_ps(best, lt, dist);
+        best_idx = _mm512_mask_mov_epi32(best_idx, lt, idx);
+        idx = _mm512_add_epi32(idx, _mm512_set1_epi32(16));
+    }
+
+    float lanes[16];
+    int lane_idx[16];
+    _mm512_storeu_ps(lanes, best);
+    _mm512_storeu_si512(lane_idx, best_idx);
+    return lowest_min_lane(lanes, lane_idx, 16);
+}
+#endif
+
+static int nearest_centroid(int kernel, const float *x, const float *transposed,
+                            const float *norms, int dsub) {
+#ifdef RAG_X86
+    if (kernel == QUANT_AVX512) return nearest_avx512(x, transposed, norms, dsub);
+    if (kernel == QUANT_AVX2) return nearest_avx2(x, transposed, norms, dsub);
+#endif
+    (void)kernel;
+    return nearest_scalar(x, transposed, norms, dsub);
+}
+
+static void transpose_centroids(const float *centroids, int dsub, float *transposed, float *norms) {
+    for (int c = 0; c < PQ_KSUB; c++) {
+        float norm = 0;
+        for (int d = 0; d < dsub; d++) {
+            float v = centroids[c * dsub + d];
+            transposed[d * PQ_KSUB + c] = v;
+            norm += v * v;
+        }
+        norms[c] = norm;
+    }
+}
+
+struct pq_train_job {
+    struct rag_quant *q;
+    const float *vectors;
+    const int *sample;
+    size_t sample_n;
+    int failed;
+};
+
+// L2 k-means per subspace; subspaces are dealt round-robin to workers
+static void pq_train_task(void *arg, int worker, int num_workers) {
+    struct pq_train_job *job = arg;
+    struct rag_quant *q = job->q;
+    int dsub = q->dsub;
+    size_t sample_n = job->sample_n;
+
+    float *points = malloc(sample_n * dsub * sizeof(float));
+    float *sums = malloc(PQ_KSUB * dsub * sizeof(float));
+    float *transposed = malloc(PQ_KSUB * dsub * sizeof(float));
+    float norms[PQ_KSUB];
+    size_t counts[PQ_KSUB];
+    int *assign = malloc(sample_n * sizeof(int));
+    if (!points || !sums || !transposed || !assign) {
+        job->failed = 1;
+        goto out;
+    }
+
+    for (int j = worker; j < q->m; j += num_workers) {
+        float *centroids = q->centroids + (size_t)j * PQ_KSUB * dsub;
+        unsigned int seed = PQ_SEED + j;
+
+        for (size_t i = 0; i < sample_n; i++) {
+            memcpy(points + i * dsub, job->vectors + (size_t)job->sample[i] * q->dim + j * dsub,
+                   dsub * sizeof(float));
+        }
+        for (int c = 0; c < PQ_KSUB; c++) {
+            memcpy(centroids + c * dsub, points + (c % sample_n) * dsub, dsub * sizeof(float));
+        }
+
+        for (int iter = 0; iter < PQ_TRAIN_ITERS; iter++) {
+            transpose_centroids(centroids, dsub, transposed, norms);
+            for (size_t i = 0; i < sample_n; i++) {
+                assign[i] = nearest_centroid(q->kernel, points + i * dsub, transposed, norms, dsub);
+            }
+
+            memset(sums, 0, PQ_KSUB * dsub * sizeof(float));
+            memset(counts, 0, sizeof(counts));
+            for (size_t i = 0; i < sample_n; i++) {
+                for (int d = 0; d < dsub; d++) sums[assign[i] * dsub + d] += points[i * dsub + d];
+                counts[assign[i]]++;
+            }
+            for (int c = 0; c < PQ_KSUB; c++) {
+                if (counts[c] == 0) {
+                    // Reseed an empty centroid from a random training point
+                    memcpy(centroids + c * dsub, points + (rand_r(&seed) % sample_n) * dsub,
+                           dsub * sizeof(float));
+                    continue;
+                }
+                for (int d = 0; d < dsub; d++) centroids[c * dsub + d] = sums[c * dsub + d] / counts[c];
+            }
+        }
+    }
+
+out:
+    free(points);
+    free(sums);
+    free(transposed);
+    free(assign);
+}
+
+struct encode_job {
+    struct rag_quant *q;
+    const float *vectors;
+    int failed;
+};
+
+static void encode_task(void *arg, int worker, int num_workers) {
+    struct encode_job *job = arg;
+    struct rag_quant *q = job->q;
+    int dim = q->dim;
+
+    if (q->type == RAG_QUANT_INT8) {
+        size_t begin, end;
+        rag_pool_range(q->n, worker, num_workers, &begin, &end);
+        for (size_t i = begin; i < end; i++) {
+            int8_t *code = q->codes + i * dim;
+            q->scales[i] = quantize_i8(job->vectors + i * dim, dim, code);
+            int32_t sum = 0;
+            for (int d = 0; d < dim; d++) sum += code[d];
+            q->sums[i] = sum;
+        }
+        return;
+    }
+
+    if (q->type == RAG_QUANT_FP16 || q->type == RAG_QUANT_BF16) {
+        size_t begin, end;
+        rag_pool_range(q->n * dim, worker, num_workers, &begin, &end);
+        for (size_t i = begin; i < end; i++) {
+            q->halves[i] = q->type == RAG_QUANT_FP16 ? float_to_half(job->vectors[i])
+                                                     : float_to_bf16(job->vectors[i]);
+        }
+        return;
+    }
+
+    // PQ: whole 16-vector blocks per worker, so no block is shared
+    size_t nblocks = (q->n + PQ_BLOCK - 1) / PQ_BLOCK, begin, end;
+    rag_pool_range(nblocks, worker, num_workers, &begin, &end);
+    float *transposed = malloc((size_t)q->m * PQ_KSUB * q->dsub * sizeof(float));
+    float *norms = malloc((size_t)q->m * PQ_KSUB * sizeof(float));
+    if (!transposed || !norms) {
+        job->failed = 1;
+        free(transposed);
+        free(norms);
+        return;
+    }
+    for (int j = 0; j < q->m; j++) {
+        transpose_centroids(q->centroids + (size_t)j * PQ_KSUB * q->dsub, q->dsub,
+                            transposed + (size_t)j * PQ_KSUB * q->dsub, norms + j * PQ_KSUB);
+    }
+
+    for (size_t b = begin; b < end; b++) {
+        uint8_t *block = q->pq_codes + b * q->m * PQ_BLOCK;
+        for (int v = 0; v < PQ_BLOCK && b * PQ_BLOCK + v < q->n; v++) {
+            const float *x = job->vectors + (b * PQ_BLOCK + v) * dim;
+            for (int j = 0; j < q->m; j++) {
+                block[j * PQ_BLOCK + v] = nearest_centroid(q->kernel, x + j * q->dsub,
+                                                           transposed + (size_t)j * PQ_KSUB * q->dsub,
+                                                           norms + j * PQ_KSUB, q->dsub);
+            }
+        }
+    }
+    free(transposed);
+    free(norms);
+}
+
+static void run_task(struct rag_pool *pool, rag_task_fn fn, void *arg) {
+    if (pool && rag_pool_size(pool) > 1) {
+        rag_pool_run(pool, fn, arg);
+    } else {
+        fn(arg, 0, 1);
+    }
+}
+
+static int pq_train(struct rag_quant *q, const float *vectors, int train_sample, struct rag_pool *pool) {
+    size_t sample_n = train_sample > 0 ? (size_t)train_sample : PQ_TRAIN_SAMPLE;
+    if (sample_n > q->n) sample_n = q->n;
+
+    int *sample = malloc(q->n * sizeof(int));
+    if (!sample) return -1;
+    unsigned int seed = PQ_SEED;
+    for (size_t i = 0; i < q->n; i++) sample[i] = i;
+    for (size_t i = 0; i < sample_n; i++) {
+        size_t j = i + (size_t)rand_r(&seed) % (q->n - i);
+        int tmp = sample[i];
+        sample[i] = sample[j];
+        sample[j] = tmp;
+    }
+
+    struct pq_train_job job = { q, vectors, sample, sample_n, 0 };
+    run_task(pool, pq_train_task, &job);
+    free(sample);
+    return job.failed ? -1 : 0;
+}
+
+struct rag_quant* rag_quant_build(const float *vectors, size_t n, int dim,
+                                  const struct rag_quant_params *params, struct rag_pool *pool) {
+    struct rag_quant *q = calloc(1, sizeof(*q));
+    if (!q) return NULL;
+    q->type = params->type;
+    q->n = n;
+    q->dim = dim;
+    q->kernel = pick_kernel(q->type);
+
+    if (q->type == RAG_QUANT_INT8) {
+        if (posix_memalign((void **)&q->codes, 64, n * dim)) q->codes = NULL;
+        q->scales = malloc(n * sizeof(float));
+        q->sums = malloc(n * sizeof(int32_t));
+        if (!q->codes || !q->scales || !q->sums) {
+            fprintf(stderr, "Failed to allocate int8 codes for %zu vectors\n", n);
+            goto fail;
+        }
+    } else if (q->type == RAG_QUANT_PQ) {
+        q->m = params->pq_m > 0 ? params->pq_m : RAG_QUANT_DEFAULT_PQ_M;
+        if (dim % q->m != 0) {
+            fprintf(stderr, "PQ subspaces (%d) must divide the dimension (%d)\n", q->m, dim);
+            goto fail;
+        }
+        q->dsub = dim / q->m;
+        size_t nblocks = (n + PQ_BLOCK - 1) / PQ_BLOCK;
+        q->centroids = malloc((size_t)q->m * PQ_KSUB * q->dsub * sizeof(float));
+        q->pq_codes = calloc(nblocks * q->m, PQ_BLOCK);
+        if (!q->centroids || !q->pq_codes) {
+            fprintf(stderr, "Failed to allocate PQ codes for %zu vectors\n", n);
+            goto fail;
+        }
+        if (n == 0 || pq_train(q, vectors, params->train_sample, pool) < 0) {
+            fprintf(stderr, "PQ training failed\n");
+            goto fail;
+        }
+    } else if (q->type == RAG_QUANT_FP16 || q->type == RAG_QUANT_BF16) {
+        if (posix_memalign((void **)&q->halves, 64, n * dim * sizeof(uint16_t))) {
+            fprintf(stderr, "Failed to allocate %s storage for %zu vectors\n",
+                    rag_quant_type_name(q->type), n);
+            goto fail;
+        }
+    } else {
+        fprintf(stderr, "Unknown quantization type %d\n", q->type);
+        goto fail;
+    }
+
+    struct encode_job job = { q, vectors, 0 };
+    run_task(pool, encode_task, &job);
+    if (job.failed) {
+        fprintf(stderr, "Encoding failed\n");
+        goto fail;
+    }
+    return q;
+
+fail:
+    rag_quant_destroy(q);
+    return NULL;
+}
+
+void rag_quant_destroy(struct rag_quant *q) {
+    if (!q) return;
+    free(q->codes);
+    free(q->scales);
+    free(q->sums);
+    free(q->centroids);
+    free(q->pq_codes);
+    free(q->halves);
+    free(q);
+}
+
+static int search_int8(const struct rag_quant *q, const float *query, struct rag_topk *topk) {
+    int8_t *qs8 = malloc(2 * q->dim);
+    if (!qs8) return -1;
+    uint8_t *qu8 = (uint8_t *)qs8 + q->dim;
+
+    float qscale = quantize_i8(query, q->dim, qs8);
+    for (int d = 0; d < q->dim; d++) qu8[d] = (uint8_t)(qs8[d] + 128);
+
+    float block[QUANT_SCAN_BLOCK];
+    for (size_t base = 0; base < q->n; base += QUANT_SCAN_BLOCK) {
+        int len = q->n - base < QUANT_SCAN_BLOCK ? q->n - base : QUANT_SCAN_BLOCK;
+        int8_scores(q, qs8, qu8, qscale, base, len, block);
+        rag_topk_push_block(topk, block, len, base);
+    }
+    free(qs8);
+    return 0;
+}
+
+static int search_pq(const struct rag_quant *q, const float *query, struct rag_topk *topk) {
+    float *table = malloc((size_t)q->m * PQ_KSUB * sizeof(float));
+    if (!table) return -1;
+
+    for (int j = 0; j < q->m; j++) {
+        const float *slice = query + j * q->dsub;
+        const float *centroids = q->centroids + (size_t)j * PQ_KSUB * q->dsub;
+        for (int c = 0; c < PQ_KSUB; c++) {
+            float sum = 0;
+            for (int d = 0; d < q->dsub; d++) sum += slice[d] * centroids[c * q->dsub + d];
+            table[j * PQ_KSUB + c] = sum;
+        }
+    }
+
+    // Score 16 blocks at a time, then filter them into the top-k
+    float block[QUANT_SCAN_BLOCK];
+    size_t nblocks = (q->n + PQ_BLOCK - 1) / PQ_BLOCK;
+    for (size_t b = 0; b < nblocks; b += QUANT_SCAN_BLOCK / PQ_BLOCK) {
+        size_t base = b * PQ_BLOCK;
+        int len = q->n - base < QUANT_SCAN_BLOCK ? q->n - base : QUANT_SCAN_BLOCK;
+        for (int off = 0; off < len; off += PQ_BLOCK) {
+            adc_block(q->kernel, table, q->pq_codes + (b + off / PQ_BLOCK) * q->m * PQ_BLOCK,
+                      q->m, block + off);
+        }
+        rag_topk_push_block(topk, block, len, base);
+    }
+    free(table);
+    return 0;
+}
+
+static int search_half(const struct rag_quant *q, const float *query, struct rag_topk *topk) {
+    float block[QUANT_SCAN_BLOCK];
+    for (size_t base = 0; base < q->n; base += QUANT_SCAN_BLOCK) {
+        int len = q->n - base < QUANT_SCAN_BLOCK ? q->n - base : QUANT_SCAN_BLOCK;
+        for (int j = 0; j < len; j++) {
+            block[j] = dot_half(q->type, q->kernel, query, q->halves + (base + j) * q->dim, q->dim);
+        }
+        rag_topk_push_block(topk, block, len, base);
+    }
+    return 0;
+}
+
+int rag_quant_search(const struct rag_quant *q, const float *query, int k,
+                     float *scores, int *ids) {
+    struct rag_topk topk;
+    rag_topk_init(&topk, k, scores, ids);
+
+    int ret;
+    switch (q->type) {
+    case RAG_QUANT_INT8: ret = search_int8(q, query, &topk); break;
+    case RAG_QUANT_PQ:   ret = search_pq(q, query, &topk); break;
+    default:             ret = search_half(q, query, &topk); break;
+    }
+    return ret < 0 ? 0 : rag_topk_finish(&topk);
+}
+
+size_t rag_quant_memory(const struct rag_quant *q) {
+    if (q->type == RAG_QUANT_INT8) {
+        return q->n * (q->dim + sizeof(float) + sizeof(int32_t));
+    }
+    if (q->type == RAG_QUANT_FP16 || q->type == RAG_QUANT_BF16) {
+        return q->n * q->dim * sizeof(uint16_t);
+    }
+    return (q->n + PQ_BLOCK - 1) / PQ_BLOCK * PQ_BLOCK * q->m +
+           (size_t)q->m * PQ_KSUB * q->dsub * sizeof(float);
+}
+
+const char *rag_quant_kernel(const struct rag_quant *q) {
+    return kernel_names[q->kernel];
+}
+
+static const char *type_names[] = { "int8", "pq", "fp16", "bf16" };
+
+const char *rag_quant_type_name(int type) {
+    if (type < 0 || type >= (int)(sizeof(type_names) / sizeof(type_names[0]))) return "unknown";
+    return type_names[type];
+}
+
+int rag_quant_parse_type(const char *name) {
+    for (int t = 0; t < (int)(sizeof(type_names) / sizeof(type_names[0])); t++) {
+        if (strcmp(name, type_names[t]) == 0) return t;
+    }
+    return -1;
+}
+
+// Self-test
+
+#ifdef RAG_X86
+__attribute__((target("f16c")))
+static float f16c_widen(uint16_t h) {
+    return _cvtsh_ss(h);
+}
+
+__attribute__((target("f16c")))
+static uint16_t f16c_narrow(float f) {
+    return _cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT);
+}
+#endif
+
+int rag_quant_self_test(void) {
+    static const int dims[] = { 1, 15, 16, 63, 64, 65, 127, 128, 129, 768, 1000 };
+    const int max_dim = 1000;
+    int failures = 0;
+
+    int8_t *a = malloc(max_dim), *b = malloc(max_dim);
+    uint8_t *au = malloc(max_dim);
+    float *table = malloc(64 * PQ_KSUB * sizeof(float));
+    uint8_t *block = malloc(64 * PQ_BLOCK);
+    float *fq = malloc(max_dim * sizeof(float));
+    uint16_t *h16 = malloc(max_dim * sizeof(uint16_t)), *b16 = malloc(max_dim * sizeof(uint16_t));
+    if (!a || !b || !au || !table || !block || !fq || !h16 || !b16) {
+        fprintf(stderr, "Self-test allocation failed\n");
+        failures = 1;
+        goto out;
+    }
+
+    // Extremes included: -127 * -127 sums are where 16-bit paths saturate
+    unsigned int seed = 777;
+    for (int i = 0; i < max_dim; i++) {
+        a[i] = i % 7 == 0 ? -127 : (int8_t)(rand_r(&seed) % 255 - 127);
+        b[i] = i % 7 == 0 ? -127 : (int8_t)(rand_r(&seed) % 255 - 127);
+        au[i] = (uint8_t)(a[i] + 128);
+    }
+    for (int i = 0; i < 64 * PQ_KSUB; i++) table[i] = (float)rand_r(&seed) / RAND_MAX - 0.5f;
+    for (int i = 0; i < 64 * PQ_BLOCK; i++) block[i] = rand_r(&seed) & 0xFF;
+    for (int i = 0; i < max_dim; i++) {
+        fq[i] = (float)rand_r(&seed) / RAND_MAX - 0.5f;
+        float x = (float)rand_r(&seed) / RAND_MAX - 0.5f;
+        h16[i] = float_to_half(x);
+        b16[i] = float_to_bf16(x);
+    }
+    int f16c = 0;
+#ifdef RAG_X86
+    f16c = __builtin_cpu_supports("f16c");
+#endif
+
+    printf("Quantized kernel self-test:\n");
+    for (int kernel = QUANT_AVX2; kernel <= QUANT_AVX512; kernel++) {
+        int i8_ok = 0, pq_ok = 0;
+#ifdef RAG_X86
+        if (kernel == QUANT_AVX2 && __builtin_cpu_supports("avx2")) {
+            i8_ok = pq_ok = 1;
+        } else if (kernel == QUANT_AVX512) {
+            pq_ok = __builtin_cpu_supports("avx512f");
+            i8_ok = pq_ok && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni");
+        }
+#endif
+        int bad = 0;
+        for (size_t d = 0; i8_ok && d < sizeof(dims) / sizeof(dims[0]); d++) {
+            int32_t want = dot_i8_scalar(a, b, dims[d]), got = want;
+#ifdef RAG_X86
+            if (kernel == QUANT_AVX2) {
+                got = dot_i8_avx2(a, b, dims[d]);
+            } else {
+                int32_t sum_b = 0;
+                for (int i = 0; i < dims[d]; i++) sum_b += b[i];
+                got = dot_u8i8_vnni(au, b, dims[d]) - 128 * sum_b;
+            }
+#endif
+            if (got != want) {
+                printf("  int8 %-7s MISMATCH dim=%d: got %d want %d\n", kernel_names[kernel], dims[d], got, want);
+                bad++;
+            }
+        }
+
+        for (int m = 1; pq_ok && m <= 64; m *= 4) {
+            float want[PQ_BLOCK], got[PQ_BLOCK];
+            adc_block_scalar(table, block, m, want);
+            adc_block(kernel, table, block, m, got);
+            for (int v = 0; v < PQ_BLOCK; v++) {
+                if (fabsf(got[v] - want[v]) > 1e-4f) {
+                    printf("  adc  %-7s MISMATCH m=%d lane=%d\n", kernel_names[kernel], m, v);
+                    bad++;
+                    break;
+                }
+            }
+        }
+
+        // Nearest-centroid search used by PQ training and encoding
+        for (int trial = 0; pq_ok && trial < 64; trial++) {
+            const float *x = table + 8 * PQ_KSUB + trial * 8;
+            const float *norms = table + 16 * PQ_KSUB;
+            if (nearest_centroid(kernel, x, table, norms, 8) != nearest_scalar(x, table, norms, 8)) {
+                printf("  pq   %-7s nearest centroid MISMATCH\n", kernel_names[kernel]);
+                bad++;
+                break;
+            }
+        }
+
+        // 16-bit float dots against the scalar widening
+        for (int type = RAG_QUANT_FP16; type <= RAG_QUANT_BF16; type++) {
+            int ok = pq_ok && (kernel == QUANT_AVX512 || type == RAG_QUANT_BF16 || f16c);
+            for (size_t d = 0; ok && d < sizeof(dims) / sizeof(dims[0]); d++) {
+                const uint16_t *v = type == RAG_QUANT_FP16 ? h16 : b16;
+                float want = type == RAG_QUANT_FP16 ? dot_f16_scalar(fq, v, dims[d])
+                                                    : dot_bf16_scalar(fq, v, dims[d]);
+                float got = dot_half(type, kernel, fq, v, dims[d]);
+                if (fabsf(got - want) > 1e-4f * (1 + fabsf(want))) {
+                    printf("  %-4s %-7s MISMATCH dim=%d: got %f want %f\n", type_names[type],
+                           kernel_names[kernel], dims[d], got, want);
+                    bad++;
+                }
+            }
+        }
+
+        printf("  int8 %-7s %s   adc %-7s %s\n",
+               kernel_names[kernel], i8_ok ? (bad ? "FAIL" : "ok") : "n/a",
+               kernel_names[kernel], pq_ok ? (bad ? "FAIL" : "ok") : "n/a");
+        failures += bad;
+    }
+
+    // Conversions: every half widens as F16C does, random floats round
+    // as F16C does, and every finite bf16 survives a round trip
+    int conv_bad = 0;
+#ifdef RAG_X86
+    if (f16c) {
+        for (uint32_t h = 0; h <= 0xFFFF; h++) {
+            float want = f16c_widen(h), got = half_to_float(h);
+            if (memcmp(&want, &got, sizeof(float)) != 0 && !(isnan(want) && isnan(got))) {
+                conv_bad++;
+            }
+        }
+        for (int i = 0; i < 1 << 20; i++) {
+            // Exponents spanning half subnormals through overflow
+            uint32_t bits = (uint32_t)(rand_r(&seed) & 1) << 31 |
+                            (uint32_t)(96 + rand_r(&seed) % 50) << 23 | (rand_r(&seed) & 0x7FFFFF);
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            if (float_to_half(f) != f16c_narrow(f)) conv_bad++;
+        }
+    }
+#endif
+    for (uint32_t b = 0; b <= 0xFFFF; b++) {
+        if ((b & 0x7F80) == 0x7F80 && (b & 0x7F)) continue;
+        if (float_to_bf16(bf16_to_float(b)) != b) conv_bad++;
+    }
+    printf("  fp16/bf16 conversions %s\n", conv_bad ? "FAIL" : "ok");
+    failures += conv_bad;
+
+out:
+    free(a);
+    free(b);
+    free(au);
+    free(table);
+    free(block);
+    free(fq);
+    free(h16);
+    free(b16);
+    return failures;
+}
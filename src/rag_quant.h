@@ -0,0 +1,54 @@
+#ifndef RAG_QUANT_H
+#define RAG_QUANT_H
+
+// Compressed embedding storage for the RAG vector server:
+// - int8: per-vector scaled scalar quantization, 1 byte per dimension
+//   (4x smaller), scanned with VNNI / AVX2 integer dot products
+// - pq:   product quantization, m subspaces x 256 centroids, 1 byte per
+//   subspace (32x smaller at m = 96), scanned with ADC lookup tables
+// - fp16 / bf16: 16-bit floats (2x smaller), widened in registers with
+//   F16C / AVX-512 and scored against the float query
+// Scores approximate the float dot product; callers that keep the float
+// vectors can re-rank the best candidates exactly.
+
+#include <stddef.h>
+
+struct rag_pool;
+
+enum rag_quant_type {
+    RAG_QUANT_INT8 = 0,
+    RAG_QUANT_PQ,
+    RAG_QUANT_FP16,
+    RAG_QUANT_BF16,
+};
+
+struct rag_quant_params {
+    int type;               // enum rag_quant_type
+    int pq_m;               // Subspaces; must divide dim
+    int train_sample;       // PQ training vectors; <= 0 uses 10000
+};
+
+#define RAG_QUANT_DEFAULT_PQ_M 96
+
+struct rag_quant;
+
+// Encode n vectors, spread over pool's workers (pool may be NULL)
+struct rag_quant* rag_quant_build(const float *vectors, size_t n, int dim,
+                                  const struct rag_quant_params *params, struct rag_pool *pool);
+void rag_quant_destroy(struct rag_quant *q);
+
+// Best k vectors by approximate score, best-first; returns the count
+int rag_quant_search(const struct rag_quant *q, const float *query, int k,
+                     float *scores, int *ids);
+
+size_t rag_quant_memory(const struct rag_quant *q);
+const char *rag_quant_kernel(const struct rag_quant *q);
+
+// Storage name ("int8", "pq", "fp16", "bf16") and back; -1 if unknown
+const char *rag_quant_type_name(int type);
+int rag_quant_parse_type(const char *name);
+
+// Check the SIMD kernels against the scalar ones; returns failures
+int rag_quant_self_test(void);
+
+#endif // RAG_QUANT_H
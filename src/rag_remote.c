@@ -0,0 +1,284 @@
+/**
+ * RAG One-Sided Search
+ * Both paths pipeline their reads: up to REMOTE_DEPTH buffers are in
+ * flight, and each is refilled as soon as its contents are scored, so
+ * scoring overlaps the network. The exact scan reads every vector once
+ * per batch and scores the whole batch with the tile kernel. The IVF
+ * path keeps the index head (centroids, list offsets, ids) local and
+ * reads only the probed lists' vectors.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rag_remote.h"
+#include "rag_kernels.h"
+#include "rag_topk.h"
+#include "rag_ivf.h"
+
+#define REMOTE_BLOCK 256        // Vectors per exact-scan read
+#define REMOTE_DEPTH 4          // Reads in flight
+
+struct rag_remote {
+    struct rag_remote_layout layout;
+    const struct rag_remote_reader *reader;
+    int depth;
+    uint64_t bytes_read;
+    uint64_t version;           // Server version word when last checked
+    int stale;                  // It changed during the last search
+
+    // Read buffers: depth x slot_size bytes
+    char *buffers;
+    size_t slot_size;
+    float *tile;                // RAG_REMOTE_MAX_BATCH x REMOTE_BLOCK scores
+
+    struct rag_ivf *ivf;        // Head only
+    int *lists;                 // Probe order, nlist entries
+};
+
+static int post_read(struct rag_remote *r, uint64_t offset, void *dest, size_t len) {
+    r->bytes_read += len;
+    return r->reader->post(r->reader->ctx, offset, dest, len);
+}
+
+static int load_ivf_head(struct rag_remote *r, int nprobe, size_t *max_list) {
+    const struct rag_remote_layout *l = &r->layout;
+    char *header = r->reader->buffer(r->reader->ctx, RAG_IVF_IMAGE_HEADER);
+    if (!header || l->ivf_size < RAG_IVF_IMAGE_HEADER ||
+        post_read(r, l->ivf_offset, header, RAG_IVF_IMAGE_HEADER) < 0 ||
+        r->reader->wait(r->reader->ctx) < 0) {
+        return -1;
+    }
+    size_t head_size = rag_ivf_image_head_size(header, l->ivf_size);
+    char *head = head_size ? r->reader->buffer(r->reader->ctx, head_size) : NULL;
+    if (!head || post_read(r, l->ivf_offset, head, head_size) < 0 ||
+        r->reader->wait(r->reader->ctx) < 0) {
+        return -1;
+    }
+    r->ivf = rag_ivf_load_head(head, l->ivf_size, nprobe);
+    if (r->ivf && ((uint32_t)rag_ivf_dim(r->ivf) != l->dim || rag_ivf_count(r->ivf) != l->count)) {
+        fprintf(stderr, "Remote IVF indexes %zu x %d-d vectors, layout has %lu x %u-d\n",
+                rag_ivf_count(r->ivf), rag_ivf_dim(r->ivf), (unsigned long)l->count, l->dim);
+        return -1;
+    }
+    r->lists = r->ivf ? malloc(rag_ivf_nlist(r->ivf) * sizeof(int)) : NULL;
+    if (!r->lists) return -1;
+
+    *max_list = 0;
+    for (int list = 0; list < rag_ivf_nlist(r->ivf); list++) {
+        size_t count;
+        rag_ivf_list_extent(r->ivf, list, NULL, &count);
+        if (count > *max_list) *max_list = count;
+    }
+    return 0;
+}
+
+struct rag_remote* rag_remote_open(const struct rag_remote_layout *layout, uint64_t region_size,
+                                   const struct rag_remote_reader *reader, int nprobe) {
+    const struct rag_remote_layout *l = layout;
+    if (l->version != RAG_REMOTE_LAYOUT_VERSION || l->dim == 0 ||
+        l->stride < l->dim * sizeof(float) || l->embeddings_offset > region_size ||
+        (l->count > 0 && (l->count - 1) > (region_size - l->embeddings_offset) / l->stride) ||
+        (l->count > 0 && l->embeddings_offset + (l->count - 1) * l->stride + l->dim * sizeof(float) > region_size) ||
+        l->ivf_offset > region_size || l->ivf_size > region_size - l->ivf_offset) {
+        fprintf(stderr, "Unsupported or inconsistent remote layout\n");
+        return NULL;
+    }
+
+    struct rag_remote *r = calloc(1, sizeof(*r));
+    if (!r) return NULL;
+    r->layout = *layout;
+    r->reader = reader;
+    if (reader->version && reader->version(reader->ctx, &r->version) < 0) {
+        fprintf(stderr, "Failed to read the remote version word\n");
+        free(r);
+        return NULL;
+    }
+    r->depth = reader->max_inflight < REMOTE_DEPTH ? reader->max_inflight : REMOTE_DEPTH;
+    if (r->depth < 1) r->depth = 1;
+
+    // Slots hold a scan block or the longest IVF list, whichever is larger
+    size_t max_list = 0;
+    if (l->ivf_size > 0 && load_ivf_head(r, nprobe, &max_list) < 0) {
+        fprintf(stderr, "Failed to fetch the remote IVF index\n");
+        rag_remote_close(r);
+        return NULL;
+    }
+    r->slot_size = REMOTE_BLOCK * l->stride;
+    if (max_list * l->dim * sizeof(float) > r->slot_size) {
+        r->slot_size = max_list * l->dim * sizeof(float);
+    }
+    r->buffers = reader->buffer(reader->ctx, r->depth * r->slot_size);
+    r->tile = malloc((size_t)RAG_REMOTE_MAX_BATCH * REMOTE_BLOCK * sizeof(float));
+    if (!r->buffers || !r->tile) {
+        fprintf(stderr, "Failed to allocate remote read buffers\n");
+        rag_remote_close(r);
+        return NULL;
+    }
+    return r;
+}
+
+void rag_remote_close(struct rag_remote *r) {
+    if (!r) return;
+    if (r->ivf) rag_ivf_destroy(r->ivf);
+    free(r->lists);
+    free(r->tile);
+    free(r);
+}
+
+int rag_remote_has_ivf(const struct rag_remote *r) {
+    return r->ivf != NULL;
+}
+
+uint64_t rag_remote_bytes_read(const struct rag_remote *r) {
+    return r->bytes_read;
+}
+
+int rag_remote_stale(const struct rag_remote *r) {
+    return r->stale;
+}
+
+// After a search's reads: note whether the server changed since the last check
+static int check_version(struct rag_remote *r, int ret) {
+    uint64_t version;
+    if (ret < 0 || !r->reader->version) return ret;
+    if (r->reader->version(r->reader->ctx, &version) < 0) return -1;
+    r->stale = version != r->version;
+    r->version = version;
+    return ret;
+}
+
+static int post_block(struct rag_remote *r, size_t block) {
+    const struct rag_remote_layout *l = &r->layout;
+    size_t first = block * REMOTE_BLOCK;
+    size_t n = l->count - first < REMOTE_BLOCK ? l->count - first : REMOTE_BLOCK;
+    // The last vector needs only dim floats, not a whole stride
+    size_t len = (n - 1) * l->stride + l->dim * sizeof(float);
+    return post_read(r, l->embeddings_offset + first * l->stride,
+                     r->buffers + (block % r->depth) * r->slot_size, len);
+}
+
+int rag_remote_scan(struct rag_remote *r, const float *queries, int nq, int k,
+                    float *scores, int *ids, int *counts) {
+    const struct rag_remote_layout *l = &r->layout;
+    int dim = l->dim;
+    if (nq > RAG_REMOTE_MAX_BATCH) nq = RAG_REMOTE_MAX_BATCH;
+    struct rag_topk topk[RAG_REMOTE_MAX_BATCH];
+    for (int q = 0; q < nq; q++) {
+        rag_topk_init(&topk[q], k, scores + (size_t)q * k, ids + (size_t)q * k);
+    }
+
+    size_t blocks = (l->count + REMOTE_BLOCK - 1) / REMOTE_BLOCK;
+    size_t posted = 0;
+    for (; posted < blocks && posted < (size_t)r->depth; posted++) {
+        if (post_block(r, posted) < 0) {
+            for (; posted > 0; posted--) r->reader->wait(r->reader->ctx);
+            return -1;
+        }
+    }
+
+    int ret = 0;
+    for (size_t b = 0; b < blocks; b++) {
+        if (r->reader->wait(r->reader->ctx) < 0) {
+            // Drain what is still in flight before giving up
+            ret = -1;
+            for (posted -= b + 1; posted > 0; posted--) r->reader->wait(r->reader->ctx);
+            return ret;
+        }
+        const char *data = r->buffers + (b % r->depth) * r->slot_size;
+        size_t first = b * REMOTE_BLOCK;
+        int n = l->count - first < REMOTE_BLOCK ? l->count - first : REMOTE_BLOCK;
+
+        if (l->stride == dim * sizeof(float)) {
+            rag_dot_tile(queries, nq, (const float *)data, n, dim, r->tile, REMOTE_BLOCK);
+        } else {
+            for (int q = 0; q < nq; q++) {
+                for (int v = 0; v < n; v++) {
+                    r->tile[q * REMOTE_BLOCK + v] = rag_dot(queries + (size_t)q * dim,
+                                                            (const float *)(data + v * l->stride), dim);
+                }
+            }
+        }
+        for (int q = 0; q < nq; q++) {
+            rag_topk_push_block(&topk[q], r->tile + q * REMOTE_BLOCK, n, first);
+        }
+
+        // Slot b is free again
+        if (posted < blocks) {
+            if (post_block(r, posted) < 0) {
+                ret = -1;
+                blocks = posted;        // Only drain what is in flight
+            } else {
+                posted++;
+            }
+        }
+    }
+
+    for (int q = 0; q < nq; q++) {
+        counts[q] = rag_topk_finish(&topk[q]);
+    }
+    return check_version(r, ret);
+}
+
+static int post_list(struct rag_remote *r, const int *lists, int p) {
+    size_t count;
+    uint64_t offset = rag_ivf_list_extent(r->ivf, lists[p], NULL, &count);
+    if (count == 0) return 0;
+    return post_read(r, r->layout.ivf_offset + offset, r->buffers + (p % r->depth) * r->slot_size,
+                     count * r->layout.dim * sizeof(float));
+}
+
+int rag_remote_ivf_search(struct rag_remote *r, const float *query, int k, float *scores, int *ids) {
+    int dim = r->layout.dim;
+    const int *lists = r->lists;
+    int nprobe = rag_ivf_probe(r->ivf, query, 0, r->lists);
+
+    struct rag_topk topk;
+    rag_topk_init(&topk, k, scores, ids);
+
+    // Empty lists post nothing, so in-flight reads are counted separately
+    int inflight = 0, next = 0;
+    for (; next < nprobe && next < r->depth; next++) {
+        size_t count;
+        rag_ivf_list_extent(r->ivf, lists[next], NULL, &count);
+        if (post_list(r, lists, next) < 0) {
+            for (; inflight > 0; inflight--) r->reader->wait(r->reader->ctx);
+            return -1;
+        }
+        if (count > 0) inflight++;
+    }
+
+    for (int p = 0; p < nprobe; p++) {
+        const int *list_ids;
+        size_t count;
+        rag_ivf_list_extent(r->ivf, lists[p], &list_ids, &count);
+        if (count > 0) {
+            inflight--;
+            if (r->reader->wait(r->reader->ctx) < 0) {
+                for (; inflight > 0; inflight--) r->reader->wait(r->reader->ctx);
+                return -1;
+            }
+            const float *vectors = (const float *)(r->buffers + (p % r->depth) * r->slot_size);
+            for (size_t base = 0; base < count; base += REMOTE_BLOCK) {
+                int n = count - base < REMOTE_BLOCK ? count - base : REMOTE_BLOCK;
+                rag_dot_tile(query, 1, vectors + base * dim, n, dim, r->tile, REMOTE_BLOCK);
+                for (int j = 0; j < n; j++) {
+                    rag_topk_push(&topk, r->tile[j], list_ids[base + j]);
+                }
+            }
+        }
+
+        if (next < nprobe) {
+            size_t next_count;
+            rag_ivf_list_extent(r->ivf, lists[next], NULL, &next_count);
+            if (post_list(r, lists, next) < 0) {
+                for (; inflight > 0; inflight--) r->reader->wait(r->reader->ctx);
+                return -1;
+            }
+            if (next_count > 0) inflight++;
+            next++;
+        }
+    }
+    int count = rag_topk_finish(&topk);
+    return check_version(r, 0) < 0 ? -1 : count;
+}
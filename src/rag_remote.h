@@ -0,0 +1,65 @@
+#ifndef RAG_REMOTE_H
+#define RAG_REMOTE_H
+
+// One-sided search: the client fetches embedding blocks or IVF posting
+// lists from a region the server published (see rag_service.h) and
+// scores them locally, so the server CPU does no work per query. Fetches
+// go through a reader, so the same code runs over RDMA READ and, in
+// tests, over local memory. If the reader can fetch the server's version
+// word, searches report when the data changed after the remote was opened.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RAG_REMOTE_LAYOUT_VERSION 1
+#define RAG_REMOTE_MAX_BATCH 64     // Queries answered by one scan pass
+
+// The layout blob published with the region; native byte order
+struct rag_remote_layout {
+    uint32_t version;           // RAG_REMOTE_LAYOUT_VERSION
+    uint32_t dim;
+    uint64_t count;             // Vectors
+    uint64_t stride;            // Bytes from one vector to the next
+    uint64_t embeddings_offset; // Of vector 0 within the region
+    uint64_t ivf_offset;        // IVF image within the region (rag_ivf.h)
+    uint64_t ivf_size;          // 0: no index published
+};
+
+struct rag_remote_reader {
+    // Memory that reads may land in, owned by the reader
+    void *(*buffer)(void *ctx, size_t size);
+    // Start a read of len bytes at offset in the region; completes in order
+    int (*post)(void *ctx, uint64_t offset, void *dest, size_t len);
+    // Wait for the oldest posted read
+    int (*wait)(void *ctx);
+    void *ctx;
+    int max_inflight;
+    // Optional: fetch the server's version word (no reads outstanding)
+    int (*version)(void *ctx, uint64_t *version);
+};
+
+struct rag_remote;
+
+// Check the layout against the region and, if it has an IVF index,
+// fetch the index head; nprobe <= 0 keeps the stored default
+struct rag_remote* rag_remote_open(const struct rag_remote_layout *layout, uint64_t region_size,
+                                   const struct rag_remote_reader *reader, int nprobe);
+void rag_remote_close(struct rag_remote *r);
+
+int rag_remote_has_ivf(const struct rag_remote *r);
+uint64_t rag_remote_bytes_read(const struct rag_remote *r);
+
+// Exact: one pass over every vector answers up to RAG_REMOTE_MAX_BATCH
+// queries. Results are nq rows of k, best-first, with counts[q] the
+// length of row q. Returns -1 if a read fails.
+int rag_remote_scan(struct rag_remote *r, const float *queries, int nq, int k,
+                    float *scores, int *ids, int *counts);
+
+// IVF: fetches only the probed lists; returns the count, or -1
+int rag_remote_ivf_search(struct rag_remote *r, const float *query, int k, float *scores, int *ids);
+
+// Whether the last search saw the version word differ from the previous
+// check (at open, or the last search); always 0 without a version reader
+int rag_remote_stale(const struct rag_remote *r);
+
+#endif // RAG_REMOTE_H
@@ -0,0 +1,1457 @@
+/**
+ * RAG Query Service
+ * Server: the main thread runs epoll over both listeners and every
+ * client socket. It accepts connections, answers TCP queries, and notices
+ * disconnects. Each accepted TLS socket gets a short-lived bootstrap
+ * thread for the handshake and QP setup, with socket timeouts, and is
+ * handed to epoll once its connection is up. One poller thread drives all RDMA connections over a
+ * shared CQ. It runs the handler when a query receive completes and posts
+ * the WRITE_WITH_IMM. Each receive slot has its own result buffer, and the
+ * slot's receive is reposted only when its write completes, so a result
+ * is never overwritten while the NIC is still reading it.
+ *
+ * With a batch handler, neither thread answers queries itself: both
+ * queue them for the batcher thread, which hands a batch to the handler
+ * when it is full or its oldest query is due, then posts the results.
+ * A queued TCP connection leaves epoll until its reply is sent, and a
+ * queued RDMA slot counts as outstanding work on its connection.
+ *
+ * Client: one query in flight. The receive that the WRITE_WITH_IMM
+ * consumes is posted before the SEND, so the response never meets an
+ * empty receive queue. One-sided reads share the client's send queue and
+ * CQ, and up to RAG_CLIENT_MAX_READS (capped by the device) run at once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "rdma_compat.h"
+#include "tls_utils.h"
+#include "rag_service.h"
+
+#define WR_ID_WRITE 1UL
+#define POLL_BATCH 16
+#define MAX_EVENTS 32
+#define CQ_SIZE 1024
+#define MAX_RDMA_CONNS (CQ_SIZE / (2 * RAG_SERVICE_RX_DEPTH))
+
+enum fd_kind {
+    FD_TLS_LISTEN = 1,
+    FD_TCP_LISTEN,
+    FD_RDMA_CONN,
+    FD_TCP_CONN,
+};
+
+struct rdma_conn;
+
+// Receive slot; wr_id carries its address, low bit set for the write
+struct rag_slot {
+    struct rdma_conn *conn;
+    char *query;
+    char *result;
+};
+
+struct rdma_conn {
+    int kind;                       // FD_RDMA_CONN; first, for epoll dispatch
+    struct tls_connection *tls;
+    uint32_t local_psn;
+    uint32_t remote_psn;
+    struct rdma_conn_params remote; // Client's result slot
+    struct ibv_qp *qp;
+    struct ibv_mr *mr;
+    char *buffer;                   // Per slot: query, then result
+    struct rag_slot slots[RAG_SERVICE_RX_DEPTH];
+
+    // Owned by the poller once linked
+    int outstanding;
+    int closing;
+    struct rdma_conn *next;
+};
+
+struct tcp_conn {
+    int kind;                       // FD_TCP_CONN
+    int fd;
+    size_t got;                     // Query bytes received so far
+    char *query;
+    char *reply;                    // Handler value (network order), then result
+};
+
+// A query waiting for the batcher: a TCP connection's or an RDMA slot's
+struct batch_entry {
+    struct tcp_conn *tcp;
+    struct rag_slot *slot;
+    uint64_t arrival_us;
+};
+
+struct rag_service {
+    const struct rag_service_config *config;
+    pthread_mutex_t lock;           // Handler calls and the RDMA connection list
+
+    // RDMA; ctx is NULL when the host has no device
+    struct ibv_device **dev_list;
+    struct ibv_context *ctx;
+    struct ibv_pd *pd;
+    struct ibv_cq *cq;
+    struct ibv_port_attr port_attr;
+    int rd_atomic;
+    struct ibv_mr *region_mr;       // Published region, if any
+    struct ibv_mr *version_mr;      // Its version word, if any
+    SSL_CTX *ssl_ctx;
+    struct rdma_conn *conns;
+    int num_rdma_conns;
+    int closing_count;
+    int bootstraps;                 // In flight; each reserves a connection
+    pthread_cond_t bootstraps_done; // Signalled when bootstraps drops to 0
+    pthread_t poller;
+    int poller_started;
+
+    int epoll_fd;
+    int tls_sock;
+    int tcp_sock;
+    int tls_kind;                   // epoll tags for the listeners
+    int tcp_kind;
+
+    uint64_t rdma_queries;
+    uint64_t tcp_queries;
+
+    // Batching; batch_lock is taken inside lock, never around it. A
+    // client has one query in flight, so once every open connection has
+    // one queued, the batch cannot grow and goes without waiting.
+    int open_conns;                 // Atomic
+    pthread_mutex_t batch_lock;
+    pthread_cond_t batch_wake;      // CLOCK_MONOTONIC
+    struct batch_entry *pending;    // Oldest first
+    int num_pending;
+    int pending_cap;
+    int batch_max;
+    pthread_t batcher;
+    int batcher_started;
+    uint64_t batches;
+    uint64_t batched_queries;
+    uint64_t due_batches;           // Sent at the deadline, not full or cut short
+    uint64_t batch_wait_us;         // Queue wait, summed over queries
+    uint64_t max_batch_wait_us;     // Since the last stats line
+};
+
+static volatile int g_running = 1;
+
+static void signal_handler(int sig) {
+    printf("\nReceived signal %d, stopping RAG service...\n", sig);
+    g_running = 0;
+}
+
+// QP bring-up shared by server and client: both sides use the
+// TLS-exchanged PSNs
+
+static int qp_to_init(struct ibv_qp *qp, int access) {
+    struct ibv_qp_attr attr = {
+        .qp_state = IBV_QPS_INIT,
+        .pkey_index = 0,
+        .port_num = 1,
+        .qp_access_flags = access
+    };
+    if (ibv_modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_PKEY_INDEX |
+                      IBV_QP_PORT | IBV_QP_ACCESS_FLAGS)) {
+        perror("Failed to modify QP to INIT");
+        return -1;
+    }
+    return 0;
+}
+
+static int qp_to_rtr(struct ibv_qp *qp, const struct rdma_conn_params *remote, uint32_t remote_psn,
+                     const struct ibv_port_attr *port_attr, int rd_atomic) {
+    struct ibv_qp_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_RTR;
+    attr.path_mtu = IBV_MTU_1024;
+    attr.dest_qp_num = remote->qp_num;
+    attr.rq_psn = remote_psn;
+    attr.max_dest_rd_atomic = rd_atomic;
+    attr.min_rnr_timer = 12;
+    attr.ah_attr.dlid = remote->lid;
+    attr.ah_attr.port_num = 1;
+    if (port_attr->link_layer == IBV_LINK_LAYER_ETHERNET) {
+        attr.ah_attr.is_global = 1;
+        attr.ah_attr.grh.hop_limit = 1;
+        memcpy(&attr.ah_attr.grh.dgid, remote->gid, 16);
+        attr.ah_attr.grh.sgid_index = 0;
+    }
+    if (ibv_modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU |
+                      IBV_QP_DEST_QPN | IBV_QP_RQ_PSN |
+                      IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER)) {
+        perror("Failed to modify QP to RTR");
+        return -1;
+    }
+    return 0;
+}
+
+static int qp_to_rts(struct ibv_qp *qp, uint32_t local_psn, int rd_atomic) {
+    struct ibv_qp_attr attr = {
+        .qp_state = IBV_QPS_RTS,
+        .timeout = 14,
+        .retry_cnt = 7,
+        .rnr_retry = 7,
+        .sq_psn = local_psn,
+        .max_rd_atomic = rd_atomic
+    };
+    if (ibv_modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT |
+                      IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN | IBV_QP_MAX_QP_RD_ATOMIC)) {
+        perror("Failed to modify QP to RTS");
+        return -1;
+    }
+    return 0;
+}
+
+static int local_params(struct ibv_context *ctx, const struct ibv_port_attr *port_attr,
+                        struct ibv_qp *qp, uint32_t psn, struct ibv_mr *mr, void *addr,
+                        struct rdma_conn_params *params) {
+    memset(params, 0, sizeof(*params));
+    params->qp_num = qp->qp_num;
+    params->lid = port_attr->lid;
+    params->psn = psn;
+    params->rkey = mr->rkey;
+    params->remote_addr = (uintptr_t)addr;
+    if (ibv_query_gid(ctx, 1, 0, (union ibv_gid *)params->gid)) {
+        perror("ibv_query_gid");
+        return -1;
+    }
+    return 0;
+}
+
+// rd_atomic: READs a QP may have in flight, capped by the device
+static int open_device(struct ibv_device ***dev_list, struct ibv_context **ctx,
+                       struct ibv_pd **pd, struct ibv_port_attr *port_attr, int *rd_atomic) {
+    int num_devices;
+    *dev_list = ibv_get_device_list(&num_devices);
+    if (!*dev_list || num_devices == 0) {
+        fprintf(stderr, "No RDMA devices found\n");
+        return -1;
+    }
+    *ctx = ibv_open_device((*dev_list)[0]);
+    if (!*ctx) {
+        fprintf(stderr, "Failed to open RDMA device\n");
+        return -1;
+    }
+    struct ibv_device_attr dev_attr;
+    if (ibv_query_port(*ctx, 1, port_attr) || ibv_query_device(*ctx, &dev_attr)) {
+        perror("ibv_query_port");
+        return -1;
+    }
+    *rd_atomic = dev_attr.max_qp_rd_atom < RAG_CLIENT_MAX_READS ? dev_attr.max_qp_rd_atom
+                                                                 : RAG_CLIENT_MAX_READS;
+    if (*rd_atomic < 1) *rd_atomic = 1;
+    *pd = ibv_alloc_pd(*ctx);
+    if (!*pd) {
+        fprintf(stderr, "Failed to allocate PD\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int send_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int recv_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void set_nodelay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// Queue one query for the batcher, waking it for a first entry (which
+// sets the deadline) or a full batch; -1 if out of memory
+static int batch_enqueue(struct rag_service *svc, struct tcp_conn *tcp, struct rag_slot *slot) {
+    pthread_mutex_lock(&svc->batch_lock);
+    if (svc->num_pending == svc->pending_cap) {
+        int cap = svc->pending_cap ? 2 * svc->pending_cap : 2 * RAG_SERVICE_MAX_BATCH;
+        struct batch_entry *pending = realloc(svc->pending, cap * sizeof(*pending));
+        if (!pending) {
+            pthread_mutex_unlock(&svc->batch_lock);
+            fprintf(stderr, "RAG service: failed to queue a query\n");
+            return -1;
+        }
+        svc->pending = pending;
+        svc->pending_cap = cap;
+    }
+    svc->pending[svc->num_pending++] = (struct batch_entry) { tcp, slot, monotonic_us() };
+    if (svc->num_pending == 1 || svc->num_pending == svc->batch_max ||
+        svc->num_pending >= __atomic_load_n(&svc->open_conns, __ATOMIC_RELAXED)) {
+        pthread_cond_signal(&svc->batch_wake);
+    }
+    pthread_mutex_unlock(&svc->batch_lock);
+    return 0;
+}
+
+// Server: RDMA data path
+
+static int post_slot_receive(struct rag_slot *slot, size_t query_size) {
+    struct rdma_conn *conn = slot->conn;
+    struct ibv_sge sge = {
+        .addr = (uintptr_t)slot->query,
+        .length = query_size,
+        .lkey = conn->mr->lkey
+    };
+    struct ibv_recv_wr wr = {
+        .wr_id = (uintptr_t)slot,
+        .sg_list = &sge,
+        .num_sge = 1
+    };
+    struct ibv_recv_wr *bad_wr;
+    if (ibv_post_recv(conn->qp, &wr, &bad_wr)) {
+        return -1;
+    }
+    conn->outstanding++;
+    return 0;
+}
+
+static int post_slot_result(struct rag_slot *slot, size_t result_size, uint32_t value) {
+    struct rdma_conn *conn = slot->conn;
+    struct ibv_sge sge = {
+        .addr = (uintptr_t)slot->result,
+        .length = result_size,
+        .lkey = conn->mr->lkey
+    };
+    struct ibv_send_wr wr = {
+        .wr_id = (uintptr_t)slot | WR_ID_WRITE,
+        .sg_list = &sge,
+        .num_sge = 1,
+        .opcode = IBV_WR_RDMA_WRITE_WITH_IMM,
+        .send_flags = IBV_SEND_SIGNALED,
+        .imm_data = htonl(value)
+    };
+    wr.wr.rdma.remote_addr = conn->remote.remote_addr;
+    wr.wr.rdma.rkey = conn->remote.rkey;
+
+    struct ibv_send_wr *bad_wr;
+    if (ibv_post_send(conn->qp, &wr, &bad_wr)) {
+        return -1;
+    }
+    conn->outstanding++;
+    return 0;
+}
+
+static void destroy_rdma_conn(struct rdma_conn *conn) {
+    if (conn->qp) ibv_destroy_qp(conn->qp);
+    if (conn->mr) ibv_dereg_mr(conn->mr);
+    if (conn->tls) close_tls_connection(conn->tls);
+    free(conn->buffer);
+    free(conn);
+}
+
+// Unlink and free closing connections once their work requests have
+// flushed (caller holds the lock)
+static void reap_closed_conns(struct rag_service *svc) {
+    struct rdma_conn **link = &svc->conns;
+    while (*link) {
+        struct rdma_conn *conn = *link;
+        if (conn->closing && conn->outstanding == 0) {
+            *link = conn->next;
+            svc->closing_count--;
+            svc->num_rdma_conns--;
+            destroy_rdma_conn(conn);
+        } else {
+            link = &conn->next;
+        }
+    }
+}
+
+static void* poller_thread(void *arg) {
+    struct rag_service *svc = arg;
+    const struct rag_service_config *config = svc->config;
+    struct ibv_wc wc[POLL_BATCH];
+
+    while (g_running) {
+        pthread_mutex_lock(&svc->lock);
+        int ne = ibv_poll_cq(svc->cq, POLL_BATCH, wc);
+        if (ne < 0) {
+            fprintf(stderr, "RAG service: ibv_poll_cq failed\n");
+            pthread_mutex_unlock(&svc->lock);
+            break;
+        }
+
+        for (int i = 0; i < ne; i++) {
+            // Flushed completions carry no valid opcode, so the WR kind rides in wr_id
+            int is_write = (wc[i].wr_id & WR_ID_WRITE) != 0;
+            struct rag_slot *slot = (struct rag_slot *)(uintptr_t)(wc[i].wr_id & ~WR_ID_WRITE);
+            struct rdma_conn *conn = slot->conn;
+
+            conn->outstanding--;
+            if (conn->closing) continue;
+            if (wc[i].status != IBV_WC_SUCCESS) {
+                fprintf(stderr, "RAG service: %s failed: %s\n", is_write ? "result write" : "receive",
+                        ibv_wc_status_str(wc[i].status));
+                continue;
+            }
+
+            int ret;
+            if (is_write) {
+                ret = post_slot_receive(slot, config->query_size);
+            } else if (wc[i].byte_len != config->query_size) {
+                fprintf(stderr, "RAG service: dropped a %u-byte query (expected %zu)\n",
+                        wc[i].byte_len, config->query_size);
+                ret = post_slot_receive(slot, config->query_size);
+            } else if (config->handle_batch) {
+                // The batcher posts the result; until then the slot is busy
+                ret = batch_enqueue(svc, NULL, slot);
+                if (ret == 0) conn->outstanding++;
+            } else {
+                uint32_t value = config->handle(config->ctx, slot->query, slot->result);
+                svc->rdma_queries++;
+                ret = post_slot_result(slot, config->result_size, value);
+            }
+            if (ret < 0) {
+                fprintf(stderr, "RAG service: failed to post a work request\n");
+            }
+        }
+
+        if (svc->closing_count > 0) {
+            reap_closed_conns(svc);
+        }
+        int idle = svc->conns == NULL;
+        pthread_mutex_unlock(&svc->lock);
+
+        if (idle) {
+            usleep(1000);
+        }
+    }
+    return NULL;
+}
+
+// Full secure bring-up of one accepted TLS connection
+static struct rdma_conn* setup_rdma_conn(struct rag_service *svc, struct tls_connection *tls) {
+    const struct rag_service_config *config = svc->config;
+    struct rdma_conn *conn = calloc(1, sizeof(*conn));
+    if (!conn) {
+        close_tls_connection(tls);
+        return NULL;
+    }
+    conn->kind = FD_RDMA_CONN;
+    conn->tls = tls;
+
+    struct rag_service_info info = {
+        .query_size = htonl(config->query_size),
+        .result_size = htonl(config->result_size)
+    };
+    if (exchange_psn_server(tls, &conn->local_psn, &conn->remote_psn) < 0) {
+        goto fail;
+    }
+    if (SSL_write(tls->ssl, &info, sizeof(info)) != sizeof(info)) {
+        print_ssl_error("Failed to send service info");
+        goto fail;
+    }
+    size_t slot_size = config->query_size + config->result_size;
+    if (posix_memalign((void **)&conn->buffer, 4096, RAG_SERVICE_RX_DEPTH * slot_size)) {
+        conn->buffer = NULL;
+        goto fail;
+    }
+    for (int i = 0; i < RAG_SERVICE_RX_DEPTH; i++) {
+        conn->slots[i].conn = conn;
+        conn->slots[i].query = conn->buffer + i * slot_size;
+        conn->slots[i].result = conn->slots[i].query + config->query_size;
+    }
+    conn->mr = ibv_reg_mr(svc->pd, conn->buffer, RAG_SERVICE_RX_DEPTH * slot_size,
+                          IBV_ACCESS_LOCAL_WRITE);
+    if (!conn->mr) {
+        perror("ibv_reg_mr");
+        goto fail;
+    }
+
+    struct ibv_qp_init_attr qp_attr = {
+        .send_cq = svc->cq,
+        .recv_cq = svc->cq,
+        .qp_type = IBV_QPT_RC,
+        .cap = {
+            .max_send_wr = RAG_SERVICE_RX_DEPTH,
+            .max_recv_wr = RAG_SERVICE_RX_DEPTH,
+            .max_send_sge = 1,
+            .max_recv_sge = 1
+        }
+    };
+    conn->qp = ibv_create_qp(svc->pd, &qp_attr);
+    if (!conn->qp) {
+        perror("ibv_create_qp");
+        goto fail;
+    }
+
+    struct rdma_conn_params params;
+    if (local_params(svc->ctx, &svc->port_attr, conn->qp, conn->local_psn, conn->mr,
+                     conn->buffer, &params) < 0 ||
+        send_rdma_params(tls, &params) < 0 || receive_rdma_params(tls, &conn->remote) < 0) {
+        goto fail;
+    }
+
+    // Receives go up before RTR; the poller does not see this QP until
+    // it is linked, so the counts need no lock yet
+    int access = IBV_ACCESS_LOCAL_WRITE | (svc->region_mr || svc->version_mr ? IBV_ACCESS_REMOTE_READ : 0);
+    if (qp_to_init(conn->qp, access) < 0) goto fail;
+    for (int i = 0; i < RAG_SERVICE_RX_DEPTH; i++) {
+        if (post_slot_receive(&conn->slots[i], config->query_size) < 0) {
+            perror("ibv_post_recv");
+            goto fail;
+        }
+    }
+    if (qp_to_rtr(conn->qp, &conn->remote, conn->remote_psn, &svc->port_attr, svc->rd_atomic) < 0 ||
+        qp_to_rts(conn->qp, conn->local_psn, svc->rd_atomic) < 0) {
+        goto fail;
+    }
+
+    // Tell the client the QP is ready, so its first SEND is not retried,
+    // and where the published region is
+    char ready = 1;
+    struct rag_region_desc desc = { 0 };
+    if (svc->region_mr) {
+        desc.addr = (uintptr_t)config->region;
+        desc.size = config->region_size;
+        desc.rkey = svc->region_mr->rkey;
+        desc.layout_size = config->layout_size;
+    }
+    if (svc->version_mr) {
+        desc.version_addr = (uintptr_t)config->version;
+        desc.version_rkey = svc->version_mr->rkey;
+    }
+    if (SSL_write(tls->ssl, &ready, 1) != 1 || SSL_write(tls->ssl, &desc, sizeof(desc)) != sizeof(desc) ||
+        (desc.layout_size > 0 &&
+         SSL_write(tls->ssl, config->layout, desc.layout_size) != (int)desc.layout_size)) {
+        print_ssl_error("Failed to send ready");
+        goto fail;
+    }
+
+    pthread_mutex_lock(&svc->lock);
+    conn->next = svc->conns;
+    svc->conns = conn;
+    svc->num_rdma_conns++;
+    pthread_mutex_unlock(&svc->lock);
+    __atomic_add_fetch(&svc->open_conns, 1, __ATOMIC_RELAXED);
+    return conn;
+
+fail:
+    fprintf(stderr, "RAG service: RDMA connection setup failed\n");
+    if (conn->outstanding > 0) {
+        // Posted receives flush into the shared CQ; let the poller reap it
+        struct ibv_qp_attr attr = { .qp_state = IBV_QPS_ERR };
+        ibv_modify_qp(conn->qp, &attr, IBV_QP_STATE);
+        close_tls_connection(conn->tls);
+        conn->tls = NULL;
+        conn->closing = 1;
+        pthread_mutex_lock(&svc->lock);
+        conn->next = svc->conns;
+        svc->conns = conn;
+        svc->num_rdma_conns++;
+        svc->closing_count++;
+        pthread_mutex_unlock(&svc->lock);
+        return NULL;
+    }
+    destroy_rdma_conn(conn);
+    return NULL;
+}
+
+// Client went away: flush the QP and let the poller free it once drained
+static void close_rdma_conn(struct rag_service *svc, struct rdma_conn *conn) {
+    struct ibv_qp_attr attr = { .qp_state = IBV_QPS_ERR };
+
+    epoll_ctl(svc->epoll_fd, EPOLL_CTL_DEL, conn->tls->socket, NULL);
+    pthread_mutex_lock(&svc->lock);
+    close_tls_connection(conn->tls);
+    conn->tls = NULL;
+    ibv_modify_qp(conn->qp, &attr, IBV_QP_STATE);
+    conn->closing = 1;
+    svc->closing_count++;
+    pthread_mutex_unlock(&svc->lock);
+    __atomic_sub_fetch(&svc->open_conns, 1, __ATOMIC_RELAXED);
+}
+
+struct bootstrap_job {
+    struct rag_service *svc;
+    int sock;
+};
+
+// Handshake and RDMA setup for one accepted socket, off the epoll thread
+static void* bootstrap_thread(void *arg) {
+    struct bootstrap_job *job = arg;
+    struct rag_service *svc = job->svc;
+    struct tls_connection *tls = accept_tls_socket(job->sock, svc->ssl_ctx);
+    free(job);
+
+    struct rdma_conn *conn = tls ? setup_rdma_conn(svc, tls) : NULL;
+    if (conn) {
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = conn };
+        if (epoll_ctl(svc->epoll_fd, EPOLL_CTL_ADD, conn->tls->socket, &ev) < 0) {
+            perror("epoll_ctl");
+            close_rdma_conn(svc, conn);
+        }
+    }
+
+    pthread_mutex_lock(&svc->lock);
+    if (--svc->bootstraps == 0) pthread_cond_broadcast(&svc->bootstraps_done);
+    pthread_mutex_unlock(&svc->lock);
+    return NULL;
+}
+
+// Accept a TLS client and start its bootstrap. The reservation keeps
+// connections plus bootstraps within MAX_RDMA_CONNS.
+static void accept_rdma_conn(struct rag_service *svc) {
+    int sock = accept(svc->tls_sock, NULL, NULL);
+    if (sock < 0) {
+        perror("accept");
+        return;
+    }
+
+    pthread_mutex_lock(&svc->lock);
+    int full = svc->num_rdma_conns + svc->bootstraps >= MAX_RDMA_CONNS;
+    if (!full) svc->bootstraps++;
+    pthread_mutex_unlock(&svc->lock);
+    if (full) {
+        fprintf(stderr, "RAG service: connection limit (%d) reached\n", MAX_RDMA_CONNS);
+        close(sock);
+        return;
+    }
+
+    struct bootstrap_job *job = malloc(sizeof(*job));
+    pthread_attr_t attr;
+    pthread_t thread;
+    int started = 0;
+    if (job && set_socket_timeouts(sock, TLS_BOOTSTRAP_TIMEOUT_S) == 0) {
+        job->svc = svc;
+        job->sock = sock;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        started = pthread_create(&thread, &attr, bootstrap_thread, job) == 0;
+        pthread_attr_destroy(&attr);
+    }
+    if (!started) {
+        fprintf(stderr, "Failed to start RDMA bootstrap thread\n");
+        free(job);
+        close(sock);
+        pthread_mutex_lock(&svc->lock);
+        if (--svc->bootstraps == 0) pthread_cond_broadcast(&svc->bootstraps_done);
+        pthread_mutex_unlock(&svc->lock);
+    }
+}
+
+// Server: TCP data path
+
+static void close_tcp_conn(struct rag_service *svc, struct tcp_conn *conn) {
+    __atomic_sub_fetch(&svc->open_conns, 1, __ATOMIC_RELAXED);
+    epoll_ctl(svc->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn->query);
+    free(conn->reply);
+    free(conn);
+}
+
+static void accept_tcp_conn(struct rag_service *svc) {
+    const struct rag_service_config *config = svc->config;
+    int fd = accept(svc->tcp_sock, NULL, NULL);
+    if (fd < 0) {
+        perror("accept");
+        return;
+    }
+    set_nodelay(fd);
+
+    struct tcp_conn *conn = calloc(1, sizeof(*conn));
+    struct rag_service_info info = {
+        .query_size = htonl(config->query_size),
+        .result_size = htonl(config->result_size)
+    };
+    if (!conn || !(conn->query = malloc(config->query_size)) ||
+        !(conn->reply = malloc(sizeof(uint32_t) + config->result_size)) ||
+        send_all(fd, &info, sizeof(info)) < 0) {
+        fprintf(stderr, "RAG service: TCP connection setup failed\n");
+        if (conn) {
+            free(conn->query);
+            free(conn->reply);
+            free(conn);
+        }
+        close(fd);
+        return;
+    }
+    conn->kind = FD_TCP_CONN;
+    conn->fd = fd;
+
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = conn };
+    if (epoll_ctl(svc->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        perror("epoll_ctl");
+        close(fd);
+        free(conn->query);
+        free(conn->reply);
+        free(conn);
+        return;
+    }
+    __atomic_add_fetch(&svc->open_conns, 1, __ATOMIC_RELAXED);
+}
+
+// Send the handler's value and result; closes the connection on failure
+static int send_tcp_reply(struct rag_service *svc, struct tcp_conn *conn, uint32_t value) {
+    value = htonl(value);
+    memcpy(conn->reply, &value, sizeof(value));
+    if (send_all(conn->fd, conn->reply, sizeof(uint32_t) + svc->config->result_size) < 0) {
+        close_tcp_conn(svc, conn);
+        return -1;
+    }
+    return 0;
+}
+
+// Read what has arrived; once a whole query is in, answer it or queue it
+static void serve_tcp_conn(struct rag_service *svc, struct tcp_conn *conn) {
+    const struct rag_service_config *config = svc->config;
+    ssize_t n = recv(conn->fd, conn->query + conn->got, config->query_size - conn->got, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (n <= 0) {
+        close_tcp_conn(svc, conn);
+        return;
+    }
+    conn->got += n;
+    if (conn->got < config->query_size) return;
+    conn->got = 0;
+
+    if (config->handle_batch) {
+        // The batcher owns the connection until it has replied
+        epoll_ctl(svc->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+        if (batch_enqueue(svc, conn, NULL) < 0) close_tcp_conn(svc, conn);
+        return;
+    }
+
+    pthread_mutex_lock(&svc->lock);
+    uint32_t value = config->handle(config->ctx, conn->query, conn->reply + sizeof(uint32_t));
+    svc->tcp_queries++;
+    pthread_mutex_unlock(&svc->lock);
+    send_tcp_reply(svc, conn, value);
+}
+
+// Answer the queued queries: sleep until the oldest is due (checking
+// for shutdown at least every 100 ms) unless the batch is full or every
+// client is in it
+static void* batcher_thread(void *arg) {
+    struct rag_service *svc = arg;
+    const struct rag_service_config *config = svc->config;
+    struct batch_entry batch[RAG_SERVICE_MAX_BATCH];
+    const void *queries[RAG_SERVICE_MAX_BATCH];
+    void *results[RAG_SERVICE_MAX_BATCH];
+    uint32_t values[RAG_SERVICE_MAX_BATCH];
+
+    pthread_mutex_lock(&svc->batch_lock);
+    while (g_running) {
+        uint64_t now = monotonic_us();
+        uint64_t due = svc->num_pending ? svc->pending[0].arrival_us + config->batch_window_us : UINT64_MAX;
+        int open = __atomic_load_n(&svc->open_conns, __ATOMIC_RELAXED);
+        if (svc->num_pending == 0 ||
+            (svc->num_pending < svc->batch_max && svc->num_pending < open && now < due)) {
+            uint64_t until = due < now + 100000 ? due : now + 100000;
+            struct timespec ts = { .tv_sec = until / 1000000, .tv_nsec = until % 1000000 * 1000 };
+            pthread_cond_timedwait(&svc->batch_wake, &svc->batch_lock, &ts);
+            continue;
+        }
+
+        int n = svc->num_pending < svc->batch_max ? svc->num_pending : svc->batch_max;
+        memcpy(batch, svc->pending, n * sizeof(*batch));
+        svc->num_pending -= n;
+        memmove(svc->pending, svc->pending + n, svc->num_pending * sizeof(*batch));
+        svc->batches++;
+        svc->batched_queries += n;
+        svc->due_batches += n < svc->batch_max && n < open;
+        for (int i = 0; i < n; i++) {
+            uint64_t wait = now - batch[i].arrival_us;
+            svc->batch_wait_us += wait;
+            if (wait > svc->max_batch_wait_us) svc->max_batch_wait_us = wait;
+        }
+        pthread_mutex_unlock(&svc->batch_lock);
+
+        for (int i = 0; i < n; i++) {
+            if (batch[i].tcp) {
+                queries[i] = batch[i].tcp->query;
+                results[i] = batch[i].tcp->reply + sizeof(uint32_t);
+            } else {
+                queries[i] = batch[i].slot->query;
+                results[i] = batch[i].slot->result;
+            }
+        }
+        config->handle_batch(config->ctx, queries, results, values, n);
+
+        // RDMA slots of a connection closed meanwhile are just released
+        pthread_mutex_lock(&svc->lock);
+        for (int i = 0; i < n; i++) {
+            struct rag_slot *slot = batch[i].slot;
+            if (!slot) {
+                svc->tcp_queries++;
+                continue;
+            }
+            slot->conn->outstanding--;
+            svc->rdma_queries++;
+            if (!slot->conn->closing && post_slot_result(slot, config->result_size, values[i]) < 0) {
+                fprintf(stderr, "RAG service: failed to post a work request\n");
+            }
+        }
+        pthread_mutex_unlock(&svc->lock);
+
+        for (int i = 0; i < n; i++) {
+            struct tcp_conn *conn = batch[i].tcp;
+            if (!conn || send_tcp_reply(svc, conn, values[i]) < 0) continue;
+            struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = conn };
+            if (epoll_ctl(svc->epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev) < 0) {
+                perror("epoll_ctl");
+                close_tcp_conn(svc, conn);
+            }
+        }
+        pthread_mutex_lock(&svc->batch_lock);
+    }
+    pthread_mutex_unlock(&svc->batch_lock);
+    return NULL;
+}
+
+static int start_batcher(struct rag_service *svc) {
+    const struct rag_service_config *config = svc->config;
+    svc->batch_max = config->batch_max > 0 && config->batch_max < RAG_SERVICE_MAX_BATCH ?
+                     config->batch_max : RAG_SERVICE_MAX_BATCH;
+    if (pthread_create(&svc->batcher, NULL, batcher_thread, svc) != 0) {
+        fprintf(stderr, "Failed to create batcher thread\n");
+        return -1;
+    }
+    svc->batcher_started = 1;
+    return 0;
+}
+
+static int tcp_listen(int port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    if (sock < 0) {
+        perror("socket");
+        return -1;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, SOMAXCONN) < 0) {
+        perror("TCP listener");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// RDMA needs a device and a certificate; without either the service
+// still answers over TCP
+static int init_rdma_side(struct rag_service *svc, int port) {
+    const struct rag_service_config *config = svc->config;
+    if (open_device(&svc->dev_list, &svc->ctx, &svc->pd, &svc->port_attr, &svc->rd_atomic) < 0) {
+        return -1;
+    }
+    if (config->region_size > 0) {
+        if (config->layout_size > RAG_SERVICE_MAX_LAYOUT) {
+            fprintf(stderr, "Layout of %zu bytes exceeds %d\n", config->layout_size, RAG_SERVICE_MAX_LAYOUT);
+            return -1;
+        }
+        // Read-only for clients, so a PROT_READ mapping registers fine
+        svc->region_mr = ibv_reg_mr(svc->pd, (void *)config->region, config->region_size,
+                                    IBV_ACCESS_REMOTE_READ);
+        if (!svc->region_mr) {
+            perror("ibv_reg_mr (published region)");
+            return -1;
+        }
+    }
+    if (config->version) {
+        svc->version_mr = ibv_reg_mr(svc->pd, (void *)config->version, sizeof(uint64_t),
+                                     IBV_ACCESS_REMOTE_READ);
+        if (!svc->version_mr) {
+            perror("ibv_reg_mr (version word)");
+            return -1;
+        }
+    }
+    svc->cq = ibv_create_cq(svc->ctx, CQ_SIZE, NULL, NULL, 0);
+    if (!svc->cq) {
+        fprintf(stderr, "Failed to create CQ\n");
+        return -1;
+    }
+
+    init_openssl();
+    svc->ssl_ctx = create_server_context();
+    if (!svc->ssl_ctx || configure_server_context(svc->ssl_ctx, CERT_FILE, KEY_FILE) < 0) {
+        fprintf(stderr, "TLS setup failed (run 'make generate-cert' first)\n");
+        return -1;
+    }
+    svc->tls_sock = create_tls_listener(port);
+    if (svc->tls_sock < 0) return -1;
+
+    if (pthread_create(&svc->poller, NULL, poller_thread, svc) != 0) {
+        fprintf(stderr, "Failed to create poller thread\n");
+        return -1;
+    }
+    svc->poller_started = 1;
+    return 0;
+}
+
+static void cleanup_service(struct rag_service *svc) {
+    g_running = 0;
+    // Bootstraps use the PD, CQ and epoll set; their socket timeouts
+    // bound the wait
+    pthread_mutex_lock(&svc->lock);
+    while (svc->bootstraps > 0) {
+        pthread_cond_wait(&svc->bootstraps_done, &svc->lock);
+    }
+    pthread_mutex_unlock(&svc->lock);
+    if (svc->batcher_started) pthread_join(svc->batcher, NULL);
+    for (int i = 0; i < svc->num_pending; i++) {
+        if (svc->pending[i].tcp) close_tcp_conn(svc, svc->pending[i].tcp);
+    }
+    free(svc->pending);
+    if (svc->poller_started) pthread_join(svc->poller, NULL);
+    while (svc->conns) {
+        struct rdma_conn *next = svc->conns->next;
+        destroy_rdma_conn(svc->conns);
+        svc->conns = next;
+    }
+    if (svc->cq) ibv_destroy_cq(svc->cq);
+    if (svc->region_mr) ibv_dereg_mr(svc->region_mr);
+    if (svc->version_mr) ibv_dereg_mr(svc->version_mr);
+    if (svc->pd) ibv_dealloc_pd(svc->pd);
+    if (svc->ctx) ibv_close_device(svc->ctx);
+    if (svc->dev_list) ibv_free_device_list(svc->dev_list);
+    if (svc->ssl_ctx) {
+        SSL_CTX_free(svc->ssl_ctx);
+        cleanup_openssl();
+    }
+    if (svc->tls_sock >= 0) close(svc->tls_sock);
+    if (svc->tcp_sock >= 0) close(svc->tcp_sock);
+    if (svc->epoll_fd >= 0) close(svc->epoll_fd);
+    pthread_mutex_destroy(&svc->lock);
+    pthread_cond_destroy(&svc->bootstraps_done);
+    pthread_mutex_destroy(&svc->batch_lock);
+    pthread_cond_destroy(&svc->batch_wake);
+}
+
+int rag_service_run(const struct rag_service_config *config) {
+    struct rag_service svc;
+    memset(&svc, 0, sizeof(svc));
+    svc.config = config;
+    svc.tls_sock = svc.tcp_sock = -1;
+    svc.tls_kind = FD_TLS_LISTEN;
+    svc.tcp_kind = FD_TCP_LISTEN;
+    pthread_mutex_init(&svc.lock, NULL);
+    pthread_cond_init(&svc.bootstraps_done, NULL);
+    pthread_mutex_init(&svc.batch_lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&svc.batch_wake, &attr);
+    pthread_condattr_destroy(&attr);
+    int tls_port = config->tls_port ? config->tls_port : TLS_PORT;
+    int tcp_port = config->tcp_port ? config->tcp_port : RAG_SERVICE_TCP_PORT;
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGPIPE, SIG_IGN);
+
+    svc.epoll_fd = epoll_create1(0);
+    if (svc.epoll_fd < 0 || (config->handle_batch && start_batcher(&svc) < 0)) {
+        if (svc.epoll_fd < 0) perror("epoll_create1");
+        cleanup_service(&svc);
+        return -1;
+    }
+
+    int rdma = init_rdma_side(&svc, tls_port) == 0;
+    if (!rdma) {
+        fprintf(stderr, "RDMA transport unavailable; serving TCP only\n");
+    }
+    svc.tcp_sock = tcp_listen(tcp_port);
+
+    struct epoll_event ev = { .events = EPOLLIN };
+    if (rdma) {
+        ev.data.ptr = &svc.tls_kind;
+        epoll_ctl(svc.epoll_fd, EPOLL_CTL_ADD, svc.tls_sock, &ev);
+    }
+    if (svc.tcp_sock >= 0) {
+        ev.data.ptr = &svc.tcp_kind;
+        epoll_ctl(svc.epoll_fd, EPOLL_CTL_ADD, svc.tcp_sock, &ev);
+    }
+    if (!rdma && svc.tcp_sock < 0) {
+        cleanup_service(&svc);
+        return -1;
+    }
+
+    printf("RAG service ready: RDMA %s, TCP on port %d (%zu-byte queries, %zu-byte results)\n",
+           rdma ? "via TLS bootstrap" : "off", tcp_port, config->query_size, config->result_size);
+    if (rdma) printf("  RDMA bootstrap on TLS port %d\n", tls_port);
+    if (svc.region_mr) {
+        printf("  Published %.2f MB for one-sided reads (rkey 0x%x)\n",
+               config->region_size / (1024.0 * 1024.0), svc.region_mr->rkey);
+    }
+    if (config->handle_batch) {
+        printf("  Batching up to %d queries within %d us\n", svc.batch_max, config->batch_window_us);
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    time_t last_stats = time(NULL);
+    uint64_t last_rdma = 0, last_tcp = 0, last_batches = 0, last_batched = 0, last_due = 0, last_wait = 0;
+    while (g_running) {
+        int nfds = epoll_wait(svc.epoll_fd, events, MAX_EVENTS, 1000);
+        if (nfds < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < nfds; i++) {
+            int kind = *(int *)events[i].data.ptr;
+            if (kind == FD_TLS_LISTEN) {
+                accept_rdma_conn(&svc);
+            } else if (kind == FD_TCP_LISTEN) {
+                accept_tcp_conn(&svc);
+            } else if (kind == FD_TCP_CONN) {
+                serve_tcp_conn(&svc, events[i].data.ptr);
+            } else {
+                // Any TLS activity after setup means the client is done
+                struct rdma_conn *conn = events[i].data.ptr;
+                char byte;
+                if (SSL_read(conn->tls->ssl, &byte, 1) <= 0) {
+                    close_rdma_conn(&svc, conn);
+                }
+            }
+        }
+
+        time_t now = time(NULL);
+        if (now - last_stats >= 10) {
+            pthread_mutex_lock(&svc.lock);
+            uint64_t rdma_queries = svc.rdma_queries, tcp_queries = svc.tcp_queries;
+            int conns = svc.num_rdma_conns - svc.closing_count;
+            pthread_mutex_unlock(&svc.lock);
+            if (rdma_queries != last_rdma || tcp_queries != last_tcp) {
+                printf("Stats: %lu RDMA + %lu TCP queries in the last %lds, %d RDMA connections\n",
+                       rdma_queries - last_rdma, tcp_queries - last_tcp, (long)(now - last_stats), conns);
+            }
+            last_rdma = rdma_queries;
+            last_tcp = tcp_queries;
+            last_stats = now;
+
+            pthread_mutex_lock(&svc.batch_lock);
+            uint64_t batches = svc.batches, batched = svc.batched_queries, due = svc.due_batches;
+            uint64_t wait = svc.batch_wait_us, max_wait = svc.max_batch_wait_us;
+            svc.max_batch_wait_us = 0;
+            pthread_mutex_unlock(&svc.batch_lock);
+            if (batches != last_batches) {
+                printf("  Batching: %lu batches of %.1f queries, %.0f%% sent at the deadline; "
+                       "queue wait %.0f us avg, %lu us max\n", batches - last_batches,
+                       (batched - last_batched) / (double)(batches - last_batches),
+                       100.0 * (due - last_due) / (batches - last_batches),
+                       (wait - last_wait) / (double)(batched - last_batched), max_wait);
+            }
+            last_batches = batches;
+            last_batched = batched;
+            last_due = due;
+            last_wait = wait;
+        }
+    }
+
+    printf("RAG service stopped (%lu RDMA, %lu TCP queries)\n", svc.rdma_queries, svc.tcp_queries);
+    pthread_mutex_lock(&svc.batch_lock);
+    if (svc.batches) {
+        printf("  Batching: %lu batches of %.1f queries, %.0f%% sent at the deadline; queue wait "
+               "%.0f us avg\n",
+               svc.batches, svc.batched_queries / (double)svc.batches,
+               100.0 * svc.due_batches / svc.batches, svc.batch_wait_us / (double)svc.batched_queries);
+    }
+    pthread_mutex_unlock(&svc.batch_lock);
+    cleanup_service(&svc);
+    return 0;
+}
+
+// Client
+
+struct rag_client {
+    int transport;
+    int cancelled;                  // Set by rag_client_cancel from another thread
+    size_t query_size;
+    size_t result_size;
+    char *query;
+    char *result;
+
+    // TCP
+    int fd;
+    char *reply;                    // Handler value, then result
+
+    // RDMA
+    struct tls_connection *tls;
+    struct ibv_device **dev_list;
+    struct ibv_context *ctx;
+    struct ibv_pd *pd;
+    struct ibv_port_attr port_attr;
+    struct ibv_cq *cq;
+    struct ibv_qp *qp;
+    struct ibv_mr *query_mr;
+    struct ibv_mr *result_mr;
+    uint32_t local_psn;
+    uint32_t remote_psn;
+    int rd_atomic;
+
+    // One-sided reads
+    struct rag_region_desc region;
+    char *layout;
+    struct read_buffer *read_buffers;
+    int reads_posted;
+    uint64_t *version_buffer;       // In a read buffer, once first used
+};
+
+struct read_buffer {
+    char *data;
+    size_t size;
+    struct ibv_mr *mr;
+    struct read_buffer *next;
+};
+
+static int check_info(const struct rag_service_info *net, size_t query_size, size_t result_size) {
+    if (ntohl(net->query_size) != query_size || ntohl(net->result_size) != result_size) {
+        fprintf(stderr, "Service speaks %u-byte queries / %u-byte results, client %zu / %zu\n",
+                ntohl(net->query_size), ntohl(net->result_size), query_size, result_size);
+        return -1;
+    }
+    return 0;
+}
+
+static int connect_tcp(struct rag_client *c, const char *host, int port) {
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM }, *res;
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0) {
+        fprintf(stderr, "Failed to resolve %s\n", host);
+        return -1;
+    }
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    int ret = c->fd >= 0 ? connect(c->fd, res->ai_addr, res->ai_addrlen) : -1;
+    freeaddrinfo(res);
+    if (ret < 0) {
+        perror("connect");
+        return -1;
+    }
+    set_nodelay(c->fd);
+
+    struct rag_service_info info;
+    c->reply = malloc(sizeof(uint32_t) + c->result_size);
+    if (!c->reply || recv_all(c->fd, &info, sizeof(info)) < 0 ||
+        check_info(&info, c->query_size, c->result_size) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int connect_rdma(struct rag_client *c, const char *host, int port) {
+    if (open_device(&c->dev_list, &c->ctx, &c->pd, &c->port_attr, &c->rd_atomic) < 0) return -1;
+    c->cq = ibv_create_cq(c->ctx, RAG_CLIENT_MAX_READS + 2, NULL, NULL, 0);
+    struct ibv_qp_init_attr qp_attr = {
+        .send_cq = c->cq,
+        .recv_cq = c->cq,
+        .qp_type = IBV_QPT_RC,
+        .cap = { .max_send_wr = RAG_CLIENT_MAX_READS, .max_recv_wr = 1, .max_send_sge = 1, .max_recv_sge = 1 }
+    };
+    c->qp = c->cq ? ibv_create_qp(c->pd, &qp_attr) : NULL;
+    c->query_mr = ibv_reg_mr(c->pd, c->query, c->query_size, IBV_ACCESS_LOCAL_WRITE);
+    c->result_mr = ibv_reg_mr(c->pd, c->result, c->result_size,
+                              IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE);
+    if (!c->qp || !c->query_mr || !c->result_mr) {
+        fprintf(stderr, "Failed to create RDMA resources\n");
+        return -1;
+    }
+
+    init_openssl();
+    c->tls = connect_tls_server(host, port);
+    if (!c->tls || exchange_psn_client(c->tls, &c->local_psn, &c->remote_psn) < 0) {
+        return -1;
+    }
+    struct rag_service_info info;
+    if (SSL_read(c->tls->ssl, &info, sizeof(info)) != sizeof(info)) {
+        print_ssl_error("Failed to receive service info");
+        return -1;
+    }
+    if (check_info(&info, c->query_size, c->result_size) < 0) return -1;
+
+    struct rdma_conn_params params, remote;
+    if (local_params(c->ctx, &c->port_attr, c->qp, c->local_psn, c->result_mr, c->result, &params) < 0 ||
+        send_rdma_params(c->tls, &params) < 0 || receive_rdma_params(c->tls, &remote) < 0 ||
+        qp_to_init(c->qp, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE) < 0 ||
+        qp_to_rtr(c->qp, &remote, c->remote_psn, &c->port_attr, c->rd_atomic) < 0 ||
+        qp_to_rts(c->qp, c->local_psn, c->rd_atomic) < 0) {
+        return -1;
+    }
+
+    char ready;
+    if (SSL_read(c->tls->ssl, &ready, 1) != 1 ||
+        SSL_read(c->tls->ssl, &c->region, sizeof(c->region)) != sizeof(c->region)) {
+        print_ssl_error("Server did not finish the connection");
+        return -1;
+    }
+    if (c->region.layout_size > RAG_SERVICE_MAX_LAYOUT) {
+        fprintf(stderr, "Server layout too large (%u bytes)\n", c->region.layout_size);
+        return -1;
+    }
+    if (c->region.layout_size > 0) {
+        c->layout = malloc(c->region.layout_size);
+        if (!c->layout ||
+            SSL_read(c->tls->ssl, c->layout, c->region.layout_size) != (int)c->region.layout_size) {
+            print_ssl_error("Failed to receive the region layout");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+struct rag_client* rag_client_connect(int transport, const char *host, int port,
+                                      size_t query_size, size_t result_size) {
+    struct rag_client *c = calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    c->transport = transport;
+    c->query_size = query_size;
+    c->result_size = result_size;
+    c->fd = -1;
+    if (posix_memalign((void **)&c->query, 4096, query_size)) c->query = NULL;
+    if (posix_memalign((void **)&c->result, 4096, result_size)) c->result = NULL;
+    if (!c->query || !c->result) {
+        rag_client_close(c);
+        return NULL;
+    }
+    memset(c->query, 0, query_size);
+    memset(c->result, 0, result_size);
+
+    int ret = transport == RAG_TRANSPORT_RDMA
+        ? connect_rdma(c, host, port ? port : TLS_PORT)
+        : connect_tcp(c, host, port ? port : RAG_SERVICE_TCP_PORT);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to connect to the RAG service at %s over %s\n", host,
+                transport == RAG_TRANSPORT_RDMA ? "RDMA" : "TCP");
+        rag_client_close(c);
+        return NULL;
+    }
+    return c;
+}
+
+void rag_client_close(struct rag_client *c) {
+    if (!c) return;
+    if (c->fd >= 0) close(c->fd);
+    if (c->tls) close_tls_connection(c->tls);
+    if (c->qp) ibv_destroy_qp(c->qp);
+    if (c->query_mr) ibv_dereg_mr(c->query_mr);
+    if (c->result_mr) ibv_dereg_mr(c->result_mr);
+    while (c->read_buffers) {
+        struct read_buffer *next = c->read_buffers->next;
+        ibv_dereg_mr(c->read_buffers->mr);
+        free(c->read_buffers->data);
+        free(c->read_buffers);
+        c->read_buffers = next;
+    }
+    if (c->cq) ibv_destroy_cq(c->cq);
+    if (c->pd) ibv_dealloc_pd(c->pd);
+    if (c->ctx) ibv_close_device(c->ctx);
+    if (c->dev_list) ibv_free_device_list(c->dev_list);
+    free(c->query);
+    free(c->result);
+    free(c->reply);
+    free(c->layout);
+    free(c);
+}
+
+void *rag_client_query(struct rag_client *c) {
+    return c->query;
+}
+
+const void *rag_client_result(const struct rag_client *c) {
+    return c->result;
+}
+
+static int64_t call_tcp(struct rag_client *c) {
+    if (send_all(c->fd, c->query, c->query_size) < 0 ||
+        recv_all(c->fd, c->reply, sizeof(uint32_t) + c->result_size) < 0) {
+        if (!__atomic_load_n(&c->cancelled, __ATOMIC_RELAXED)) fprintf(stderr, "RAG service connection lost\n");
+        return -1;
+    }
+    uint32_t value;
+    memcpy(&value, c->reply, sizeof(value));
+    memcpy(c->result, c->reply + sizeof(uint32_t), c->result_size);
+    return ntohl(value);
+}
+
+static int64_t call_rdma(struct rag_client *c) {
+    // The WRITE_WITH_IMM consumes a receive; it carries no payload
+    struct ibv_recv_wr rwr = { .wr_id = 0, .sg_list = NULL, .num_sge = 0 }, *bad_rwr;
+    struct ibv_sge sge = {
+        .addr = (uintptr_t)c->query,
+        .length = c->query_size,
+        .lkey = c->query_mr->lkey
+    };
+    struct ibv_send_wr swr = {
+        .wr_id = 1,
+        .sg_list = &sge,
+        .num_sge = 1,
+        .opcode = IBV_WR_SEND,
+        .send_flags = IBV_SEND_SIGNALED
+    }, *bad_swr;
+    if (ibv_post_recv(c->qp, &rwr, &bad_rwr) || ibv_post_send(c->qp, &swr, &bad_swr)) {
+        fprintf(stderr, "Failed to post the query\n");
+        return -1;
+    }
+
+    // Both completions, in either order
+    int64_t value = -1;
+    for (int done = 0; done < 2;) {
+        struct ibv_wc wc;
+        int ne = ibv_poll_cq(c->cq, 1, &wc);
+        if (ne < 0) return -1;
+        if (ne == 0) {
+            if (__atomic_load_n(&c->cancelled, __ATOMIC_RELAXED)) return -1;
+            continue;
+        }
+        done++;
+        if (wc.status != IBV_WC_SUCCESS) {
+            fprintf(stderr, "RAG query %s failed: %s\n", wc.wr_id ? "send" : "result",
+                    ibv_wc_status_str(wc.status));
+            return -1;
+        }
+        if (wc.wr_id == 0) value = ntohl(wc.imm_data);
+    }
+    return value;
+}
+
+int64_t rag_client_call(struct rag_client *c) {
+    if (__atomic_load_n(&c->cancelled, __ATOMIC_RELAXED)) return -1;
+    return c->transport == RAG_TRANSPORT_RDMA ? call_rdma(c) : call_tcp(c);
+}
+
+void rag_client_cancel(struct rag_client *c) {
+    __atomic_store_n(&c->cancelled, 1, __ATOMIC_RELAXED);
+    if (c->fd >= 0) shutdown(c->fd, SHUT_RDWR);
+}
+
+const struct rag_region_desc *rag_client_region(const struct rag_client *c, const void **layout) {
+    if (c->transport != RAG_TRANSPORT_RDMA || c->region.size == 0) return NULL;
+    if (layout) *layout = c->layout;
+    return &c->region;
+}
+
+void *rag_client_read_buffer(struct rag_client *c, size_t size) {
+    if (c->transport != RAG_TRANSPORT_RDMA) return NULL;
+    struct read_buffer *buf = calloc(1, sizeof(*buf));
+    if (!buf) return NULL;
+    if (posix_memalign((void **)&buf->data, 4096, size)) {
+        free(buf);
+        return NULL;
+    }
+    buf->size = size;
+    buf->mr = ibv_reg_mr(c->pd, buf->data, size, IBV_ACCESS_LOCAL_WRITE);
+    if (!buf->mr) {
+        perror("ibv_reg_mr (read buffer)");
+        free(buf->data);
+        free(buf);
+        return NULL;
+    }
+    buf->next = c->read_buffers;
+    c->read_buffers = buf;
+    return buf->data;
+}
+
+static int post_rdma_read(struct rag_client *c, uint64_t addr, uint32_t rkey, void *dest, size_t len) {
+    struct read_buffer *buf = c->read_buffers;
+    while (buf && ((char *)dest < buf->data || (char *)dest + len > buf->data + buf->size)) {
+        buf = buf->next;
+    }
+    if (!buf || c->reads_posted >= RAG_CLIENT_MAX_READS) {
+        fprintf(stderr, "Read destination not in a read buffer, or too many reads posted\n");
+        return -1;
+    }
+
+    // The QP holds at most rd_atomic READs at once; the NIC queues the rest
+    struct ibv_sge sge = {
+        .addr = (uintptr_t)dest,
+        .length = len,
+        .lkey = buf->mr->lkey
+    };
+    struct ibv_send_wr wr = {
+        .wr_id = 2,
+        .sg_list = &sge,
+        .num_sge = 1,
+        .opcode = IBV_WR_RDMA_READ,
+        .send_flags = IBV_SEND_SIGNALED
+    }, *bad_wr;
+    wr.wr.rdma.remote_addr = addr;
+    wr.wr.rdma.rkey = rkey;
+    if (ibv_post_send(c->qp, &wr, &bad_wr)) {
+        fprintf(stderr, "Failed to post RDMA READ\n");
+        return -1;
+    }
+    c->reads_posted++;
+    return 0;
+}
+
+int rag_client_read_post(struct rag_client *c, uint64_t offset, void *dest, size_t len) {
+    if (offset > c->region.size || len > c->region.size - offset) {
+        fprintf(stderr, "Read of %zu bytes at %lu is outside the published region\n",
+                len, (unsigned long)offset);
+        return -1;
+    }
+    return post_rdma_read(c, c->region.addr + offset, c->region.rkey, dest, len);
+}
+
+int rag_client_read_wait(struct rag_client *c) {
+    if (c->reads_posted == 0) return -1;
+    struct ibv_wc wc;
+    int ne;
+    while ((ne = ibv_poll_cq(c->cq, 1, &wc)) == 0) {
+    }
+    c->reads_posted--;
+    if (ne < 0 || wc.status != IBV_WC_SUCCESS) {
+        fprintf(stderr, "RDMA READ failed: %s\n", ne < 0 ? "poll error" : ibv_wc_status_str(wc.status));
+        return -1;
+    }
+    return 0;
+}
+
+int rag_client_read_version(struct rag_client *c, uint64_t *version) {
+    if (c->transport != RAG_TRANSPORT_RDMA || c->region.version_addr == 0 || c->reads_posted > 0) {
+        return -1;
+    }
+    if (!c->version_buffer && !(c->version_buffer = rag_client_read_buffer(c, sizeof(uint64_t)))) {
+        return -1;
+    }
+    // The word is aligned and the server updates it with single atomic stores
+    if (post_rdma_read(c, c->region.version_addr, c->region.version_rkey,
+                       c->version_buffer, sizeof(uint64_t)) < 0 ||
+        rag_client_read_wait(c) < 0) {
+        return -1;
+    }
+    *version = *(volatile uint64_t *)c->version_buffer;
+    return 0;
+}
@@ -0,0 +1,128 @@
+#ifndef RAG_SERVICE_H
+#define RAG_SERVICE_H
+
+// Networked query service for the RAG demo, with two transports that
+// carry the same fixed-size query and result structs:
+// - RDMA: the client bootstraps its QP over TLS (PSN exchange and
+//   parameter swap, as the secure server does) and SENDs a query. The
+//   server answers with one RDMA WRITE_WITH_IMM into the client's
+//   registered result slot; the immediate is the handler's return value.
+// - TCP: the query and result go over a plain socket, one at a time.
+// The server runs RDMA only when a device is present; TCP always runs.
+//
+// A server can also publish one memory region for one-sided access:
+// RDMA clients READ it directly, and the server CPU never sees those
+// reads. An optional version word published with it lets those clients
+// notice that the data behind the region has changed.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RAG_SERVICE_TCP_PORT 4434
+#define RAG_SERVICE_RX_DEPTH 4      // Query receives kept posted per connection
+#define RAG_SERVICE_MAX_LAYOUT 4096 // Largest published layout blob
+#define RAG_CLIENT_MAX_READS 16     // One-sided reads in flight per client
+#define RAG_SERVICE_MAX_BATCH 64    // Most queries per handle_batch call
+
+// Sent by the server over TLS after the PSN exchange, so a client built
+// with different structs fails at connect time; network byte order
+struct rag_service_info {
+    uint32_t query_size;
+    uint32_t result_size;
+};
+
+// Sent over TLS once the QP is ready, followed by layout_size bytes of
+// application layout describing the region. Native byte order, like the
+// region's contents.
+struct rag_region_desc {
+    uint64_t addr;
+    uint64_t size;              // 0: nothing published
+    uint32_t rkey;
+    uint32_t layout_size;
+    uint64_t version_addr;      // 0: no version word published
+    uint32_t version_rkey;
+    uint32_t reserved;
+};
+
+// Answer one query into result; the return value reaches the client as
+// the immediate (and as rag_client_call's return value)
+typedef uint32_t (*rag_service_fn)(void *ctx, const void *query, void *result);
+
+// Answer n queries at once: result i and values[i] as rag_service_fn
+// would for query i
+typedef void (*rag_service_batch_fn)(void *ctx, const void *const *queries, void *const *results,
+                                     uint32_t *values, int n);
+
+struct rag_service_config {
+    int tls_port;               // RDMA bootstrap; 0 = TLS_PORT
+    int tcp_port;               // 0 = RAG_SERVICE_TCP_PORT
+    size_t query_size;
+    size_t result_size;
+    rag_service_fn handle;      // Called from one thread at a time
+    void *ctx;
+
+    // Optional batching, in place of handle: queries from every
+    // connection queue up, and a batch goes to handle_batch once
+    // batch_max are waiting or the oldest has waited batch_window_us,
+    // so no query waits longer than the window plus the batch before it
+    rag_service_batch_fn handle_batch;
+    int batch_max;              // 0 = RAG_SERVICE_MAX_BATCH
+    int batch_window_us;
+
+    // Optional region for one-sided READs, registered on the service's PD
+    const void *region;
+    size_t region_size;
+    const void *layout;
+    size_t layout_size;
+    // Optional change counter, READable next to the region; the owner
+    // keeps it at a fixed address and updates it atomically
+    const uint64_t *version;
+};
+
+// Serve until SIGINT / SIGTERM; returns -1 if neither transport starts
+int rag_service_run(const struct rag_service_config *config);
+
+enum rag_transport {
+    RAG_TRANSPORT_RDMA = 0,
+    RAG_TRANSPORT_TCP,
+};
+
+struct rag_client;
+
+// port 0 picks the transport's default
+struct rag_client* rag_client_connect(int transport, const char *host, int port,
+                                      size_t query_size, size_t result_size);
+void rag_client_close(struct rag_client *c);
+
+// Queries are built and results read in place; for RDMA both buffers
+// are registered, so a call copies nothing on the client
+void *rag_client_query(struct rag_client *c);
+const void *rag_client_result(const struct rag_client *c);
+
+// Send the query buffer and wait for the result; returns the handler's
+// value, or -1 on failure
+int64_t rag_client_call(struct rag_client *c);
+
+// Make a call blocked in another thread, and every later one, return -1;
+// only rag_client_close is useful afterwards
+void rag_client_cancel(struct rag_client *c);
+
+// One-sided access (RDMA only). rag_client_region returns the published
+// region, or NULL if there is none, with its layout blob.
+const struct rag_region_desc *rag_client_region(const struct rag_client *c, const void **layout);
+
+// Register another buffer for reads to land in; freed with the client
+void *rag_client_read_buffer(struct rag_client *c, size_t size);
+
+// Post a READ of len bytes at offset in the region into dest, inside a
+// read buffer; at most RAG_CLIENT_MAX_READS may be outstanding, and none
+// during rag_client_call. Reads complete in order, so
+// rag_client_read_wait waits for the oldest. Both return -1 on failure.
+int rag_client_read_post(struct rag_client *c, uint64_t offset, void *dest, size_t len);
+int rag_client_read_wait(struct rag_client *c);
+
+// READ the server's version word, with no other reads outstanding;
+// returns -1 if none is published or the read fails
+int rag_client_read_version(struct rag_client *c, uint64_t *version);
+
+#endif // RAG_SERVICE_H
@@ -0,0 +1,389 @@
+/**
+ * RAG Shard Fan-out
+ * Every replica connection has its own thread, because a service call
+ * blocks until its answer arrives. The coordinator copies the query into
+ * the first idle replica of each shard and wakes its thread. It then
+ * sleeps on one condition variable until every shard has answered or
+ * failed, or until the next hedge or timeout deadline. Each query has a
+ * sequence number, and an answer only counts for the query it belongs
+ * to. A replica whose query timed out finishes that call in its own time
+ * and is idle again afterwards.
+ *
+ * Call latencies go into a per-shard ring. The adaptive hedge delay (the
+ * ring's p95) is recomputed every HEDGE_REFRESH calls, so hedging adds
+ * about 5% more calls to a shard when its latency is steady.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "rag_shard.h"
+#include "rag_service.h"
+
+#define HEDGE_REFRESH 64
+#define HEDGE_MIN_SAMPLES 32        // No adaptive hedging before this many calls
+
+enum { SHARD_PENDING, SHARD_ANSWERED, SHARD_MISSING };
+
+struct rag_shards;
+
+struct replica {
+    struct rag_shards *set;
+    int shard;
+    struct rag_client *client;
+    pthread_t thread;
+    int started;
+    pthread_cond_t wake;
+    int posted;                     // Query copied in, thread not yet started on it
+    int busy;                       // Posted or in a call
+    int broken;                     // A call failed; never asked again
+    uint64_t seq;                   // Query the call belongs to
+    uint64_t sent_us;
+};
+
+struct shard {
+    struct replica replicas[RAG_SHARD_MAX_REPLICAS];
+    int num_replicas;
+    int next;                       // Replica asked first by the next query
+
+    // Current query
+    int state;
+    int inflight;                   // Replicas still working on it
+    int primary;
+    int hedged;
+    char *result;
+    int64_t value;
+
+    uint64_t latency[RAG_SHARD_WINDOW];
+    uint64_t calls;                 // Latencies recorded; the ring holds the last ones
+    uint64_t hedge_us;              // Adaptive delay; 0 until enough calls
+    struct rag_shard_stats stats;
+};
+
+struct rag_shards {
+    struct shard *shards;
+    int num_shards;
+    size_t query_size;
+    size_t result_size;
+    struct rag_shard_params params;
+    pthread_mutex_t lock;
+    pthread_cond_t done;            // A replica finished a call
+    uint64_t seq;
+    int stop;
+};
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Sorted copy of a shard's recent latencies; returns the count
+static size_t sorted_window(const struct shard *sh, uint64_t *out) {
+    size_t n = sh->calls < RAG_SHARD_WINDOW ? sh->calls : RAG_SHARD_WINDOW;
+    memcpy(out, sh->latency, n * sizeof(uint64_t));
+    qsort(out, n, sizeof(uint64_t), compare_u64);
+    return n;
+}
+
+static void record_latency(struct shard *sh, uint64_t us) {
+    sh->latency[sh->calls++ % RAG_SHARD_WINDOW] = us;
+    if (sh->calls >= HEDGE_MIN_SAMPLES && sh->calls % HEDGE_REFRESH == 0) {
+        uint64_t sorted[RAG_SHARD_WINDOW];
+        size_t n = sorted_window(sh, sorted);
+        sh->hedge_us = sorted[n * 95 / 100];
+    }
+}
+
+static void *replica_thread(void *arg) {
+    struct replica *r = arg;
+    struct rag_shards *s = r->set;
+    struct shard *sh = &s->shards[r->shard];
+
+    pthread_mutex_lock(&s->lock);
+    while (1) {
+        while (!r->posted && !s->stop) pthread_cond_wait(&r->wake, &s->lock);
+        if (s->stop) break;
+        r->posted = 0;
+        pthread_mutex_unlock(&s->lock);
+
+        int64_t value = rag_client_call(r->client);
+        uint64_t end = now_us();
+
+        pthread_mutex_lock(&s->lock);
+        r->busy = 0;
+        if (value < 0) {
+            r->broken = 1;
+        } else {
+            record_latency(sh, end - r->sent_us);
+        }
+        if (r->seq == s->seq && sh->state == SHARD_PENDING) {
+            sh->inflight--;
+            if (value >= 0) {
+                memcpy(sh->result, rag_client_result(r->client), s->result_size);
+                sh->value = value;
+                sh->state = SHARD_ANSWERED;
+                sh->stats.answered++;
+                if (r != &sh->replicas[sh->primary]) sh->stats.hedge_wins++;
+            } else if (sh->inflight == 0) {
+                sh->state = SHARD_MISSING;
+                sh->stats.failures++;
+            }
+        }
+        pthread_cond_signal(&s->done);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+// First idle, working replica from the shard's round-robin position
+static int idle_replica(const struct shard *sh) {
+    for (int j = 0; j < sh->num_replicas; j++) {
+        int i = (sh->next + j) % sh->num_replicas;
+        if (!sh->replicas[i].busy && !sh->replicas[i].broken) return i;
+    }
+    return -1;
+}
+
+static void post_query(struct rag_shards *s, struct shard *sh, int i, const void *query) {
+    struct replica *r = &sh->replicas[i];
+    memcpy(rag_client_query(r->client), query, s->query_size);
+    r->seq = s->seq;
+    r->sent_us = now_us();
+    r->posted = r->busy = 1;
+    sh->inflight++;
+    pthread_cond_signal(&r->wake);
+}
+
+// host[:port] from the len bytes at p
+static struct rag_client *connect_replica(const char *p, size_t len, int transport,
+                                          size_t query_size, size_t result_size) {
+    char host[256];
+    if (len == 0 || len >= sizeof(host)) {
+        fprintf(stderr, "Bad shard address '%.*s'\n", (int)len, p);
+        return NULL;
+    }
+    memcpy(host, p, len);
+    host[len] = '\0';
+    int port = 0;
+    char *colon = strrchr(host, ':');
+    if (colon) {
+        char *end;
+        port = strtol(colon + 1, &end, 10);
+        if (*end || port <= 0 || port > 65535) {
+            fprintf(stderr, "Bad port in shard address '%s'\n", host);
+            return NULL;
+        }
+        *colon = '\0';
+    }
+    return rag_client_connect(transport, host, port, query_size, result_size);
+}
+
+struct rag_shards* rag_shards_connect(const char *spec, int transport, size_t query_size,
+                                      size_t result_size, const struct rag_shard_params *params) {
+    int num_shards = 1;
+    for (const char *p = spec; *p; p++) num_shards += *p == ',';
+    if (num_shards > RAG_SHARD_MAX) {
+        fprintf(stderr, "At most %d shards\n", RAG_SHARD_MAX);
+        return NULL;
+    }
+
+    struct rag_shards *s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    s->shards = calloc(num_shards, sizeof(struct shard));
+    s->query_size = query_size;
+    s->result_size = result_size;
+    s->params = *params;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s->done, &attr);
+    pthread_condattr_destroy(&attr);
+    if (!s->shards) {
+        rag_shards_close(s);
+        return NULL;
+    }
+
+    const char *p = spec;
+    for (int i = 0; i < num_shards; i++) {
+        struct shard *sh = &s->shards[s->num_shards++];
+        sh->result = malloc(result_size);
+        if (!sh->result) {
+            rag_shards_close(s);
+            return NULL;
+        }
+        const char *end = p + strcspn(p, ",");
+        while (p <= end) {
+            size_t len = strcspn(p, ",|");
+            if (sh->num_replicas == RAG_SHARD_MAX_REPLICAS) {
+                fprintf(stderr, "At most %d replicas per shard\n", RAG_SHARD_MAX_REPLICAS);
+                rag_shards_close(s);
+                return NULL;
+            }
+            struct replica *r = &sh->replicas[sh->num_replicas];
+            r->client = connect_replica(p, len, transport, query_size, result_size);
+            if (!r->client) {
+                rag_shards_close(s);
+                return NULL;
+            }
+            r->set = s;
+            r->shard = i;
+            pthread_cond_init(&r->wake, NULL);
+            sh->num_replicas++;
+            if (pthread_create(&r->thread, NULL, replica_thread, r) != 0) {
+                fprintf(stderr, "Failed to start a shard connection thread\n");
+                rag_shards_close(s);
+                return NULL;
+            }
+            r->started = 1;
+            p += len + 1;
+        }
+    }
+    return s;
+}
+
+void rag_shards_close(struct rag_shards *s) {
+    if (!s) return;
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    for (int i = 0; i < s->num_shards; i++) {
+        for (int j = 0; j < s->shards[i].num_replicas; j++) {
+            struct replica *r = &s->shards[i].replicas[j];
+            // A call that timed out may never return on its own
+            if (r->busy) rag_client_cancel(r->client);
+            pthread_cond_signal(&r->wake);
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    for (int i = 0; i < s->num_shards; i++) {
+        struct shard *sh = &s->shards[i];
+        for (int j = 0; j < sh->num_replicas; j++) {
+            struct replica *r = &sh->replicas[j];
+            if (r->started) pthread_join(r->thread, NULL);
+            pthread_cond_destroy(&r->wake);
+            rag_client_close(r->client);
+        }
+        free(sh->result);
+    }
+    pthread_cond_destroy(&s->done);
+    pthread_mutex_destroy(&s->lock);
+    free(s->shards);
+    free(s);
+}
+
+void rag_shards_set_params(struct rag_shards *s, const struct rag_shard_params *params) {
+    pthread_mutex_lock(&s->lock);
+    s->params = *params;
+    pthread_mutex_unlock(&s->lock);
+}
+
+int rag_shards_count(const struct rag_shards *s) {
+    return s->num_shards;
+}
+
+// When to ask a second replica, relative to the query's start; 0 = never
+static uint64_t hedge_delay(const struct rag_shards *s, const struct shard *sh) {
+    if (sh->num_replicas < 2 || s->params.hedge_us < 0) return 0;
+    return s->params.hedge_us > 0 ? (uint64_t)s->params.hedge_us : sh->hedge_us;
+}
+
+int rag_shards_call(struct rag_shards *s, const void *query, const void **results, int64_t *values) {
+    pthread_mutex_lock(&s->lock);
+    s->seq++;
+    uint64_t start = now_us();
+    for (int i = 0; i < s->num_shards; i++) {
+        struct shard *sh = &s->shards[i];
+        sh->stats.queries++;
+        sh->inflight = 0;
+        sh->hedged = 0;
+        sh->state = SHARD_PENDING;
+        int r = idle_replica(sh);
+        if (r < 0) {
+            sh->state = SHARD_MISSING;
+            sh->stats.failures++;
+            continue;
+        }
+        sh->primary = r;
+        sh->next = (r + 1) % sh->num_replicas;
+        post_query(s, sh, r, query);
+    }
+
+    uint64_t deadline = s->params.timeout_us > 0 ? start + s->params.timeout_us : 0;
+    while (1) {
+        uint64_t now = now_us(), wake = deadline;
+        int pending = 0;
+        for (int i = 0; i < s->num_shards; i++) {
+            struct shard *sh = &s->shards[i];
+            if (sh->state != SHARD_PENDING) continue;
+            pending++;
+            uint64_t delay = hedge_delay(s, sh);
+            if (sh->hedged || delay == 0) continue;
+            if (now >= start + delay) {
+                // With no replica free, the query stays with the first
+                int r = idle_replica(sh);
+                if (r >= 0) {
+                    post_query(s, sh, r, query);
+                    sh->stats.hedges++;
+                }
+                sh->hedged = 1;
+            } else if (wake == 0 || start + delay < wake) {
+                wake = start + delay;
+            }
+        }
+        if (pending == 0) break;
+        if (deadline && now >= deadline) {
+            for (int i = 0; i < s->num_shards; i++) {
+                if (s->shards[i].state != SHARD_PENDING) continue;
+                s->shards[i].state = SHARD_MISSING;
+                s->shards[i].stats.timeouts++;
+            }
+            break;
+        }
+        if (wake) {
+            struct timespec ts = { wake / 1000000, (wake % 1000000) * 1000 };
+            pthread_cond_timedwait(&s->done, &s->lock, &ts);
+        } else {
+            pthread_cond_wait(&s->done, &s->lock);
+        }
+    }
+
+    int answered = 0;
+    for (int i = 0; i < s->num_shards; i++) {
+        struct shard *sh = &s->shards[i];
+        int ok = sh->state == SHARD_ANSWERED;
+        results[i] = ok ? sh->result : NULL;
+        values[i] = ok ? sh->value : -1;
+        answered += ok;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return answered;
+}
+
+void rag_shards_stats(struct rag_shards *s, int shard, struct rag_shard_stats *stats) {
+    uint64_t sorted[RAG_SHARD_WINDOW];
+    pthread_mutex_lock(&s->lock);
+    const struct shard *sh = &s->shards[shard];
+    *stats = sh->stats;
+    size_t n = sorted_window(sh, sorted);
+    stats->p50_us = n ? sorted[n / 2] : 0;
+    stats->p95_us = n ? sorted[n * 95 / 100] : 0;
+    stats->p99_us = n ? sorted[n * 99 / 100] : 0;
+    pthread_mutex_unlock(&s->lock);
+}
+
+void rag_shards_reset_stats(struct rag_shards *s) {
+    pthread_mutex_lock(&s->lock);
+    for (int i = 0; i < s->num_shards; i++) {
+        memset(&s->shards[i].stats, 0, sizeof(struct rag_shard_stats));
+    }
+    pthread_mutex_unlock(&s->lock);
+}
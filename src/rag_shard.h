@@ -0,0 +1,64 @@
+#ifndef RAG_SHARD_H
+#define RAG_SHARD_H
+
+// Scatter-gather over query service instances (rag_service.h), for a
+// coordinator in front of a corpus split across servers. Every query
+// goes to each shard at once; a shard that has not answered within the
+// timeout is left out of that query's answers. A shard may have
+// replicas: if the one asked is slower than the hedge delay, the query
+// is also sent to an idle replica and the first answer wins. Merging
+// the answers is up to the caller.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RAG_SHARD_MAX 64
+#define RAG_SHARD_MAX_REPLICAS 4
+#define RAG_SHARD_WINDOW 1024       // Recent latencies kept per shard
+
+struct rag_shard_params {
+    int timeout_us;                 // Give up on a shard after this; 0 = wait
+    int hedge_us;                   // Ask a replica after this; 0 = the shard's
+                                    // recent p95, < 0 = never
+};
+
+struct rag_shards;
+
+// spec lists shards separated by ',' and a shard's replicas by '|', each
+// host[:port], e.g. "10.0.0.1:4434|10.0.0.2:4434,10.0.0.3:4434". Every
+// replica gets one connection over transport (enum rag_transport); port
+// 0 picks the transport's default. Returns NULL if any fails to connect.
+struct rag_shards* rag_shards_connect(const char *spec, int transport, size_t query_size,
+                                      size_t result_size, const struct rag_shard_params *params);
+void rag_shards_close(struct rag_shards *s);
+
+// Takes effect from the next call
+void rag_shards_set_params(struct rag_shards *s, const struct rag_shard_params *params);
+
+int rag_shards_count(const struct rag_shards *s);
+
+// Send query to every shard and wait for each to answer, fail or time
+// out. results[i] is shard i's result and values[i] its handler value,
+// or NULL and -1 if it gave none; results stay valid until the next
+// call. A replica still busy with a query that timed out is not asked
+// again until it answers. Returns the number of shards that answered.
+int rag_shards_call(struct rag_shards *s, const void *query, const void **results, int64_t *values);
+
+struct rag_shard_stats {
+    uint64_t queries;
+    uint64_t answered;
+    uint64_t timeouts;
+    uint64_t failures;              // Connection lost, or no replica free
+    uint64_t hedges;                // Queries also sent to a second replica
+    uint64_t hedge_wins;            // ... and answered by it first
+    uint64_t p50_us;                // Answer latency over the recent window
+    uint64_t p95_us;
+    uint64_t p99_us;
+};
+
+void rag_shards_stats(struct rag_shards *s, int shard, struct rag_shard_stats *stats);
+
+// Zero the counters; the latency window, and so the hedge delays, stay
+void rag_shards_reset_stats(struct rag_shards *s);
+
+#endif // RAG_SHARD_H
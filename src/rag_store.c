@@ -0,0 +1,972 @@
+/**
+ * RAG Mutable Store
+ * There is a single writer at a time (write_lock), and readers take no
+ * lock at all. A reader pins itself by writing the global epoch into a
+ * free slot, then loads the view pointer. A writer that replaces an
+ * object first swaps the pointer, then retires the object at the epoch
+ * it advances past. The object is freed once every pinned slot shows a
+ * later epoch. Both sides use sequentially consistent operations. So
+ * either the writer's slot scan sees the reader's pin, or the reader
+ * loads the new pointer.
+ *
+ * Segment rows below the published count never change. Updates append
+ * rather than overwrite, so readers always see whole vectors. A row's
+ * tombstone bit is only ever set, never cleared.
+ *
+ * Compaction has three steps. First the current segments are sealed,
+ * and later inserts go to a fresh segment. Then, with no lock held, the
+ * live rows are copied into a new base. Finally, under the lock, rows
+ * that died during the copy are re-tombstoned and the new view is
+ * swapped in. While the background compactor runs, writers that append
+ * wait once the segments hold STORE_BACKLOG compaction thresholds, so a
+ * writer that outpaces it cannot grow the segments (and every scan)
+ * without bound.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include "rag_store.h"
+#include "rag_kernels.h"
+
+#define STORE_SCAN_BLOCK 256
+#define STORE_SEED 0x5704eu
+
+struct reader_slot {
+    uint64_t epoch;                 // 0: free
+    char pad[56];                   // One cache line per slot
+};
+
+struct store_base {
+    float *vectors;
+    int *ids;
+    char *meta;
+    uint64_t *dead;
+    size_t count;
+    int owned;                      // vectors/ids/meta were allocated here
+};
+
+// Where an id's live row is; writer-side only
+struct row_loc {
+    struct rag_segment *seg;        // NULL: base row
+    long row;                       // -1: deleted
+};
+
+#define STORE_BACKLOG 4
+
+struct limbo {
+    uint64_t epoch;
+    void (*release)(void *);
+    void *object;
+    struct limbo *next;
+};
+
+struct rag_store {
+    int dim;
+    size_t meta_size;
+    struct rag_store_view *view;    // Current; swapped atomically
+    uint64_t version;
+    uint64_t epoch;
+    struct reader_slot slots[RAG_STORE_MAX_READERS];
+
+    // Writer state, under write_lock
+    pthread_mutex_t write_lock;
+    pthread_mutex_t compact_lock;   // One compaction at a time
+    struct store_base *base;
+    struct row_loc *rows;
+    size_t num_ids, max_ids;
+    uint64_t *deleted;              // Deleted original ids; read by anyone
+    size_t num_original;
+    size_t dead_rows;               // Tombstones in the current view
+    struct limbo *limbo;
+    int compaction_allowed;
+    uint64_t compactions;
+    uint64_t reclaimed;
+
+    pthread_t compactor;
+    pthread_cond_t wake;
+    pthread_cond_t drained;         // Signalled when a compaction swaps in
+    int compactor_running;
+    int compactor_cpus;
+    int stopping;
+    double ratio;
+};
+
+// The pin this thread holds; one store at a time
+static __thread struct rag_store *pin_store;
+static __thread int pin_slot = -1;
+static __thread int pin_depth;
+
+static size_t bitmap_words(size_t bits) {
+    return (bits + 63) / 64;
+}
+
+static void set_bit(uint64_t *bits, size_t i) {
+    __atomic_fetch_or(&bits[i / 64], 1ULL << (i % 64), __ATOMIC_RELEASE);
+}
+
+static struct rag_segment *segment_create(int dim, size_t meta_size) {
+    struct rag_segment *seg = calloc(1, sizeof(*seg));
+    if (!seg) return NULL;
+    seg->vectors = malloc((size_t)RAG_STORE_SEGMENT * dim * sizeof(float));
+    seg->ids = malloc(RAG_STORE_SEGMENT * sizeof(int));
+    seg->meta = calloc(RAG_STORE_SEGMENT, meta_size ? meta_size : 1);
+    seg->dead = calloc(bitmap_words(RAG_STORE_SEGMENT), sizeof(uint64_t));
+    if (!seg->vectors || !seg->ids || !seg->meta || !seg->dead) {
+        free(seg->vectors);
+        free(seg->ids);
+        free(seg->meta);
+        free(seg->dead);
+        free(seg);
+        return NULL;
+    }
+    return seg;
+}
+
+static void segment_free(void *object) {
+    struct rag_segment *seg = object;
+    free(seg->vectors);
+    free(seg->ids);
+    free(seg->meta);
+    free(seg->dead);
+    free(seg);
+}
+
+static void base_free(void *object) {
+    struct store_base *b = object;
+    if (b->owned) {
+        free(b->vectors);
+        free(b->ids);
+        free(b->meta);
+    }
+    free(b->dead);
+    free(b);
+}
+
+// A view of b and num_segments segments, the first copied of which come
+// from segments (the caller fills in the rest)
+static struct rag_store_view *view_create(const struct store_base *b, struct rag_segment **segments,
+                                          int copied, int num_segments) {
+    struct rag_store_view *v = malloc(sizeof(*v) + num_segments * sizeof(struct rag_segment *));
+    if (!v) return NULL;
+    v->base = b->vectors;
+    v->base_count = b->count;
+    v->base_ids = b->ids;
+    v->base_meta = b->meta;
+    v->base_dead = b->dead;
+    v->num_segments = num_segments;
+    v->segments = (struct rag_segment **)(v + 1);
+    if (copied) memcpy(v->segments, segments, copied * sizeof(struct rag_segment *));
+    return v;
+}
+
+// Caller holds write_lock
+static void retire(struct rag_store *s, void (*release)(void *), void *object) {
+    struct limbo *l = malloc(sizeof(*l));
+    if (!l) {
+        // Leaking is safe; freeing early is not
+        fprintf(stderr, "Store: cannot retire object, leaking it\n");
+        return;
+    }
+    l->epoch = __atomic_fetch_add(&s->epoch, 1, __ATOMIC_SEQ_CST);
+    l->release = release;
+    l->object = object;
+    l->next = s->limbo;
+    s->limbo = l;
+}
+
+// Free retired objects no pinned reader can still see; caller holds write_lock
+static void reclaim(struct rag_store *s) {
+    uint64_t oldest = UINT64_MAX;
+    for (int i = 0; i < RAG_STORE_MAX_READERS; i++) {
+        uint64_t e = __atomic_load_n(&s->slots[i].epoch, __ATOMIC_SEQ_CST);
+        if (e && e < oldest) oldest = e;
+    }
+    struct limbo **link = &s->limbo;
+    while (*link) {
+        struct limbo *l = *link;
+        if (l->epoch < oldest) {
+            *link = l->next;
+            l->release(l->object);
+            free(l);
+            s->reclaimed++;
+        } else {
+            link = &l->next;
+        }
+    }
+}
+
+static void publish(struct rag_store *s, struct rag_store_view *v) {
+    struct rag_store_view *old = __atomic_exchange_n(&s->view, v, __ATOMIC_SEQ_CST);
+    if (old) retire(s, free, old);
+}
+
+static void bump_version(struct rag_store *s) {
+    __atomic_add_fetch(&s->version, 1, __ATOMIC_RELEASE);
+}
+
+struct rag_store* rag_store_create(const float *base, size_t count, int dim, size_t meta_size) {
+    struct rag_store *s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    s->dim = dim;
+    s->meta_size = meta_size;
+    s->epoch = 1;
+    s->compaction_allowed = 1;
+    pthread_mutex_init(&s->write_lock, NULL);
+    pthread_mutex_init(&s->compact_lock, NULL);
+    pthread_cond_init(&s->wake, NULL);
+    pthread_cond_init(&s->drained, NULL);
+
+    s->base = calloc(1, sizeof(*s->base));
+    s->max_ids = count > RAG_STORE_SEGMENT ? count : RAG_STORE_SEGMENT;
+    s->rows = malloc(s->max_ids * sizeof(*s->rows));
+    struct rag_segment *seg = segment_create(dim, meta_size);
+    s->deleted = calloc(bitmap_words(count) + 1, sizeof(uint64_t));
+    if (!s->base || !s->rows || !seg || !s->deleted ||
+        !(s->base->dead = calloc(bitmap_words(count) + 1, sizeof(uint64_t)))) {
+        fprintf(stderr, "Failed to allocate vector store\n");
+        if (seg) segment_free(seg);
+        rag_store_destroy(s);
+        return NULL;
+    }
+    s->base->vectors = (float *)base;
+    s->base->count = count;
+    for (size_t i = 0; i < count; i++) {
+        s->rows[i].seg = NULL;
+        s->rows[i].row = i;
+    }
+    s->num_ids = count;
+    s->num_original = count;
+
+    s->view = view_create(s->base, &seg, 1, 1);
+    if (!s->view) {
+        segment_free(seg);
+        rag_store_destroy(s);
+        return NULL;
+    }
+    return s;
+}
+
+void rag_store_destroy(struct rag_store *s) {
+    if (!s) return;
+    if (s->compactor_running) {
+        pthread_mutex_lock(&s->write_lock);
+        s->stopping = 1;
+        pthread_cond_signal(&s->wake);
+        pthread_cond_broadcast(&s->drained);
+        pthread_mutex_unlock(&s->write_lock);
+        pthread_join(s->compactor, NULL);
+    }
+    if (s->view) {
+        for (int i = 0; i < s->view->num_segments; i++) segment_free(s->view->segments[i]);
+        free(s->view);
+    }
+    while (s->limbo) {
+        struct limbo *l = s->limbo;
+        s->limbo = l->next;
+        l->release(l->object);
+        free(l);
+    }
+    if (s->base) base_free(s->base);
+    free(s->rows);
+    free(s->deleted);
+    pthread_cond_destroy(&s->wake);
+    pthread_cond_destroy(&s->drained);
+    pthread_mutex_destroy(&s->compact_lock);
+    pthread_mutex_destroy(&s->write_lock);
+    free(s);
+}
+
+const struct rag_store_view *rag_store_enter(struct rag_store *s) {
+    if (pin_depth++ > 0) {
+        if (pin_store != s) {
+            fprintf(stderr, "Store: thread already pins another store\n");
+        }
+        return __atomic_load_n(&s->view, __ATOMIC_SEQ_CST);
+    }
+    // Claim any free slot; readers beyond the slot count wait for one
+    int i = ((uintptr_t)&pin_slot / 64) % RAG_STORE_MAX_READERS;
+    for (;; i = (i + 1) % RAG_STORE_MAX_READERS) {
+        uint64_t free_epoch = 0;
+        uint64_t epoch = __atomic_load_n(&s->epoch, __ATOMIC_SEQ_CST);
+        if (__atomic_compare_exchange_n(&s->slots[i].epoch, &free_epoch, epoch, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            pin_slot = i;
+            break;
+        }
+        if (i == RAG_STORE_MAX_READERS - 1) sched_yield();
+    }
+    pin_store = s;
+    return __atomic_load_n(&s->view, __ATOMIC_SEQ_CST);
+}
+
+void rag_store_exit(struct rag_store *s) {
+    if (--pin_depth > 0) return;
+    __atomic_store_n(&s->slots[pin_slot].epoch, 0, __ATOMIC_RELEASE);
+    pin_slot = -1;
+    pin_store = NULL;
+}
+
+void rag_store_mask_base(const struct rag_store_view *v, size_t row, float *scores, int n) {
+    // One bitmap word at a time; live words are skipped whole
+    for (int i = 0; i < n;) {
+        size_t r = row + i;
+        uint64_t word = __atomic_load_n(&v->base_dead[r / 64], __ATOMIC_RELAXED) >> (r % 64);
+        int span = 64 - r % 64;
+        if (span > n - i) span = n - i;
+        for (int b = 0; word && b < span; b++, word >>= 1) {
+            if (word & 1) scores[i + b] = -__builtin_inff();
+        }
+        i += span;
+    }
+}
+
+void rag_store_scan_segments(const struct rag_store_view *v, const float *query, int dim,
+                             const uint64_t *id_filter, size_t filter_bits, struct rag_topk *topk) {
+    float tile[STORE_SCAN_BLOCK];
+    for (int s = 0; s < v->num_segments; s++) {
+        const struct rag_segment *seg = v->segments[s];
+        size_t rows = rag_segment_rows(seg);
+        size_t first = v->base_count + (size_t)s * RAG_STORE_SEGMENT;
+        if (id_filter) {
+            // Only rows the filter allows are scored
+            for (size_t j = 0; j < rows; j++) {
+                size_t id = seg->ids[j];
+                if (id >= filter_bits || !((id_filter[id / 64] >> (id % 64)) & 1) ||
+                    rag_store_bit(seg->dead, j)) {
+                    continue;
+                }
+                rag_topk_push(topk, rag_dot(query, seg->vectors + j * dim, dim), first + j);
+            }
+            continue;
+        }
+        for (size_t j = 0; j < rows; j += STORE_SCAN_BLOCK) {
+            int n = rows - j < STORE_SCAN_BLOCK ? rows - j : STORE_SCAN_BLOCK;
+            rag_dot_tile(query, 1, seg->vectors + j * dim, n, dim, tile, STORE_SCAN_BLOCK);
+            for (int i = 0; i < n; i++) {
+                if (rag_store_bit(seg->dead, j + i)) tile[i] = -__builtin_inff();
+            }
+            rag_topk_push_block(topk, tile, n, first + j);
+        }
+    }
+}
+
+static const struct rag_segment *row_segment(const struct rag_store_view *v, size_t row, size_t *j) {
+    size_t s = (row - v->base_count) / RAG_STORE_SEGMENT;
+    *j = (row - v->base_count) % RAG_STORE_SEGMENT;
+    return s < (size_t)v->num_segments ? v->segments[s] : NULL;
+}
+
+int rag_store_row_id(const struct rag_store_view *v, size_t row) {
+    if (row < v->base_count) return v->base_ids ? v->base_ids[row] : (int)row;
+    size_t j;
+    const struct rag_segment *seg = row_segment(v, row, &j);
+    return seg ? seg->ids[j] : -1;
+}
+
+const float *rag_store_row_vector(const struct rag_store_view *v, size_t row, int dim) {
+    if (row < v->base_count) return v->base + row * dim;
+    size_t j;
+    const struct rag_segment *seg = row_segment(v, row, &j);
+    return seg ? seg->vectors + j * dim : NULL;
+}
+
+const char *rag_store_row_meta(const struct rag_store *s, const struct rag_store_view *v, size_t row) {
+    const char *meta = NULL;
+    if (!s->meta_size) return NULL;
+    if (row < v->base_count) {
+        meta = v->base_meta ? v->base_meta + row * s->meta_size : NULL;
+    } else {
+        size_t j;
+        const struct rag_segment *seg = row_segment(v, row, &j);
+        meta = seg ? seg->meta + j * s->meta_size : NULL;
+    }
+    return meta && meta[0] ? meta : NULL;
+}
+
+// Append one row to the open segment, starting a new one when it is full;
+// caller holds write_lock. Returns the row's location.
+// Copies meta_len bytes of meta (at most meta_size) into the new row
+static int append_row(struct rag_store *s, int id, const float *vector, const char *meta,
+                      size_t meta_len, struct row_loc *loc) {
+    struct rag_store_view *v = s->view;
+    struct rag_segment *seg = v->segments[v->num_segments - 1];
+    if (seg->count == RAG_STORE_SEGMENT) {
+        seg = segment_create(s->dim, s->meta_size);
+        struct rag_store_view *next = seg ? view_create(s->base, v->segments, v->num_segments,
+                                                           v->num_segments + 1) : NULL;
+        if (!next) {
+            if (seg) segment_free(seg);
+            fprintf(stderr, "Store: failed to grow\n");
+            return -1;
+        }
+        next->segments[v->num_segments] = seg;
+        publish(s, next);
+    }
+
+    size_t j = seg->count;
+    memcpy(seg->vectors + j * s->dim, vector, s->dim * sizeof(float));
+    seg->ids[j] = id;
+    if (meta && s->meta_size) {
+        memcpy(seg->meta + j * s->meta_size, meta, meta_len < s->meta_size ? meta_len : s->meta_size);
+    }
+    // Publishes the row written above
+    __atomic_store_n(&seg->count, j + 1, __ATOMIC_RELEASE);
+    loc->seg = seg;
+    loc->row = j;
+    return 0;
+}
+
+static const char *loc_meta(const struct rag_store *s, const struct row_loc *loc) {
+    if (!s->meta_size) return NULL;
+    if (loc->seg) return loc->seg->meta + loc->row * s->meta_size;
+    return s->base->meta ? s->base->meta + loc->row * s->meta_size : NULL;
+}
+
+static void kill_row(struct rag_store *s, struct row_loc *loc) {
+    set_bit(loc->seg ? loc->seg->dead : s->base->dead, loc->row);
+    loc->row = -1;
+    s->dead_rows++;
+}
+
+static size_t segment_rows_locked(const struct rag_store *s) {
+    size_t rows = 0;
+    for (int i = 0; i < s->view->num_segments; i++) rows += s->view->segments[i]->count;
+    return rows;
+}
+
+static double compaction_limit(const struct rag_store *s) {
+    return s->ratio * (s->base->count > RAG_STORE_SEGMENT ? s->base->count : RAG_STORE_SEGMENT);
+}
+
+static int needs_compaction(const struct rag_store *s) {
+    double limit = compaction_limit(s);
+    return s->compaction_allowed && (s->dead_rows > limit || segment_rows_locked(s) > limit);
+}
+
+static void wake_compactor(struct rag_store *s) {
+    if (s->compactor_running) pthread_cond_signal(&s->wake);
+}
+
+// Called with write_lock held before appending a row
+static void throttle(struct rag_store *s) {
+    while (s->compactor_running && s->compaction_allowed && !s->stopping &&
+           segment_rows_locked(s) > STORE_BACKLOG * compaction_limit(s)) {
+        wake_compactor(s);
+        pthread_cond_wait(&s->drained, &s->write_lock);
+    }
+}
+
+int rag_store_insert(struct rag_store *s, const float *vector, const char *meta) {
+    pthread_mutex_lock(&s->write_lock);
+    throttle(s);
+    int id = -1;
+    if (s->num_ids == s->max_ids) {
+        struct row_loc *rows = realloc(s->rows, 2 * s->max_ids * sizeof(*rows));
+        if (!rows) goto out;
+        s->rows = rows;
+        s->max_ids *= 2;
+    }
+    size_t meta_len = meta && s->meta_size ? strnlen(meta, s->meta_size - 1) : 0;
+    if (append_row(s, s->num_ids, vector, meta, meta_len, &s->rows[s->num_ids]) == 0) {
+        id = s->num_ids++;
+        bump_version(s);
+        wake_compactor(s);
+    }
+out:
+    reclaim(s);
+    pthread_mutex_unlock(&s->write_lock);
+    return id;
+}
+
+int rag_store_update(struct rag_store *s, int id, const float *vector) {
+    pthread_mutex_lock(&s->write_lock);
+    throttle(s);
+    int ret = -1;
+    if (id >= 0 && (size_t)id < s->num_ids && s->rows[id].row >= 0) {
+        // Readers may briefly see both versions, never neither
+        struct row_loc old = s->rows[id], fresh;
+        // The old row stays allocated under write_lock, so its metadata
+        // is copied whole straight into the new one
+        if (append_row(s, id, vector, loc_meta(s, &old), s->meta_size, &fresh) == 0) {
+            kill_row(s, &old);
+            s->rows[id] = fresh;
+            bump_version(s);
+            wake_compactor(s);
+            ret = 0;
+        }
+    }
+    reclaim(s);
+    pthread_mutex_unlock(&s->write_lock);
+    return ret;
+}
+
+int rag_store_delete(struct rag_store *s, int id) {
+    pthread_mutex_lock(&s->write_lock);
+    int ret = -1;
+    if (id >= 0 && (size_t)id < s->num_ids && s->rows[id].row >= 0) {
+        kill_row(s, &s->rows[id]);
+        if ((size_t)id < s->num_original) set_bit(s->deleted, id);
+        bump_version(s);
+        wake_compactor(s);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&s->write_lock);
+    return ret;
+}
+
+int rag_store_id_deleted(const struct rag_store *s, int id) {
+    return id >= 0 && (size_t)id < s->num_original && rag_store_bit(s->deleted, id);
+}
+
+uint64_t rag_store_version(const struct rag_store *s) {
+    return __atomic_load_n(&s->version, __ATOMIC_ACQUIRE);
+}
+
+const uint64_t *rag_store_version_word(const struct rag_store *s) {
+    return &s->version;
+}
+
+static size_t count_bits(const uint64_t *bits, size_t n) {
+    size_t total = 0;
+    for (size_t w = 0; w < bitmap_words(n); w++) {
+        uint64_t word = __atomic_load_n(&bits[w], __ATOMIC_RELAXED);
+        if (n % 64 && w == n / 64) word &= (1ULL << (n % 64)) - 1;
+        total += __builtin_popcountll(word);
+    }
+    return total;
+}
+
+// Rows a compaction folds: the base and the first num_sealed segments
+struct fold {
+    const struct store_base *base;
+    struct rag_segment **sealed;
+    int num_sealed;
+};
+
+static size_t fold_rows(const struct fold *f) {
+    size_t rows = f->base->count;
+    for (int i = 0; i < f->num_sealed; i++) rows += f->sealed[i]->count;
+    return rows;
+}
+
+static int fold_dead(const struct fold *f, size_t row, struct row_loc *loc) {
+    if (row < f->base->count) {
+        loc->seg = NULL;
+        loc->row = row;
+        return rag_store_bit(f->base->dead, row);
+    }
+    row -= f->base->count;
+    for (int i = 0;; i++) {
+        if (row < f->sealed[i]->count) {
+            loc->seg = f->sealed[i];
+            loc->row = row;
+            return rag_store_bit(loc->seg->dead, row);
+        }
+        row -= f->sealed[i]->count;
+    }
+}
+
+int rag_store_compact(struct rag_store *s) {
+    pthread_mutex_lock(&s->compact_lock);
+
+    // Seal: every current segment is folded, new rows go to a fresh one
+    pthread_mutex_lock(&s->write_lock);
+    if (!s->compaction_allowed) {
+        pthread_mutex_unlock(&s->write_lock);
+        pthread_mutex_unlock(&s->compact_lock);
+        return -1;
+    }
+    struct rag_store_view *v = s->view;
+    struct fold f = { s->base, NULL, v->num_segments };
+    f.sealed = malloc(f.num_sealed * sizeof(*f.sealed));
+    struct rag_segment *fresh = segment_create(s->dim, s->meta_size);
+    struct rag_store_view *sealed = NULL;
+    if (fresh && f.sealed) {
+        sealed = view_create(s->base, v->segments, v->num_segments, v->num_segments + 1);
+    }
+    if (!sealed) {
+        pthread_mutex_unlock(&s->write_lock);
+        pthread_mutex_unlock(&s->compact_lock);
+        free(f.sealed);
+        if (fresh) segment_free(fresh);
+        return -1;
+    }
+    memcpy(f.sealed, v->segments, f.num_sealed * sizeof(*f.sealed));
+    for (int i = 0; i < f.num_sealed; i++) f.sealed[i]->sealed = 1;
+    sealed->segments[f.num_sealed] = fresh;
+    publish(s, sealed);
+    pthread_mutex_unlock(&s->write_lock);
+
+    // Copy live rows without the lock; sealed rows no longer change, only
+    // their tombstones can still be set
+    size_t rows = fold_rows(&f), live = 0;
+    struct row_loc loc;
+    for (size_t r = 0; r < rows; r++) live += !fold_dead(&f, r, &loc);
+
+    struct store_base *b = calloc(1, sizeof(*b));
+    struct row_loc *origin = malloc((live ? live : 1) * sizeof(*origin));
+    if (b) {
+        b->owned = 1;
+        b->count = live;
+        b->vectors = malloc((live ? live : 1) * s->dim * sizeof(float));
+        b->ids = malloc((live ? live : 1) * sizeof(int));
+        b->meta = s->meta_size ? calloc(live ? live : 1, s->meta_size) : NULL;
+        b->dead = calloc(bitmap_words(live) + 1, sizeof(uint64_t));
+    }
+    if (!b || !origin || !b->vectors || !b->ids || !b->dead || (s->meta_size && !b->meta)) {
+        fprintf(stderr, "Store: compaction allocation failed\n");
+        if (b) base_free(b);
+        free(origin);
+        free(f.sealed);
+        pthread_mutex_unlock(&s->compact_lock);
+        return -1;
+    }
+
+    size_t out = 0;
+    for (size_t r = 0; r < rows && out < live; r++) {
+        if (fold_dead(&f, r, &loc)) continue;
+        const float *src;
+        if (loc.seg) {
+            src = loc.seg->vectors + loc.row * s->dim;
+            b->ids[out] = loc.seg->ids[loc.row];
+            if (s->meta_size) memcpy(b->meta + out * s->meta_size, loc.seg->meta + loc.row * s->meta_size, s->meta_size);
+        } else {
+            src = f.base->vectors + loc.row * s->dim;
+            b->ids[out] = f.base->ids ? f.base->ids[loc.row] : (int)loc.row;
+            if (s->meta_size && f.base->meta) {
+                memcpy(b->meta + out * s->meta_size, f.base->meta + loc.row * s->meta_size, s->meta_size);
+            }
+        }
+        memcpy(b->vectors + out * s->dim, src, s->dim * sizeof(float));
+        origin[out++] = loc;
+    }
+    // Rows killed between the two passes leave tail slots unused
+    b->count = out;
+
+    // Swap in: rows that died during the copy die again in the new base,
+    // and surviving ids now live in it
+    pthread_mutex_lock(&s->write_lock);
+    size_t folded_dead = count_bits(f.base->dead, f.base->count);
+    for (int i = 0; i < f.num_sealed; i++) folded_dead += count_bits(f.sealed[i]->dead, f.sealed[i]->count);
+    size_t new_dead = 0;
+    for (size_t r = 0; r < out; r++) {
+        const uint64_t *bits = origin[r].seg ? origin[r].seg->dead : f.base->dead;
+        if (rag_store_bit(bits, origin[r].row)) {
+            set_bit(b->dead, r);
+            new_dead++;
+        } else {
+            s->rows[b->ids[r]].seg = NULL;
+            s->rows[b->ids[r]].row = r;
+        }
+    }
+    v = s->view;
+    struct rag_store_view *next = view_create(b, v->segments + f.num_sealed, v->num_segments - f.num_sealed,
+                                              v->num_segments - f.num_sealed);
+    if (!next) {
+        // Nothing was remapped in a way that outlives b, so back out
+        for (size_t r = 0; r < out; r++) {
+            if (!rag_store_bit(b->dead, r)) s->rows[b->ids[r]] = origin[r];
+        }
+        pthread_mutex_unlock(&s->write_lock);
+        base_free(b);
+        free(origin);
+        free(f.sealed);
+        pthread_mutex_unlock(&s->compact_lock);
+        return -1;
+    }
+    publish(s, next);
+    retire(s, base_free, s->base);
+    for (int i = 0; i < f.num_sealed; i++) retire(s, segment_free, f.sealed[i]);
+    s->base = b;
+    s->dead_rows = s->dead_rows - folded_dead + new_dead;
+    s->compactions++;
+    bump_version(s);
+    reclaim(s);
+    pthread_cond_broadcast(&s->drained);
+    pthread_mutex_unlock(&s->write_lock);
+
+    free(origin);
+    free(f.sealed);
+    pthread_mutex_unlock(&s->compact_lock);
+    return 0;
+}
+
+static void *compactor_main(void *arg) {
+    struct rag_store *s = arg;
+    // Inherited from whichever thread started it
+    cpu_set_t mask;
+    int cpus = pthread_getaffinity_np(pthread_self(), sizeof(mask), &mask) == 0 ? CPU_COUNT(&mask) : 0;
+    pthread_mutex_lock(&s->write_lock);
+    s->compactor_cpus = cpus;
+    while (!s->stopping) {
+        if (!needs_compaction(s)) {
+            pthread_cond_wait(&s->wake, &s->write_lock);
+            continue;
+        }
+        pthread_mutex_unlock(&s->write_lock);
+        rag_store_compact(s);
+        pthread_mutex_lock(&s->write_lock);
+    }
+    pthread_mutex_unlock(&s->write_lock);
+    return NULL;
+}
+
+int rag_store_start_compactor(struct rag_store *s, double ratio) {
+    if (s->compactor_running) return 0;
+    s->ratio = ratio > 0 ? ratio : 0.25;
+    if (pthread_create(&s->compactor, NULL, compactor_main, s) != 0) {
+        fprintf(stderr, "Failed to start the compactor thread\n");
+        return -1;
+    }
+    s->compactor_running = 1;
+    return 0;
+}
+
+void rag_store_set_compaction(struct rag_store *s, int allowed) {
+    pthread_mutex_lock(&s->write_lock);
+    s->compaction_allowed = allowed;
+    wake_compactor(s);
+    pthread_cond_broadcast(&s->drained);
+    pthread_mutex_unlock(&s->write_lock);
+}
+
+void rag_store_stats(struct rag_store *s, struct rag_store_stats *stats) {
+    pthread_mutex_lock(&s->write_lock);
+    stats->version = s->version;
+    stats->base_rows = s->base->count;
+    stats->segment_rows = segment_rows_locked(s);
+    stats->dead = s->dead_rows;
+    stats->live = stats->base_rows + stats->segment_rows - stats->dead;
+    stats->compactions = s->compactions;
+    stats->reclaimed = s->reclaimed;
+    stats->compactor_cpus = s->compactor_cpus;
+    pthread_mutex_unlock(&s->write_lock);
+}
+
+// ---------------------------------------------------------------------------
+// Self-test
+// ---------------------------------------------------------------------------
+
+static int check(const char *name, int ok) {
+    printf("  %-34s %s\n", name, ok ? "ok" : "FAIL");
+    return !ok;
+}
+
+// Test vectors are constant, so a torn read shows up as unequal elements
+static void fill(float *v, int dim, float value) {
+    for (int d = 0; d < dim; d++) v[d] = value;
+}
+
+// Whether the live rows are exactly the ids with expected[id] != 0, each
+// holding that value
+static int live_matches(struct rag_store *s, const float *expected, size_t num_ids, int dim) {
+    int *seen = calloc(num_ids, sizeof(int));
+    if (!seen) return 0;
+    int ok = 1;
+    const struct rag_store_view *v = rag_store_enter(s);
+    size_t rows = v->base_count + (size_t)v->num_segments * RAG_STORE_SEGMENT;
+    for (size_t r = 0; r < rows && ok; r++) {
+        if (r < v->base_count) {
+            if (rag_store_base_dead(v, r)) continue;
+        } else {
+            size_t j;
+            const struct rag_segment *seg = row_segment(v, r, &j);
+            if (j >= rag_segment_rows(seg) || rag_store_bit(seg->dead, j)) continue;
+        }
+        int id = rag_store_row_id(v, r);
+        ok = id >= 0 && (size_t)id < num_ids && !seen[id]++ &&
+             rag_store_row_vector(v, r, dim)[dim - 1] == expected[id];
+    }
+    rag_store_exit(s);
+    for (size_t id = 0; id < num_ids && ok; id++) ok = seen[id] == (expected[id] != 0);
+    free(seen);
+    return ok;
+}
+
+struct stress {
+    struct rag_store *store;
+    int dim;
+    int done;
+    long reads;
+    int torn;
+};
+
+static void *stress_reader(void *arg) {
+    struct stress *st = arg;
+    long reads = 0;
+    int torn = 0;
+    while (!__atomic_load_n(&st->done, __ATOMIC_ACQUIRE)) {
+        const struct rag_store_view *v = rag_store_enter(st->store);
+        for (size_t r = 0; r < v->base_count; r++) {
+            const float *x = v->base + r * st->dim;
+            if (x[0] != x[st->dim - 1] || x[0] == 0) torn++;
+        }
+        for (int s = 0; s < v->num_segments; s++) {
+            const struct rag_segment *seg = v->segments[s];
+            size_t n = rag_segment_rows(seg);
+            for (size_t j = 0; j < n; j++) {
+                const float *x = seg->vectors + j * st->dim;
+                if (x[0] != x[st->dim - 1] || x[0] == 0 || seg->ids[j] < 0) torn++;
+            }
+        }
+        rag_store_exit(st->store);
+        reads++;
+    }
+    __atomic_fetch_add(&st->reads, reads, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&st->torn, torn, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+int rag_store_self_test(void) {
+    enum { DIM = 16, BASE = 1000, OPS = 30000, READERS = 2 };
+    size_t max_ids = BASE + OPS;
+    float *base = malloc((size_t)BASE * DIM * sizeof(float));
+    float *expected = calloc(max_ids, sizeof(float));
+    if (!base || !expected) {
+        fprintf(stderr, "Self-test allocation failed\n");
+        free(base);
+        free(expected);
+        return 1;
+    }
+    printf("Vector store self-test:\n");
+    for (int i = 0; i < BASE; i++) {
+        expected[i] = i + 1;
+        fill(base + i * DIM, DIM, expected[i]);
+    }
+
+    int failures = 0;
+    struct rag_store *s = rag_store_create(base, BASE, DIM, 16);
+    if (!s) {
+        free(base);
+        free(expected);
+        return 1;
+    }
+
+    float v[DIM];
+    fill(v, DIM, 5000);
+    int id = rag_store_insert(s, v, "fresh");
+    expected[id] = 5000;
+    fill(v, DIM, 6000);
+    int updated = rag_store_update(s, 7, v) == 0 && rag_store_update(s, id, v) == 0;
+    expected[7] = expected[id] = 6000;
+    int deleted = rag_store_delete(s, 3) == 0 && rag_store_delete(s, 3) < 0 &&
+                  rag_store_delete(s, 99999) < 0 && rag_store_update(s, 3, v) < 0;
+    expected[3] = 0;
+    failures += check("insert assigns the next id", id == BASE);
+    failures += check("update and delete", updated && deleted);
+    failures += check("live set after changes", live_matches(s, expected, id + 1, DIM));
+
+    // The best match for a constant query is the largest value
+    float scores[4];
+    int rows[4];
+    struct rag_topk topk;
+    rag_topk_init(&topk, 4, scores, rows);
+    fill(v, DIM, 1);
+    const struct rag_store_view *view = rag_store_enter(s);
+    rag_store_scan_segments(view, v, DIM, NULL, 0, &topk);
+    int found = rag_topk_finish(&topk);
+    const char *meta = found ? rag_store_row_meta(s, view, rows[0]) : NULL;
+    int scan_ok = found == 2 && (rag_store_row_id(view, rows[0]) == 7 || rag_store_row_id(view, rows[0]) == id) &&
+                  rag_store_row_meta(s, view, 0) == NULL;
+    int meta_ok = meta == NULL ? rag_store_row_id(view, rows[0]) == 7 : strcmp(meta, "fresh") == 0;
+    rag_store_exit(s);
+    failures += check("segment scan skips dead rows", scan_ok && meta_ok);
+
+    uint64_t before = rag_store_version(s);
+    int compacted = rag_store_compact(s) == 0;
+    struct rag_store_stats stats;
+    rag_store_stats(s, &stats);
+    failures += check("compaction keeps the live set",
+                      compacted && live_matches(s, expected, id + 1, DIM) &&
+                      stats.dead == 0 && stats.segment_rows == 0 && stats.base_rows == BASE &&
+                      rag_store_version(s) > before);
+    view = rag_store_enter(s);
+    int meta_kept = 0;
+    for (size_t r = 0; r < view->base_count; r++) {
+        const char *m = rag_store_row_meta(s, view, r);
+        if (m && rag_store_row_id(view, r) == id) meta_kept = strcmp(m, "fresh") == 0;
+    }
+    rag_store_exit(s);
+    failures += check("metadata survives update and compaction", meta_kept);
+
+    rag_store_set_compaction(s, 0);
+    failures += check("compaction can be disabled", rag_store_compact(s) < 0);
+    rag_store_set_compaction(s, 1);
+
+    // Readers scan continuously while a writer churns through inserts,
+    // updates and deletes and the compactor folds them in the background
+    struct stress st = { s, DIM, 0, 0, 0 };
+    pthread_t readers[READERS];
+    int started = 0;
+    for (; started < READERS; started++) {
+        if (pthread_create(&readers[started], NULL, stress_reader, &st) != 0) break;
+    }
+    rag_store_start_compactor(s, 0.5);
+    size_t num_ids = id + 1;
+    unsigned int seed = STORE_SEED;
+    int write_errors = 0;
+    for (int op = 0; op < OPS; op++) {
+        int target = rand_r(&seed) % num_ids;
+        float value = 10000 + op;
+        switch (rand_r(&seed) % 4) {
+        case 0:
+        case 1:
+            fill(v, DIM, value);
+            id = rag_store_insert(s, v, NULL);
+            if (id < 0) write_errors++;
+            else expected[id] = value, num_ids = id + 1;
+            break;
+        case 2:
+            fill(v, DIM, value);
+            if ((rag_store_update(s, target, v) == 0) != (expected[target] != 0)) write_errors++;
+            if (expected[target] != 0) expected[target] = value;
+            break;
+        default:
+            if ((rag_store_delete(s, target) == 0) != (expected[target] != 0)) write_errors++;
+            expected[target] = 0;
+            break;
+        }
+        if (op % 1024 == 0) sched_yield();
+    }
+    __atomic_store_n(&st.done, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < started; i++) pthread_join(readers[i], NULL);
+    rag_store_stats(s, &stats);
+
+    failures += check("writes agree with the model", write_errors == 0);
+    failures += check("concurrent readers see whole rows", started == READERS && st.torn == 0 && st.reads > 0);
+    failures += check("final live set", live_matches(s, expected, num_ids, DIM));
+    failures += check("background compaction ran", stats.compactions > 1 && stats.reclaimed > 0);
+    printf("  %ld reader passes, %llu compactions, %llu objects reclaimed\n", st.reads,
+           (unsigned long long)stats.compactions, (unsigned long long)stats.reclaimed);
+
+    rag_store_destroy(s);
+
+    // Updates carry the whole metadata row across, however wide
+    enum { WIDE = 600 };
+    char text[WIDE];
+    memset(text, 'm', WIDE - 1);
+    text[WIDE - 1] = '\0';
+    int wide_ok = 0;
+    if ((s = rag_store_create(base, BASE, DIM, WIDE))) {
+        id = rag_store_insert(s, v, text);
+        wide_ok = id >= 0 && rag_store_update(s, id, v) == 0;
+        view = rag_store_enter(s);
+        for (int i = 0; i < view->num_segments && wide_ok; i++) {
+            for (size_t r = 0; r < view->segments[i]->count; r++) {
+                const char *m = view->segments[i]->meta + r * WIDE;
+                if (!rag_store_bit(view->segments[i]->dead, r)) wide_ok = strcmp(m, text) == 0;
+            }
+        }
+        rag_store_exit(s);
+        rag_store_destroy(s);
+    }
+    failures += check("update keeps wide metadata", wide_ok);
+
+    free(base);
+    free(expected);
+    return failures;
+}
@@ -0,0 +1,122 @@
+#ifndef RAG_STORE_H
+#define RAG_STORE_H
+
+// Mutable vector store: an immutable base matrix plus append-only
+// segments, with one tombstone bit per row. Inserts append a row, deletes
+// set its tombstone, and updates do both (the new version is appended
+// before the old one is hidden). Readers never lock. They pin an epoch,
+// take the current view and scan it while a single writer keeps
+// appending. Views, segments and compacted bases that a writer replaces
+// are freed only once no pinned reader can still see them. Compaction
+// copies the live rows into a new base in the background and publishes
+// it with one pointer swap.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "rag_topk.h"
+
+#define RAG_STORE_SEGMENT 4096          // Rows per append-only segment
+#define RAG_STORE_MAX_READERS 128       // Threads that may pin the store
+
+struct rag_segment {
+    size_t count;                       // Published rows; load with acquire
+    float *vectors;                     // RAG_STORE_SEGMENT x dim
+    int *ids;
+    char *meta;                         // meta_size bytes per row
+    uint64_t *dead;                     // Tombstone bits
+    int sealed;                         // Being (or been) folded into a base
+};
+
+// A consistent set of rows. Row r < base_count is base row r; after
+// that, row base_count + s * RAG_STORE_SEGMENT + j is row j of segment s.
+struct rag_store_view {
+    const float *base;                  // base_count x dim
+    size_t base_count;
+    const int *base_ids;                // NULL: base row r is id r
+    const char *base_meta;              // NULL: no metadata stored for base rows
+    uint64_t *base_dead;
+    int num_segments;
+    struct rag_segment **segments;
+};
+
+struct rag_store_stats {
+    uint64_t version;                   // Bumped by every change
+    size_t base_rows;
+    size_t segment_rows;
+    size_t live;
+    size_t dead;                        // Tombstoned rows not yet compacted away
+    uint64_t compactions;
+    uint64_t reclaimed;                 // Objects freed after their grace period
+    int compactor_cpus;                 // In the compactor's affinity mask; 0 if not running
+};
+
+struct rag_store;
+
+// base is borrowed and must outlive the store; meta_size bytes of
+// metadata are kept per inserted row
+struct rag_store* rag_store_create(const float *base, size_t count, int dim, size_t meta_size);
+void rag_store_destroy(struct rag_store *s);
+
+// Readers: pin, use the view, unpin. Pins nest within a thread.
+const struct rag_store_view *rag_store_enter(struct rag_store *s);
+void rag_store_exit(struct rag_store *s);
+
+static inline size_t rag_segment_rows(const struct rag_segment *seg) {
+    return __atomic_load_n(&seg->count, __ATOMIC_ACQUIRE);
+}
+
+static inline int rag_store_bit(const uint64_t *bits, size_t i) {
+    return (__atomic_load_n(&bits[i / 64], __ATOMIC_RELAXED) >> (i % 64)) & 1;
+}
+
+// Whether base row r has been deleted or replaced
+static inline int rag_store_base_dead(const struct rag_store_view *v, size_t r) {
+    return rag_store_bit(v->base_dead, r);
+}
+
+// Set scores of tombstoned base rows [row, row + n) to -inf
+void rag_store_mask_base(const struct rag_store_view *v, size_t row, float *scores, int n);
+
+// Score every live segment row against query into topk (ids are rows).
+// With id_filter, only rows whose id has its bit set there are scored;
+// ids at or past filter_bits are excluded.
+void rag_store_scan_segments(const struct rag_store_view *v, const float *query, int dim,
+                             const uint64_t *id_filter, size_t filter_bits, struct rag_topk *topk);
+
+int rag_store_row_id(const struct rag_store_view *v, size_t row);
+const float *rag_store_row_vector(const struct rag_store_view *v, size_t row, int dim);
+// NULL if the row carries no stored metadata
+const char *rag_store_row_meta(const struct rag_store *s, const struct rag_store_view *v, size_t row);
+
+// Writers (serialised internally). Insert returns the new id; update and
+// delete return -1 for an unknown or deleted id.
+int rag_store_insert(struct rag_store *s, const float *vector, const char *meta);
+int rag_store_update(struct rag_store *s, int id, const float *vector);
+int rag_store_delete(struct rag_store *s, int id);
+
+// Whether one of the ids the store was created with has been deleted
+// (not updated); lock-free, for indexes built over the original ids
+int rag_store_id_deleted(const struct rag_store *s, int id);
+
+// Increments on every insert, update, delete and compaction. The word
+// stays at one address, so it can be registered for remote reads.
+uint64_t rag_store_version(const struct rag_store *s);
+const uint64_t *rag_store_version_word(const struct rag_store *s);
+
+// Fold live rows into a new base now; returns -1 if disabled or failed
+int rag_store_compact(struct rag_store *s);
+
+// Compact in the background once tombstones or segment rows exceed
+// ratio of the base, holding inserts and updates back while appended
+// rows are far past that; allowed = 0 disables compaction (e.g. while an
+// index refers to base rows by position)
+int rag_store_start_compactor(struct rag_store *s, double ratio);
+void rag_store_set_compaction(struct rag_store *s, int allowed);
+
+void rag_store_stats(struct rag_store *s, struct rag_store_stats *stats);
+
+// Insert/update/delete semantics, compaction, and readers racing a
+// writer; returns the number of failures
+int rag_store_self_test(void);
+
+#endif // RAG_STORE_H
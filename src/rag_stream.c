@@ -0,0 +1,602 @@
+/**
+ * RAG Streaming File Reader
+ * Reads are queued in a ring of RAG_STREAM_DEPTH and complete in posting
+ * order, as rag_remote expects; io_uring may finish them in any order,
+ * so a completion only marks its slot done. O_DIRECT needs the offset,
+ * length and destination aligned: a read that is not goes to the slot's
+ * own aligned bounce buffer, covering the request rounded out to
+ * RAG_STREAM_ALIGN, and is copied out when waited for. Posts only queue
+ * SQEs; they are submitted together, in the io_uring_enter that waits
+ * for a completion or once the ring of reads is full. A short read
+ * (which io_uring may return even on a regular file) is re-queued for
+ * the rest, and fails only when the file has no more to give.
+ *
+ * The cache counts reads per extent (offset and length), so it learns
+ * which extents are hot. A missed extent is admitted if it fits the
+ * budget, or if evicting extents read fewer times than it makes room.
+ * A scan that reads every block equally often therefore keeps whatever
+ * it cached first instead of cycling through the budget.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "rag_stream.h"
+#include "rag_remote.h"
+
+#define URING_ENTRIES (2 * RAG_STREAM_DEPTH)
+#define NIL -1
+
+enum { READ_PENDING = 1, READ_DONE };
+
+struct uring {
+    int fd;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned queued;                // SQEs filled but not yet submitted
+    uint64_t submits;               // io_uring_enter calls that submitted
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+struct stream_read {
+    int state;
+    int res;                        // Bytes read so far, or -errno
+    int extent;
+    uint64_t offset;
+    size_t len;
+    char *dest;
+    uint64_t start;                 // What was asked of the file
+    char *buf;
+    size_t size;
+    char *bounce;                   // Kept per slot, grown as needed
+    size_t bounce_size;
+    int bounced;                    // Read into the bounce, not dest
+    size_t skip;                    // Of offset past the bounce's start
+    size_t need;                    // Bytes the read must return; 0 = cache hit
+};
+
+// Every extent read so far, with its copy if cached
+struct extent {
+    uint64_t offset;
+    size_t len;
+    uint64_t count;                 // Reads
+    char *data;
+};
+
+struct rag_stream {
+    int fd;
+    int direct;
+    struct uring ring;
+    int uring;
+
+    struct stream_read reads[RAG_STREAM_DEPTH];
+    int head;                       // Oldest posted
+    int inflight;
+
+    struct extent *extents;
+    int num_extents;
+    int extents_cap;
+    int *table;                     // Open addressing over extent indices
+    int table_cap;                  // Power of two, at most half full
+    size_t budget;
+    size_t cached;
+    size_t cached_extents;
+
+    void **buffers;                 // Handed out through the reader
+    int num_buffers;
+
+    struct rag_stream_stats stats;
+};
+
+// io_uring without liburing: map the rings, fill SQEs, enter
+
+static int uring_setup(struct uring *r) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (r->fd < 0) return -1;
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ring_size > r->sq_ring_size) r->sq_ring_size = r->cq_ring_size;
+        r->cq_ring_size = r->sq_ring_size;
+    }
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) {
+        r->sq_ring = NULL;
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+    } else {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED) {
+            r->cq_ring = NULL;
+            return -1;
+        }
+    }
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        return -1;
+    }
+
+    char *sq = r->sq_ring, *cq = r->cq_ring;
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+static void uring_teardown(struct uring *r) {
+    if (r->sqes) munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring && r->cq_ring != r->sq_ring) munmap(r->cq_ring, r->cq_ring_size);
+    if (r->sq_ring) munmap(r->sq_ring, r->sq_ring_size);
+    if (r->fd >= 0) close(r->fd);
+}
+
+static int uring_enter(struct uring *r, unsigned submit, unsigned wait) {
+    for (;;) {
+        int ret = syscall(__NR_io_uring_enter, r->fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0,
+                          NULL, 0);
+        if (ret >= 0 || errno != EINTR) return ret;
+    }
+}
+
+// Queue a read for the next uring_flush; at most RAG_STREAM_DEPTH reads
+// are in flight, so the SQ never fills
+static void uring_read(struct uring *r, int fd, uint64_t offset, void *buf, size_t len, uint64_t tag) {
+    unsigned tail = *r->sq_tail;
+    unsigned index = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->user_data = tag;
+    r->sq_array[index] = index;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->queued++;
+}
+
+// Submit every queued read in one call, also waiting for wait completions
+static int uring_flush(struct uring *r, unsigned wait) {
+    do {
+        int ret = uring_enter(r, r->queued, wait);
+        if (ret < 0 || (ret == 0 && r->queued)) return -1;
+        if (ret) r->submits++;
+        r->queued -= ret;
+        wait = 0;
+    } while (r->queued);
+    return 0;
+}
+
+// Wait for one completion and take its tag and result
+static int uring_complete(struct uring *r, uint64_t *tag, int *res) {
+    unsigned head = *r->cq_head;
+    while (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        if (uring_flush(r, 1) < 0) return -1;
+    }
+    struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+    *tag = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// Extent table
+
+static uint64_t extent_hash(uint64_t offset, size_t len) {
+    uint64_t h = (offset ^ ((uint64_t)len << 40)) * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 29);
+}
+
+static int table_grow(struct rag_stream *s) {
+    int cap = s->table_cap ? 2 * s->table_cap : 256;
+    int *table = malloc(cap * sizeof(int));
+    if (!table) return -1;
+    for (int i = 0; i < cap; i++) table[i] = NIL;
+    for (int e = 0; e < s->num_extents; e++) {
+        size_t slot = extent_hash(s->extents[e].offset, s->extents[e].len) & (cap - 1);
+        while (table[slot] != NIL) slot = (slot + 1) & (cap - 1);
+        table[slot] = e;
+    }
+    free(s->table);
+    s->table = table;
+    s->table_cap = cap;
+    return 0;
+}
+
+// Index of the extent, added on first sight; NIL if out of memory
+static int extent_find(struct rag_stream *s, uint64_t offset, size_t len) {
+    size_t mask = s->table_cap - 1;
+    for (size_t slot = extent_hash(offset, len) & mask; s->table_cap; slot = (slot + 1) & mask) {
+        int e = s->table[slot];
+        if (e == NIL) break;
+        if (s->extents[e].offset == offset && s->extents[e].len == len) return e;
+    }
+
+    if (2 * (s->num_extents + 1) > s->table_cap && table_grow(s) < 0) return NIL;
+    if (s->num_extents == s->extents_cap) {
+        int cap = s->extents_cap ? 2 * s->extents_cap : 256;
+        struct extent *extents = realloc(s->extents, cap * sizeof(*extents));
+        if (!extents) return NIL;
+        s->extents = extents;
+        s->extents_cap = cap;
+    }
+    int e = s->num_extents++;
+    s->extents[e] = (struct extent) { offset, len, 0, NULL };
+    size_t slot = extent_hash(offset, len) & (s->table_cap - 1);
+    while (s->table[slot] != NIL) slot = (slot + 1) & (s->table_cap - 1);
+    s->table[slot] = e;
+    return e;
+}
+
+static void evict(struct rag_stream *s, struct extent *x) {
+    free(x->data);
+    x->data = NULL;
+    s->cached -= x->len;
+    s->cached_extents--;
+}
+
+// Cache extent e's bytes if they fit, evicting colder extents if that
+// makes room
+static void admit(struct rag_stream *s, int e, const void *data) {
+    struct extent *x = &s->extents[e];
+    if (x->len > s->budget) return;
+    if (s->cached + x->len > s->budget) {
+        size_t colder = 0;
+        for (int i = 0; i < s->num_extents; i++) {
+            if (s->extents[i].data && s->extents[i].count < x->count) colder += s->extents[i].len;
+        }
+        if (s->cached - colder + x->len > s->budget) return;
+        while (s->cached + x->len > s->budget) {
+            int victim = NIL;
+            for (int i = 0; i < s->num_extents; i++) {
+                if (s->extents[i].data && (victim == NIL || s->extents[i].count < s->extents[victim].count)) {
+                    victim = i;
+                }
+            }
+            evict(s, &s->extents[victim]);
+        }
+    }
+    x->data = malloc(x->len);
+    if (!x->data) return;
+    memcpy(x->data, data, x->len);
+    s->cached += x->len;
+    s->cached_extents++;
+}
+
+// Reader callbacks
+
+static void *stream_buffer(void *ctx, size_t size) {
+    struct rag_stream *s = ctx;
+    void **buffers = realloc(s->buffers, (s->num_buffers + 1) * sizeof(void *));
+    if (!buffers) return NULL;
+    s->buffers = buffers;
+    void *buf;
+    size = (size + RAG_STREAM_ALIGN - 1) / RAG_STREAM_ALIGN * RAG_STREAM_ALIGN;
+    if (posix_memalign(&buf, RAG_STREAM_ALIGN, size ? size : RAG_STREAM_ALIGN)) return NULL;
+    s->buffers[s->num_buffers++] = buf;
+    return buf;
+}
+
+static int stream_post(void *ctx, uint64_t offset, void *dest, size_t len) {
+    struct rag_stream *s = ctx;
+    if (s->inflight == RAG_STREAM_DEPTH) {
+        fprintf(stderr, "Stream: more than %d reads posted\n", RAG_STREAM_DEPTH);
+        return -1;
+    }
+    int slot = (s->head + s->inflight) % RAG_STREAM_DEPTH;
+    struct stream_read *rd = &s->reads[slot];
+    rd->offset = offset;
+    rd->len = len;
+    rd->dest = dest;
+    rd->extent = extent_find(s, offset, len);
+    s->stats.reads++;
+    s->stats.bytes_requested += len;
+
+    struct extent *x = rd->extent != NIL ? &s->extents[rd->extent] : NULL;
+    if (x) x->count++;
+    if (x && x->data) {
+        memcpy(dest, x->data, len);
+        s->stats.cache_hits++;
+        rd->state = READ_DONE;
+        rd->res = 0;
+        rd->need = 0;
+        s->inflight++;
+        return 0;
+    }
+
+    // Straight into dest if O_DIRECT can take it, else through the bounce
+    char *buf = dest;
+    uint64_t start = offset;
+    size_t size = len;
+    rd->skip = 0;
+    rd->bounced = 0;
+    if (s->direct && (offset % RAG_STREAM_ALIGN || len % RAG_STREAM_ALIGN ||
+                      (uintptr_t)dest % RAG_STREAM_ALIGN)) {
+        start = offset / RAG_STREAM_ALIGN * RAG_STREAM_ALIGN;
+        size = (offset + len - start + RAG_STREAM_ALIGN - 1) / RAG_STREAM_ALIGN * RAG_STREAM_ALIGN;
+        if (size > rd->bounce_size) {
+            void *bounce;
+            if (posix_memalign(&bounce, RAG_STREAM_ALIGN, size)) return -1;
+            free(rd->bounce);
+            rd->bounce = bounce;
+            rd->bounce_size = size;
+        }
+        buf = rd->bounce;
+        rd->bounced = 1;
+        rd->skip = offset - start;
+    }
+    rd->need = rd->skip + len;
+    rd->start = start;
+    rd->buf = buf;
+    rd->size = size;
+    s->stats.bytes_from_disk += size;
+
+    if (s->uring) {
+        uring_read(&s->ring, s->fd, start, buf, size, slot);
+        rd->res = 0;
+        rd->state = READ_PENDING;
+        // Nothing more can be posted before a wait, so send them now
+        if (s->inflight + 1 == RAG_STREAM_DEPTH && uring_flush(&s->ring, 0) < 0) {
+            perror("io_uring_enter");
+            return -1;
+        }
+    } else {
+        ssize_t got = 0;
+        while ((size_t)got < rd->need) {
+            ssize_t n = pread(s->fd, buf + got, size - got, start + got);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            got += n;
+        }
+        rd->res = got;
+        rd->state = READ_DONE;
+    }
+    s->inflight++;
+    return 0;
+}
+
+// Account one completion, queueing the rest of a short read
+static void stream_complete(struct rag_stream *s, uint64_t tag, int res) {
+    struct stream_read *rd = &s->reads[tag];
+    if (res < 0) {
+        rd->res = res;
+    } else {
+        rd->res += res;
+        // O_DIRECT ends a read off the alignment only at the end of file
+        if (res > 0 && (size_t)rd->res < rd->need && !(s->direct && res % RAG_STREAM_ALIGN)) {
+            uring_read(&s->ring, s->fd, rd->start + rd->res, rd->buf + rd->res, rd->size - rd->res, tag);
+            return;
+        }
+    }
+    rd->state = READ_DONE;
+}
+
+static int stream_wait(void *ctx) {
+    struct rag_stream *s = ctx;
+    if (s->inflight == 0) return -1;
+    struct stream_read *rd = &s->reads[s->head];
+    while (rd->state == READ_PENDING) {
+        uint64_t tag;
+        int res;
+        if (uring_complete(&s->ring, &tag, &res) < 0) {
+            perror("io_uring_enter");
+            return -1;
+        }
+        stream_complete(s, tag, res);
+    }
+    // Reads posted since, or re-queued, run while this one is scored
+    if (s->ring.queued && uring_flush(&s->ring, 0) < 0) {
+        perror("io_uring_enter");
+        return -1;
+    }
+    s->head = (s->head + 1) % RAG_STREAM_DEPTH;
+    s->inflight--;
+
+    if (rd->need == 0) return 0;                // Served from the cache
+    if (rd->res < 0 || (size_t)rd->res < rd->need) {
+        fprintf(stderr, "Stream: read of %zu bytes at %lu failed: %s\n", rd->len, rd->offset,
+                rd->res < 0 ? strerror(-rd->res) : "short read");
+        return -1;
+    }
+    if (rd->bounced) memcpy(rd->dest, rd->bounce + rd->skip, rd->len);
+    if (rd->extent != NIL) admit(s, rd->extent, rd->dest);
+    return 0;
+}
+
+struct rag_stream* rag_stream_open(const char *path, size_t cache_budget, int direct) {
+    struct rag_stream *s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    s->ring.fd = -1;
+    s->budget = cache_budget;
+    s->fd = direct ? open(path, O_RDONLY | O_DIRECT) : -1;
+    s->direct = s->fd >= 0;
+    if (s->fd < 0) s->fd = open(path, O_RDONLY);
+    if (s->fd < 0) {
+        perror(path);
+        free(s);
+        return NULL;
+    }
+    s->uring = uring_setup(&s->ring) == 0;
+    if (!s->uring) {
+        uring_teardown(&s->ring);
+        memset(&s->ring, 0, sizeof(s->ring));
+        s->ring.fd = -1;
+    }
+    return s;
+}
+
+void rag_stream_close(struct rag_stream *s) {
+    if (!s) return;
+    // Reads still in flight would land in freed buffers
+    if (s->ring.queued) uring_flush(&s->ring, 0);
+    int pending = 0;
+    for (int i = 0; i < s->inflight; i++) {
+        pending += s->reads[(s->head + i) % RAG_STREAM_DEPTH].state == READ_PENDING;
+    }
+    for (; pending > 0; pending--) {
+        uint64_t tag;
+        int res;
+        if (uring_complete(&s->ring, &tag, &res) < 0) break;
+    }
+    uring_teardown(&s->ring);
+    close(s->fd);
+    for (int i = 0; i < RAG_STREAM_DEPTH; i++) free(s->reads[i].bounce);
+    for (int e = 0; e < s->num_extents; e++) free(s->extents[e].data);
+    free(s->extents);
+    free(s->table);
+    for (int i = 0; i < s->num_buffers; i++) free(s->buffers[i]);
+    free(s->buffers);
+    free(s);
+}
+
+void rag_stream_reader(struct rag_stream *s, struct rag_remote_reader *reader) {
+    memset(reader, 0, sizeof(*reader));
+    reader->buffer = stream_buffer;
+    reader->post = stream_post;
+    reader->wait = stream_wait;
+    reader->ctx = s;
+    reader->max_inflight = RAG_STREAM_DEPTH;
+}
+
+void rag_stream_stats(const struct rag_stream *s, struct rag_stream_stats *stats) {
+    *stats = s->stats;
+    stats->submits = s->ring.submits;
+    stats->cache_bytes = s->cached;
+    stats->cache_extents = s->cached_extents;
+    stats->uring = s->uring;
+    stats->direct = s->direct;
+}
+
+void rag_stream_reset_stats(struct rag_stream *s) {
+    memset(&s->stats, 0, sizeof(s->stats));
+    s->ring.submits = 0;
+}
+
+// Self-test
+
+static int check(const char *name, int ok) {
+    printf("  %-34s %s\n", name, ok ? "ok" : "FAIL");
+    return !ok;
+}
+
+static unsigned char pattern(uint64_t i) {
+    return (unsigned char)(i * 7 + (i >> 9));
+}
+
+static int matches(const unsigned char *buf, uint64_t offset, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] != pattern(offset + i)) return 0;
+    }
+    return 1;
+}
+
+// Read len bytes at offset through the reader and check them
+static int read_ok(struct rag_remote_reader *reader, unsigned char *buf, uint64_t offset, size_t len) {
+    memset(buf, 0, len);
+    return reader->post(reader->ctx, offset, buf, len) == 0 && reader->wait(reader->ctx) == 0 &&
+           matches(buf, offset, len);
+}
+
+int rag_stream_self_test(void) {
+    enum { FILE_SIZE = (1 << 20) + 123, BUDGET = 64 << 10, EXTENT = 40 << 10 };
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/rag_stream_self_test.%d", (int)getpid());
+    unsigned char *data = malloc(FILE_SIZE);
+    FILE *f = fopen(path, "wb");
+    int written = data && f;
+    for (size_t i = 0; written && i < FILE_SIZE; i++) data[i] = pattern(i);
+    written = written && fwrite(data, 1, FILE_SIZE, f) == FILE_SIZE;
+    if (f && fclose(f) != 0) written = 0;
+    free(data);
+
+    printf("Streaming reader self-test:\n");
+    struct rag_stream *s = written ? rag_stream_open(path, BUDGET, 1) : NULL;
+    if (!s) {
+        fprintf(stderr, "Self-test setup failed\n");
+        unlink(path);
+        return 1;
+    }
+    struct rag_stream_stats stats;
+    rag_stream_stats(s, &stats);
+    printf("  (%s, %s)\n", stats.uring ? "io_uring" : "pread fallback",
+           stats.direct ? "O_DIRECT" : "page cache");
+    struct rag_remote_reader reader;
+    rag_stream_reader(s, &reader);
+
+    // A full pipeline of aligned, unaligned and end-of-file reads, waited
+    // in order; unaligned destinations go through the bounce buffers
+    static const struct { uint64_t offset; size_t len; size_t at; } reads[RAG_STREAM_DEPTH] = {
+        { 0, 8192, 0 }, { 4100, 1000, 8192 + 3 }, { FILE_SIZE - 500, 500, 12288 },
+        { 65536, 131072, 16384 }, { 1, 1, 147456 + 1 }, { 200000, 70000, 151552 },
+        { FILE_SIZE - 4096 - 7, 4096 + 7, 221184 + 5 }, { 12288, 4096, 233472 }
+    };
+    unsigned char *buf = reader.buffer(reader.ctx, 240 << 10);
+    int ok = buf != NULL;
+    for (int i = 0; ok && i < RAG_STREAM_DEPTH; i++) {
+        ok = reader.post(reader.ctx, reads[i].offset, buf + reads[i].at, reads[i].len) == 0;
+    }
+    ok = ok && reader.post(reader.ctx, 0, buf, 1) < 0;      // Ring full
+    for (int i = 0; ok && i < RAG_STREAM_DEPTH; i++) {
+        ok = reader.wait(reader.ctx) == 0 && matches(buf + reads[i].at, reads[i].offset, reads[i].len);
+    }
+    int failures = check("pipelined reads in order", ok);
+    rag_stream_stats(s, &stats);
+    failures += check("one submit for the pipeline", !stats.uring || stats.submits == 1);
+
+    // Past the end of file the short read is retried, then fails
+    printf("  (Expected read error follows)\n");
+    ok = buf && reader.post(reader.ctx, FILE_SIZE - 100, buf, 200) == 0 && reader.wait(reader.ctx) < 0;
+    failures += check("read past the end fails", ok && read_ok(&reader, buf, FILE_SIZE - 100, 100));
+
+    // A cached extent; a second one read less often stays out until it
+    // has been read more often, then takes the first one's place
+    rag_stream_reset_stats(s);
+    uint64_t a = 300000, c = 600000;
+    unsigned char *ext = reader.buffer(reader.ctx, EXTENT);
+    ok = ext != NULL;
+    for (int i = 0; ok && i < 3; i++) ok = read_ok(&reader, ext, a, EXTENT);
+    rag_stream_stats(s, &stats);
+    failures += check("hot extent served from cache", ok && stats.cache_hits == 2);
+    for (int i = 0; ok && i < 4; i++) ok = read_ok(&reader, ext, c, EXTENT);
+    rag_stream_stats(s, &stats);
+    ok = ok && stats.cache_hits == 2;
+    ok = ok && read_ok(&reader, ext, c, EXTENT) && read_ok(&reader, ext, a, EXTENT);
+    rag_stream_stats(s, &stats);
+    failures += check("hotter extent displaces colder", ok && stats.cache_hits == 3 &&
+                      stats.cache_extents == 1 && stats.cache_bytes == EXTENT);
+
+    rag_stream_close(s);
+    unlink(path);
+    return failures;
+}
@@ -0,0 +1,52 @@
+#ifndef RAG_STREAM_H
+#define RAG_STREAM_H
+
+// Streaming reads of a database file for scans larger than memory. A
+// stream is a rag_remote_reader (rag_remote.h) over a local file, so the
+// one-sided search code scans it exactly as it scans a server's region:
+// blocks or IVF lists are read RAG_STREAM_DEPTH deep through io_uring
+// while earlier ones are scored. With O_DIRECT the page cache stays out
+// of the way, and memory use is what the stream holds: its read buffers
+// plus a cache of the most often read extents (e.g. hot IVF lists) up to
+// a byte budget.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RAG_STREAM_DEPTH 8          // Reads in flight
+#define RAG_STREAM_ALIGN 4096       // O_DIRECT offset, length and buffer alignment
+
+struct rag_remote_reader;
+struct rag_stream;
+
+// direct: bypass the page cache where the file system allows it. Without
+// io_uring (e.g. blocked by a sandbox), reads fall back to pread at post
+// time, which still works but no longer overlaps the scan.
+struct rag_stream* rag_stream_open(const char *path, size_t cache_budget, int direct);
+void rag_stream_close(struct rag_stream *s);
+
+// Fill in reader callbacks over s; its buffers are freed with the stream
+void rag_stream_reader(struct rag_stream *s, struct rag_remote_reader *reader);
+
+struct rag_stream_stats {
+    uint64_t reads;                 // Posted
+    uint64_t cache_hits;
+    uint64_t bytes_requested;
+    uint64_t bytes_from_disk;       // Misses, with alignment padding
+    uint64_t submits;               // io_uring_enter calls that submitted reads
+    size_t cache_bytes;             // Held now
+    size_t cache_extents;
+    int uring;                      // Reads go through io_uring
+    int direct;                     // ... and bypass the page cache
+};
+
+void rag_stream_stats(const struct rag_stream *s, struct rag_stream_stats *stats);
+
+// Zero the counters; the cache and its read counts stay
+void rag_stream_reset_stats(struct rag_stream *s);
+
+// Aligned and unaligned reads in flight, and cache admission by read
+// count; returns the number of failures
+int rag_stream_self_test(void);
+
+#endif // RAG_STREAM_H
@@ -0,0 +1,216 @@
+/**
+ * RAG Top-k Selection
+ * Bounded min-heap plus a block filter: scores are computed a block at a
+ * time and compared against the heap root with SIMD, so once the heap is
+ * warm almost no candidate reaches the heap at all. Cost is
+ * O(n + m log k) for m admissions instead of O(n k) for sorted insertion.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "rag_topk.h"
+#include "rag_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RAG_X86 1
+#endif
+
+#define RAG_FILTER_BLOCK 256
+
+static void sift_down(struct rag_topk *t, int i, int size) {
+    float score = t->scores[i];
+    int id = t->ids[i];
+
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= size) break;
+        if (child + 1 < size && t->scores[child + 1] < t->scores[child]) child++;
+        if (t->scores[child] >= score) break;
+        t->scores[i] = t->scores[child];
+        t->ids[i] = t->ids[child];
+        i = child;
+    }
+    t->scores[i] = score;
+    t->ids[i] = id;
+}
+
+void rag_topk_insert(struct rag_topk *t, float score, int id) {
+    if (t->size < t->k) {
+        // Sift up
+        int i = t->size++;
+        while (i > 0) {
+            int parent = (i - 1) / 2;
+            if (t->scores[parent] <= score) break;
+            t->scores[i] = t->scores[parent];
+            t->ids[i] = t->ids[parent];
+            i = parent;
+        }
+        t->scores[i] = score;
+        t->ids[i] = id;
+    } else if (score > t->scores[0]) {
+        t->scores[0] = score;
+        t->ids[0] = id;
+        sift_down(t, 0, t->size);
+    }
+}
+
+// Branch-free: every index is written, the count only advances on a hit
+static int filter_scalar(const float *scores, int n, float threshold, int *out) {
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        out[count] = i;
+        count += scores[i] > threshold;
+    }
+    return count;
+}
+
+#ifdef RAG_X86
+__attribute__((target("avx2")))
+static int filter_avx2(const float *scores, int n, float threshold, int *out) {
+    __m256 thr = _mm256_set1_ps(threshold);
+    int count = 0, i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        unsigned mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(scores + i), thr, _CMP_GT_OQ));
+        while (mask) {
+            out[count++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    for (; i < n; i++) {
+        if (scores[i] > threshold) out[count++] = i;
+    }
+    return count;
+}
+
+__attribute__((target("avx512f")))
+static int filter_avx512(const float *scores, int n, float threshold, int *out) {
+    __m512 thr = _mm512_set1_ps(threshold);
+    __m512i idx = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m512i step = _mm512_set1_epi32(16);
+    int count = 0, i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __mmask16 mask = _mm512_cmp_ps_mask(_mm512_loadu_ps(scores + i), thr, _CMP_GT_OQ);
+        // Write the hit indices contiguously in one store
+        _mm512_mask_compressstoreu_epi32(out + count, mask, idx);
+        count += __builtin_popcount(mask);
+        idx = _mm512_add_epi32(idx, step);
+    }
+    for (; i < n; i++) {
+        if (scores[i] > threshold) out[count++] = i;
+    }
+    return count;
+}
+#endif
+
+int rag_filter_above(const float *scores, int n, float threshold, int *out) {
+#ifdef RAG_X86
+    int isa = rag_kernels_active();
+    if (isa >= RAG_ISA_AVX512) return filter_avx512(scores, n, threshold, out);
+    if (isa >= RAG_ISA_AVX2) return filter_avx2(scores, n, threshold, out);
+#endif
+    return filter_scalar(scores, n, threshold, out);
+}
+
+void rag_topk_push_block(struct rag_topk *t, const float *scores, int n, int base_id) {
+    int hits[RAG_FILTER_BLOCK];
+
+    for (int start = 0; start < n; start += RAG_FILTER_BLOCK) {
+        int len = n - start < RAG_FILTER_BLOCK ? n - start : RAG_FILTER_BLOCK;
+
+        // Until the heap is full everything but masked entries is admitted
+        if (t->size < t->k) {
+            for (int i = 0; i < len; i++) {
+                if (scores[start + i] > -__builtin_inff()) {
+                    rag_topk_push(t, scores[start + i], base_id + start + i);
+                }
+            }
+            continue;
+        }
+
+        int count = rag_filter_above(scores + start, len, t->scores[0], hits);
+        for (int h = 0; h < count; h++) {
+            int i = start + hits[h];
+            rag_topk_push(t, scores[i], base_id + i);
+        }
+    }
+}
+
+void rag_topk_merge(struct rag_topk *t, const struct rag_topk *other) {
+    for (int i = 0; i < other->size; i++) {
+        rag_topk_push(t, other->scores[i], other->ids[i]);
+    }
+}
+
+int rag_topk_finish(struct rag_topk *t) {
+    // Heap sort: moving the minimum to the back leaves the array best-first
+    for (int end = t->size - 1; end > 0; end--) {
+        float score = t->scores[0];
+        int id = t->ids[0];
+        t->scores[0] = t->scores[end];
+        t->ids[0] = t->ids[end];
+        t->scores[end] = score;
+        t->ids[end] = id;
+        sift_down(t, 0, end);
+    }
+    return t->size;
+}
+
+// Self-test
+
+static int compare_desc(const void *a, const void *b) {
+    float fa = *(const float *)a, fb = *(const float *)b;
+    return (fa < fb) - (fa > fb);
+}
+
+int rag_topk_self_test(void) {
+    static const int ks[] = { 1, 2, 10, 100, 1000 };
+    const int n = 10000;
+    int failures = 0;
+
+    float *scores = malloc(n * sizeof(float));
+    float *sorted = malloc(n * sizeof(float));
+    float *heap_scores = malloc(n * sizeof(float));
+    int *heap_ids = malloc(n * sizeof(int));
+    if (!scores || !sorted || !heap_scores || !heap_ids) {
+        fprintf(stderr, "Self-test allocation failed\n");
+        free(scores); free(sorted); free(heap_scores); free(heap_ids);
+        return 1;
+    }
+
+    unsigned int seed = 54321;
+    for (int i = 0; i < n; i++) {
+        scores[i] = (float)rand_r(&seed) / RAND_MAX * 2.0f - 1.0f;
+        sorted[i] = scores[i];
+    }
+    qsort(sorted, n, sizeof(float), compare_desc);
+
+    printf("Top-k selection self-test:\n");
+    for (size_t c = 0; c < sizeof(ks) / sizeof(ks[0]); c++) {
+        for (int blocked = 0; blocked <= 1; blocked++) {
+            struct rag_topk t;
+            rag_topk_init(&t, ks[c], heap_scores, heap_ids);
+            if (blocked) {
+                rag_topk_push_block(&t, scores, n, 0);
+            } else {
+                for (int i = 0; i < n; i++) rag_topk_push(&t, scores[i], i);
+            }
+
+            int count = rag_topk_finish(&t);
+            int bad = count != ks[c];
+            for (int i = 0; i < count && !bad; i++) {
+                bad = heap_scores[i] != sorted[i] || scores[heap_ids[i]] != heap_scores[i];
+            }
+            printf("  k=%-5d %-8s %s\n", ks[c], blocked ? "filtered" : "heap", bad ? "FAIL" : "ok");
+            failures += bad;
+        }
+    }
+
+    free(scores);
+    free(sorted);
+    free(heap_scores);
+    free(heap_ids);
+    return failures;
+}
@@ -0,0 +1,54 @@
+#ifndef RAG_TOPK_H
+#define RAG_TOPK_H
+
+// Bounded top-k selection over similarity scores. A min-heap of the k
+// best scores keeps its smallest at the root, so the root is the
+// admission threshold. Storage is supplied by the caller.
+
+struct rag_topk {
+    int k;
+    int size;
+    float *scores;
+    int *ids;
+};
+
+static inline void rag_topk_init(struct rag_topk *t, int k, float *scores, int *ids) {
+    t->k = k;
+    t->size = 0;
+    t->scores = scores;
+    t->ids = ids;
+}
+
+// Score a candidate must beat to enter (-inf until k candidates are held)
+static inline float rag_topk_threshold(const struct rag_topk *t) {
+    return t->size < t->k ? -__builtin_inff() : t->scores[0];
+}
+
+void rag_topk_insert(struct rag_topk *t, float score, int id);
+
+// Offer one candidate; the common rejection stays inline
+static inline void rag_topk_push(struct rag_topk *t, float score, int id) {
+    if (t->size < t->k || score > t->scores[0]) {
+        rag_topk_insert(t, score, id);
+    }
+}
+
+// Offer scores[0..n) with ids base_id.. ; only scores above the current
+// threshold are pushed, found with the SIMD filter. -inf marks an entry
+// to skip and is never admitted.
+void rag_topk_push_block(struct rag_topk *t, const float *scores, int n, int base_id);
+
+// Merge another selection into t
+void rag_topk_merge(struct rag_topk *t, const struct rag_topk *other);
+
+// Sort the held results best-first in place (t is no longer a heap
+// afterwards); returns the count
+int rag_topk_finish(struct rag_topk *t);
+
+// Indices i in [0, n) with scores[i] > threshold; returns how many
+int rag_filter_above(const float *scores, int n, float threshold, int *out);
+
+// Compare heap and filtered selection against a full sort; returns failures
+int rag_topk_self_test(void);
+
+#endif // RAG_TOPK_H
@@ -0,0 +1,368 @@
+/**
+ * RDMA Connection-Rate Benchmark
+ * Opens and closes full secure connections (TLS + PSN exchange + QP
+ * transitions) against the benchmark server at a target rate, ramping
+ * the rate in stages to find what the server can sustain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include "rdma_compat.h"
+#include "tls_utils.h"
+#include "rdma_perf.h"
+
+#define CONNRATE_LATE_NS 10000000ULL   // Started >10 ms after its slot
+#define CONNRATE_MAX_FAIL_PCT 1.0      // Sustainable: at most 1% failures
+#define CONNRATE_MIN_ACHIEVED 0.95     // ... and at least 95% of the target rate
+
+struct connrate_run;
+
+// Per-thread results for the current stage
+struct connrate_worker {
+    int index;
+    pthread_t thread;
+    struct connrate_run *run;
+    struct ibv_cq *cq;
+
+    uint64_t *lat;          // Setup latencies of successful attempts
+    size_t lat_count;
+    size_t lat_cap;
+    uint64_t attempts;
+    uint64_t late;
+    uint64_t failures[PERF_STAGE_COUNT];
+    uint64_t queue_sum;
+    uint32_t queue_max;
+    uint32_t backlog;
+    uint32_t bootstraps;    // Server's concurrent bring-ups, from accept info
+};
+
+struct connrate_run {
+    const struct connrate_config *config;
+
+    // Shared RDMA resources
+    struct ibv_device **dev_list;
+    struct ibv_context *ctx;
+    struct ibv_pd *pd;
+
+    struct connrate_worker *workers;
+    pthread_barrier_t stage_start;
+    pthread_barrier_t stage_end;
+    volatile int done;
+
+    // Current stage schedule: attempt k is due at start_ns + k * interval_ns
+    uint64_t start_ns;
+    uint64_t end_ns;
+    double interval_ns;
+    volatile uint64_t next_ticket;
+};
+
+static void sleep_until_ns(uint64_t deadline) {
+    struct timespec ts = {
+        .tv_sec = deadline / 1000000000ULL,
+        .tv_nsec = deadline % 1000000000ULL
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+static void record_setup_latency(struct connrate_worker *worker, uint64_t ns) {
+    if (worker->lat_count == worker->lat_cap) {
+        size_t cap = worker->lat_cap ? worker->lat_cap * 2 : 1024;
+        uint64_t *lat = realloc(worker->lat, cap * sizeof(uint64_t));
+        if (!lat) return;
+        worker->lat = lat;
+        worker->lat_cap = cap;
+    }
+    worker->lat[worker->lat_count++] = ns;
+}
+
+// One complete open/close cycle
+static void connect_once(struct connrate_worker *worker, int id) {
+    struct connrate_run *run = worker->run;
+    struct perf_ctrl ctrl = {
+        .mode = PERF_MODE_PASSIVE,
+        .max_size = 64,
+        .rx_depth = 1,
+        .flags = PERF_FLAG_ACCEPT_INFO
+    };
+
+    uint64_t start = perf_now_ns();
+
+    struct ibv_qp_init_attr qp_attr = {
+        .send_cq = worker->cq,
+        .recv_cq = worker->cq,
+        .qp_type = IBV_QPT_RC,
+        .cap = {
+            .max_send_wr = 1,
+            .max_recv_wr = 1,
+            .max_send_sge = 1,
+            .max_recv_sge = 1
+        }
+    };
+    struct ibv_qp *qp = ibv_create_qp(run->pd, &qp_attr);
+    if (!qp) {
+        worker->failures[PERF_STAGE_QP]++;
+        return;
+    }
+
+    struct perf_bootstrap bs = {
+        .id = id,
+        .server_ip = run->config->server_ip,
+        .port = run->config->port,
+        .ctrl = &ctrl,
+        .qp = qp
+    };
+    if (perf_secure_connect(&bs) < 0) {
+        worker->failures[bs.failed_stage]++;
+        ibv_destroy_qp(qp);
+        return;
+    }
+
+    record_setup_latency(worker, perf_now_ns() - start);
+    worker->queue_sum += bs.accept_info.queue_len;
+    if (bs.accept_info.queue_len > worker->queue_max) {
+        worker->queue_max = bs.accept_info.queue_len;
+    }
+    worker->backlog = bs.accept_info.backlog;
+    worker->bootstraps = bs.accept_info.bootstraps;
+
+    // Closing the TLS socket tells the server to tear its side down
+    close_tls_connection(bs.tls_conn);
+    ibv_destroy_qp(qp);
+}
+
+static void* connrate_thread(void *arg) {
+    struct connrate_worker *worker = arg;
+    struct connrate_run *run = worker->run;
+
+    while (1) {
+        pthread_barrier_wait(&run->stage_start);
+        if (run->done) break;
+
+        // Open loop: take the next slot in the schedule, wait for it, connect
+        while (1) {
+            uint64_t ticket = __sync_fetch_and_add(&run->next_ticket, 1);
+            uint64_t due = run->start_ns + (uint64_t)(ticket * run->interval_ns);
+            if (due >= run->end_ns) break;
+
+            uint64_t now = perf_now_ns();
+            if (now < due) {
+                sleep_until_ns(due);
+            } else if (now - due > CONNRATE_LATE_NS) {
+                worker->late++;
+            }
+
+            worker->attempts++;
+            connect_once(worker, (int)ticket);
+        }
+
+        pthread_barrier_wait(&run->stage_end);
+    }
+
+    return NULL;
+}
+
+static int init_connrate_rdma(struct connrate_run *run) {
+    int num_devices;
+    run->dev_list = ibv_get_device_list(&num_devices);
+    if (!run->dev_list || num_devices == 0) {
+        fprintf(stderr, "No RDMA devices found\n");
+        return -1;
+    }
+
+    run->ctx = ibv_open_device(run->dev_list[0]);
+    if (!run->ctx) {
+        fprintf(stderr, "Failed to open RDMA device\n");
+        return -1;
+    }
+
+    run->pd = ibv_alloc_pd(run->ctx);
+    if (!run->pd) {
+        fprintf(stderr, "Failed to allocate PD\n");
+        return -1;
+    }
+
+    // QPs come and go; their CQ stays for the whole run
+    for (int i = 0; i < run->config->threads; i++) {
+        run->workers[i].cq = ibv_create_cq(run->ctx, 4, NULL, NULL, 0);
+        if (!run->workers[i].cq) {
+            fprintf(stderr, "Failed to create CQ for thread %d\n", i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void reset_stage(struct connrate_run *run) {
+    for (int i = 0; i < run->config->threads; i++) {
+        struct connrate_worker *worker = &run->workers[i];
+        worker->lat_count = 0;
+        worker->attempts = 0;
+        worker->late = 0;
+        memset(worker->failures, 0, sizeof(worker->failures));
+        worker->queue_sum = 0;
+        worker->queue_max = 0;
+    }
+}
+
+// Merge one stage's results, print its row and return 1 if it was sustainable
+static int report_stage(struct connrate_run *run, int rate, double elapsed_s) {
+    uint64_t attempts = 0, late = 0, queue_sum = 0;
+    uint64_t failures[PERF_STAGE_COUNT] = {0};
+    uint32_t queue_max = 0, backlog = 0;
+    size_t ok = 0;
+
+    for (int i = 0; i < run->config->threads; i++) {
+        struct connrate_worker *worker = &run->workers[i];
+        attempts += worker->attempts;
+        late += worker->late;
+        queue_sum += worker->queue_sum;
+        if (worker->queue_max > queue_max) queue_max = worker->queue_max;
+        if (worker->backlog) backlog = worker->backlog;
+        ok += worker->lat_count;
+        for (int s = 0; s < PERF_STAGE_COUNT; s++) {
+            failures[s] += worker->failures[s];
+        }
+    }
+
+    uint64_t *lat = malloc((ok ? ok : 1) * sizeof(uint64_t));
+    size_t pos = 0;
+    for (int i = 0; i < run->config->threads && lat; i++) {
+        memcpy(lat + pos, run->workers[i].lat, run->workers[i].lat_count * sizeof(uint64_t));
+        pos += run->workers[i].lat_count;
+    }
+    struct latency_summary summary;
+    summarize_latencies(lat, lat ? ok : 0, &summary);
+    free(lat);
+
+    uint64_t failed = attempts - ok;
+    double achieved = ok / elapsed_s;
+    double fail_pct = attempts ? failed * 100.0 / attempts : 0.0;
+    int client_limited = attempts && late * 100 > attempts;
+    int sustainable = !client_limited && fail_pct <= CONNRATE_MAX_FAIL_PCT &&
+                      achieved >= rate * CONNRATE_MIN_ACHIEVED;
+
+    printf("%8d %9.0f %8lu %6.2f%% %9.2f %9.2f %9.2f %6.1f %4u/%-5u %s\n",
+           rate, achieved, attempts, fail_pct,
+           summary.p50 / 1e6, summary.p99 / 1e6, summary.max / 1e6,
+           ok ? (double)queue_sum / ok : 0.0, queue_max, backlog,
+           client_limited ? "client-limited" : (sustainable ? "ok" : "SATURATED"));
+
+    if (failed) {
+        printf("         failures:");
+        for (int s = 1; s < PERF_STAGE_COUNT; s++) {
+            if (failures[s]) printf(" %s=%lu", perf_stage_name(s), failures[s]);
+        }
+        printf("\n");
+    }
+    if (client_limited) {
+        printf("         %lu attempts started >%llu ms late; raise --threads\n",
+               late, CONNRATE_LATE_NS / 1000000ULL);
+    }
+    fflush(stdout);
+
+    return sustainable;
+}
+
+// Staged ramp: start_rate, start_rate + step, ... until a stage saturates
+int run_connection_rate(const struct connrate_config *config) {
+    struct connrate_run run;
+    int ret = -1;
+    memset(&run, 0, sizeof(run));
+    run.config = config;
+
+    printf("\n=== RDMA Connection-Rate Benchmark ===\n");
+    printf("Server: %s:%d\n", config->server_ip, config->port ? config->port : TLS_PORT);
+    printf("Ramp: %d -> %d conn/s in steps of %d, %d s per stage, %d connecting threads\n",
+           config->start_rate, config->max_rate, config->step_rate,
+           config->stage_sec, config->threads);
+
+    run.workers = calloc(config->threads, sizeof(struct connrate_worker));
+    if (!run.workers) {
+        return -1;
+    }
+    if (init_connrate_rdma(&run) < 0) {
+        goto out;
+    }
+
+    pthread_barrier_init(&run.stage_start, NULL, config->threads + 1);
+    pthread_barrier_init(&run.stage_end, NULL, config->threads + 1);
+
+    for (int i = 0; i < config->threads; i++) {
+        run.workers[i].index = i;
+        run.workers[i].run = &run;
+        if (pthread_create(&run.workers[i].thread, NULL, connrate_thread, &run.workers[i]) != 0) {
+            // Threads already waiting on the barrier would never be released
+            fprintf(stderr, "Aborting: failed to create connecting thread %d\n", i);
+            exit(1);
+        }
+    }
+
+    printf("\n%8s %9s %8s %7s %9s %9s %9s %6s %10s %s\n",
+           "target/s", "achieved", "attempts", "failed",
+           "p50(ms)", "p99(ms)", "max(ms)", "q-avg", "q-max/blog", "verdict");
+
+    int best = 0;
+    for (int rate = config->start_rate; rate <= config->max_rate; rate += config->step_rate) {
+        reset_stage(&run);
+        run.interval_ns = 1e9 / rate;
+        run.next_ticket = 0;
+        run.start_ns = perf_now_ns() + 10000000ULL;
+        run.end_ns = run.start_ns + (uint64_t)config->stage_sec * 1000000000ULL;
+
+        pthread_barrier_wait(&run.stage_start);
+        pthread_barrier_wait(&run.stage_end);
+
+        // Attempts finishing after end_ns still count, over the longer window
+        double elapsed_s = (perf_now_ns() - run.start_ns) / 1e9;
+        if (!report_stage(&run, rate, elapsed_s)) {
+            break;
+        }
+        best = rate;
+
+        // Let the server reap the last stage's connections
+        sleep(1);
+    }
+
+    run.done = 1;
+    pthread_barrier_wait(&run.stage_start);
+    for (int i = 0; i < config->threads; i++) {
+        pthread_join(run.workers[i].thread, NULL);
+    }
+    pthread_barrier_destroy(&run.stage_start);
+    pthread_barrier_destroy(&run.stage_end);
+
+    // What the rates measure: one bootstrap at a time, or several in parallel
+    uint32_t bootstraps = 0;
+    for (int i = 0; i < config->threads; i++) {
+        if (run.workers[i].bootstraps) bootstraps = run.workers[i].bootstraps;
+    }
+    if (bootstraps == 1) {
+        printf("\nServer bootstrap: serialized (--bootstraps 1)\n");
+    } else if (bootstraps > 1) {
+        printf("\nServer bootstrap: up to %u concurrent, each on its own thread\n", bootstraps);
+    }
+
+    if (best) {
+        printf("\nSustainable connection rate: %d conn/s\n", best);
+    } else {
+        printf("\nNo stage was sustainable; lower --rate-start\n");
+    }
+    ret = 0;
+
+out:
+    for (int i = 0; i < config->threads; i++) {
+        if (run.workers[i].cq) ibv_destroy_cq(run.workers[i].cq);
+        free(run.workers[i].lat);
+    }
+    free(run.workers);
+    if (run.pd) ibv_dealloc_pd(run.pd);
+    if (run.ctx) ibv_close_device(run.ctx);
+    if (run.dev_list) ibv_free_device_list(run.dev_list);
+    return ret;
+}
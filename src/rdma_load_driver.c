@@ -0,0 +1,574 @@
+/**
+ * RDMA Load Driver
+ * Generates load from many secure connections with a few pinned threads:
+ * - One device context and PD for the whole process
+ * - One CQ and one registered buffer arena per driver thread
+ * - Each thread multiplexes all of its QPs over that CQ (no thread per client)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include "rdma_compat.h"
+#include "tls_utils.h"
+#include "rdma_perf.h"
+
+#define LOAD_POLL_BATCH 64
+#define LOAD_SIGNAL_INTERVAL 16       // Signal one send in N to reclaim SQ slots
+#define LOAD_LATENCY_RESERVOIR 65536  // Round-trip samples kept per thread
+#define LOAD_MAX_WINDOW 4096
+#define LOAD_SLOT_ALIGN 64
+
+// wr_id layout: connection index | slot | receive flag
+#define WR_RECV_FLAG 1ULL
+#define WR_SLOT_SHIFT 1
+#define WR_SLOT_BITS 19
+#define WR_CONN_SHIFT (WR_SLOT_SHIFT + WR_SLOT_BITS)
+
+struct load_driver;
+
+// One multiplexed connection
+struct load_conn {
+    struct ibv_qp *qp;
+    struct tls_connection *tls_conn;
+    char *send_buf;        // window slots of slot_size bytes
+    char *recv_buf;
+    uint64_t *post_ns;     // Send timestamp per slot
+    uint32_t sends;
+    int established;
+};
+
+// Driver thread: owns a CQ, an arena and a share of the connections
+struct load_worker {
+    int index;
+    int cpu;
+    pthread_t thread;
+    struct load_driver *driver;
+
+    struct ibv_cq *cq;
+    struct ibv_mr *mr;
+    char *arena;
+    uint64_t *post_ns;
+    struct load_conn *conns;
+    int num_conns;
+    int first_conn_id;
+    int established;
+    uint64_t setup_ns;
+
+    // Progress counters, read by the reporting thread
+    volatile uint64_t messages;
+    volatile uint64_t bytes;
+    volatile uint64_t errors;
+
+    // Reservoir sample of round-trip latencies
+    uint64_t *lat_samples;
+    size_t lat_count;
+    uint64_t lat_seen;
+    uint64_t rng;
+};
+
+struct load_driver {
+    const struct load_config *config;
+    size_t slot_size;
+
+    // Shared RDMA resources
+    struct ibv_device **dev_list;
+    struct ibv_context *ctx;
+    struct ibv_pd *pd;
+    int max_cqe;
+
+    struct load_worker *workers;
+    volatile int stop;
+
+    // Start gate: threads report setup done, then wait for go. Unlike a
+    // barrier it needs no thread count up front, so a partial start can
+    // still release the threads that did start.
+    pthread_mutex_t gate_lock;
+    pthread_cond_t gate_cond;
+    int ready;
+    int go;
+};
+
+static uint64_t xorshift64(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static void record_latency(struct load_worker *worker, uint64_t ns) {
+    worker->lat_seen++;
+    if (worker->lat_count < LOAD_LATENCY_RESERVOIR) {
+        worker->lat_samples[worker->lat_count++] = ns;
+        return;
+    }
+    uint64_t pos = xorshift64(&worker->rng) % worker->lat_seen;
+    if (pos < LOAD_LATENCY_RESERVOIR) {
+        worker->lat_samples[pos] = ns;
+    }
+}
+
+static int post_load_recv(struct load_worker *worker, int conn_idx, int slot) {
+    struct load_conn *conn = &worker->conns[conn_idx];
+    size_t slot_size = worker->driver->slot_size;
+
+    struct ibv_sge sge = {
+        .addr = (uintptr_t)(conn->recv_buf + slot * slot_size),
+        .length = slot_size,
+        .lkey = worker->mr->lkey
+    };
+    struct ibv_recv_wr wr = {
+        .wr_id = ((uint64_t)conn_idx << WR_CONN_SHIFT) |
+                 ((uint64_t)slot << WR_SLOT_SHIFT) | WR_RECV_FLAG,
+        .sg_list = &sge,
+        .num_sge = 1
+    };
+
+    struct ibv_recv_wr *bad_wr;
+    return ibv_post_recv(conn->qp, &wr, &bad_wr) ? -1 : 0;
+}
+
+static int post_load_send(struct load_worker *worker, int conn_idx, int slot) {
+    struct load_conn *conn = &worker->conns[conn_idx];
+    int size = worker->driver->config->message_size;
+
+    struct ibv_sge sge = {
+        .addr = (uintptr_t)(conn->send_buf + slot * worker->driver->slot_size),
+        .length = size,
+        .lkey = worker->mr->lkey
+    };
+    struct ibv_send_wr wr = {
+        .wr_id = ((uint64_t)conn_idx << WR_CONN_SHIFT) | ((uint64_t)slot << WR_SLOT_SHIFT),
+        .sg_list = &sge,
+        .num_sge = 1,
+        .opcode = IBV_WR_SEND
+    };
+    if (++conn->sends % LOAD_SIGNAL_INTERVAL == 0) {
+        wr.send_flags |= IBV_SEND_SIGNALED;
+    }
+    if (size <= 64) {
+        wr.send_flags |= IBV_SEND_INLINE;
+    }
+
+    conn->post_ns[slot] = perf_now_ns();
+    struct ibv_send_wr *bad_wr;
+    return ibv_post_send(conn->qp, &wr, &bad_wr) ? -1 : 0;
+}
+
+// Pin the calling thread to one CPU
+static void pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        fprintf(stderr, "Warning: could not pin driver thread to CPU %d\n", cpu);
+    }
+}
+
+// Allocate the worker's CQ and arena, then bring up its connections one by one
+static void setup_worker(struct load_worker *worker) {
+    struct load_driver *driver = worker->driver;
+    const struct load_config *config = driver->config;
+    int window = config->window;
+
+    // Fits max_cqe: run_load_driver checked it
+    int cqe = worker->num_conns * (window * 2 + LOAD_SIGNAL_INTERVAL);
+    worker->cq = ibv_create_cq(driver->ctx, cqe, NULL, NULL, 0);
+
+    size_t arena_size = (size_t)worker->num_conns * window * 2 * driver->slot_size;
+    if (posix_memalign((void **)&worker->arena, 4096, arena_size)) {
+        worker->arena = NULL;
+    }
+    worker->conns = calloc(worker->num_conns, sizeof(struct load_conn));
+    worker->post_ns = calloc((size_t)worker->num_conns * window, sizeof(uint64_t));
+    worker->lat_samples = malloc(LOAD_LATENCY_RESERVOIR * sizeof(uint64_t));
+    if (!worker->cq || !worker->arena || !worker->conns || !worker->post_ns ||
+        !worker->lat_samples) {
+        fprintf(stderr, "Driver thread %d: resource allocation failed\n", worker->index);
+        return;
+    }
+    memset(worker->arena, 'L', arena_size);
+
+    // One MR per thread instead of one per connection
+    worker->mr = ibv_reg_mr(driver->pd, worker->arena, arena_size, IBV_ACCESS_LOCAL_WRITE);
+    if (!worker->mr) {
+        fprintf(stderr, "Driver thread %d: failed to register arena\n", worker->index);
+        return;
+    }
+
+    struct perf_ctrl ctrl = {
+        .mode = PERF_MODE_ECHO,
+        .max_size = config->message_size,
+        .rx_depth = window
+    };
+
+    uint64_t start = perf_now_ns();
+    for (int i = 0; i < worker->num_conns && !driver->stop; i++) {
+        struct load_conn *conn = &worker->conns[i];
+        conn->send_buf = worker->arena + (size_t)i * window * 2 * driver->slot_size;
+        conn->recv_buf = conn->send_buf + (size_t)window * driver->slot_size;
+        conn->post_ns = worker->post_ns + (size_t)i * window;
+
+        struct ibv_qp_init_attr qp_attr = {
+            .send_cq = worker->cq,
+            .recv_cq = worker->cq,
+            .qp_type = IBV_QPT_RC,
+            .cap = {
+                .max_send_wr = window + LOAD_SIGNAL_INTERVAL,
+                .max_recv_wr = window,
+                .max_send_sge = 1,
+                .max_recv_sge = 1,
+                .max_inline_data = 64
+            }
+        };
+        conn->qp = ibv_create_qp(driver->pd, &qp_attr);
+        if (!conn->qp) {
+            fprintf(stderr, "Connection %d: failed to create QP\n", worker->first_conn_id + i);
+            worker->errors++;
+            continue;
+        }
+
+        struct perf_bootstrap bs = {
+            .id = worker->first_conn_id + i,
+            .server_ip = config->server_ip,
+            .port = config->port,
+            .ctrl = &ctrl,
+            .qp = conn->qp
+        };
+        if (perf_secure_connect(&bs) < 0) {
+            ibv_destroy_qp(conn->qp);
+            conn->qp = NULL;
+            worker->errors++;
+            continue;
+        }
+        conn->tls_conn = bs.tls_conn;
+
+        int ok = 1;
+        for (int slot = 0; slot < window && ok; slot++) {
+            ok = post_load_recv(worker, i, slot) == 0;
+        }
+        if (!ok) {
+            fprintf(stderr, "Connection %d: failed to post receives\n", bs.id);
+            worker->errors++;
+            continue;
+        }
+
+        conn->established = 1;
+        worker->established++;
+    }
+    worker->setup_ns = perf_now_ns() - start;
+}
+
+// Closed loop: every echo received immediately releases the next send on its slot
+static void drive_traffic(struct load_worker *worker) {
+    struct load_driver *driver = worker->driver;
+    int window = driver->config->window;
+    struct ibv_wc wc[LOAD_POLL_BATCH];
+
+    for (int i = 0; i < worker->num_conns; i++) {
+        if (!worker->conns[i].established) continue;
+        for (int slot = 0; slot < window; slot++) {
+            if (post_load_send(worker, i, slot) < 0) {
+                worker->conns[i].established = 0;
+                worker->errors++;
+                break;
+            }
+        }
+    }
+
+    while (!driver->stop) {
+        int ne = ibv_poll_cq(worker->cq, LOAD_POLL_BATCH, wc);
+        if (ne < 0) {
+            fprintf(stderr, "Driver thread %d: ibv_poll_cq failed\n", worker->index);
+            worker->errors++;
+            break;
+        }
+
+        uint64_t now = ne > 0 ? perf_now_ns() : 0;
+        uint64_t messages = 0, bytes = 0;
+        for (int i = 0; i < ne; i++) {
+            int conn_idx = wc[i].wr_id >> WR_CONN_SHIFT;
+            int slot = (wc[i].wr_id >> WR_SLOT_SHIFT) & ((1 << WR_SLOT_BITS) - 1);
+            struct load_conn *conn = &worker->conns[conn_idx];
+
+            if (wc[i].status != IBV_WC_SUCCESS) {
+                if (conn->established) {
+                    fprintf(stderr, "Connection %d: %s\n", worker->first_conn_id + conn_idx,
+                            ibv_wc_status_str(wc[i].status));
+                    conn->established = 0;
+                }
+                worker->errors++;
+                continue;
+            }
+
+            // Signaled sends only reclaim send queue slots
+            if (!(wc[i].wr_id & WR_RECV_FLAG)) continue;
+
+            record_latency(worker, now - conn->post_ns[slot]);
+            messages++;
+            bytes += wc[i].byte_len;
+
+            if (!conn->established) continue;
+            if (post_load_recv(worker, conn_idx, slot) < 0 ||
+                post_load_send(worker, conn_idx, slot) < 0) {
+                conn->established = 0;
+                worker->errors++;
+            }
+        }
+
+        if (messages) {
+            worker->messages += messages;
+            worker->bytes += bytes;
+        }
+    }
+}
+
+static void cleanup_worker(struct load_worker *worker) {
+    if (worker->conns) {
+        for (int i = 0; i < worker->num_conns; i++) {
+            if (worker->conns[i].tls_conn) close_tls_connection(worker->conns[i].tls_conn);
+            if (worker->conns[i].qp) ibv_destroy_qp(worker->conns[i].qp);
+        }
+    }
+    if (worker->mr) ibv_dereg_mr(worker->mr);
+    if (worker->cq) ibv_destroy_cq(worker->cq);
+    free(worker->conns);
+    free(worker->post_ns);
+    free(worker->arena);
+}
+
+static void* load_worker_thread(void *arg) {
+    struct load_worker *worker = arg;
+
+    if (worker->cpu >= 0) {
+        pin_to_cpu(worker->cpu);
+    }
+
+    setup_worker(worker);
+
+    // Traffic starts only once every thread has finished its connections
+    struct load_driver *driver = worker->driver;
+    pthread_mutex_lock(&driver->gate_lock);
+    driver->ready++;
+    pthread_cond_broadcast(&driver->gate_cond);
+    while (!driver->go) {
+        pthread_cond_wait(&driver->gate_cond, &driver->gate_lock);
+    }
+    pthread_mutex_unlock(&driver->gate_lock);
+
+    if (worker->established > 0 && !driver->stop) {
+        drive_traffic(worker);
+    }
+
+    cleanup_worker(worker);
+    return NULL;
+}
+
+static int init_load_rdma(struct load_driver *driver) {
+    int num_devices;
+    driver->dev_list = ibv_get_device_list(&num_devices);
+    if (!driver->dev_list || num_devices == 0) {
+        fprintf(stderr, "No RDMA devices found\n");
+        return -1;
+    }
+
+    driver->ctx = ibv_open_device(driver->dev_list[0]);
+    if (!driver->ctx) {
+        fprintf(stderr, "Failed to open RDMA device\n");
+        return -1;
+    }
+
+    struct ibv_device_attr device_attr;
+    if (ibv_query_device(driver->ctx, &device_attr)) {
+        perror("ibv_query_device");
+        return -1;
+    }
+    driver->max_cqe = device_attr.max_cqe;
+
+    driver->pd = ibv_alloc_pd(driver->ctx);
+    if (!driver->pd) {
+        fprintf(stderr, "Failed to allocate PD\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static uint64_t total_messages(struct load_driver *driver) {
+    uint64_t sum = 0;
+    for (int i = 0; i < driver->config->threads; i++) {
+        sum += driver->workers[i].messages;
+    }
+    return sum;
+}
+
+// Many connections from a few threads against the benchmark server's echo mode
+int run_load_driver(const struct load_config *config) {
+    struct load_driver driver;
+    int ret = -1;
+    memset(&driver, 0, sizeof(driver));
+    driver.config = config;
+    driver.slot_size = (config->message_size + LOAD_SLOT_ALIGN - 1) & ~(size_t)(LOAD_SLOT_ALIGN - 1);
+
+    if (config->window < 1 || config->window > LOAD_MAX_WINDOW) {
+        fprintf(stderr, "Window must be 1..%d\n", LOAD_MAX_WINDOW);
+        return -1;
+    }
+
+    printf("\n=== RDMA Multi-Connection Load Driver ===\n");
+    printf("Server: %s:%d\n", config->server_ip, config->port ? config->port : TLS_PORT);
+    printf("Connections: %d over %d driver thread(s), window %d, %d-byte messages\n",
+           config->connections, config->threads, config->window, config->message_size);
+
+    if (init_load_rdma(&driver) < 0) {
+        goto out;
+    }
+
+    // Every connection can have its whole window of sends and receives,
+    // plus unreaped signalled sends, completing on its thread's one CQ
+    int per_conn = config->window * 2 + LOAD_SIGNAL_INTERVAL;
+    long max_conns = (config->connections + config->threads - 1) / config->threads;
+    if (max_conns * per_conn > driver.max_cqe) {
+        long conns_fit = driver.max_cqe / per_conn;
+        long window_fit = (driver.max_cqe / max_conns - LOAD_SIGNAL_INTERVAL) / 2;
+        fprintf(stderr, "%ld connections per thread need a %ld-entry CQ, but the device allows %d:\n",
+                max_conns, max_conns * per_conn, driver.max_cqe);
+        if (conns_fit > 0) {
+            fprintf(stderr, "  use at least %ld threads (--threads)\n",
+                    (config->connections + conns_fit - 1) / conns_fit);
+        }
+        if (window_fit > 0) {
+            fprintf(stderr, "  or a window of at most %ld (--window)\n", window_fit);
+        }
+        goto out;
+    }
+
+    driver.workers = calloc(config->threads, sizeof(struct load_worker));
+    if (!driver.workers) {
+        goto out;
+    }
+    pthread_mutex_init(&driver.gate_lock, NULL);
+    pthread_cond_init(&driver.gate_cond, NULL);
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int per_worker = config->connections / config->threads;
+    int remainder = config->connections % config->threads;
+    int next_conn = 0;
+    int started = 0;
+    for (int i = 0; i < config->threads; i++) {
+        struct load_worker *worker = &driver.workers[i];
+        worker->index = i;
+        worker->driver = &driver;
+        worker->num_conns = per_worker + (i < remainder ? 1 : 0);
+        worker->first_conn_id = next_conn;
+        worker->cpu = config->cpu_base >= 0 ? (int)((config->cpu_base + i) % ncpu) : -1;
+        worker->rng = 0x9E3779B97F4A7C15ULL ^ (uint64_t)(i + 1);
+        next_conn += worker->num_conns;
+
+        if (pthread_create(&worker->thread, NULL, load_worker_thread, worker) != 0) {
+            fprintf(stderr, "Failed to create driver thread %d\n", i);
+            break;
+        }
+        started++;
+    }
+    if (started < config->threads) {
+        // Cut the started threads' setup short, open the gate and reap them
+        fprintf(stderr, "Aborting: only %d of %d driver threads started\n", started, config->threads);
+        driver.stop = 1;
+    }
+
+    uint64_t setup_start = perf_now_ns();
+    pthread_mutex_lock(&driver.gate_lock);
+    while (driver.ready < started) {
+        pthread_cond_wait(&driver.gate_cond, &driver.gate_lock);
+    }
+    driver.go = 1;
+    pthread_cond_broadcast(&driver.gate_cond);
+    pthread_mutex_unlock(&driver.gate_lock);
+    double setup_s = (perf_now_ns() - setup_start) / 1e9;
+
+    if (started < config->threads) {
+        for (int i = 0; i < started; i++) {
+            pthread_join(driver.workers[i].thread, NULL);
+            free(driver.workers[i].lat_samples);
+        }
+        goto out_gate;
+    }
+
+    int established = 0;
+    uint64_t errors = 0;
+    for (int i = 0; i < config->threads; i++) {
+        established += driver.workers[i].established;
+        errors += driver.workers[i].errors;
+    }
+    printf("\nEstablished %d/%d connections in %.2f s (%.0f conn/s), %lu setup errors\n",
+           established, config->connections, setup_s,
+           setup_s > 0 ? established / setup_s : 0.0, errors);
+
+    // Per-second progress while the threads run
+    uint64_t prev = 0;
+    uint64_t traffic_start = perf_now_ns();
+    for (int sec = 1; sec <= config->duration_sec && established > 0; sec++) {
+        sleep(1);
+        uint64_t now_total = total_messages(&driver);
+        printf("  t=%3ds  %12.0f msg/s\n", sec, (double)(now_total - prev));
+        fflush(stdout);
+        prev = now_total;
+    }
+    driver.stop = 1;
+    double traffic_s = (perf_now_ns() - traffic_start) / 1e9;
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(driver.workers[i].thread, NULL);
+    }
+
+    // Merge per-thread results
+    uint64_t messages = 0, bytes = 0;
+    size_t lat_total = 0;
+    errors = 0;
+    for (int i = 0; i < config->threads; i++) {
+        messages += driver.workers[i].messages;
+        bytes += driver.workers[i].bytes;
+        errors += driver.workers[i].errors;
+        lat_total += driver.workers[i].lat_count;
+    }
+
+    uint64_t *lat = malloc((lat_total ? lat_total : 1) * sizeof(uint64_t));
+    size_t pos = 0;
+    for (int i = 0; i < config->threads && lat; i++) {
+        memcpy(lat + pos, driver.workers[i].lat_samples,
+               driver.workers[i].lat_count * sizeof(uint64_t));
+        pos += driver.workers[i].lat_count;
+        free(driver.workers[i].lat_samples);
+    }
+
+    struct latency_summary summary;
+    summarize_latencies(lat, lat ? lat_total : 0, &summary);
+    free(lat);
+
+    printf("\n=== Load Driver Results ===\n");
+    printf("Connections: %d established, %d driver thread(s)\n", established, config->threads);
+    printf("Messages: %lu echoed in %.2f s\n", messages, traffic_s);
+    printf("Throughput: %.0f msg/s, %.2f MB/s\n",
+           messages / traffic_s, bytes / (1024.0 * 1024.0) / traffic_s);
+    printf("Round trip (us): avg %.2f, p50 %.2f, p99 %.2f, p99.9 %.2f, max %.2f\n",
+           summary.avg / 1000.0, summary.p50 / 1000.0, summary.p99 / 1000.0,
+           summary.p999 / 1000.0, summary.max / 1000.0);
+    printf("Errors: %lu\n", errors);
+
+    ret = 0;
+
+out_gate:
+    pthread_mutex_destroy(&driver.gate_lock);
+    pthread_cond_destroy(&driver.gate_cond);
+out:
+    free(driver.workers);
+    if (driver.pd) ibv_dealloc_pd(driver.pd);
+    if (driver.ctx) ibv_close_device(driver.ctx);
+    if (driver.dev_list) ibv_free_device_list(driver.dev_list);
+    return ret;
+}
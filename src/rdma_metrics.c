@@ -0,0 +1,379 @@
+/**
+ * RDMA Server Metrics
+ * Lock-free per-connection counters, aggregated once a second by a
+ * metrics thread and served in Prometheus text format over a local
+ * HTTP (TCP or Unix socket) endpoint.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "rdma_compat.h"
+#include "rdma_metrics.h"
+
+#define METRICS_TICK_MS 1000
+#define METRICS_REQUEST_MAX 1024
+
+// Counter families exported both server-wide and per connection
+static const struct {
+    const char *name;
+    const char *help;
+    size_t offset;
+} counter_fields[] = {
+    { "messages_received_total", "Messages received", offsetof(struct conn_counters, messages_rx) },
+    { "messages_sent_total", "Messages sent", offsetof(struct conn_counters, messages_tx) },
+    { "bytes_received_total", "Payload bytes received", offsetof(struct conn_counters, bytes_rx) },
+    { "bytes_sent_total", "Payload bytes sent", offsetof(struct conn_counters, bytes_tx) },
+    { "completions_total", "Work completions polled", offsetof(struct conn_counters, completions) },
+    { "rnr_retry_exceeded_total", "Completions failed with RNR retry exceeded",
+      offsetof(struct conn_counters, rnr_retry_exceeded) },
+    { "errors_total", "Failed completions and posts", offsetof(struct conn_counters, errors) },
+};
+#define NUM_COUNTER_FIELDS (sizeof(counter_fields) / sizeof(counter_fields[0]))
+
+static uint64_t metrics_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t load_counter(const struct conn_counters *c, size_t offset) {
+    return __atomic_load_n((const uint64_t *)((const char *)c + offset), __ATOMIC_RELAXED);
+}
+
+struct metrics_registry* metrics_create(const char *device) {
+    struct metrics_registry *reg = calloc(1, sizeof(*reg));
+    if (!reg) {
+        return NULL;
+    }
+
+    reg->device = device;
+    reg->listen_fd = -1;
+    reg->last_tick_ns = metrics_now_ns();
+    pthread_mutex_init(&reg->lock, NULL);
+    return reg;
+}
+
+struct conn_metrics* metrics_register(struct metrics_registry *reg, int id) {
+    struct conn_metrics *m = calloc(1, sizeof(*m));
+    if (!m) {
+        return NULL;
+    }
+    m->id = id;
+
+    pthread_mutex_lock(&reg->lock);
+    m->next = reg->conns;
+    if (reg->conns) reg->conns->prev = m;
+    reg->conns = m;
+    reg->active++;
+    reg->accepted++;
+    pthread_mutex_unlock(&reg->lock);
+
+    return m;
+}
+
+// Caller guarantees the connection's owner no longer updates m
+void metrics_unregister(struct metrics_registry *reg, struct conn_metrics *m) {
+    if (!m) return;
+
+    pthread_mutex_lock(&reg->lock);
+    if (m->prev) m->prev->next = m->next;
+    else reg->conns = m->next;
+    if (m->next) m->next->prev = m->prev;
+    reg->active--;
+
+    for (size_t i = 0; i < NUM_COUNTER_FIELDS; i++) {
+        *(uint64_t *)((char *)&reg->retired + counter_fields[i].offset) +=
+            load_counter(&m->counters, counter_fields[i].offset);
+    }
+    pthread_mutex_unlock(&reg->lock);
+
+    free(m);
+}
+
+void metrics_completion(struct conn_metrics *m, int wc_status) {
+    metrics_add(&m->counters.completions, 1);
+    metrics_queue(m, -1);
+
+    if (wc_status == IBV_WC_RNR_RETRY_EXC_ERR) {
+        metrics_add(&m->counters.rnr_retry_exceeded, 1);
+    } else if (wc_status != IBV_WC_SUCCESS) {
+        metrics_add(&m->counters.errors, 1);
+    }
+}
+
+// Recompute message rates over the last interval (metrics thread only)
+static void aggregate(struct metrics_registry *reg) {
+    uint64_t now = metrics_now_ns();
+    double dt = (now - reg->last_tick_ns) / 1e9;
+    if (dt <= 0) return;
+
+    pthread_mutex_lock(&reg->lock);
+    uint64_t total = reg->retired.messages_rx + reg->retired.messages_tx;
+    for (struct conn_metrics *m = reg->conns; m; m = m->next) {
+        uint64_t messages = load_counter(&m->counters, offsetof(struct conn_counters, messages_rx)) +
+                            load_counter(&m->counters, offsetof(struct conn_counters, messages_tx));
+        m->message_rate = (messages - m->last_messages) / dt;
+        m->last_messages = messages;
+        total += messages;
+    }
+    pthread_mutex_unlock(&reg->lock);
+
+    reg->message_rate = total >= reg->last_messages ? (total - reg->last_messages) / dt : 0;
+    reg->last_messages = total;
+    reg->last_tick_ns = now;
+}
+
+// Device-wide counter from sysfs, e.g. rnr_nak_retry_err; -1 if unavailable
+static long long read_hw_counter(const char *device, const char *name) {
+    char path[256];
+    snprintf(path, sizeof(path), "/sys/class/infiniband/%s/ports/1/hw_counters/%s", device, name);
+
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    long long value = -1;
+    if (fscanf(f, "%lld", &value) != 1) value = -1;
+    fclose(f);
+    return value;
+}
+
+static void render(struct metrics_registry *reg, FILE *out) {
+    pthread_mutex_lock(&reg->lock);
+
+    fprintf(out, "# HELP rdma_connections_active Connections currently open\n");
+    fprintf(out, "# TYPE rdma_connections_active gauge\n");
+    fprintf(out, "rdma_connections_active %d\n", reg->active);
+    fprintf(out, "# HELP rdma_connections_accepted_total Connections accepted since start\n");
+    fprintf(out, "# TYPE rdma_connections_accepted_total counter\n");
+    fprintf(out, "rdma_connections_accepted_total %lu\n", reg->accepted);
+    fprintf(out, "# HELP rdma_message_rate Messages per second over the last interval\n");
+    fprintf(out, "# TYPE rdma_message_rate gauge\n");
+    fprintf(out, "rdma_message_rate %.1f\n", reg->message_rate);
+
+    // Server-wide totals include connections that have already closed
+    for (size_t i = 0; i < NUM_COUNTER_FIELDS; i++) {
+        uint64_t total = load_counter(&reg->retired, counter_fields[i].offset);
+        for (struct conn_metrics *m = reg->conns; m; m = m->next) {
+            total += load_counter(&m->counters, counter_fields[i].offset);
+        }
+        fprintf(out, "# HELP rdma_%s %s\n", counter_fields[i].name, counter_fields[i].help);
+        fprintf(out, "# TYPE rdma_%s counter\n", counter_fields[i].name);
+        fprintf(out, "rdma_%s %lu\n", counter_fields[i].name, total);
+    }
+
+    for (size_t i = 0; i < NUM_COUNTER_FIELDS; i++) {
+        fprintf(out, "# HELP rdma_conn_%s %s, per connection\n",
+                counter_fields[i].name, counter_fields[i].help);
+        fprintf(out, "# TYPE rdma_conn_%s counter\n", counter_fields[i].name);
+        for (struct conn_metrics *m = reg->conns; m; m = m->next) {
+            fprintf(out, "rdma_conn_%s{conn=\"%d\"} %lu\n", counter_fields[i].name, m->id,
+                    load_counter(&m->counters, counter_fields[i].offset));
+        }
+    }
+
+    fprintf(out, "# HELP rdma_conn_queue_occupancy Work requests posted and not yet completed\n");
+    fprintf(out, "# TYPE rdma_conn_queue_occupancy gauge\n");
+    for (struct conn_metrics *m = reg->conns; m; m = m->next) {
+        fprintf(out, "rdma_conn_queue_occupancy{conn=\"%d\"} %ld\n", m->id,
+                (long)__atomic_load_n(&m->queue_occupancy, __ATOMIC_RELAXED));
+    }
+
+    fprintf(out, "# HELP rdma_conn_message_rate Messages per second over the last interval\n");
+    fprintf(out, "# TYPE rdma_conn_message_rate gauge\n");
+    for (struct conn_metrics *m = reg->conns; m; m = m->next) {
+        fprintf(out, "rdma_conn_message_rate{conn=\"%d\"} %.1f\n", m->id, m->message_rate);
+    }
+
+    pthread_mutex_unlock(&reg->lock);
+
+    // Verbs cannot count RNR NAK retries per QP; the port counter is the closest
+    if (reg->device) {
+        long long rnr = read_hw_counter(reg->device, "rnr_nak_retry_err");
+        if (rnr >= 0) {
+            fprintf(out, "# HELP rdma_device_rnr_nak_retry_err_total Port RNR NAK retries (hw_counters)\n");
+            fprintf(out, "# TYPE rdma_device_rnr_nak_retry_err_total counter\n");
+            fprintf(out, "rdma_device_rnr_nak_retry_err_total{device=\"%s\"} %lld\n", reg->device, rnr);
+        }
+    }
+}
+
+// Answer one HTTP request with the current metrics, whatever the path
+static void serve_client(struct metrics_registry *reg, int fd) {
+    char request[METRICS_REQUEST_MAX];
+    struct timeval tv = { .tv_sec = 1, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (recv(fd, request, sizeof(request), 0) <= 0) {
+        return;
+    }
+
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *out = open_memstream(&body, &body_len);
+    if (!out) return;
+    render(reg, out);
+    fclose(out);
+
+    char header[160];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 200 OK\r\n"
+                              "Content-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %zu\r\n"
+                              "Connection: close\r\n\r\n", body_len);
+
+    if (send(fd, header, header_len, MSG_NOSIGNAL) == header_len) {
+        size_t sent = 0;
+        while (sent < body_len) {
+            ssize_t n = send(fd, body + sent, body_len - sent, MSG_NOSIGNAL);
+            if (n <= 0) break;
+            sent += n;
+        }
+    }
+    free(body);
+}
+
+static void* metrics_thread(void *arg) {
+    struct metrics_registry *reg = arg;
+    struct pollfd pfd = { .fd = reg->listen_fd, .events = POLLIN };
+
+    while (reg->running) {
+        int ret = poll(&pfd, 1, METRICS_TICK_MS);
+        if (ret < 0 && errno != EINTR) {
+            perror("metrics poll");
+            break;
+        }
+
+        if (metrics_now_ns() - reg->last_tick_ns >= METRICS_TICK_MS * 1000000ULL) {
+            aggregate(reg);
+        }
+
+        if (ret > 0 && (pfd.revents & POLLIN)) {
+            int fd = accept(reg->listen_fd, NULL, NULL);
+            if (fd >= 0) {
+                serve_client(reg, fd);
+                close(fd);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static int listen_unix(struct metrics_registry *reg, const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Metrics socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        close(sock);
+        return -1;
+    }
+    snprintf(reg->unix_path, sizeof(reg->unix_path), "%s", path);
+    return sock;
+}
+
+static int listen_tcp(const char *spec) {
+    char host[64] = "127.0.0.1";
+    const char *colon = strrchr(spec, ':');
+    int port;
+
+    if (colon) {
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - spec), spec);
+        port = atoi(colon + 1);
+    } else {
+        port = atoi(spec);
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (port <= 0 || port > 65535 || inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid metrics address: %s\n", spec);
+        return -1;
+    }
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("socket");
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+int metrics_start(struct metrics_registry *reg, const char *addr) {
+    if (strncmp(addr, "unix:", 5) == 0) {
+        reg->listen_fd = listen_unix(reg, addr + 5);
+    } else {
+        reg->listen_fd = listen_tcp(addr);
+    }
+    if (reg->listen_fd < 0) {
+        return -1;
+    }
+
+    if (listen(reg->listen_fd, 16) < 0) {
+        perror("listen");
+        close(reg->listen_fd);
+        reg->listen_fd = -1;
+        return -1;
+    }
+
+    reg->running = 1;
+    if (pthread_create(&reg->thread, NULL, metrics_thread, reg) != 0) {
+        fprintf(stderr, "Failed to create metrics thread\n");
+        reg->running = 0;
+        close(reg->listen_fd);
+        reg->listen_fd = -1;
+        return -1;
+    }
+
+    printf("Metrics endpoint: %s\n", addr);
+    return 0;
+}
+
+void metrics_destroy(struct metrics_registry *reg) {
+    if (!reg) return;
+
+    if (reg->running) {
+        reg->running = 0;
+        pthread_join(reg->thread, NULL);
+    }
+    if (reg->listen_fd >= 0) close(reg->listen_fd);
+    if (reg->unix_path[0]) unlink(reg->unix_path);
+
+    struct conn_metrics *m = reg->conns;
+    while (m) {
+        struct conn_metrics *next = m->next;
+        free(m);
+        m = next;
+    }
+    pthread_mutex_destroy(&reg->lock);
+    free(reg);
+}
@@ -0,0 +1,84 @@
+#ifndef RDMA_METRICS_H
+#define RDMA_METRICS_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+// Cumulative per-connection counters. Each connection's counters are
+// written only by the thread that owns its CQ (relaxed atomics) and read
+// by the metrics thread, so the data path never takes a lock.
+struct conn_counters {
+    uint64_t messages_rx;
+    uint64_t messages_tx;
+    uint64_t bytes_rx;
+    uint64_t bytes_tx;
+    uint64_t completions;
+    uint64_t rnr_retry_exceeded;   // IBV_WC_RNR_RETRY_EXC_ERR completions
+    uint64_t errors;               // Any other failed completion or post
+};
+
+struct conn_metrics {
+    int id;
+    struct conn_counters counters;
+    int64_t queue_occupancy;       // Work requests posted and not yet completed
+
+    // Owned by the metrics thread
+    uint64_t last_messages;
+    double message_rate;
+    struct conn_metrics *prev;
+    struct conn_metrics *next;
+};
+
+struct metrics_registry {
+    const char *device;            // For device-wide hw_counters, may be NULL
+    pthread_mutex_t lock;          // Protects the connection list only
+    struct conn_metrics *conns;
+    int active;
+    uint64_t accepted;
+    struct conn_counters retired;  // Totals of unregistered connections
+
+    // Endpoint and aggregation
+    int listen_fd;
+    char unix_path[108];
+    pthread_t thread;
+    volatile int running;
+    uint64_t last_tick_ns;
+    uint64_t last_messages;
+    double message_rate;
+};
+
+// Registry lifetime
+struct metrics_registry* metrics_create(const char *device);
+void metrics_destroy(struct metrics_registry *reg);
+
+// Serve Prometheus text at addr: "unix:/path", "host:port" or "port"
+// (bare ports bind 127.0.0.1). Also starts the once-a-second aggregation.
+int metrics_start(struct metrics_registry *reg, const char *addr);
+
+// Connection lifetime; counters of unregistered connections are kept in the totals
+struct conn_metrics* metrics_register(struct metrics_registry *reg, int id);
+void metrics_unregister(struct metrics_registry *reg, struct conn_metrics *m);
+
+// Data-path updates (lock-free)
+static inline void metrics_add(uint64_t *counter, uint64_t n) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+static inline void metrics_queue(struct conn_metrics *m, int64_t delta) {
+    __atomic_fetch_add(&m->queue_occupancy, delta, __ATOMIC_RELAXED);
+}
+
+static inline void metrics_recv(struct conn_metrics *m, uint64_t bytes) {
+    metrics_add(&m->counters.messages_rx, 1);
+    metrics_add(&m->counters.bytes_rx, bytes);
+}
+
+static inline void metrics_send(struct conn_metrics *m, uint64_t bytes) {
+    metrics_add(&m->counters.messages_tx, 1);
+    metrics_add(&m->counters.bytes_tx, bytes);
+}
+
+// One polled completion: counts it, releases its queue slot, classifies failures
+void metrics_completion(struct conn_metrics *m, int wc_status);
+
+#endif // RDMA_METRICS_H
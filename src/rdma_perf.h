@@ -0,0 +1,209 @@
+/**
+ * RDMA Performance Harness - shared definitions
+ * Used by rdma_performance_test.c (driver), rdma_perf_client.c (client side)
+ * and rdma_perf_server.c (benchmark peer)
+ */
+
+#ifndef RDMA_PERF_H
+#define RDMA_PERF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/time.h>
+#include "tls_utils.h"
+
+#define PERF_MIN_MSG_SIZE 2
+#define PERF_MAX_MSG_SIZE (8 * 1024 * 1024)
+#define PERF_DEFAULT_DEPTH 16
+#define PERF_DEFAULT_ITERS 1000
+#define PERF_MAX_RD_ATOMIC 16
+#define PERF_DEFAULT_ECHO_MEM (64UL * 1024 * 1024)
+#define PERF_DEFAULT_BOOTSTRAPS 64
+
+// Performance metrics for each client
+struct client_metrics {
+    struct timeval connect_start;
+    struct timeval connect_end;
+    struct timeval first_msg;
+    struct timeval last_msg;
+
+    int messages_sent;
+    int messages_received;
+    int errors;
+    double total_latency_ms;
+};
+
+// Data-path behaviour requested from the benchmark server (rdma_perf_server.c)
+enum perf_mode {
+    PERF_MODE_SINK = 1,      // Keep receives posted, discard payload (SEND bandwidth)
+    PERF_MODE_PASSIVE = 2,   // Expose a buffer for RDMA WRITE/READ, no server CPU
+    PERF_MODE_ECHO = 3       // SEND every received message straight back
+};
+
+// perf_ctrl.flags
+#define PERF_FLAG_SERVER_TS (1u << 0)    // Echo server stamps perf_msg_hdr
+#define PERF_FLAG_ACCEPT_INFO (1u << 1)  // Server replies with perf_accept_info
+
+// Server's listen queue as seen when it accepted this connection.
+// Sent right after perf_ctrl when requested; network byte order.
+struct perf_accept_info {
+    uint32_t queue_len;  // Connections waiting in the accept queue
+    uint32_t backlog;    // Listen backlog the server asked for
+    uint32_t bootstraps; // Connections it brings up at once, 1 = serialized
+};
+
+// Leading bytes of every ping-pong message. Timestamps are CLOCK_MONOTONIC
+// nanoseconds in host byte order; each side only compares its own stamps.
+struct perf_msg_hdr {
+    uint64_t seq;
+    uint64_t client_tx_ns;
+    uint64_t server_rx_ns;   // When the server polled the receive
+    uint64_t server_tx_ns;   // Just before the server posted the echo
+};
+
+// Operations exercised by the size sweep
+enum perf_op {
+    PERF_OP_SEND  = 1 << 0,
+    PERF_OP_WRITE = 1 << 1,
+    PERF_OP_READ  = 1 << 2
+};
+#define PERF_OP_ALL (PERF_OP_SEND | PERF_OP_WRITE | PERF_OP_READ)
+
+// Control block sent by the client over TLS right after the PSN exchange,
+// before RDMA parameters are swapped. Fields travel in network byte order.
+struct perf_ctrl {
+    uint32_t mode;
+    uint32_t max_size;   // Largest message the server must be able to hold
+    uint32_t rx_depth;   // Receives to keep posted (SEND modes)
+    uint32_t flags;
+};
+
+// Message-size sweep configuration
+struct sweep_config {
+    const char *server_ip;
+    int port;
+    int ops;             // Mask of enum perf_op
+    int min_size;
+    int max_size;
+    int queue_depth;     // Outstanding work requests per QP
+    int iterations;      // Work requests per size (scaled down for big sizes)
+};
+
+// Round-trip (ping-pong) configuration
+struct pingpong_config {
+    const char *server_ip;
+    int port;
+    int message_size;
+    int iterations;
+    int warmup;
+    int busy_poll;           // 0 = sleep on a completion channel
+    int server_timestamps;   // Ask the server to stamp perf_msg_hdr
+};
+
+// Multi-connection load driver configuration
+struct load_config {
+    const char *server_ip;
+    int port;
+    int connections;     // Total QPs across all driver threads
+    int threads;         // Driver threads, each with its own shared CQ
+    int window;          // Messages in flight per connection
+    int message_size;
+    int duration_sec;
+    int cpu_base;        // First CPU to pin to, -1 to leave threads unpinned
+};
+
+// Benchmark server configuration
+struct perf_server_config {
+    int port;
+    int pollers;              // CQ poller threads
+    int backlog;              // Listen backlog, 0 = SOMAXCONN
+    size_t max_echo_mem;      // Echo buffer cap per connection, 0 = PERF_DEFAULT_ECHO_MEM
+    int bootstraps;           // Concurrent TLS + QP bring-ups, 0 = PERF_DEFAULT_BOOTSTRAPS
+    const char *metrics_addr; // Prometheus endpoint, NULL to disable
+};
+
+// Staged connection-rate ramp configuration
+struct connrate_config {
+    const char *server_ip;
+    int port;
+    int start_rate;      // Connections per second in the first stage
+    int step_rate;       // Added per stage
+    int max_rate;
+    int stage_sec;
+    int threads;         // Connecting threads (bounds setups in flight)
+};
+
+// Bootstrap step that failed (perf_bootstrap.failed_stage)
+enum perf_setup_stage {
+    PERF_STAGE_NONE = 0,
+    PERF_STAGE_QP,            // Local QP creation (set by the caller)
+    PERF_STAGE_TLS,           // TCP connect or TLS handshake
+    PERF_STAGE_PSN,
+    PERF_STAGE_CTRL,
+    PERF_STAGE_PARAMS,
+    PERF_STAGE_TRANSITION,    // INIT -> RTR -> RTS
+    PERF_STAGE_COUNT
+};
+
+struct ibv_qp;
+
+// Secure bootstrap of one QP that the caller created on its own PD/CQs
+struct perf_bootstrap {
+    // Inputs
+    int id;                        // For log messages only
+    const char *server_ip;
+    int port;
+    const struct perf_ctrl *ctrl;  // NULL when talking to the plain secure server
+    struct ibv_qp *qp;
+    uint32_t rkey;                 // Local window advertised to the server
+    uint64_t remote_addr;
+    int rd_atomic;
+
+    // Outputs
+    struct tls_connection *tls_conn;
+    uint32_t local_psn;
+    uint32_t remote_psn;
+    struct rdma_conn_params remote_params;
+    struct perf_accept_info accept_info;  // Host order; PERF_FLAG_ACCEPT_INFO only
+    int failed_stage;                     // enum perf_setup_stage
+};
+
+// Latency distribution in nanoseconds
+struct latency_summary {
+    size_t count;
+    uint64_t min;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+    double avg;
+};
+
+// Monotonic clock in nanoseconds (gettimeofday is too coarse for single WRs)
+static inline uint64_t perf_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// rdma_perf_client.c
+int run_rdma_client_test(int client_id, const char *server_ip, const char *server_name,
+                         int num_messages, int message_size, int think_time_ms,
+                         struct client_metrics *metrics);
+int perf_secure_connect(struct perf_bootstrap *bootstrap);
+int run_rdma_sweep(const struct sweep_config *config);
+int run_rdma_pingpong(const struct pingpong_config *config);
+void summarize_latencies(uint64_t *samples, size_t count, struct latency_summary *out);
+const char *perf_op_name(int op);
+const char *perf_stage_name(int stage);
+
+// rdma_perf_server.c
+int run_perf_server(const struct perf_server_config *config);
+
+// rdma_load_driver.c
+int run_load_driver(const struct load_config *config);
+int run_connection_rate(const struct connrate_config *config);
+
+#endif // RDMA_PERF_H
@@ -15,28 +15,29 @@
 #include <sys/socket.h>
 #include "rdma_compat.h"
 #include "tls_utils.h"
+#include "rdma_perf.h"
 
 #define BUFFER_SIZE 4096
 #define DEFAULT_PORT 4791
-
-// Performance metrics for each client
-struct client_metrics {
-    struct timeval connect_start;
-    struct timeval connect_end;
-    struct timeval first_msg;
-    struct timeval last_msg;
-    
-    int messages_sent;
-    int messages_received;
-    int errors;
-    double total_latency_ms;
-};
+#define DEFAULT_QUEUE_DEPTH 10
+#define SWEEP_BYTES_PER_SIZE (1ULL << 30)  // Cap per-size traffic for large messages
 
 // RDMA client context
 struct rdma_client_context {
     int client_id;
     char *server_ip;
     char *server_name;
+    int port;
+    
+    // Resource sizing (0 selects the legacy defaults)
+    size_t buffer_size;
+    int queue_depth;
+    int rd_atomic;
+    uint32_t max_inline;
+    int use_events;          // Receive CQ sleeps on a completion channel
+    
+    // Benchmark server control block (mode 0 = plain secure server)
+    struct perf_ctrl ctrl;
     
     // TLS connection
     struct tls_connection *tls_conn;
@@ -50,38 +51,25 @@ struct rdma_client_context {
     struct ibv_qp *qp;
     struct ibv_cq *send_cq;
     struct ibv_cq *recv_cq;
+    struct ibv_comp_channel *channel;
     struct ibv_mr *send_mr;
     struct ibv_mr *recv_mr;
     char *send_buffer;
     char *recv_buffer;
     
     // Remote connection info
-    struct rdma_conn_params local_params;
     struct rdma_conn_params remote_params;
     
     // Performance metrics
     struct client_metrics metrics;
 };
 
-// Get device GID
-static int get_device_gid(struct ibv_context *ctx, union ibv_gid *gid) {
-    struct ibv_device_attr device_attr;
-    if (ibv_query_device(ctx, &device_attr)) {
-        perror("ibv_query_device");
-        return -1;
-    }
-    
-    // Use first port, first GID
-    if (ibv_query_gid(ctx, 1, 0, gid)) {
-        perror("ibv_query_gid");
-        return -1;
-    }
-    
-    return 0;
-}
-
 // Create RDMA resources using pure IB verbs
 static int create_rdma_resources(struct rdma_client_context *client) {
+    if (client->buffer_size == 0) client->buffer_size = BUFFER_SIZE;
+    if (client->queue_depth <= 0) client->queue_depth = DEFAULT_QUEUE_DEPTH;
+    if (client->rd_atomic <= 0) client->rd_atomic = 1;
+    
     // Get device list
     int num_devices;
     client->dev_list = ibv_get_device_list(&num_devices);
@@ -97,6 +85,13 @@ static int create_rdma_resources(struct rdma_client_context *client) {
         return -1;
     }
     
+    // Outstanding RDMA READs are bounded by the device
+    struct ibv_device_attr device_attr;
+    if (client->rd_atomic > 1 && ibv_query_device(client->ctx, &device_attr) == 0 &&
+        client->rd_atomic > device_attr.max_qp_rd_atom) {
+        client->rd_atomic = device_attr.max_qp_rd_atom > 0 ? device_attr.max_qp_rd_atom : 1;
+    }
+    
     // Allocate PD
     client->pd = ibv_alloc_pd(client->ctx);
     if (!client->pd) {
@@ -104,9 +99,18 @@ static int create_rdma_resources(struct rdma_client_context *client) {
         return -1;
     }
     
+    // Completion channel only when the caller wants to block instead of spin
+    if (client->use_events) {
+        client->channel = ibv_create_comp_channel(client->ctx);
+        if (!client->channel) {
+            fprintf(stderr, "Failed to create completion channel\n");
+            return -1;
+        }
+    }
+    
     // Create CQs
-    client->send_cq = ibv_create_cq(client->ctx, 10, NULL, NULL, 0);
-    client->recv_cq = ibv_create_cq(client->ctx, 10, NULL, NULL, 0);
+    client->send_cq = ibv_create_cq(client->ctx, client->queue_depth, NULL, NULL, 0);
+    client->recv_cq = ibv_create_cq(client->ctx, client->queue_depth, NULL, client->channel, 0);
     if (!client->send_cq || !client->recv_cq) {
         fprintf(stderr, "Failed to create CQs\n");
         return -1;
@@ -118,8 +122,8 @@ static int create_rdma_resources(struct rdma_client_context *client) {
         .recv_cq = client->recv_cq,
         .qp_type = IBV_QPT_RC,
         .cap = {
-            .max_send_wr = 10,
-            .max_recv_wr = 10,
+            .max_send_wr = client->queue_depth,
+            .max_recv_wr = client->queue_depth,
             .max_send_sge = 1,
             .max_recv_sge = 1,
             .max_inline_data = 256
@@ -131,47 +135,56 @@ static int create_rdma_resources(struct rdma_client_context *client) {
         fprintf(stderr, "Failed to create QP\n");
         return -1;
     }
+    client->max_inline = qp_attr.cap.max_inline_data;
     
     // Allocate and register buffers
-    client->send_buffer = calloc(1, BUFFER_SIZE);
-    client->recv_buffer = calloc(1, BUFFER_SIZE);
+    client->send_buffer = calloc(1, client->buffer_size);
+    client->recv_buffer = calloc(1, client->buffer_size);
     if (!client->send_buffer || !client->recv_buffer) {
         fprintf(stderr, "Failed to allocate buffers\n");
         return -1;
     }
     
     int mr_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE;
-    client->send_mr = ibv_reg_mr(client->pd, client->send_buffer, BUFFER_SIZE, mr_flags);
-    client->recv_mr = ibv_reg_mr(client->pd, client->recv_buffer, BUFFER_SIZE, mr_flags);
+    client->send_mr = ibv_reg_mr(client->pd, client->send_buffer, client->buffer_size, mr_flags);
+    client->recv_mr = ibv_reg_mr(client->pd, client->recv_buffer, client->buffer_size, mr_flags);
     if (!client->send_mr || !client->recv_mr) {
         fprintf(stderr, "Failed to register memory\n");
         return -1;
     }
     
-    // Get local connection parameters
-    union ibv_gid local_gid;
-    if (get_device_gid(client->ctx, &local_gid) < 0) {
+    return 0;
+}
+
+// Transition QP to INIT
+static int modify_qp_to_init(struct ibv_qp *qp) {
+    struct ibv_qp_attr attr = {
+        .qp_state = IBV_QPS_INIT,
+        .pkey_index = 0,
+        .port_num = 1,
+        .qp_access_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE
+    };
+    
+    if (ibv_modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_PKEY_INDEX | 
+                      IBV_QP_PORT | IBV_QP_ACCESS_FLAGS)) {
+        fprintf(stderr, "Failed to modify QP to INIT\n");
         return -1;
     }
-    memcpy(client->local_params.gid, local_gid.raw, 16);
-    client->local_params.qp_num = client->qp->qp_num;
-    client->local_params.lid = 0;  // Not used in RoCE
-    client->local_params.psn = client->local_psn;
     
     return 0;
 }
 
 // Transition QP to RTR (Ready to Receive)
-static int modify_qp_to_rtr(struct rdma_client_context *client) {
+static int modify_qp_to_rtr(struct ibv_qp *qp, const struct rdma_conn_params *remote, int rd_atomic) {
     union ibv_gid remote_gid;
-    memcpy(remote_gid.raw, client->remote_params.gid, 16);
+    memcpy(remote_gid.raw, remote->gid, 16);
     
     struct ibv_qp_attr attr = {
         .qp_state = IBV_QPS_RTR,
         .path_mtu = IBV_MTU_1024,
-        .dest_qp_num = client->remote_params.qp_num,
-        .rq_psn = client->remote_params.psn,  // Use remote PSN for receive
-        .max_dest_rd_atomic = 1,
+        .dest_qp_num = remote->qp_num,
+        .rq_psn = remote->psn,  // Use remote PSN for receive
+        .max_dest_rd_atomic = rd_atomic,
         .min_rnr_timer = 12,
         .ah_attr = {
             .is_global = 1,
@@ -180,7 +193,7 @@ static int modify_qp_to_rtr(struct rdma_client_context *client) {
                 .sgid_index = 0,
                 .hop_limit = 1
             },
-            .dlid = client->remote_params.lid,
+            .dlid = remote->lid,
             .sl = 0,
             .src_path_bits = 0,
             .port_num = 1
@@ -191,7 +204,7 @@ static int modify_qp_to_rtr(struct rdma_client_context *client) {
                 IBV_QP_DEST_QPN | IBV_QP_RQ_PSN |
                 IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER;
     
-    if (ibv_modify_qp(client->qp, &attr, flags)) {
+    if (ibv_modify_qp(qp, &attr, flags)) {
         fprintf(stderr, "Failed to modify QP to RTR\n");
         return -1;
     }
@@ -200,20 +213,20 @@ static int modify_qp_to_rtr(struct rdma_client_context *client) {
 }
 
 // Transition QP to RTS (Ready to Send)
-static int modify_qp_to_rts(struct rdma_client_context *client) {
+static int modify_qp_to_rts(struct ibv_qp *qp, uint32_t local_psn, int rd_atomic) {
     struct ibv_qp_attr attr = {
         .qp_state = IBV_QPS_RTS,
         .timeout = 14,
         .retry_cnt = 7,
         .rnr_retry = 7,
-        .sq_psn = client->local_psn,  // Use local PSN for send
-        .max_rd_atomic = 1
+        .sq_psn = local_psn,  // Use local PSN for send
+        .max_rd_atomic = rd_atomic
     };
     
     int flags = IBV_QP_STATE | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT |
                 IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN | IBV_QP_MAX_QP_RD_ATOMIC;
     
-    if (ibv_modify_qp(client->qp, &attr, flags)) {
+    if (ibv_modify_qp(qp, &attr, flags)) {
         fprintf(stderr, "Failed to modify QP to RTS\n");
         return -1;
     }
@@ -221,82 +234,115 @@ static int modify_qp_to_rts(struct rdma_client_context *client) {
     return 0;
 }
 
-// Helper to get SSL from TLS connection
-static SSL* get_tls_ssl(struct tls_connection *conn) {
-    return conn ? conn->ssl : NULL;
-}
-
-// Create TLS client connection
-static struct tls_connection* create_tls_client_connection(const char *server_ip, int port) {
-    return connect_tls_server(server_ip, port);
-}
-
-// Connect to server with TLS PSN exchange
-static int connect_to_server(struct rdma_client_context *client) {
-    // Record connection start time
-    gettimeofday(&client->metrics.connect_start, NULL);
-    
-    // Create TLS connection for PSN exchange
-    client->tls_conn = create_tls_client_connection(client->server_ip, TLS_PORT);
-    if (!client->tls_conn) {
-        fprintf(stderr, "Client %d: Failed to create TLS connection\n", client->client_id);
+// Secure bring-up of a caller-created QP: TLS, PSN exchange, optional
+// benchmark control, RDMA parameter swap and INIT -> RTR -> RTS
+int perf_secure_connect(struct perf_bootstrap *bs) {
+    bs->failed_stage = PERF_STAGE_TLS;
+    bs->tls_conn = connect_tls_server(bs->server_ip, bs->port ? bs->port : TLS_PORT);
+    if (!bs->tls_conn) {
+        fprintf(stderr, "Client %d: Failed to create TLS connection\n", bs->id);
         return -1;
     }
     
-    // Generate secure PSN
-    client->local_psn = generate_secure_psn();
-    
-    // Exchange PSNs and parameters
-    if (exchange_psn_client(client->tls_conn, &client->local_psn, &client->remote_psn) < 0) {
-        fprintf(stderr, "Client %d: PSN exchange failed\n", client->client_id);
-        return -1;
+    bs->failed_stage = PERF_STAGE_PSN;
+    if (exchange_psn_client(bs->tls_conn, &bs->local_psn, &bs->remote_psn) < 0) {
+        fprintf(stderr, "Client %d: PSN exchange failed\n", bs->id);
+        goto fail;
     }
     
-    // Create RDMA resources
-    if (create_rdma_resources(client) < 0) {
-        fprintf(stderr, "Client %d: Failed to create RDMA resources\n", client->client_id);
-        return -1;
+    // Tell the benchmark server which data path to run
+    bs->failed_stage = PERF_STAGE_CTRL;
+    if (bs->ctrl) {
+        struct perf_ctrl net_ctrl = {
+            .mode = htonl(bs->ctrl->mode),
+            .max_size = htonl(bs->ctrl->max_size),
+            .rx_depth = htonl(bs->ctrl->rx_depth),
+            .flags = htonl(bs->ctrl->flags)
+        };
+        if (SSL_write(bs->tls_conn->ssl, &net_ctrl, sizeof(net_ctrl)) != sizeof(net_ctrl)) {
+            fprintf(stderr, "Client %d: Failed to send benchmark control\n", bs->id);
+            goto fail;
+        }
+        
+        if (bs->ctrl->flags & PERF_FLAG_ACCEPT_INFO) {
+            struct perf_accept_info info;
+            if (SSL_read(bs->tls_conn->ssl, &info, sizeof(info)) != sizeof(info)) {
+                fprintf(stderr, "Client %d: Failed to receive accept info\n", bs->id);
+                goto fail;
+            }
+            bs->accept_info.queue_len = ntohl(info.queue_len);
+            bs->accept_info.backlog = ntohl(info.backlog);
+            bs->accept_info.bootstraps = ntohl(info.bootstraps);
+        }
     }
     
-    // Exchange RDMA parameters
-    SSL *ssl = get_tls_ssl(client->tls_conn);
+    struct rdma_conn_params local_params = {0};
+    local_params.qp_num = bs->qp->qp_num;
+    local_params.lid = 0;  // Not used in RoCE
+    local_params.psn = bs->local_psn;
+    local_params.rkey = bs->rkey;
+    local_params.remote_addr = bs->remote_addr;
+    if (ibv_query_gid(bs->qp->context, 1, 0, (union ibv_gid *)local_params.gid)) {
+        perror("ibv_query_gid");
+        goto fail;
+    }
     
-    // Send local parameters
-    if (SSL_write(ssl, &client->local_params, sizeof(client->local_params)) <= 0) {
-        fprintf(stderr, "Client %d: Failed to send RDMA parameters\n", client->client_id);
-        return -1;
+    // Exchange RDMA parameters (network byte order, same as the servers)
+    bs->failed_stage = PERF_STAGE_PARAMS;
+    if (send_rdma_params(bs->tls_conn, &local_params) < 0 ||
+        receive_rdma_params(bs->tls_conn, &bs->remote_params) < 0) {
+        fprintf(stderr, "Client %d: RDMA parameter exchange failed\n", bs->id);
+        goto fail;
     }
     
-    // Receive remote parameters
-    if (SSL_read(ssl, &client->remote_params, sizeof(client->remote_params)) <= 0) {
-        fprintf(stderr, "Client %d: Failed to receive RDMA parameters\n", client->client_id);
-        return -1;
+    bs->failed_stage = PERF_STAGE_TRANSITION;
+    if (bs->rd_atomic <= 0) bs->rd_atomic = 1;
+    if (modify_qp_to_init(bs->qp) < 0 ||
+        modify_qp_to_rtr(bs->qp, &bs->remote_params, bs->rd_atomic) < 0 ||
+        modify_qp_to_rts(bs->qp, bs->local_psn, bs->rd_atomic) < 0) {
+        fprintf(stderr, "Client %d: QP transition failed\n", bs->id);
+        goto fail;
     }
     
-    // Transition QP to INIT
-    struct ibv_qp_attr attr = {
-        .qp_state = IBV_QPS_INIT,
-        .pkey_index = 0,
-        .port_num = 1,
-        .qp_access_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE
-    };
+    bs->failed_stage = PERF_STAGE_NONE;
+    return 0;
     
-    if (ibv_modify_qp(client->qp, &attr, IBV_QP_STATE | IBV_QP_PKEY_INDEX | 
-                      IBV_QP_PORT | IBV_QP_ACCESS_FLAGS)) {
-        fprintf(stderr, "Client %d: Failed to modify QP to INIT\n", client->client_id);
-        return -1;
-    }
+fail:
+    close_tls_connection(bs->tls_conn);
+    bs->tls_conn = NULL;
+    return -1;
+}
+
+// Connect to server with TLS PSN exchange
+static int connect_to_server(struct rdma_client_context *client) {
+    // Record connection start time
+    gettimeofday(&client->metrics.connect_start, NULL);
     
-    // Transition to RTR
-    if (modify_qp_to_rtr(client) < 0) {
+    // Create RDMA resources
+    if (create_rdma_resources(client) < 0) {
+        fprintf(stderr, "Client %d: Failed to create RDMA resources\n", client->client_id);
         return -1;
     }
     
-    // Transition to RTS
-    if (modify_qp_to_rts(client) < 0) {
+    struct perf_bootstrap bs = {
+        .id = client->client_id,
+        .server_ip = client->server_ip,
+        .port = client->port,
+        .ctrl = client->ctrl.mode != 0 ? &client->ctrl : NULL,
+        .qp = client->qp,
+        .rkey = client->recv_mr->rkey,
+        .remote_addr = (uintptr_t)client->recv_buffer,
+        .rd_atomic = client->rd_atomic
+    };
+    if (perf_secure_connect(&bs) < 0) {
         return -1;
     }
     
+    client->tls_conn = bs.tls_conn;
+    client->local_psn = bs.local_psn;
+    client->remote_psn = bs.remote_psn;
+    client->remote_params = bs.remote_params;
+    
     // Record connection end time
     gettimeofday(&client->metrics.connect_end, NULL);
     
@@ -350,7 +396,7 @@ static int send_rdma_message(struct rdma_client_context *client, const char *mes
 static int post_receive(struct rdma_client_context *client) {
     struct ibv_sge sge = {
         .addr = (uintptr_t)client->recv_buffer,
-        .length = BUFFER_SIZE,
+        .length = client->buffer_size,
         .lkey = client->recv_mr->lkey
     };
     
@@ -369,6 +415,22 @@ static int post_receive(struct rdma_client_context *client) {
     return 0;
 }
 
+// Release everything connect_to_server() created
+static void destroy_client_resources(struct rdma_client_context *client) {
+    if (client->qp) ibv_destroy_qp(client->qp);
+    if (client->send_mr) ibv_dereg_mr(client->send_mr);
+    if (client->recv_mr) ibv_dereg_mr(client->recv_mr);
+    if (client->send_cq) ibv_destroy_cq(client->send_cq);
+    if (client->recv_cq) ibv_destroy_cq(client->recv_cq);
+    if (client->channel) ibv_destroy_comp_channel(client->channel);
+    if (client->pd) ibv_dealloc_pd(client->pd);
+    if (client->ctx) ibv_close_device(client->ctx);
+    if (client->dev_list) ibv_free_device_list(client->dev_list);
+    if (client->tls_conn) close_tls_connection(client->tls_conn);
+    free(client->send_buffer);
+    free(client->recv_buffer);
+}
+
 // Run performance test for a single client
 int run_rdma_client_test(int client_id, const char *server_ip, const char *server_name,
                          int num_messages, int message_size, int think_time_ms,
@@ -378,9 +440,13 @@ int run_rdma_client_test(int client_id, const char *server_ip, const char *serve
     client.server_ip = (char*)server_ip;
     client.server_name = (char*)server_name;
     
+    // Size buffers for the requested message instead of overflowing BUFFER_SIZE
+    client.buffer_size = message_size > BUFFER_SIZE ? (size_t)message_size : BUFFER_SIZE;
+    
     // Connect to server
     if (connect_to_server(&client) < 0) {
         metrics->errors++;
+        destroy_client_resources(&client);
         return -1;
     }
     
@@ -428,18 +494,415 @@ int run_rdma_client_test(int client_id, const char *server_ip, const char *serve
     *metrics = client.metrics;
     
     // Cleanup
-    if (client.qp) ibv_destroy_qp(client.qp);
-    if (client.send_mr) ibv_dereg_mr(client.send_mr);
-    if (client.recv_mr) ibv_dereg_mr(client.recv_mr);
-    if (client.send_cq) ibv_destroy_cq(client.send_cq);
-    if (client.recv_cq) ibv_destroy_cq(client.recv_cq);
-    if (client.pd) ibv_dealloc_pd(client.pd);
-    if (client.ctx) ibv_close_device(client.ctx);
-    if (client.dev_list) ibv_free_device_list(client.dev_list);
-    if (client.tls_conn) close_tls_connection(client.tls_conn);
-    free(client.send_buffer);
-    free(client.recv_buffer);
+    destroy_client_resources(&client);
     free(message);
     
     return 0;
-}
\ No newline at end of file
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile over a sorted sample array
+static uint64_t percentile(const uint64_t *sorted, size_t count, double p) {
+    size_t rank = (size_t)(p * count + 0.999999);
+    if (rank == 0) rank = 1;
+    if (rank > count) rank = count;
+    return sorted[rank - 1];
+}
+
+// Sort samples in place and extract the latency distribution
+void summarize_latencies(uint64_t *samples, size_t count, struct latency_summary *out) {
+    memset(out, 0, sizeof(*out));
+    if (count == 0) return;
+    
+    qsort(samples, count, sizeof(uint64_t), compare_u64);
+    
+    double sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    
+    out->count = count;
+    out->min = samples[0];
+    out->p50 = percentile(samples, count, 0.50);
+    out->p90 = percentile(samples, count, 0.90);
+    out->p99 = percentile(samples, count, 0.99);
+    out->p999 = percentile(samples, count, 0.999);
+    out->max = samples[count - 1];
+    out->avg = sum / count;
+}
+
+const char *perf_op_name(int op) {
+    switch (op) {
+        case PERF_OP_SEND:  return "SEND";
+        case PERF_OP_WRITE: return "RDMA_WRITE";
+        case PERF_OP_READ:  return "RDMA_READ";
+        default:            return "UNKNOWN";
+    }
+}
+
+const char *perf_stage_name(int stage) {
+    switch (stage) {
+        case PERF_STAGE_NONE:       return "none";
+        case PERF_STAGE_QP:         return "qp-create";
+        case PERF_STAGE_TLS:        return "tls";
+        case PERF_STAGE_PSN:        return "psn";
+        case PERF_STAGE_CTRL:       return "ctrl";
+        case PERF_STAGE_PARAMS:     return "params";
+        case PERF_STAGE_TRANSITION: return "qp-rtr/rts";
+        default:                    return "unknown";
+    }
+}
+
+// Post one sweep work request; wr_id indexes the latency sample slot
+static int post_sweep_wr(struct rdma_client_context *client, int op, int size, uint64_t wr_id) {
+    struct ibv_sge sge = {
+        .addr = (uintptr_t)client->send_buffer,
+        .length = size,
+        .lkey = client->send_mr->lkey
+    };
+    
+    struct ibv_send_wr wr = {
+        .wr_id = wr_id,
+        .sg_list = &sge,
+        .num_sge = 1,
+        .send_flags = IBV_SEND_SIGNALED
+    };
+    
+    switch (op) {
+        case PERF_OP_SEND:
+            wr.opcode = IBV_WR_SEND;
+            break;
+        case PERF_OP_WRITE:
+            wr.opcode = IBV_WR_RDMA_WRITE;
+            wr.wr.rdma.remote_addr = client->remote_params.remote_addr;
+            wr.wr.rdma.rkey = client->remote_params.rkey;
+            break;
+        case PERF_OP_READ:
+            // READ lands in the local receive buffer
+            wr.opcode = IBV_WR_RDMA_READ;
+            sge.addr = (uintptr_t)client->recv_buffer;
+            sge.lkey = client->recv_mr->lkey;
+            wr.wr.rdma.remote_addr = client->remote_params.remote_addr;
+            wr.wr.rdma.rkey = client->remote_params.rkey;
+            break;
+        default:
+            return -1;
+    }
+    
+    // Small SEND/WRITE payloads go inline, as perftest does
+    if (op != PERF_OP_READ && (uint32_t)size <= client->max_inline) {
+        wr.send_flags |= IBV_SEND_INLINE;
+    }
+    
+    struct ibv_send_wr *bad_wr;
+    return ibv_post_send(client->qp, &wr, &bad_wr) ? -1 : 0;
+}
+
+// Keep queue_depth work requests in flight until iters complete.
+// samples[i] holds the post timestamp of WR i until it completes, then its latency.
+static int run_sweep_size(struct rdma_client_context *client, int op, int size,
+                          int iters, uint64_t *samples, uint64_t *elapsed_ns) {
+    struct ibv_wc wc[16];
+    int posted = 0;
+    int completed = 0;
+    
+    uint64_t start = perf_now_ns();
+    while (completed < iters) {
+        while (posted < iters && posted - completed < client->queue_depth) {
+            samples[posted] = perf_now_ns();
+            if (post_sweep_wr(client, op, size, posted) < 0) {
+                fprintf(stderr, "%s: post failed at size %d\n", perf_op_name(op), size);
+                return -1;
+            }
+            posted++;
+        }
+        
+        int ne = ibv_poll_cq(client->send_cq, 16, wc);
+        if (ne < 0) {
+            fprintf(stderr, "%s: poll CQ failed\n", perf_op_name(op));
+            return -1;
+        }
+        
+        uint64_t now = perf_now_ns();
+        for (int i = 0; i < ne; i++) {
+            if (wc[i].status != IBV_WC_SUCCESS) {
+                fprintf(stderr, "%s: completion error at size %d: %s\n",
+                        perf_op_name(op), size, ibv_wc_status_str(wc[i].status));
+                return -1;
+            }
+            samples[wc[i].wr_id] = now - samples[wc[i].wr_id];
+            completed++;
+        }
+    }
+    *elapsed_ns = perf_now_ns() - start;
+    
+    return 0;
+}
+
+// Sweep all sizes for one operation over a single secure connection
+static int sweep_operation(const struct sweep_config *config, int op) {
+    struct rdma_client_context client = {0};
+    client.client_id = 0;
+    client.server_ip = (char*)config->server_ip;
+    client.port = config->port;
+    client.buffer_size = config->max_size;
+    client.queue_depth = config->queue_depth;
+    client.rd_atomic = PERF_MAX_RD_ATOMIC;
+    client.ctrl.mode = (op == PERF_OP_SEND) ? PERF_MODE_SINK : PERF_MODE_PASSIVE;
+    client.ctrl.max_size = config->max_size;
+    client.ctrl.rx_depth = config->queue_depth;
+    
+    if (connect_to_server(&client) < 0) {
+        fprintf(stderr, "%s: failed to connect to %s\n", perf_op_name(op), config->server_ip);
+        destroy_client_resources(&client);
+        return -1;
+    }
+    
+    uint64_t *samples = malloc(config->iterations * sizeof(uint64_t));
+    if (!samples) {
+        destroy_client_resources(&client);
+        return -1;
+    }
+    
+    printf("\n=== %s size sweep (queue depth %d) ===\n", perf_op_name(op), client.queue_depth);
+    printf("%10s %8s %10s %10s %10s %10s %10s %10s %10s\n",
+           "bytes", "iters", "GB/s", "Mpps", "avg(us)", "p50(us)", "p99(us)", "p99.9(us)", "max(us)");
+    
+    int ret = 0;
+    for (long size = config->min_size; size <= config->max_size; size *= 2) {
+        // Large messages get fewer iterations so each point stays bounded
+        int iters = config->iterations;
+        if ((uint64_t)size * iters > SWEEP_BYTES_PER_SIZE) {
+            iters = SWEEP_BYTES_PER_SIZE / size;
+            if (iters < 32) iters = 32;
+        }
+        
+        uint64_t elapsed_ns;
+        if (run_sweep_size(&client, op, size, iters, samples, &elapsed_ns) < 0) {
+            ret = -1;
+            break;
+        }
+        
+        struct latency_summary lat;
+        summarize_latencies(samples, iters, &lat);
+        double seconds = elapsed_ns / 1e9;
+        
+        printf("%10ld %8d %10.3f %10.3f %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+               size, iters,
+               (double)size * iters / seconds / 1e9,
+               iters / seconds / 1e6,
+               lat.avg / 1000.0, lat.p50 / 1000.0, lat.p99 / 1000.0,
+               lat.p999 / 1000.0, lat.max / 1000.0);
+        fflush(stdout);
+    }
+    
+    free(samples);
+    destroy_client_resources(&client);
+    return ret;
+}
+
+// Message-size sweep (2 B .. 8 MB by default) across SEND, WRITE and READ
+int run_rdma_sweep(const struct sweep_config *config) {
+    int ret = 0;
+    
+    printf("\n=== RDMA Message-Size Sweep ===\n");
+    printf("Server: %s:%d\n", config->server_ip, config->port ? config->port : TLS_PORT);
+    printf("Sizes: %d .. %d bytes, queue depth %d, up to %d iterations per size\n",
+           config->min_size, config->max_size, config->queue_depth, config->iterations);
+    
+    const int ops[] = { PERF_OP_SEND, PERF_OP_WRITE, PERF_OP_READ };
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (!(config->ops & ops[i])) continue;
+        if (sweep_operation(config, ops[i]) < 0) {
+            ret = -1;
+        }
+    }
+    
+    return ret;
+}
+
+// Wait for one completion on a CQ, spinning or sleeping on its channel
+static int wait_completion(struct rdma_client_context *client, struct ibv_cq *cq,
+                           int use_events, struct ibv_wc *wc) {
+    for (;;) {
+        int ne = ibv_poll_cq(cq, 1, wc);
+        if (ne < 0) return -1;
+        if (ne > 0) break;
+        if (!use_events) continue;
+        
+        // CQ was armed before the send went out, so the event cannot be missed
+        struct ibv_cq *ev_cq;
+        void *ev_ctx;
+        if (ibv_get_cq_event(client->channel, &ev_cq, &ev_ctx)) {
+            perror("ibv_get_cq_event");
+            return -1;
+        }
+        ibv_ack_cq_events(ev_cq, 1);
+        if (ibv_req_notify_cq(ev_cq, 0)) {
+            return -1;
+        }
+    }
+    
+    if (wc->status != IBV_WC_SUCCESS) {
+        fprintf(stderr, "Client %d: completion failed: %s\n",
+                client->client_id, ibv_wc_status_str(wc->status));
+        return -1;
+    }
+    return 0;
+}
+
+// One ping-pong exchange; fills local send-completion, round-trip and server times
+static int pingpong_once(struct rdma_client_context *client, uint64_t seq, int size,
+                         uint64_t *send_ns, uint64_t *rtt_ns, uint64_t *server_ns) {
+    struct ibv_wc wc;
+    
+    if (post_receive(client) < 0) {
+        return -1;
+    }
+    if (client->use_events && ibv_req_notify_cq(client->recv_cq, 0)) {
+        return -1;
+    }
+    
+    struct perf_msg_hdr *hdr = (struct perf_msg_hdr *)client->send_buffer;
+    uint64_t t0 = perf_now_ns();
+    hdr->seq = seq;
+    hdr->client_tx_ns = t0;
+    hdr->server_rx_ns = 0;
+    hdr->server_tx_ns = 0;
+    
+    struct ibv_sge sge = {
+        .addr = (uintptr_t)client->send_buffer,
+        .length = size,
+        .lkey = client->send_mr->lkey
+    };
+    struct ibv_send_wr wr = {
+        .wr_id = seq,
+        .sg_list = &sge,
+        .num_sge = 1,
+        .opcode = IBV_WR_SEND,
+        .send_flags = IBV_SEND_SIGNALED
+    };
+    if ((uint32_t)size <= client->max_inline) {
+        wr.send_flags |= IBV_SEND_INLINE;
+    }
+    
+    struct ibv_send_wr *bad_wr;
+    if (ibv_post_send(client->qp, &wr, &bad_wr)) {
+        fprintf(stderr, "Client %d: Failed to post send\n", client->client_id);
+        return -1;
+    }
+    
+    // Local send completion is always spun on; it is what the legacy test timed
+    if (wait_completion(client, client->send_cq, 0, &wc) < 0) {
+        return -1;
+    }
+    *send_ns = perf_now_ns() - t0;
+    
+    if (wait_completion(client, client->recv_cq, client->use_events, &wc) < 0) {
+        return -1;
+    }
+    *rtt_ns = perf_now_ns() - t0;
+    
+    const struct perf_msg_hdr *echo = (const struct perf_msg_hdr *)client->recv_buffer;
+    if (wc.byte_len < sizeof(*echo) || echo->seq != seq) {
+        fprintf(stderr, "Client %d: unexpected echo (len %u)\n", client->client_id, wc.byte_len);
+        return -1;
+    }
+    *server_ns = echo->server_tx_ns > echo->server_rx_ns ?
+                 echo->server_tx_ns - echo->server_rx_ns : 0;
+    
+    return 0;
+}
+
+static void print_latency_row(const char *name, uint64_t *samples, size_t count) {
+    struct latency_summary lat;
+    summarize_latencies(samples, count, &lat);
+    printf("%-22s %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n", name,
+           lat.avg / 1000.0, lat.min / 1000.0, lat.p50 / 1000.0,
+           lat.p99 / 1000.0, lat.p999 / 1000.0, lat.max / 1000.0);
+}
+
+// True round-trip latency against the benchmark server's echo mode
+int run_rdma_pingpong(const struct pingpong_config *config) {
+    struct rdma_client_context client = {0};
+    int size = config->message_size;
+    int total = config->warmup + config->iterations;
+    int ret = 0;
+    
+    if (size < (int)sizeof(struct perf_msg_hdr)) {
+        size = sizeof(struct perf_msg_hdr);
+    }
+    
+    client.client_id = 0;
+    client.server_ip = (char*)config->server_ip;
+    client.port = config->port;
+    client.buffer_size = size;
+    client.queue_depth = 2;
+    client.use_events = !config->busy_poll;
+    client.ctrl.mode = PERF_MODE_ECHO;
+    client.ctrl.max_size = size;
+    client.ctrl.rx_depth = 1;
+    client.ctrl.flags = config->server_timestamps ? PERF_FLAG_SERVER_TS : 0;
+    
+    if (connect_to_server(&client) < 0) {
+        fprintf(stderr, "Ping-pong: failed to connect to %s\n", config->server_ip);
+        destroy_client_resources(&client);
+        return -1;
+    }
+    
+    uint64_t *send_lat = calloc(config->iterations, sizeof(uint64_t));
+    uint64_t *rtt_lat = calloc(config->iterations, sizeof(uint64_t));
+    uint64_t *server_lat = calloc(config->iterations, sizeof(uint64_t));
+    uint64_t *oneway_lat = calloc(config->iterations, sizeof(uint64_t));
+    if (!send_lat || !rtt_lat || !server_lat || !oneway_lat) {
+        ret = -1;
+        goto out;
+    }
+    
+    memset(client.send_buffer, 'P', size);
+    
+    int samples = 0;
+    for (int i = 0; i < total; i++) {
+        uint64_t send_ns, rtt_ns, server_ns;
+        if (pingpong_once(&client, i + 1, size, &send_ns, &rtt_ns, &server_ns) < 0) {
+            ret = -1;
+            break;
+        }
+        if (i < config->warmup) continue;
+        
+        send_lat[samples] = send_ns;
+        rtt_lat[samples] = rtt_ns;
+        server_lat[samples] = server_ns;
+        // Wire + stack time in each direction once server processing is removed
+        oneway_lat[samples] = (rtt_ns > server_ns ? rtt_ns - server_ns : 0) / 2;
+        samples++;
+    }
+    
+    printf("\n=== RDMA Ping-Pong Latency ===\n");
+    printf("Server: %s, message %d bytes, %d iterations (+%d warmup), %s\n",
+           config->server_ip, size, samples, config->warmup,
+           config->busy_poll ? "busy-poll" : "completion channel");
+    printf("%-22s %10s %10s %10s %10s %10s %10s\n",
+           "component (us)", "avg", "min", "p50", "p99", "p99.9", "max");
+    print_latency_row("local send completion", send_lat, samples);
+    print_latency_row("round trip", rtt_lat, samples);
+    if (config->server_timestamps) {
+        print_latency_row("server processing", server_lat, samples);
+        print_latency_row("one-way (est.)", oneway_lat, samples);
+    } else {
+        print_latency_row("one-way (rtt/2)", oneway_lat, samples);
+    }
+    
+out:
+    free(send_lat);
+    free(rtt_lat);
+    free(server_lat);
+    free(oneway_lat);
+    destroy_client_resources(&client);
+    return ret;
+}
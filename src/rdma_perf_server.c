@@ -0,0 +1,881 @@
+/**
+ * RDMA Performance Test Server
+ * Benchmark peer for rdma_performance_test (--server-mode):
+ * - Same TLS bootstrap and PSN exchange as the secure server, run on
+ *   short-lived threads (--bootstraps at once) with socket timeouts, so
+ *   the accept loop never waits on a client
+ * - One shared device context and PD for all connections
+ * - A few poller threads drive every connection's data path over shared CQs
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "rdma_compat.h"
+#include "tls_utils.h"
+#include "rdma_perf.h"
+#include "rdma_metrics.h"
+
+#define MAX_POLLERS 16
+#define POLL_BATCH 32
+#define MAX_EVENTS 64
+#define MAX_RX_DEPTH 4096
+#define INITIAL_CQ_SIZE 1024
+
+struct perf_poller;
+struct perf_server;
+struct perf_conn;
+
+// Receive slot; wr_id carries its address, low bit set for the echo SEND
+struct perf_slot {
+    struct perf_conn *conn;
+    char *buf;
+};
+#define WR_ID_SEND 1UL
+
+// One benchmark connection
+struct perf_conn {
+    int id;
+    struct perf_ctrl ctrl;
+
+    // TLS connection
+    struct tls_connection *tls_conn;
+    uint32_t local_psn;
+    uint32_t remote_psn;
+    uint32_t accept_queue;   // Listen queue length seen when this one was accepted
+
+    // RDMA resources (CQ belongs to the poller)
+    struct ibv_qp *qp;
+    struct ibv_mr *mr;
+    char *buffer;
+    size_t buffer_size;
+    struct perf_slot *slots;
+    uint32_t max_inline;
+    int cq_entries;       // CQ capacity reserved on the poller
+
+    // Owned by the poller once linked
+    int outstanding;      // Posted receives and sends not yet completed
+    int closing;
+    struct conn_metrics *metrics;
+    struct perf_poller *poller;
+    struct perf_conn *next;
+};
+
+// Poller thread: owns one CQ shared by all of its connections
+struct perf_poller {
+    int index;
+    pthread_t thread;
+    struct ibv_cq *cq;
+    int cq_size;
+    int cq_reserved;
+    pthread_mutex_t lock;
+    struct perf_conn *conns;
+    int closing_count;
+    uint64_t completions;
+    struct perf_server *server;
+};
+
+struct perf_server {
+    // TLS
+    SSL_CTX *ssl_ctx;
+    int listen_sock;
+    int epoll_fd;
+    int backlog;
+    uint32_t accept_queue_peak;   // Since the last stats line
+
+    // Bring-ups in flight; the listener is parked while all slots are busy
+    int max_bootstraps;
+    int bootstraps;
+    pthread_mutex_t bootstrap_lock;
+    pthread_cond_t bootstraps_done;
+
+    // Shared RDMA resources
+    struct ibv_device **dev_list;
+    struct ibv_context *ctx;
+    struct ibv_pd *pd;
+    struct ibv_port_attr port_attr;
+    int max_cqe;
+    int rd_atomic;
+    size_t max_echo_mem;
+
+    // Data path
+    struct perf_poller pollers[MAX_POLLERS];
+    int num_pollers;
+
+    int next_conn_id;
+    volatile int active_conns;
+    struct metrics_registry *metrics;
+};
+
+static volatile int g_running = 1;
+
+static void signal_handler(int sig) {
+    printf("\nReceived signal %d, stopping benchmark server...\n", sig);
+    g_running = 0;
+}
+
+// Post one receive into a slot (sink slots all share one buffer)
+static int post_slot_receive(struct perf_slot *slot) {
+    struct perf_conn *conn = slot->conn;
+    struct ibv_sge sge = {
+        .addr = (uintptr_t)slot->buf,
+        .length = conn->ctrl.max_size,
+        .lkey = conn->mr->lkey
+    };
+
+    struct ibv_recv_wr wr = {
+        .wr_id = (uintptr_t)slot,
+        .sg_list = &sge,
+        .num_sge = 1
+    };
+
+    struct ibv_recv_wr *bad_wr;
+    if (ibv_post_recv(conn->qp, &wr, &bad_wr)) {
+        return -1;
+    }
+    conn->outstanding++;
+    metrics_queue(conn->metrics, 1);
+    return 0;
+}
+
+// Send a received message back from its slot; the slot is reposted on completion
+static int post_slot_echo(struct perf_slot *slot, uint32_t length, uint64_t rx_ns) {
+    struct perf_conn *conn = slot->conn;
+
+    if ((conn->ctrl.flags & PERF_FLAG_SERVER_TS) && length >= sizeof(struct perf_msg_hdr)) {
+        struct perf_msg_hdr *hdr = (struct perf_msg_hdr *)slot->buf;
+        hdr->server_rx_ns = rx_ns;
+        hdr->server_tx_ns = perf_now_ns();
+    }
+
+    struct ibv_sge sge = {
+        .addr = (uintptr_t)slot->buf,
+        .length = length,
+        .lkey = conn->mr->lkey
+    };
+
+    struct ibv_send_wr wr = {
+        .wr_id = (uintptr_t)slot | WR_ID_SEND,
+        .sg_list = &sge,
+        .num_sge = 1,
+        .opcode = IBV_WR_SEND,
+        .send_flags = IBV_SEND_SIGNALED
+    };
+    if (length <= conn->max_inline) {
+        wr.send_flags |= IBV_SEND_INLINE;
+    }
+
+    struct ibv_send_wr *bad_wr;
+    if (ibv_post_send(conn->qp, &wr, &bad_wr)) {
+        return -1;
+    }
+    conn->outstanding++;
+    metrics_queue(conn->metrics, 1);
+    metrics_send(conn->metrics, length);
+    return 0;
+}
+
+// Make room on the poller's CQ for another connection (caller holds the lock)
+static int reserve_cq_entries(struct perf_server *server, struct perf_poller *poller, int entries) {
+    int needed = poller->cq_reserved + entries;
+
+    if (needed > poller->cq_size) {
+        int new_size = poller->cq_size;
+        while (new_size < needed) new_size *= 2;
+        if (new_size > server->max_cqe) new_size = server->max_cqe;
+        if (new_size < needed || ibv_resize_cq(poller->cq, new_size)) {
+            fprintf(stderr, "Poller %d: CQ cannot hold %d entries\n", poller->index, needed);
+            return -1;
+        }
+        poller->cq_size = new_size;
+    }
+
+    poller->cq_reserved = needed;
+    return 0;
+}
+
+// Free a connection's RDMA resources (QP must be drained)
+static void destroy_conn(struct perf_server *server, struct perf_conn *conn) {
+    metrics_unregister(server->metrics, conn->metrics);
+    if (conn->qp) ibv_destroy_qp(conn->qp);
+    if (conn->mr) ibv_dereg_mr(conn->mr);
+    if (conn->tls_conn) close_tls_connection(conn->tls_conn);
+    free(conn->slots);
+    free(conn->buffer);
+    free(conn);
+}
+
+// Unlink and free closing connections whose work requests have all flushed
+static void reap_closed_conns(struct perf_server *server, struct perf_poller *poller) {
+    struct perf_conn **link = &poller->conns;
+
+    while (*link) {
+        struct perf_conn *conn = *link;
+        if (conn->closing && conn->outstanding == 0) {
+            *link = conn->next;
+            poller->closing_count--;
+            poller->cq_reserved -= conn->cq_entries;
+            destroy_conn(server, conn);
+            __sync_fetch_and_sub(&server->active_conns, 1);
+        } else {
+            link = &conn->next;
+        }
+    }
+}
+
+// Poller thread: keep receives posted (and echo them) for every connection on this CQ
+static void* poller_thread(void *arg) {
+    struct perf_poller *poller = arg;
+    struct perf_server *server = poller->server;
+    struct ibv_wc wc[POLL_BATCH];
+
+    while (g_running) {
+        pthread_mutex_lock(&poller->lock);
+
+        int ne = ibv_poll_cq(poller->cq, POLL_BATCH, wc);
+        if (ne < 0) {
+            fprintf(stderr, "Poller %d: ibv_poll_cq failed\n", poller->index);
+            pthread_mutex_unlock(&poller->lock);
+            break;
+        }
+
+        uint64_t rx_ns = ne > 0 ? perf_now_ns() : 0;
+        for (int i = 0; i < ne; i++) {
+            // Flushed completions carry no valid opcode, so the WR kind rides in wr_id
+            int is_send = (wc[i].wr_id & WR_ID_SEND) != 0;
+            struct perf_slot *slot = (struct perf_slot *)(uintptr_t)(wc[i].wr_id & ~WR_ID_SEND);
+            struct perf_conn *conn = slot->conn;
+
+            conn->outstanding--;
+
+            // Flushes from a closing connection are not errors
+            if (conn->closing) {
+                metrics_queue(conn->metrics, -1);
+                continue;
+            }
+            metrics_completion(conn->metrics, wc[i].status);
+
+            if (wc[i].status != IBV_WC_SUCCESS) {
+                fprintf(stderr, "Connection %d: %s failed: %s\n", conn->id,
+                        is_send ? "echo" : "receive", ibv_wc_status_str(wc[i].status));
+                continue;
+            }
+            if (!is_send) {
+                metrics_recv(conn->metrics, wc[i].byte_len);
+            }
+
+            int ret;
+            if (!is_send && conn->ctrl.mode == PERF_MODE_ECHO) {
+                ret = post_slot_echo(slot, wc[i].byte_len, rx_ns);
+            } else {
+                // Sink receive done, or echo sent and the slot is free again
+                ret = post_slot_receive(slot);
+            }
+            if (ret < 0) {
+                fprintf(stderr, "Connection %d: failed to repost work request\n", conn->id);
+                metrics_add(&conn->metrics->counters.errors, 1);
+            }
+        }
+        poller->completions += ne;
+
+        if (poller->closing_count > 0) {
+            reap_closed_conns(server, poller);
+        }
+
+        int idle = (poller->conns == NULL);
+        pthread_mutex_unlock(&poller->lock);
+
+        if (idle) {
+            usleep(1000);
+        }
+    }
+
+    return NULL;
+}
+
+// Read the client's benchmark control block
+static int receive_perf_ctrl(struct perf_server *server, struct perf_conn *conn) {
+    struct perf_ctrl net_ctrl;
+
+    if (SSL_read(conn->tls_conn->ssl, &net_ctrl, sizeof(net_ctrl)) != sizeof(net_ctrl)) {
+        print_ssl_error("Failed to receive benchmark control");
+        return -1;
+    }
+
+    conn->ctrl.mode = ntohl(net_ctrl.mode);
+    conn->ctrl.max_size = ntohl(net_ctrl.max_size);
+    conn->ctrl.rx_depth = ntohl(net_ctrl.rx_depth);
+    conn->ctrl.flags = ntohl(net_ctrl.flags);
+
+    if (conn->ctrl.mode != PERF_MODE_SINK && conn->ctrl.mode != PERF_MODE_PASSIVE &&
+        conn->ctrl.mode != PERF_MODE_ECHO) {
+        fprintf(stderr, "Connection %d: unknown mode %u\n", conn->id, conn->ctrl.mode);
+        return -1;
+    }
+    if (conn->ctrl.max_size == 0 || conn->ctrl.max_size > PERF_MAX_MSG_SIZE) {
+        fprintf(stderr, "Connection %d: invalid max size %u\n", conn->id, conn->ctrl.max_size);
+        return -1;
+    }
+    if (conn->ctrl.rx_depth == 0 || conn->ctrl.rx_depth > MAX_RX_DEPTH) {
+        conn->ctrl.rx_depth = PERF_DEFAULT_DEPTH;
+    }
+    // Echo gives every receive its own max_size slot; both come from the
+    // client, so their product is capped rather than trusted
+    if (conn->ctrl.mode == PERF_MODE_ECHO &&
+        (size_t)conn->ctrl.max_size * conn->ctrl.rx_depth > server->max_echo_mem) {
+        fprintf(stderr, "Connection %d: echo buffer of %u x %u bytes exceeds the %zu MB limit "
+                "(--max-echo-mem)\n", conn->id, conn->ctrl.rx_depth, conn->ctrl.max_size,
+                server->max_echo_mem >> 20);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Current length of the listen socket's accept queue. For a listening
+// socket TCP_INFO reports the queue length in tcpi_unacked and the
+// effective backlog in tcpi_sacked.
+static uint32_t accept_queue_length(struct perf_server *server) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+
+    if (getsockopt(server->listen_sock, IPPROTO_TCP, TCP_INFO, &info, &len) < 0) {
+        return 0;
+    }
+    return info.tcpi_unacked;
+}
+
+// Report accept-queue state to a client that asked for it
+static int send_accept_info(struct perf_server *server, struct perf_conn *conn) {
+    struct perf_accept_info info = {
+        .queue_len = htonl(conn->accept_queue),
+        .backlog = htonl(server->backlog),
+        .bootstraps = htonl(server->max_bootstraps)
+    };
+
+    if (SSL_write(conn->tls_conn->ssl, &info, sizeof(info)) != sizeof(info)) {
+        print_ssl_error("Failed to send accept info");
+        return -1;
+    }
+    return 0;
+}
+
+// INIT -> (post receives) -> RTR -> RTS with the TLS-exchanged PSNs
+static int bring_up_qp(struct perf_server *server, struct perf_conn *conn,
+                       struct rdma_conn_params *remote) {
+    struct ibv_qp_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_INIT;
+    attr.port_num = 1;
+    attr.pkey_index = 0;
+    attr.qp_access_flags = IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
+                           IBV_ACCESS_REMOTE_WRITE;
+    if (ibv_modify_qp(conn->qp, &attr, IBV_QP_STATE | IBV_QP_PKEY_INDEX |
+                      IBV_QP_PORT | IBV_QP_ACCESS_FLAGS)) {
+        perror("Failed to modify QP to INIT");
+        return -1;
+    }
+
+    // Receives go up before RTR so the poller never races the initial fill
+    if (conn->ctrl.mode != PERF_MODE_PASSIVE) {
+        for (uint32_t i = 0; i < conn->ctrl.rx_depth; i++) {
+            if (post_slot_receive(&conn->slots[i]) < 0) {
+                perror("ibv_post_recv");
+                return -1;
+            }
+        }
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_RTR;
+    attr.path_mtu = IBV_MTU_1024;
+    attr.dest_qp_num = remote->qp_num;
+    attr.rq_psn = conn->remote_psn;
+    attr.max_dest_rd_atomic = server->rd_atomic;
+    attr.min_rnr_timer = 12;
+    attr.ah_attr.dlid = remote->lid;
+    attr.ah_attr.port_num = 1;
+    if (server->port_attr.link_layer == IBV_LINK_LAYER_ETHERNET) {
+        attr.ah_attr.is_global = 1;
+        attr.ah_attr.grh.hop_limit = 1;
+        memcpy(&attr.ah_attr.grh.dgid, remote->gid, 16);
+        attr.ah_attr.grh.sgid_index = 0;
+    }
+    if (ibv_modify_qp(conn->qp, &attr, IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU |
+                      IBV_QP_DEST_QPN | IBV_QP_RQ_PSN |
+                      IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER)) {
+        perror("Failed to modify QP to RTR");
+        return -1;
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.qp_state = IBV_QPS_RTS;
+    attr.timeout = 14;
+    attr.retry_cnt = 7;
+    attr.rnr_retry = 7;
+    attr.sq_psn = conn->local_psn;
+    attr.max_rd_atomic = server->rd_atomic;
+    if (ibv_modify_qp(conn->qp, &attr, IBV_QP_STATE | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT |
+                      IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN | IBV_QP_MAX_QP_RD_ATOMIC)) {
+        perror("Failed to modify QP to RTS");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Full secure bring-up of one accepted TLS connection
+static struct perf_conn* setup_connection(struct perf_server *server,
+                                          struct tls_connection *tls_conn,
+                                          uint32_t accept_queue) {
+    struct perf_conn *conn = calloc(1, sizeof(*conn));
+    if (!conn) {
+        close_tls_connection(tls_conn);
+        return NULL;
+    }
+    conn->tls_conn = tls_conn;
+    conn->accept_queue = accept_queue;
+    conn->id = __sync_add_and_fetch(&server->next_conn_id, 1);
+    conn->poller = &server->pollers[conn->id % server->num_pollers];
+    conn->metrics = metrics_register(server->metrics, conn->id);
+    if (!conn->metrics) {
+        goto fail;
+    }
+
+    if (exchange_psn_server(tls_conn, &conn->local_psn, &conn->remote_psn) < 0 ||
+        receive_perf_ctrl(server, conn) < 0) {
+        goto fail;
+    }
+    if ((conn->ctrl.flags & PERF_FLAG_ACCEPT_INFO) && send_accept_info(server, conn) < 0) {
+        goto fail;
+    }
+
+    // Buffer is the receive target and the WRITE/READ window; echo needs
+    // a private slot per receive because the payload is sent back in place
+    conn->buffer_size = conn->ctrl.max_size;
+    if (conn->ctrl.mode == PERF_MODE_ECHO) {
+        conn->buffer_size *= conn->ctrl.rx_depth;
+    }
+    if (posix_memalign((void **)&conn->buffer, 4096, conn->buffer_size)) {
+        conn->buffer = NULL;
+        goto fail;
+    }
+    memset(conn->buffer, 0, conn->buffer_size);
+
+    conn->slots = calloc(conn->ctrl.rx_depth, sizeof(struct perf_slot));
+    if (!conn->slots) {
+        goto fail;
+    }
+    for (uint32_t i = 0; i < conn->ctrl.rx_depth; i++) {
+        conn->slots[i].conn = conn;
+        conn->slots[i].buf = conn->buffer;
+        if (conn->ctrl.mode == PERF_MODE_ECHO) {
+            conn->slots[i].buf += (size_t)i * conn->ctrl.max_size;
+        }
+    }
+
+    conn->mr = ibv_reg_mr(server->pd, conn->buffer, conn->buffer_size,
+                          IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE |
+                          IBV_ACCESS_REMOTE_READ);
+    if (!conn->mr) {
+        perror("ibv_reg_mr");
+        goto fail;
+    }
+
+    struct perf_poller *poller = conn->poller;
+    conn->cq_entries = conn->ctrl.rx_depth * (conn->ctrl.mode == PERF_MODE_ECHO ? 2 : 1);
+    pthread_mutex_lock(&poller->lock);
+    int reserved = reserve_cq_entries(server, poller, conn->cq_entries);
+    pthread_mutex_unlock(&poller->lock);
+    if (reserved < 0) {
+        conn->cq_entries = 0;
+        goto fail;
+    }
+
+    struct ibv_qp_init_attr qp_attr = {
+        .send_cq = poller->cq,
+        .recv_cq = poller->cq,
+        .qp_type = IBV_QPT_RC,
+        .cap = {
+            .max_send_wr = conn->ctrl.rx_depth,
+            .max_recv_wr = conn->ctrl.rx_depth,
+            .max_send_sge = 1,
+            .max_recv_sge = 1,
+            .max_inline_data = 64
+        }
+    };
+    conn->qp = ibv_create_qp(server->pd, &qp_attr);
+    if (!conn->qp) {
+        perror("ibv_create_qp");
+        goto fail_reserved;
+    }
+    conn->max_inline = qp_attr.cap.max_inline_data;
+
+    struct rdma_conn_params local_params = {0};
+    struct rdma_conn_params remote_params;
+    local_params.qp_num = conn->qp->qp_num;
+    local_params.lid = server->port_attr.lid;
+    local_params.psn = conn->local_psn;
+    local_params.rkey = conn->mr->rkey;
+    local_params.remote_addr = (uintptr_t)conn->buffer;
+    if (ibv_query_gid(server->ctx, 1, 0, (union ibv_gid *)local_params.gid)) {
+        perror("ibv_query_gid");
+        goto fail_reserved;
+    }
+
+    if (send_rdma_params(tls_conn, &local_params) < 0 ||
+        receive_rdma_params(tls_conn, &remote_params) < 0) {
+        goto fail_reserved;
+    }
+
+    if (bring_up_qp(server, conn, &remote_params) < 0) {
+        goto fail_reserved;
+    }
+
+    // Hand the connection to its poller
+    pthread_mutex_lock(&poller->lock);
+    conn->next = poller->conns;
+    poller->conns = conn;
+    pthread_mutex_unlock(&poller->lock);
+    __sync_fetch_and_add(&server->active_conns, 1);
+
+    return conn;
+
+fail_reserved:
+    pthread_mutex_lock(&poller->lock);
+    poller->cq_reserved -= conn->cq_entries;
+    conn->cq_entries = 0;
+    pthread_mutex_unlock(&poller->lock);
+    // Receives posted in INIT may still flush into the shared CQ
+    if (conn->outstanding > 0) {
+        struct ibv_qp_attr err_attr = { .qp_state = IBV_QPS_ERR };
+        ibv_modify_qp(conn->qp, &err_attr, IBV_QP_STATE);
+        conn->closing = 1;
+        pthread_mutex_lock(&poller->lock);
+        conn->next = poller->conns;
+        poller->conns = conn;
+        poller->closing_count++;
+        pthread_mutex_unlock(&poller->lock);
+        __sync_fetch_and_add(&server->active_conns, 1);
+        return NULL;
+    }
+fail:
+    fprintf(stderr, "Connection %d: setup failed\n", conn->id);
+    destroy_conn(server, conn);
+    return NULL;
+}
+
+// Client went away: flush the QP and let the poller free it once drained
+static void close_connection(struct perf_server *server, struct perf_conn *conn) {
+    struct perf_poller *poller = conn->poller;
+    struct ibv_qp_attr attr = { .qp_state = IBV_QPS_ERR };
+
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->tls_conn->socket, NULL);
+
+    pthread_mutex_lock(&poller->lock);
+    close_tls_connection(conn->tls_conn);
+    conn->tls_conn = NULL;
+    ibv_modify_qp(conn->qp, &attr, IBV_QP_STATE);
+    conn->closing = 1;
+    poller->closing_count++;
+    pthread_mutex_unlock(&poller->lock);
+}
+
+struct bootstrap_job {
+    struct perf_server *server;
+    int sock;
+    uint32_t accept_queue;
+};
+
+// Free a bootstrap slot, unparking the listener if it was full
+static void finish_bootstrap(struct perf_server *server) {
+    pthread_mutex_lock(&server->bootstrap_lock);
+    if (server->bootstraps-- == server->max_bootstraps) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, server->listen_sock, &ev);
+    }
+    if (server->bootstraps == 0) {
+        pthread_cond_broadcast(&server->bootstraps_done);
+    }
+    pthread_mutex_unlock(&server->bootstrap_lock);
+}
+
+// TLS handshake and connection setup for one accepted socket
+static void* bootstrap_thread(void *arg) {
+    struct bootstrap_job *job = arg;
+    struct perf_server *server = job->server;
+    struct tls_connection *tls_conn = accept_tls_socket(job->sock, server->ssl_ctx);
+    struct perf_conn *conn = tls_conn ? setup_connection(server, tls_conn, job->accept_queue) : NULL;
+    free(job);
+
+    if (conn) {
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = conn };
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, conn->tls_conn->socket, &ev) < 0) {
+            perror("epoll_ctl");
+            close_connection(server, conn);
+        }
+    }
+
+    finish_bootstrap(server);
+    return NULL;
+}
+
+// Accept one client and hand it to a bootstrap thread
+static void accept_connection(struct perf_server *server) {
+    // Sample before accept so the count includes this connection
+    uint32_t queued = accept_queue_length(server);
+    if (queued > server->accept_queue_peak) {
+        server->accept_queue_peak = queued;
+    }
+
+    int sock = accept(server->listen_sock, NULL, NULL);
+    if (sock < 0) {
+        perror("accept");
+        return;
+    }
+
+    // Last free slot: later clients wait in the accept queue
+    pthread_mutex_lock(&server->bootstrap_lock);
+    if (++server->bootstraps == server->max_bootstraps) {
+        struct epoll_event ev = { .events = 0, .data.ptr = NULL };
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, server->listen_sock, &ev);
+    }
+    pthread_mutex_unlock(&server->bootstrap_lock);
+
+    struct bootstrap_job *job = malloc(sizeof(*job));
+    pthread_attr_t attr;
+    pthread_t thread;
+    int started = 0;
+    if (job && set_socket_timeouts(sock, TLS_BOOTSTRAP_TIMEOUT_S) == 0) {
+        job->server = server;
+        job->sock = sock;
+        job->accept_queue = queued;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        started = pthread_create(&thread, &attr, bootstrap_thread, job) == 0;
+        pthread_attr_destroy(&attr);
+    }
+    if (!started) {
+        fprintf(stderr, "Failed to start bootstrap thread\n");
+        free(job);
+        close(sock);
+        finish_bootstrap(server);
+    }
+}
+
+// Shared device context, PD and one CQ per poller
+static int init_perf_rdma(struct perf_server *server) {
+    int num_devices;
+    server->dev_list = ibv_get_device_list(&num_devices);
+    if (!server->dev_list || num_devices == 0) {
+        fprintf(stderr, "No RDMA devices found\n");
+        return -1;
+    }
+
+    server->ctx = ibv_open_device(server->dev_list[0]);
+    if (!server->ctx) {
+        fprintf(stderr, "Failed to open RDMA device\n");
+        return -1;
+    }
+
+    struct ibv_device_attr device_attr;
+    if (ibv_query_device(server->ctx, &device_attr)) {
+        perror("ibv_query_device");
+        return -1;
+    }
+    server->max_cqe = device_attr.max_cqe;
+    server->rd_atomic = device_attr.max_qp_rd_atom;
+    if (server->rd_atomic > PERF_MAX_RD_ATOMIC) server->rd_atomic = PERF_MAX_RD_ATOMIC;
+    if (server->rd_atomic < 1) server->rd_atomic = 1;
+
+    if (ibv_query_port(server->ctx, 1, &server->port_attr)) {
+        perror("ibv_query_port");
+        return -1;
+    }
+
+    server->pd = ibv_alloc_pd(server->ctx);
+    if (!server->pd) {
+        fprintf(stderr, "Failed to allocate PD\n");
+        return -1;
+    }
+
+    for (int i = 0; i < server->num_pollers; i++) {
+        struct perf_poller *poller = &server->pollers[i];
+        poller->index = i;
+        poller->server = server;
+        poller->cq_size = INITIAL_CQ_SIZE < server->max_cqe ? INITIAL_CQ_SIZE : server->max_cqe;
+        poller->cq = ibv_create_cq(server->ctx, poller->cq_size, NULL, NULL, 0);
+        if (!poller->cq) {
+            fprintf(stderr, "Failed to create CQ for poller %d\n", i);
+            return -1;
+        }
+        pthread_mutex_init(&poller->lock, NULL);
+    }
+
+    printf("Benchmark server RDMA resources:\n");
+    printf("  Device: %s\n", ibv_get_device_name(server->dev_list[0]));
+    printf("  Pollers: %d (one shared CQ each)\n", server->num_pollers);
+    printf("  Max outstanding RDMA READs per QP: %d\n", server->rd_atomic);
+
+    return 0;
+}
+
+static void cleanup_perf_server(struct perf_server *server) {
+    for (int i = 0; i < server->num_pollers; i++) {
+        struct perf_poller *poller = &server->pollers[i];
+        struct perf_conn *conn = poller->conns;
+        while (conn) {
+            struct perf_conn *next = conn->next;
+            destroy_conn(server, conn);
+            conn = next;
+        }
+        if (poller->cq) ibv_destroy_cq(poller->cq);
+        pthread_mutex_destroy(&poller->lock);
+    }
+
+    metrics_destroy(server->metrics);
+    if (server->pd) ibv_dealloc_pd(server->pd);
+    if (server->ctx) ibv_close_device(server->ctx);
+    if (server->dev_list) ibv_free_device_list(server->dev_list);
+    if (server->epoll_fd > 0) close(server->epoll_fd);
+    if (server->listen_sock >= 0) close(server->listen_sock);
+    if (server->ssl_ctx) SSL_CTX_free(server->ssl_ctx);
+    cleanup_openssl();
+    pthread_mutex_destroy(&server->bootstrap_lock);
+    pthread_cond_destroy(&server->bootstraps_done);
+}
+
+// Benchmark server main loop: accepts and tears down connections, pollers do the rest
+int run_perf_server(const struct perf_server_config *config) {
+    struct perf_server server;
+    int port = config->port ? config->port : TLS_PORT;
+    memset(&server, 0, sizeof(server));
+    server.listen_sock = -1;
+    server.backlog = config->backlog > 0 ? config->backlog : SOMAXCONN;
+    server.max_echo_mem = config->max_echo_mem ? config->max_echo_mem : PERF_DEFAULT_ECHO_MEM;
+    server.max_bootstraps = config->bootstraps > 0 ? config->bootstraps : PERF_DEFAULT_BOOTSTRAPS;
+    pthread_mutex_init(&server.bootstrap_lock, NULL);
+    pthread_cond_init(&server.bootstraps_done, NULL);
+    server.num_pollers = config->pollers;
+    if (server.num_pollers < 1) server.num_pollers = 1;
+    if (server.num_pollers > MAX_POLLERS) server.num_pollers = MAX_POLLERS;
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGPIPE, SIG_IGN);
+
+    init_openssl();
+    server.ssl_ctx = create_server_context();
+    if (!server.ssl_ctx ||
+        configure_server_context(server.ssl_ctx, CERT_FILE, KEY_FILE) < 0) {
+        fprintf(stderr, "TLS setup failed (run 'make generate-cert' first)\n");
+        cleanup_perf_server(&server);
+        return -1;
+    }
+
+    if (init_perf_rdma(&server) < 0) {
+        cleanup_perf_server(&server);
+        return -1;
+    }
+
+    server.metrics = metrics_create(ibv_get_device_name(server.dev_list[0]));
+    if (!server.metrics ||
+        (config->metrics_addr && metrics_start(server.metrics, config->metrics_addr) < 0)) {
+        cleanup_perf_server(&server);
+        return -1;
+    }
+
+    server.listen_sock = create_tls_listener_backlog(port, server.backlog);
+    if (server.listen_sock < 0) {
+        cleanup_perf_server(&server);
+        return -1;
+    }
+
+    server.epoll_fd = epoll_create1(0);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (server.epoll_fd < 0 ||
+        epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_sock, &ev) < 0) {
+        perror("epoll");
+        cleanup_perf_server(&server);
+        return -1;
+    }
+
+    for (int i = 0; i < server.num_pollers; i++) {
+        if (pthread_create(&server.pollers[i].thread, NULL, poller_thread, &server.pollers[i]) != 0) {
+            fprintf(stderr, "Failed to create poller thread %d\n", i);
+            g_running = 0;
+            server.num_pollers = i;
+            break;
+        }
+    }
+
+    printf("RDMA benchmark server ready on TLS port %d (listen backlog %d)\n", port, server.backlog);
+    if (server.max_bootstraps == 1) {
+        printf("  Connection bootstrap: serialized, %d s socket timeouts\n", TLS_BOOTSTRAP_TIMEOUT_S);
+    } else {
+        printf("  Connection bootstrap: up to %d concurrent threads, %d s socket timeouts\n",
+               server.max_bootstraps, TLS_BOOTSTRAP_TIMEOUT_S);
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    time_t last_stats = time(NULL);
+    while (g_running) {
+        int nfds = epoll_wait(server.epoll_fd, events, MAX_EVENTS, 1000);
+        if (nfds < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < nfds; i++) {
+            struct perf_conn *conn = events[i].data.ptr;
+
+            if (conn == NULL) {
+                accept_connection(&server);
+                continue;
+            }
+
+            // Any TLS activity after setup means the client is done
+            char byte;
+            if (SSL_read(conn->tls_conn->ssl, &byte, 1) <= 0) {
+                close_connection(&server, conn);
+            }
+        }
+
+        time_t now = time(NULL);
+        if (now - last_stats >= 10) {
+            uint64_t completions = 0;
+            for (int i = 0; i < server.num_pollers; i++) {
+                completions += server.pollers[i].completions;
+            }
+            printf("Stats: active connections=%d, completions=%lu, accept queue peak=%u/%d\n",
+                   server.active_conns, completions, server.accept_queue_peak, server.backlog);
+            server.accept_queue_peak = 0;
+            last_stats = now;
+        }
+    }
+
+    g_running = 0;
+    // Bootstraps link connections into the pollers; socket timeouts bound this
+    pthread_mutex_lock(&server.bootstrap_lock);
+    while (server.bootstraps > 0) {
+        pthread_cond_wait(&server.bootstraps_done, &server.bootstrap_lock);
+    }
+    pthread_mutex_unlock(&server.bootstrap_lock);
+    for (int i = 0; i < server.num_pollers; i++) {
+        pthread_join(server.pollers[i].thread, NULL);
+    }
+
+    printf("Benchmark server stopped\n");
+    cleanup_perf_server(&server);
+    return 0;
+}
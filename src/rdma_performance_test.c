@@ -16,24 +16,8 @@
 #include <errno.h>
 #include <getopt.h>
 #include <fcntl.h>
-
-// Client metrics structure (must match rdma_perf_client.c)
-struct client_metrics {
-    struct timeval connect_start;
-    struct timeval connect_end;
-    struct timeval first_msg;
-    struct timeval last_msg;
-    
-    int messages_sent;
-    int messages_received;
-    int errors;
-    double total_latency_ms;
-};
-
-// Declare the RDMA client function
-extern int run_rdma_client_test(int client_id, const char *server_ip, const char *server_name,
-                                int num_messages, int message_size, int think_time_ms,
-                                struct client_metrics *metrics);
+#include "tls_utils.h"
+#include "rdma_perf.h"
 
 // Global performance metrics
 struct perf_metrics {
@@ -72,6 +56,57 @@ struct test_config {
     int think_time_ms;
     int connection_delay_ms;
     int verbose;
+    
+    // Benchmark modes
+    int sweep;
+    int pingpong;
+    int warmup;
+    int busy_poll;
+    int server_timestamps;
+    int server_mode;
+    int load;
+    int threads;
+    int window;
+    int duration;
+    int cpu_base;
+    int conn_rate;
+    int rate_start;
+    int rate_step;
+    int rate_max;
+    int stage_sec;
+    int backlog;
+    int max_echo_mem;
+    int bootstraps;
+    const char *metrics_addr;
+    int port;
+    int pollers;
+    int ops;
+    int min_size;
+    int max_size;
+    int queue_depth;
+    int iterations;
+};
+
+// Long-only options
+enum {
+    OPT_MIN_SIZE = 256,
+    OPT_MAX_SIZE,
+    OPT_POLLERS,
+    OPT_WARMUP,
+    OPT_NO_BUSY_POLL,
+    OPT_SERVER_TS,
+    OPT_THREADS,
+    OPT_WINDOW,
+    OPT_DURATION,
+    OPT_CPU_BASE,
+    OPT_RATE_START,
+    OPT_RATE_STEP,
+    OPT_RATE_MAX,
+    OPT_STAGE_SEC,
+    OPT_BACKLOG,
+    OPT_METRICS,
+    OPT_MAX_ECHO_MEM,
+    OPT_BOOTSTRAPS
 };
 
 // Client context for threading
@@ -344,12 +379,74 @@ static void print_usage(const char *prog) {
     printf("  -M, --num-messages NUM  Messages per client (default: 100)\n");
     printf("  -t, --think-time MS     Think time between messages (default: 10)\n");
     printf("  -d, --delay MS          Connection delay between clients (default: 0)\n");
+    printf("  -p, --port PORT         TLS port for sweep/server modes (default: %d)\n", TLS_PORT);
     printf("  -v, --verbose           Verbose output\n");
     printf("  -h, --help              Show this help\n");
+    printf("\nMessage-size sweep (needs a peer started with --server-mode):\n");
+    printf("  -S, --sweep             Sweep message sizes instead of the multi-client test\n");
+    printf("  -o, --ops LIST          Comma list of send,write,read (default: all)\n");
+    printf("      --min-size BYTES    Smallest message (default: %d)\n", PERF_MIN_MSG_SIZE);
+    printf("      --max-size BYTES    Largest message (default: %d)\n", PERF_MAX_MSG_SIZE);
+    printf("  -q, --depth NUM         Outstanding work requests (default: %d)\n", PERF_DEFAULT_DEPTH);
+    printf("  -i, --iters NUM         Iterations per size or ping-pong run (default: %d)\n", PERF_DEFAULT_ITERS);
+    printf("\nRound-trip latency (against --server-mode peer):\n");
+    printf("  -P, --pingpong          Ping-pong -m byte messages, -i iterations\n");
+    printf("      --warmup NUM        Untimed exchanges first (default: 100)\n");
+    printf("      --no-busy-poll      Sleep on a completion channel instead of spinning\n");
+    printf("      --server-ts         Have the server stamp rx/tx times into each echo\n");
+    printf("\nBenchmark server:\n");
+    printf("  -L, --server-mode       Run as the benchmark peer\n");
+    printf("      --pollers NUM       CQ poller threads in server mode (default: 1)\n");
+    printf("      --backlog NUM       Listen backlog in server mode (default: SOMAXCONN)\n");
+    printf("      --max-echo-mem MB   Largest echo buffer (size x depth) one connection may ask\n"
+           "                          for in server mode (default: %lu)\n", PERF_DEFAULT_ECHO_MEM >> 20);
+    printf("      --bootstraps NUM    Connections brought up at once in server mode, each on\n"
+           "                          its own thread (default: %d; 1 = serialized)\n", PERF_DEFAULT_BOOTSTRAPS);
+    printf("      --metrics ADDR      Prometheus endpoint: PORT, HOST:PORT or unix:PATH\n");
+    printf("\nMulti-connection load (-c connections, -m message size):\n");
+    printf("  -W, --load              Few pinned threads multiplexing many QPs\n");
+    printf("      --threads NUM       Driver threads (default: 4)\n");
+    printf("      --window NUM        Messages in flight per connection (default: 4)\n");
+    printf("      --duration SEC      Traffic duration (default: 10)\n");
+    printf("      --cpu-base CPU      Pin thread i to CPU base+i, -1 to disable (default: 0)\n");
+    printf("\nConnection-rate ramp (full secure open/close per connection):\n");
+    printf("  -R, --conn-rate         Ramp the connection rate until the server saturates\n");
+    printf("      --rate-start NUM    First stage, connections/s (default: 100)\n");
+    printf("      --rate-step NUM     Added per stage (default: 100)\n");
+    printf("      --rate-max NUM      Last stage (default: 10000)\n");
+    printf("      --stage-sec SEC     Stage length (default: 5)\n");
+    printf("      --threads NUM       Connecting threads, shared with --load\n");
     printf("\nExamples:\n");
     printf("  %s -c 10                     # Test with 10 RDMA clients\n", prog);
     printf("  %s -c 100 -M 10              # 100 clients, 10 messages each\n", prog);
     printf("  %s -c 1000 -d 10 -t 50       # 1000 clients with delays\n", prog);
+    printf("  %s -L                        # Start benchmark server\n", prog);
+    printf("  %s -S -o write,read -q 32    # Size sweep against it\n", prog);
+    printf("  %s -P -m 64 --server-ts      # Round trip with server time split out\n", prog);
+    printf("  %s -W -c 10000 --threads 8   # 10k connections from 8 threads\n", prog);
+    printf("  %s -R --threads 16           # Find the sustainable connection rate\n", prog);
+}
+
+// Parse "send,write,read" into a perf_op mask
+static int parse_ops(const char *list) {
+    int ops = 0;
+    char *copy = strdup(list);
+    char *saveptr = NULL;
+    
+    for (char *tok = strtok_r(copy, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr)) {
+        if (strcmp(tok, "send") == 0) ops |= PERF_OP_SEND;
+        else if (strcmp(tok, "write") == 0) ops |= PERF_OP_WRITE;
+        else if (strcmp(tok, "read") == 0) ops |= PERF_OP_READ;
+        else if (strcmp(tok, "all") == 0) ops |= PERF_OP_ALL;
+        else {
+            fprintf(stderr, "Unknown operation: %s\n", tok);
+            ops = -1;
+            break;
+        }
+    }
+    
+    free(copy);
+    return ops;
 }
 
 int main(int argc, char *argv[]) {
@@ -361,7 +458,24 @@ int main(int argc, char *argv[]) {
         .messages_per_client = 100,
         .think_time_ms = 10,
         .connection_delay_ms = 0,
-        .verbose = 0
+        .verbose = 0,
+        .port = TLS_PORT,
+        .pollers = 1,
+        .ops = PERF_OP_ALL,
+        .min_size = PERF_MIN_MSG_SIZE,
+        .max_size = PERF_MAX_MSG_SIZE,
+        .queue_depth = PERF_DEFAULT_DEPTH,
+        .iterations = PERF_DEFAULT_ITERS,
+        .warmup = 100,
+        .busy_poll = 1,
+        .threads = 4,
+        .window = 4,
+        .duration = 10,
+        .cpu_base = 0,
+        .rate_start = 100,
+        .rate_step = 100,
+        .rate_max = 10000,
+        .stage_sec = 5
     };
     
     static struct option long_options[] = {
@@ -372,13 +486,40 @@ int main(int argc, char *argv[]) {
         {"num-messages", required_argument, 0, 'M'},
         {"think-time", required_argument, 0, 't'},
         {"delay", required_argument, 0, 'd'},
+        {"port", required_argument, 0, 'p'},
         {"verbose", no_argument, 0, 'v'},
         {"help", no_argument, 0, 'h'},
+        {"sweep", no_argument, 0, 'S'},
+        {"ops", required_argument, 0, 'o'},
+        {"min-size", required_argument, 0, OPT_MIN_SIZE},
+        {"max-size", required_argument, 0, OPT_MAX_SIZE},
+        {"depth", required_argument, 0, 'q'},
+        {"iters", required_argument, 0, 'i'},
+        {"server-mode", no_argument, 0, 'L'},
+        {"pollers", required_argument, 0, OPT_POLLERS},
+        {"pingpong", no_argument, 0, 'P'},
+        {"warmup", required_argument, 0, OPT_WARMUP},
+        {"no-busy-poll", no_argument, 0, OPT_NO_BUSY_POLL},
+        {"server-ts", no_argument, 0, OPT_SERVER_TS},
+        {"load", no_argument, 0, 'W'},
+        {"threads", required_argument, 0, OPT_THREADS},
+        {"window", required_argument, 0, OPT_WINDOW},
+        {"duration", required_argument, 0, OPT_DURATION},
+        {"cpu-base", required_argument, 0, OPT_CPU_BASE},
+        {"conn-rate", no_argument, 0, 'R'},
+        {"rate-start", required_argument, 0, OPT_RATE_START},
+        {"rate-step", required_argument, 0, OPT_RATE_STEP},
+        {"rate-max", required_argument, 0, OPT_RATE_MAX},
+        {"stage-sec", required_argument, 0, OPT_STAGE_SEC},
+        {"backlog", required_argument, 0, OPT_BACKLOG},
+        {"metrics", required_argument, 0, OPT_METRICS},
+        {"max-echo-mem", required_argument, 0, OPT_MAX_ECHO_MEM},
+        {"bootstraps", required_argument, 0, OPT_BOOTSTRAPS},
         {0, 0, 0, 0}
     };
     
     int opt;
-    while ((opt = getopt_long(argc, argv, "c:s:n:m:M:t:d:vh", long_options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "c:s:n:m:M:t:d:p:vhSo:q:i:LPWR", long_options, NULL)) != -1) {
         switch (opt) {
             case 'c':
                 config.num_clients = atoi(optarg);
@@ -401,9 +542,99 @@ int main(int argc, char *argv[]) {
             case 'd':
                 config.connection_delay_ms = atoi(optarg);
                 break;
+            case 'p':
+                config.port = atoi(optarg);
+                break;
             case 'v':
                 config.verbose = 1;
                 break;
+            case 'S':
+                config.sweep = 1;
+                break;
+            case 'o':
+                config.ops = parse_ops(optarg);
+                if (config.ops <= 0) return 1;
+                break;
+            case OPT_MIN_SIZE:
+                config.min_size = atoi(optarg);
+                break;
+            case OPT_MAX_SIZE:
+                config.max_size = atoi(optarg);
+                break;
+            case 'q':
+                config.queue_depth = atoi(optarg);
+                break;
+            case 'i':
+                config.iterations = atoi(optarg);
+                break;
+            case 'L':
+                config.server_mode = 1;
+                break;
+            case OPT_POLLERS:
+                config.pollers = atoi(optarg);
+                break;
+            case 'P':
+                config.pingpong = 1;
+                break;
+            case OPT_WARMUP:
+                config.warmup = atoi(optarg);
+                break;
+            case OPT_NO_BUSY_POLL:
+                config.busy_poll = 0;
+                break;
+            case OPT_SERVER_TS:
+                config.server_timestamps = 1;
+                break;
+            case 'W':
+                config.load = 1;
+                break;
+            case OPT_THREADS:
+                config.threads = atoi(optarg);
+                break;
+            case OPT_WINDOW:
+                config.window = atoi(optarg);
+                break;
+            case OPT_DURATION:
+                config.duration = atoi(optarg);
+                break;
+            case OPT_CPU_BASE:
+                config.cpu_base = atoi(optarg);
+                break;
+            case 'R':
+                config.conn_rate = 1;
+                break;
+            case OPT_RATE_START:
+                config.rate_start = atoi(optarg);
+                break;
+            case OPT_RATE_STEP:
+                config.rate_step = atoi(optarg);
+                break;
+            case OPT_RATE_MAX:
+                config.rate_max = atoi(optarg);
+                break;
+            case OPT_STAGE_SEC:
+                config.stage_sec = atoi(optarg);
+                break;
+            case OPT_BACKLOG:
+                config.backlog = atoi(optarg);
+                break;
+            case OPT_METRICS:
+                config.metrics_addr = optarg;
+                break;
+            case OPT_MAX_ECHO_MEM:
+                config.max_echo_mem = atoi(optarg);
+                if (config.max_echo_mem < 1) {
+                    fprintf(stderr, "Invalid --max-echo-mem: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case OPT_BOOTSTRAPS:
+                config.bootstraps = atoi(optarg);
+                if (config.bootstraps < 1) {
+                    fprintf(stderr, "Invalid --bootstraps: %s\n", optarg);
+                    return 1;
+                }
+                break;
             case 'h':
                 print_usage(argv[0]);
                 return 0;
@@ -413,6 +644,117 @@ int main(int argc, char *argv[]) {
         }
     }
     
+    if (config.server_mode) {
+        struct perf_server_config server = {
+            .port = config.port,
+            .pollers = config.pollers,
+            .backlog = config.backlog,
+            .max_echo_mem = (size_t)config.max_echo_mem << 20,
+            .bootstraps = config.bootstraps,
+            .metrics_addr = config.metrics_addr
+        };
+        return run_perf_server(&server) < 0 ? 1 : 0;
+    }
+    
+    if (config.pingpong) {
+        if (config.message_size < 1 || config.message_size > PERF_MAX_MSG_SIZE ||
+            config.iterations < 1 || config.warmup < 0) {
+            fprintf(stderr, "Invalid ping-pong parameters\n");
+            return 1;
+        }
+        
+        struct pingpong_config pingpong = {
+            .server_ip = config.server_ip,
+            .port = config.port,
+            .message_size = config.message_size,
+            .iterations = config.iterations,
+            .warmup = config.warmup,
+            .busy_poll = config.busy_poll,
+            .server_timestamps = config.server_timestamps
+        };
+        init_openssl();
+        return run_rdma_pingpong(&pingpong) < 0 ? 1 : 0;
+    }
+    
+    if (config.conn_rate) {
+        if (config.rate_start < 1 || config.rate_step < 1 || config.rate_max < config.rate_start ||
+            config.stage_sec < 1 || config.threads < 1) {
+            fprintf(stderr, "Invalid connection-rate parameters\n");
+            return 1;
+        }
+        
+        struct connrate_config connrate = {
+            .server_ip = config.server_ip,
+            .port = config.port,
+            .start_rate = config.rate_start,
+            .step_rate = config.rate_step,
+            .max_rate = config.rate_max,
+            .stage_sec = config.stage_sec,
+            .threads = config.threads
+        };
+        signal(SIGPIPE, SIG_IGN);
+        init_openssl();
+        return run_connection_rate(&connrate) < 0 ? 1 : 0;
+    }
+    
+    if (config.load) {
+        if (config.num_clients < 1 || config.threads < 1 || config.threads > config.num_clients ||
+            config.message_size < 1 || config.message_size > PERF_MAX_MSG_SIZE ||
+            config.duration < 1) {
+            fprintf(stderr, "Invalid load parameters\n");
+            return 1;
+        }
+        
+        // Each connection holds a TLS socket for its lifetime
+        struct rlimit rlim;
+        if (getrlimit(RLIMIT_NOFILE, &rlim) == 0 &&
+            rlim.rlim_cur < (rlim_t)config.num_clients * 2 + 1024) {
+            rlim.rlim_cur = (rlim_t)config.num_clients * 2 + 1024;
+            if (rlim.rlim_max != RLIM_INFINITY && rlim.rlim_cur > rlim.rlim_max) {
+                rlim.rlim_cur = rlim.rlim_max;
+            }
+            setrlimit(RLIMIT_NOFILE, &rlim);
+        }
+        
+        struct load_config load = {
+            .server_ip = config.server_ip,
+            .port = config.port,
+            .connections = config.num_clients,
+            .threads = config.threads,
+            .window = config.window,
+            .message_size = config.message_size,
+            .duration_sec = config.duration,
+            .cpu_base = config.cpu_base
+        };
+        init_openssl();
+        return run_load_driver(&load) < 0 ? 1 : 0;
+    }
+    
+    if (config.sweep) {
+        if (config.min_size < 1 || config.max_size > PERF_MAX_MSG_SIZE ||
+            config.min_size > config.max_size) {
+            fprintf(stderr, "Invalid size range: %d..%d (max %d)\n",
+                    config.min_size, config.max_size, PERF_MAX_MSG_SIZE);
+            return 1;
+        }
+        if (config.queue_depth < 1 || config.iterations < 1) {
+            fprintf(stderr, "Queue depth and iterations must be positive\n");
+            return 1;
+        }
+        
+        struct sweep_config sweep = {
+            .server_ip = config.server_ip,
+            .port = config.port,
+            .ops = config.ops,
+            .min_size = config.min_size,
+            .max_size = config.max_size,
+            .queue_depth = config.queue_depth,
+            .iterations = config.iterations
+        };
+        init_openssl();
+        return run_rdma_sweep(&sweep) < 0 ? 1 : 0;
+    }
+    
     // Validate
     if (config.num_clients <= 0 || config.num_clients > 10000) {
         fprintf(stderr, "Invalid number of clients: %d\n", config.num_clients);
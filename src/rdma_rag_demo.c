@@ -12,48 +12,142 @@
 #include <time.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <pthread.h>
 #include "rdma_compat.h"
+#include "rag_kernels.h"
+#include "rag_topk.h"
+#include "rag_pool.h"
+#include "rag_hnsw.h"
+#include "rag_ivf.h"
+#include "rag_quant.h"
+#include "rag_db.h"
+#include "rag_service.h"
+#include "rag_remote.h"
+#include "rag_cache.h"
+#include "rag_store.h"
+#include "rag_filter.h"
+#include "rag_lexical.h"
+#include "rag_shard.h"
+#include "rag_stream.h"
+#include "rag_dataset.h"
+#include "tls_utils.h"
 
 #define VECTOR_DIM 768        // Standard embedding dimension (BERT-base)
 #define NUM_VECTORS 100000    // 100K vectors in database
 #define TOP_K 10              // Return top 10 similar vectors
 #define EMBEDDING_SIZE (VECTOR_DIM * sizeof(float))
-
-// Vector database entry
-struct vector_entry {
-    float embedding[VECTOR_DIM];
-    char metadata[256];  // Document ID, chunk info, etc.
-    int id;
-};
+#define METADATA_SIZE 256
+#define QUERY_TEXT_SIZE 128   // Keywords a query may carry for hybrid search
+#define EMBEDDING_ALIGN 64    // Cache line; EMBEDDING_SIZE keeps every row aligned
 
 // RAG query structure
 struct rag_query {
     float query_embedding[VECTOR_DIM];
     int top_k;
     int client_id;
+    char filter[RAG_FILTER_MAX_EXPR];   // Attribute filter (see rag_filter.h); "" = none
+    char text[QUERY_TEXT_SIZE];         // Keywords for hybrid search; "" = vector only
 };
 
-// RAG result structure
-#define MAX_K 50
+// RAG result structure; large k serves reranking, which needs indices
+// and scores, so metadata is only copied for the best MAX_CONTEXTS
+#define MAX_K 1024
+#define MAX_CONTEXTS 32
+#define SCAN_BLOCK 256        // Scores computed per top-k filter pass
+#define BATCH_TILE 32         // Vectors scored against every query of a batch while hot in L2
+#define MAX_BATCH 64
 struct rag_result {
     int indices[MAX_K];
     float distances[MAX_K];
-    char contexts[MAX_K][256];
+    char contexts[MAX_CONTEXTS][METADATA_SIZE];
     int actual_k;
+    uint32_t search_us;             // Server-side search time, set by the query service
+    uint32_t vector_us;             // Hybrid searches: time in each stage (the vector
+    uint32_t lexical_us;            // and lexical ones overlap); distances then hold
+    uint32_t fusion_us;             // fused rank scores
+    uint32_t shards_missing;        // Coordinator: shards left out (timed out or failed)
+    uint32_t batch_size;            // Queries answered by the same scan (1 = alone)
 };
 
+// Per-worker selection for one sharded query, padded so neighbouring
+// workers never write the same cache line
+struct shard_topk {
+    float scores[MAX_K];
+    int ids[MAX_K];
+    struct rag_topk topk;
+} __attribute__((aligned(64)));
+
 // RDMA-optimized vector server
 struct rdma_vector_server {
-    // Vector database
-    struct vector_entry *vectors;
+    // Vector database, stored column-wise so the scan streams only
+    // embeddings; metadata and ids are touched for the final top-k
+    float *embeddings;              // num_vectors x VECTOR_DIM, one aligned block
+    char (*metadata)[METADATA_SIZE];  // Document ID, chunk info, etc.
+    struct rag_db *db;              // Mapped file backing embeddings and metadata, if any
+    int *ids;
     size_t num_vectors;
+    size_t embeddings_size;
     
     // RDMA resources
     struct ibv_context *ctx;
     struct ibv_pd *pd;
-    struct ibv_mr *vectors_mr;      // Memory region for vector DB
-    struct ibv_mr *query_mr;        // Memory region for queries
-    struct ibv_mr *results_mr;      // Memory region for results
+    struct ibv_mr *vectors_mr;      // Memory region for the embedding block
+    
+    // Search workers; shard i is the vectors worker i touched first, so
+    // with pinned workers each shard lives on its scanner's NUMA node
+    struct rag_pool *pool;
+    struct shard_topk *shards;
+    
+    // Approximate index, at most one; both NULL means exact scans
+    struct rag_hnsw *hnsw;
+    struct rag_hnsw_scratch *hnsw_scratch;
+    struct rag_ivf *ivf;
+    
+    // Compressed copy scanned instead of the floats; the floats stay for
+    // re-ranking the best rerank * k candidates (0 = no re-rank)
+    struct rag_quant *quant;
+    int rerank;
+    
+    // Results of recent queries, checked before any search; NULL = off
+    struct rag_cache *cache;
+    uint64_t cache_version;         // Store version the cached results reflect
+    
+    // Online inserts, updates and deletes over the embeddings above.
+    // Searches scan the store's current view; approximate indexes cover
+    // the original rows, and rows changed since are patched in per query.
+    struct rag_store *store;
+    
+    // Per-vector attributes that queries filter on, and the last filter
+    // compiled from them (clients tend to repeat one)
+    struct rag_attrs *attrs;
+    struct rag_filter *filter;
+    char filter_expr[RAG_FILTER_MAX_EXPR];
+    
+    // BM25 index over the metadata text for hybrid search (NULL = off),
+    // searched on its own thread beside the vector search
+    struct rag_lexical *lexical;
+    struct lexical_worker *lexical_worker;
+    
+    // Spawned test shards only: delay this percentage of queries by
+    // stall_us, to stand in for a straggling server
+    int stall_pct;
+    int stall_us;
+    
+    // Query service batching (batch_max 0 = off): up to batch_max plain
+    // queries arriving within batch_window_us share one scan, staged in
+    // the buffers below while serving
+    int batch_max;
+    int batch_window_us;
+    float *batch_queries;
+    struct rag_result *batch_results;
     
     // Performance counters
     uint64_t total_queries;
@@ -67,99 +161,680 @@ static uint64_t get_time_us() {
     return tv.tv_sec * 1000000ULL + tv.tv_usec;
 }
 
-// Initialize random vector for demo
+// Generated databases and queries follow --seed: the d-th database a
+// process generates is dataset stream d, and the n-th random query is
+// vector n of the query stream, so runs with one seed see the same data
+static uint64_t dataset_seed = RAG_DATASET_DEFAULT_SEED;
+static uint64_t queries_generated;
+
+#define QUERY_STREAM (~0ULL)
+
+// Random unit vector for demo queries
 static void init_random_vector(float *vec, int dim) {
-    for (int i = 0; i < dim; i++) {
-        vec[i] = (float)rand() / RAND_MAX * 2.0 - 1.0;  // [-1, 1]
+    uint64_t n = __atomic_fetch_add(&queries_generated, 1, __ATOMIC_RELAXED);
+    rag_dataset_generate(rag_dataset_seed(dataset_seed, QUERY_STREAM), n, 1, dim, vec, dim);
+}
+
+// Similarity for vectors loaded from files. Search ranks by inner
+// product, so angular and l2 vectors are normalized: over base vectors
+// of one norm (SIFT1M, Deep1B) that ranks as L2 distance does, and the
+// loader warns when the norms spread.
+enum { METRIC_IP, METRIC_ANGULAR, METRIC_L2 };
+
+static int parse_metric(const char *name) {
+    static const char *names[] = { "ip", "angular", "l2" };
+    for (int m = 0; m < 3; m++) {
+        if (strcmp(name, names[m]) == 0) return m;
+    }
+    fprintf(stderr, "Unknown metric: %s (ip, angular or l2)\n", name);
+    return -1;
+}
+
+// Returns the vector's norm before any scaling
+static float apply_metric(float *vec, int dim, int metric) {
+    float norm = sqrtf(rag_dot(vec, vec, dim));
+    if (metric != METRIC_IP && norm > 0) {
+        float scale = 1.0f / norm;
+        for (int i = 0; i < dim; i++) vec[i] *= scale;
+    }
+    return norm;
+}
+
+static inline const float *vector_embedding(const struct rdma_vector_server *server, size_t i) {
+    return server->embeddings + i * VECTOR_DIM;
+}
+
+static const char *vector_metadata(const struct rdma_vector_server *server, size_t i) {
+    return server->db ? rag_db_metadata(server->db, i) : server->metadata[i];
+}
+
+// Compute cosine similarity (vectors are normalized, so this is the dot
+// product from the SIMD kernel selected at startup)
+static inline float cosine_similarity(const float *a, const float *b, int dim) {
+    return rag_dot(a, b, dim);
+}
+
+// Score base rows [begin, end) of a store view against one query into
+// a top-k selection; deleted rows never enter it
+static void scan_range(const struct rag_store_view *view, const float *query,
+                       size_t begin, size_t end, struct rag_topk *topk) {
+    float scores[SCAN_BLOCK];
+    for (size_t base = begin; base < end; base += SCAN_BLOCK) {
+        int len = end - base < SCAN_BLOCK ? end - base : SCAN_BLOCK;
+        for (int j = 0; j < len; j++) {
+            scores[j] = cosine_similarity(query, view->base + (base + j) * VECTOR_DIM, VECTOR_DIM);
+        }
+        rag_store_mask_base(view, base, scores, len);
+        rag_topk_push_block(topk, scores, len, base);
+    }
+}
+
+// Score the base rows in [begin, end) whose bit is set in rows, skipping
+// deleted ones; only allowed rows are read
+static void scan_allowed(const struct rag_store_view *view, const float *query, const uint64_t *rows,
+                         size_t begin, size_t end, struct rag_topk *topk) {
+    for (size_t w = begin / 64; w * 64 < end; w++) {
+        uint64_t word = rows[w] & ~__atomic_load_n(&view->base_dead[w], __ATOMIC_RELAXED);
+        if (w * 64 < begin) word &= ~0ULL << (begin % 64);
+        if (end - w * 64 < 64) word &= (1ULL << (end - w * 64)) - 1;
+        while (word) {
+            size_t r = w * 64 + __builtin_ctzll(word);
+            word &= word - 1;
+            rag_topk_push(topk, cosine_similarity(query, view->base + r * VECTOR_DIM, VECTOR_DIM), r);
+        }
     }
+}
+
+// Fill in the rest of a result whose first count entries are sorted
+// store rows, turning the rows into vector ids
+static void finish_result(const struct rdma_vector_server *server, const struct rag_store_view *view,
+                          int count, int top_k, struct rag_result *result) {
+    result->actual_k = count;
     
-    // Normalize to unit vector
-    float norm = 0;
-    for (int i = 0; i < dim; i++) {
-        norm += vec[i] * vec[i];
+    // Unfilled slots when the database holds fewer than k vectors
+    for (int i = result->actual_k; i < top_k; i++) {
+        result->distances[i] = -2.0;
+        result->indices[i] = -1;
     }
-    norm = sqrt(norm);
-    for (int i = 0; i < dim; i++) {
-        vec[i] /= norm;
+    
+    // Copy metadata for the best results; original vectors keep theirs
+    // outside the store
+    for (int i = 0; i < result->actual_k; i++) {
+        int row = result->indices[i];
+        result->indices[i] = rag_store_row_id(view, row);
+        if (i >= MAX_CONTEXTS) continue;
+        const char *meta = rag_store_row_meta(server->store, view, row);
+        if (!meta) {
+            meta = (size_t)result->indices[i] < server->num_vectors ?
+                   vector_metadata(server, result->indices[i]) : "";
+        }
+        snprintf(result->contexts[i], METADATA_SIZE, "%s", meta);
+    }
+}
+
+// An index returns original rows: drop those deleted or replaced since,
+// and add the rows inserted since (that f allows, if set) from the
+// store's segments
+static int apply_updates(const struct rag_store_view *view, const float *query,
+                         const struct rag_filter *f, int count, int top_k, struct rag_result *result) {
+    float scores[MAX_K];
+    int rows[MAX_K];
+    struct rag_topk topk;
+    rag_topk_init(&topk, top_k, scores, rows);
+    for (int i = 0; i < count; i++) {
+        if (!rag_store_base_dead(view, result->indices[i])) {
+            rag_topk_push(&topk, result->distances[i], result->indices[i]);
+        }
+    }
+    rag_store_scan_segments(view, query, VECTOR_DIM, f ? f->bits : NULL, f ? f->num_bits : 0, &topk);
+    count = rag_topk_finish(&topk);
+    memcpy(result->distances, scores, count * sizeof(float));
+    memcpy(result->indices, rows, count * sizeof(int));
+    return count;
+}
+
+static int clamp_top_k(int top_k) {
+    if (top_k > MAX_K) return MAX_K;
+    if (top_k < 1) return 1;
+    return top_k;
+}
+
+struct search_job {
+    struct rdma_vector_server *server;
+    const struct rag_store_view *view;
+    const float *query;
+    int top_k;
+    const uint64_t *rows;           // Base rows to score; NULL = all
+};
+
+// One worker's shard of a single query
+static void search_shard_task(void *arg, int worker, int num_workers) {
+    struct search_job *job = arg;
+    struct shard_topk *shard = &job->server->shards[worker];
+    size_t begin, end;
+    
+    rag_pool_range(job->view->base_count, worker, num_workers, &begin, &end);
+    rag_topk_init(&shard->topk, job->top_k, shard->scores, shard->ids);
+    if (job->rows) {
+        scan_allowed(job->view, job->query, job->rows, begin, end, &shard->topk);
+    } else {
+        scan_range(job->view, job->query, begin, end, &shard->topk);
+    }
+}
+
+// Scan the compressed vectors, then optionally re-score the best
+// candidates with the float vectors and keep the top k
+static int quantized_search(const struct rdma_vector_server *server, const float *query,
+                            int top_k, struct rag_result *result) {
+    if (!server->rerank) {
+        return rag_quant_search(server->quant, query, top_k, result->distances, result->indices);
+    }
+    
+    float candidate_scores[MAX_K];
+    int candidates[MAX_K];
+    int wanted = top_k * server->rerank < MAX_K ? top_k * server->rerank : MAX_K;
+    int found = rag_quant_search(server->quant, query, wanted, candidate_scores, candidates);
+    
+    struct rag_topk topk;
+    rag_topk_init(&topk, top_k, result->distances, result->indices);
+    for (int i = 0; i < found; i++) {
+        rag_topk_push(&topk, cosine_similarity(query, vector_embedding(server, candidates[i]), VECTOR_DIM),
+                      candidates[i]);
+    }
+    return rag_topk_finish(&topk);
+}
+
+// Compile expr, reusing the last filter when a query repeats it
+static const struct rag_filter *compile_filter(struct rdma_vector_server *server, const char *expr) {
+    if (server->filter && strcmp(server->filter_expr, expr) == 0) {
+        return server->filter;
+    }
+    struct rag_filter *f = rag_filter_compile(server->attrs, expr);
+    if (!f) return NULL;
+    rag_filter_destroy(server->filter);
+    server->filter = f;
+    snprintf(server->filter_expr, sizeof(server->filter_expr), "%s", expr);
+    return f;
+}
+
+// The base rows whose ids f allows, as a bitset over view->base_count.
+// Rows are ids until a compaction renumbers them; only then is a
+// translated copy (*owned = 1) built.
+static uint64_t *filter_rows(const struct rag_store_view *view, const struct rag_filter *f, int *owned) {
+    *owned = 0;
+    if (!view->base_ids && f->num_bits >= view->base_count) {
+        return f->bits;
+    }
+    uint64_t *rows = calloc(view->base_count / 64 + 1, sizeof(uint64_t));
+    if (!rows) {
+        fprintf(stderr, "Failed to allocate filter rows\n");
+        return NULL;
+    }
+    for (size_t r = 0; r < view->base_count; r++) {
+        size_t id = view->base_ids ? (size_t)view->base_ids[r] : r;
+        if (rag_filter_allows(f, id)) rows[r / 64] |= 1ULL << (r % 64);
+    }
+    *owned = 1;
+    return rows;
+}
+
+// Exact scan of only the rows allowed, sharded like the full scan, plus
+// the segment rows whose ids f allows
+static int scan_filtered(struct rdma_vector_server *server, const struct rag_store_view *view,
+                         const struct rag_filter *f, const uint64_t *rows, const float *query,
+                         int top_k, struct rag_result *result) {
+    struct rag_topk topk;
+    rag_topk_init(&topk, top_k, result->distances, result->indices);
+    if (server->pool && rag_pool_size(server->pool) > 1) {
+        struct search_job job = { server, view, query, top_k, rows };
+        rag_pool_run(server->pool, search_shard_task, &job);
+        for (int w = 0; w < rag_pool_size(server->pool); w++) {
+            rag_topk_merge(&topk, &server->shards[w].topk);
+        }
+    } else {
+        scan_allowed(view, query, rows, 0, view->base_count, &topk);
+    }
+    rag_store_scan_segments(view, query, VECTOR_DIM, f->bits, f->num_bits, &topk);
+    return rag_topk_finish(&topk);
+}
+
+// Search only the rows f allows. The plan is chosen by what it costs to
+// find k allowed results: a filter passing few rows is cheapest to score
+// exactly; one passing many is applied inside the index traversal. Only
+// compressed storage post-filters, and only when scanning it still reads
+// less than the allowed float rows would. Index results are patched with
+// the store's changes as for unfiltered queries.
+static int filtered_search(struct rdma_vector_server *server, const struct rag_store_view *view,
+                           const struct rag_filter *f, const float *query, int top_k,
+                           uint64_t version, struct rag_result *result) {
+    int owned;
+    uint64_t *rows = filter_rows(view, f, &owned);
+    if (!rows) return 0;
+    
+    double n = view->base_count, allowed = f->count;
+    int wanted = top_k;
+    if (version) wanted = 2 * top_k < MAX_K ? 2 * top_k : MAX_K;
+    int count = -1;
+    if (allowed == 0) {
+        count = 0;
+    } else if (server->hnsw) {
+        // A traversal visits about 32 nodes per ef slot, and only the
+        // allowed share of them can fill a slot
+        double ef = rag_hnsw_ef_search(server->hnsw) > wanted ? rag_hnsw_ef_search(server->hnsw) : wanted;
+        if (allowed * allowed >= 32 * ef * n) {
+            count = rag_hnsw_search_filtered(server->hnsw, server->hnsw_scratch, query, wanted, 0,
+                                             rows, result->distances, result->indices);
+        }
+    } else if (server->ivf) {
+        // Probe enough lists to expect 4k allowed candidates
+        int nlist = rag_ivf_nlist(server->ivf);
+        double needed = 4.0 * wanted * nlist / allowed;
+        if (needed <= nlist / 4) {
+            int nprobe = rag_ivf_nprobe(server->ivf);
+            if (needed > nprobe) nprobe = (int)needed + 1;
+            count = rag_ivf_search_filtered(server->ivf, query, wanted, nprobe, rows,
+                                            result->distances, result->indices, NULL);
+        }
+    } else if (server->quant && allowed * EMBEDDING_SIZE > rag_quant_memory(server->quant)) {
+        // Fetch enough candidates to expect twice k allowed among them
+        double fetch = 2.0 * wanted * n / allowed;
+        if (fetch <= MAX_K) {
+            int found = quantized_search(server, query, (int)fetch, result);
+            count = 0;
+            for (int i = 0; i < found && count < wanted; i++) {
+                int r = result->indices[i];
+                if ((rows[r / 64] >> (r % 64)) & 1) {
+                    result->distances[count] = result->distances[i];
+                    result->indices[count++] = r;
+                }
+            }
+        }
+    }
+    
+    if (count < 0) {
+        count = scan_filtered(server, view, f, rows, query, top_k, result);
+    } else if (version) {
+        count = apply_updates(view, query, f, count, top_k, result);
     }
+    if (owned) free(rows);
+    return count;
 }
 
-// Compute cosine similarity (optimized for SIMD)
-static float cosine_similarity(const float *a, const float *b, int dim) {
-    float dot = 0;
+// Perform vector search (this would be RDMA-accelerated). filter (NULL
+// or "" for none) restricts results to vectors whose attributes match;
+// returns -1, with no results, if it does not compile.
+static int vector_search_filtered(struct rdma_vector_server *server,
+                                  const float *query,
+                                  int top_k,
+                                  const char *filter,
+                                  struct rag_result *result) {
+    uint64_t start = get_time_us();
     
-    // Unroll loop for better performance
-    int i;
-    for (i = 0; i < dim - 3; i += 4) {
-        dot += a[i] * b[i];
-        dot += a[i+1] * b[i+1];
-        dot += a[i+2] * b[i+2];
-        dot += a[i+3] * b[i+3];
+    top_k = clamp_top_k(top_k);
+    
+    const struct rag_filter *f = NULL;
+    if (filter && *filter) {
+        f = compile_filter(server, filter);
+        if (!f) {
+            result->actual_k = 0;
+            return -1;
+        }
     }
     
-    // Handle remaining elements
-    for (; i < dim; i++) {
-        dot += a[i] * b[i];
+    // Cached results are dropped once the store has changed; filtered
+    // queries bypass the cache, which is keyed by the embedding alone
+    uint64_t version = rag_store_version(server->store);
+    if (server->cache && version != server->cache_version) {
+        rag_cache_clear(server->cache);
+        server->cache_version = version;
+    }
+    if (!f && server->cache && rag_cache_lookup(server->cache, query, top_k, result, NULL) != RAG_CACHE_MISS) {
+        server->total_queries++;
+        server->total_latency_us += get_time_us() - start;
+        return 0;
+    }
+    const struct rag_store_view *view = rag_store_enter(server->store);
+    int count;
+    if (f) {
+        count = filtered_search(server, view, f, query, top_k, version, result);
+    } else if (server->hnsw || server->ivf || server->quant) {
+        // Once rows have been deleted, fetch extra so k usually survive
+        int wanted = top_k;
+        if (version) wanted = 2 * top_k < MAX_K ? 2 * top_k : MAX_K;
+        if (server->hnsw) {
+            count = rag_hnsw_search(server->hnsw, server->hnsw_scratch, query, wanted, 0,
+                                    result->distances, result->indices);
+        } else if (server->ivf) {
+            count = rag_ivf_search(server->ivf, query, wanted, 0,
+                                   result->distances, result->indices, NULL);
+        } else {
+            count = quantized_search(server, query, wanted, result);
+        }
+        if (version) count = apply_updates(view, query, NULL, count, top_k, result);
+    } else {
+        // Linear search; the result arrays double as the top-k heap
+        struct rag_topk topk;
+        rag_topk_init(&topk, top_k, result->distances, result->indices);
+        
+        if (server->pool && rag_pool_size(server->pool) > 1) {
+            // Every worker scans its shard, then the local top-k are merged
+            struct search_job job = { server, view, query, top_k, NULL };
+            rag_pool_run(server->pool, search_shard_task, &job);
+            for (int w = 0; w < rag_pool_size(server->pool); w++) {
+                rag_topk_merge(&topk, &server->shards[w].topk);
+            }
+        } else {
+            scan_range(view, query, 0, view->base_count, &topk);
+        }
+        rag_store_scan_segments(view, query, VECTOR_DIM, NULL, 0, &topk);
+        count = rag_topk_finish(&topk);
+    }
+    finish_result(server, view, count, top_k, result);
+    rag_store_exit(server->store);
+    if (!f && server->cache && rag_store_version(server->store) == version) {
+        rag_cache_insert(server->cache, query, top_k, result);
     }
     
-    return dot;  // Assuming normalized vectors
+    uint64_t latency = get_time_us() - start;
+    server->total_queries++;
+    server->total_latency_us += latency;
+    return 0;
 }
 
-// Perform vector search (this would be RDMA-accelerated)
 static void vector_search(struct rdma_vector_server *server,
                          const float *query,
                          int top_k,
                          struct rag_result *result) {
+    vector_search_filtered(server, query, top_k, NULL, result);
+}
+
+struct batch_job {
+    struct rdma_vector_server *server;
+    const struct rag_store_view *view;
+    const float *queries;           // num_queries x VECTOR_DIM
+    int num_queries;
+    int top_k;
+    struct rag_topk *heaps;         // [worker][query]
+    float *scores;                  // [worker][query][top_k]
+    int *ids;
+};
+
+// One worker's shard for a whole batch: each tile of vectors is read
+// from memory once and scored against every query while it is cached,
+// with the register-blocked tile kernel computing the score matrix
+static void batch_shard_task(void *arg, int worker, int num_workers) {
+    struct batch_job *job = arg;
+    int nq = job->num_queries;
+    struct rag_topk *heaps = job->heaps + (size_t)worker * nq;
+    size_t begin, end;
+    
+    for (int q = 0; q < nq; q++) {
+        size_t slot = ((size_t)worker * nq + q) * job->top_k;
+        rag_topk_init(&heaps[q], job->top_k, job->scores + slot, job->ids + slot);
+    }
+    
+    rag_pool_range(job->view->base_count, worker, num_workers, &begin, &end);
+    float scores[MAX_BATCH * BATCH_TILE];
+    for (size_t base = begin; base < end; base += BATCH_TILE) {
+        int len = end - base < BATCH_TILE ? end - base : BATCH_TILE;
+        rag_dot_tile(job->queries, nq, job->view->base + base * VECTOR_DIM, len,
+                     VECTOR_DIM, scores, BATCH_TILE);
+        for (int q = 0; q < nq; q++) {
+            rag_store_mask_base(job->view, base, scores + q * BATCH_TILE, len);
+            rag_topk_push_block(&heaps[q], scores + q * BATCH_TILE, len, base);
+        }
+    }
+}
+
+// Search num_queries queries in one pass over the database (always
+// exact: the batch scan is the throughput path)
+static int vector_search_batch(struct rdma_vector_server *server,
+                               const float *queries, int num_queries,
+                               int top_k, struct rag_result *results) {
     uint64_t start = get_time_us();
+    int workers = server->pool ? rag_pool_size(server->pool) : 1;
     
-    // Clamp top_k to MAX_K
-    if (top_k > MAX_K) top_k = MAX_K;
-    result->actual_k = top_k;
+    if (num_queries < 1 || num_queries > MAX_BATCH) {
+        fprintf(stderr, "Batch size must be 1-%d\n", MAX_BATCH);
+        return -1;
+    }
+    top_k = clamp_top_k(top_k);
     
-    // Initialize result distances to -infinity
-    for (int i = 0; i < top_k; i++) {
-        result->distances[i] = -2.0;
-        result->indices[i] = -1;
+    size_t slots = (size_t)workers * num_queries;
+    struct batch_job job = { server, NULL, queries, num_queries, top_k, NULL, NULL, NULL };
+    job.heaps = malloc(slots * sizeof(struct rag_topk));
+    job.scores = malloc(slots * top_k * sizeof(float));
+    job.ids = malloc(slots * top_k * sizeof(int));
+    if (!job.heaps || !job.scores || !job.ids) {
+        fprintf(stderr, "Failed to allocate batch selection\n");
+        free(job.heaps);
+        free(job.scores);
+        free(job.ids);
+        return -1;
     }
     
-    // Linear search (in production, would use HNSW or IVF)
-    for (size_t i = 0; i < server->num_vectors; i++) {
-        float sim = cosine_similarity(query, server->vectors[i].embedding, VECTOR_DIM);
-        
-        // Check if this should be in top-k
-        if (sim > result->distances[top_k - 1]) {
-            // Find insertion position
-            int pos = top_k - 1;
-            while (pos > 0 && sim > result->distances[pos - 1]) {
-                pos--;
-            }
-            
-            // Shift elements
-            for (int j = top_k - 1; j > pos; j--) {
-                result->distances[j] = result->distances[j - 1];
-                result->indices[j] = result->indices[j - 1];
-            }
-            
-            // Insert new element
-            result->distances[pos] = sim;
-            result->indices[pos] = i;
-        }
+    job.view = rag_store_enter(server->store);
+    if (workers > 1) {
+        rag_pool_run(server->pool, batch_shard_task, &job);
+    } else {
+        batch_shard_task(&job, 0, 1);
     }
     
-    // Copy metadata for results
-    for (int i = 0; i < top_k; i++) {
-        if (result->indices[i] >= 0) {
-            strcpy(result->contexts[i], server->vectors[result->indices[i]].metadata);
+    for (int q = 0; q < num_queries; q++) {
+        struct rag_topk topk;
+        rag_topk_init(&topk, top_k, results[q].distances, results[q].indices);
+        for (int w = 0; w < workers; w++) {
+            rag_topk_merge(&topk, &job.heaps[(size_t)w * num_queries + q]);
         }
+        rag_store_scan_segments(job.view, queries + (size_t)q * VECTOR_DIM, VECTOR_DIM, NULL, 0, &topk);
+        finish_result(server, job.view, rag_topk_finish(&topk), top_k, &results[q]);
     }
+    rag_store_exit(server->store);
+    
+    free(job.heaps);
+    free(job.scores);
+    free(job.ids);
     
+    // Every query in the batch waited for the whole pass
     uint64_t latency = get_time_us() - start;
-    server->total_queries++;
-    server->total_latency_us += latency;
+    server->total_queries += num_queries;
+    server->total_latency_us += latency * num_queries;
+    return 0;
+}
+
+static const char *server_metadata(void *ctx, size_t i) {
+    return vector_metadata(ctx, i);
+}
+
+enum { LEXICAL_IDLE, LEXICAL_POSTED, LEXICAL_DONE, LEXICAL_STOP };
+
+// One lexical search at a time, handed over under lock
+struct lexical_worker {
+    struct rdma_vector_server *server;
+    struct rag_lexical_scratch *scratch;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int state;
+    const char *text;
+    const uint64_t *allowed;
+    int k;
+    float scores[MAX_K];
+    int ids[MAX_K];
+    int count;
+    uint32_t us;
+    int cpus;                       // In the thread's affinity mask
+};
+
+static void lexical_run(struct lexical_worker *lw) {
+    uint64_t start = get_time_us();
+    lw->count = rag_lexical_search(lw->server->lexical, lw->scratch, lw->text, lw->k, lw->allowed,
+                                   lw->scores, lw->ids);
+    lw->us = get_time_us() - start;
+}
+
+static void *lexical_thread(void *arg) {
+    struct lexical_worker *lw = arg;
+    cpu_set_t mask;
+    int cpus = pthread_getaffinity_np(pthread_self(), sizeof(mask), &mask) == 0 ? CPU_COUNT(&mask) : 0;
+    pthread_mutex_lock(&lw->lock);
+    lw->cpus = cpus;
+    while (1) {
+        while (lw->state != LEXICAL_POSTED && lw->state != LEXICAL_STOP) {
+            pthread_cond_wait(&lw->wake, &lw->lock);
+        }
+        if (lw->state == LEXICAL_STOP) break;
+        pthread_mutex_unlock(&lw->lock);
+        lexical_run(lw);
+        pthread_mutex_lock(&lw->lock);
+        lw->state = LEXICAL_DONE;
+        pthread_cond_broadcast(&lw->wake);
+    }
+    pthread_mutex_unlock(&lw->lock);
+    return NULL;
+}
+
+// Start a lexical search for the top k ids matching text (and allowed)
+static void lexical_post(struct lexical_worker *lw, const char *text, int k, const uint64_t *allowed) {
+    pthread_mutex_lock(&lw->lock);
+    lw->text = text;
+    lw->k = k;
+    lw->allowed = allowed;
+    lw->state = LEXICAL_POSTED;
+    pthread_cond_broadcast(&lw->wake);
+    pthread_mutex_unlock(&lw->lock);
+}
+
+static void lexical_wait(struct lexical_worker *lw) {
+    pthread_mutex_lock(&lw->lock);
+    while (lw->state != LEXICAL_DONE) pthread_cond_wait(&lw->wake, &lw->lock);
+    lw->state = LEXICAL_IDLE;
+    pthread_mutex_unlock(&lw->lock);
+}
+
+static void destroy_lexical(struct rdma_vector_server *server) {
+    struct lexical_worker *lw = server->lexical_worker;
+    if (lw) {
+        pthread_mutex_lock(&lw->lock);
+        lw->state = LEXICAL_STOP;
+        pthread_cond_broadcast(&lw->wake);
+        pthread_mutex_unlock(&lw->lock);
+        pthread_join(lw->thread, NULL);
+        pthread_cond_destroy(&lw->wake);
+        pthread_mutex_destroy(&lw->lock);
+        rag_lexical_scratch_destroy(lw->scratch);
+        free(lw);
+    }
+    rag_lexical_destroy(server->lexical);
+    server->lexical = NULL;
+    server->lexical_worker = NULL;
+}
+
+// Index every vector's metadata text for hybrid search
+static int build_lexical(struct rdma_vector_server *server) {
+    uint64_t start = get_time_us();
+    server->lexical = rag_lexical_build(server_metadata, server, server->num_vectors);
+    struct lexical_worker *lw = calloc(1, sizeof(*lw));
+    if (!server->lexical || !lw || !(lw->scratch = rag_lexical_scratch_create(server->lexical))) {
+        fprintf(stderr, "Failed to set up the lexical index\n");
+        free(lw);
+        destroy_lexical(server);
+        return -1;
+    }
+    lw->server = server;
+    pthread_mutex_init(&lw->lock, NULL);
+    pthread_cond_init(&lw->wake, NULL);
+    if (pthread_create(&lw->thread, NULL, lexical_thread, lw) != 0) {
+        fprintf(stderr, "Failed to start the lexical search thread\n");
+        pthread_cond_destroy(&lw->wake);
+        pthread_mutex_destroy(&lw->lock);
+        rag_lexical_scratch_destroy(lw->scratch);
+        free(lw);
+        destroy_lexical(server);
+        return -1;
+    }
+    server->lexical_worker = lw;
+    
+    struct rag_lexical_stats stats;
+    rag_lexical_stats(server->lexical, &stats);
+    printf("Lexical index ready: %.2fs, %zu terms, %zu postings in %.2f MB (%.1f bits each, "
+           "%.1fx under 32-bit ids + counts)\n", (get_time_us() - start) / 1e6, stats.terms,
+           stats.postings, stats.bytes / (1024.0 * 1024.0), 8.0 * stats.posting_bytes / stats.postings,
+           8.0 * stats.postings / stats.posting_bytes);
+    return 0;
+}
+
+// Hybrid search: BM25 over the chunk text runs on the lexical thread
+// while the vector search runs here, each ranking 4k deep, and the two
+// are merged by reciprocal rank fusion. Without text (or a lexical
+// index) this is a plain vector search. Returns -1, with no results, if
+// filter does not compile.
+static int vector_search_hybrid(struct rdma_vector_server *server, const float *query,
+                                const char *text, int top_k, const char *filter,
+                                struct rag_result *result) {
+    result->vector_us = result->lexical_us = result->fusion_us = 0;
+    if (!text || !*text || !server->lexical) {
+        return vector_search_filtered(server, query, top_k, filter, result);
+    }
+    
+    uint64_t start = get_time_us();
+    top_k = clamp_top_k(top_k);
+    int depth = 4 * top_k < MAX_K ? 4 * top_k : MAX_K;
+    const struct rag_filter *f = NULL;
+    if (filter && *filter && !(f = compile_filter(server, filter))) {
+        result->actual_k = 0;
+        return -1;
+    }
+    
+    struct lexical_worker *lw = server->lexical_worker;
+    lexical_post(lw, text, depth, f ? f->bits : NULL);
+    vector_search_filtered(server, query, depth, filter, result);
+    uint64_t vector_done = get_time_us();
+    lexical_wait(lw);
+    
+    // The lexical index covers the original ids; drop deleted ones
+    uint64_t fusion_start = get_time_us();
+    int kept = 0;
+    for (int i = 0; i < lw->count; i++) {
+        if (!rag_store_id_deleted(server->store, lw->ids[i])) lw->ids[kept++] = lw->ids[i];
+    }
+    const int *lists[2] = { result->indices, lw->ids };
+    int counts[2] = { result->actual_k, kept };
+    float scores[MAX_K];
+    int ids[MAX_K];
+    int count = rag_rrf_fuse(lists, counts, 2, top_k, scores, ids);
+    
+    // Vector hits come with their metadata; lexical-only ones are
+    // original vectors, whose metadata an update carries over unchanged
+    char contexts[MAX_CONTEXTS][METADATA_SIZE];
+    for (int i = 0; i < count && i < MAX_CONTEXTS; i++) {
+        const char *meta = NULL;
+        for (int j = 0; j < result->actual_k && j < MAX_CONTEXTS && !meta; j++) {
+            if (result->indices[j] == ids[i]) meta = result->contexts[j];
+        }
+        if (!meta) meta = (size_t)ids[i] < server->num_vectors ? vector_metadata(server, ids[i]) : "";
+        snprintf(contexts[i], METADATA_SIZE, "%s", meta);
+    }
+    memcpy(result->contexts, contexts, (count < MAX_CONTEXTS ? count : MAX_CONTEXTS) * METADATA_SIZE);
+    memcpy(result->distances, scores, count * sizeof(float));
+    memcpy(result->indices, ids, count * sizeof(int));
+    result->actual_k = count;
+    for (int i = count; i < top_k; i++) {
+        result->distances[i] = 0;
+        result->indices[i] = -1;
+    }
+    
+    uint64_t end = get_time_us();
+    result->vector_us = vector_done - start;
+    result->lexical_us = lw->us;
+    result->fusion_us = end - fusion_start;
+    server->total_latency_us += end - vector_done;
+    return 0;
 }
 
 // Simulate RDMA vector search with timing
-static void rdma_vector_search_demo(struct rdma_vector_server *server) {
+static void rdma_vector_search_demo(struct rdma_vector_server *server, const char *filter,
+                                    const char *text) {
     printf("\n=== RDMA-RAG Vector Search Demo ===\n\n");
     
     // Generate random query
@@ -169,7 +844,9 @@ static void rdma_vector_search_demo(struct rdma_vector_server *server) {
     struct rag_result result;
     
     // Traditional TCP/HTTP simulation
-    printf("1. Traditional TCP/HTTP RAG:\n");
+    // Transfer costs here are modelled with sleeps; --serve / --connect
+    // measure them over real RDMA and TCP connections
+    printf("1. Traditional TCP/HTTP RAG (modelled transfer costs):\n");
     printf("   - Serializing embedding... ");
     usleep(5000);  // 5ms serialization
     printf("✓ (5ms)\n");
@@ -184,7 +861,7 @@ static void rdma_vector_search_demo(struct rdma_vector_server *server) {
     
     printf("   - Vector search... ");
     uint64_t search_start = get_time_us();
-    vector_search(server, query, TOP_K, &result);
+    vector_search_hybrid(server, query, text, TOP_K, filter, &result);
     uint64_t search_time = get_time_us() - search_start;
     printf("✓ (%.2fms)\n", search_time / 1000.0);
     
@@ -196,7 +873,7 @@ static void rdma_vector_search_demo(struct rdma_vector_server *server) {
     printf("   Total: %.2fms\n\n", traditional_total);
     
     // RDMA simulation
-    printf("2. RDMA-RAG:\n");
+    printf("2. RDMA-RAG (modelled transfer costs):\n");
     printf("   - RDMA registration... ");
     usleep(10);  // 10μs registration
     printf("✓ (0.01ms)\n");
@@ -207,7 +884,7 @@ static void rdma_vector_search_demo(struct rdma_vector_server *server) {
     
     printf("   - Vector search... ");
     search_start = get_time_us();
-    vector_search(server, query, TOP_K, &result);
+    vector_search_hybrid(server, query, text, TOP_K, filter, &result);
     search_time = get_time_us() - search_start;
     printf("✓ (%.2fms)\n", search_time / 1000.0);
     
@@ -219,10 +896,15 @@ static void rdma_vector_search_demo(struct rdma_vector_server *server) {
     printf("   Total: %.2fms\n\n", rdma_total);
     
     // Show results
-    printf("3. Search Results (Top %d similar vectors):\n", TOP_K);
-    for (int i = 0; i < TOP_K && result.indices[i] >= 0; i++) {
-        printf("   [%d] Vector #%d (similarity: %.4f) - %s\n",
-               i + 1, result.indices[i], result.distances[i], result.contexts[i]);
+    printf("3. Search Results (Top %d similar vectors%s%s%s%s):\n", TOP_K,
+           *filter ? " where " : "", filter, *text ? ", fused with keywords: " : "", text);
+    for (int i = 0; i < result.actual_k; i++) {
+        printf("   [%d] Vector #%d (%s: %.4f) - %s\n", i + 1, result.indices[i],
+               *text ? "fused score" : "similarity", result.distances[i], result.contexts[i]);
+    }
+    if (*text) {
+        printf("   Stages: vector %u us, lexical %u us (concurrent), fusion %u us\n",
+               result.vector_us, result.lexical_us, result.fusion_us);
     }
     
     printf("\n4. Performance Comparison:\n");
@@ -231,6 +913,7 @@ static void rdma_vector_search_demo(struct rdma_vector_server *server) {
     printf("   │ RDMA-RAG:            %6.2fms     │\n", rdma_total);
     printf("   │ Speedup:             %6.1fx       │\n", traditional_total / rdma_total);
     printf("   └─────────────────────────────────────┘\n");
+    printf("   Transfer costs are modelled; run --serve and --connect for measured ones\n");
     
     // Show potential at scale
     printf("\n5. Projected Performance at Scale:\n");
@@ -241,64 +924,454 @@ static void rdma_vector_search_demo(struct rdma_vector_server *server) {
     printf("   - Daily savings: %.1f compute hours\n", (traditional_total - rdma_total) * 86400 / 3600);
 }
 
-// Initialize the vector database
-static struct rdma_vector_server* init_vector_server(size_t num_vectors) {
+static void destroy_vector_server(struct rdma_vector_server *server) {
+    destroy_lexical(server);
+    rag_store_destroy(server->store);
+    rag_filter_destroy(server->filter);
+    rag_attrs_destroy(server->attrs);
+    if (server->vectors_mr) ibv_dereg_mr(server->vectors_mr);
+    if (server->pd) ibv_dealloc_pd(server->pd);
+    if (server->ctx) ibv_close_device(server->ctx);
+    if (server->db) {
+        rag_db_close(server->db);
+    } else {
+        free(server->embeddings);
+    }
+    free(server->metadata);
+    free(server->ids);
+    free(server->shards);
+    rag_hnsw_scratch_destroy(server->hnsw_scratch);
+    rag_hnsw_destroy(server->hnsw);
+    rag_ivf_destroy(server->ivf);
+    rag_quant_destroy(server->quant);
+    rag_cache_destroy(server->cache);
+    free(server);
+}
+
+static int build_ivf(struct rdma_vector_server *server, const struct rag_ivf_params *params) {
+    // A database file may carry a trained index
+    size_t image_size;
+    const void *image = server->db ? rag_db_section(server->db, RAG_DB_SECTION_IVF, &image_size) : NULL;
+    if (image) {
+        server->ivf = rag_ivf_load(image, image_size, params->nprobe);
+        if (!server->ivf) return -1;
+        // The image is trusted only if it indexes exactly these vectors
+        if (rag_ivf_dim(server->ivf) != VECTOR_DIM || rag_ivf_count(server->ivf) != server->num_vectors) {
+            fprintf(stderr, "IVF in the database file indexes %zu x %d-d vectors, not %zu x %d-d\n",
+                    rag_ivf_count(server->ivf), rag_ivf_dim(server->ivf),
+                    server->num_vectors, VECTOR_DIM);
+            rag_ivf_destroy(server->ivf);
+            server->ivf = NULL;
+            return -1;
+        }
+        printf("IVF loaded from the database file: %d lists\n", rag_ivf_nlist(server->ivf));
+        rag_store_set_compaction(server->store, 0);
+        return 0;
+    }
+    
+    printf("Training IVF index (%d k-means iterations, %d workers)...\n",
+           params->train_iters, server->pool ? rag_pool_size(server->pool) : 1);
+    
+    uint64_t start = get_time_us();
+    server->ivf = rag_ivf_build(server->embeddings, server->num_vectors, VECTOR_DIM,
+                                params, server->pool);
+    if (!server->ivf) return -1;
+    
+    // List balance decides how evenly nprobe translates into work
+    size_t largest = 0, count;
+    for (int l = 0; l < rag_ivf_nlist(server->ivf); l++) {
+        rag_ivf_list(server->ivf, l, NULL, &count);
+        if (count > largest) largest = count;
+    }
+    rag_store_set_compaction(server->store, 0);
+    printf("IVF ready: %.2fs, %d lists (mean %.0f, largest %zu vectors), %.2f MB\n",
+           (get_time_us() - start) / 1e6, rag_ivf_nlist(server->ivf),
+           server->num_vectors / (double)rag_ivf_nlist(server->ivf), largest,
+           rag_ivf_memory(server->ivf) / (1024.0 * 1024.0));
+    return 0;
+}
+
+static int build_quant(struct rdma_vector_server *server, const struct rag_quant_params *params) {
+    printf("Encoding embeddings as %s...\n", rag_quant_type_name(params->type));
+    
+    uint64_t start = get_time_us();
+    server->quant = rag_quant_build(server->embeddings, server->num_vectors, VECTOR_DIM,
+                                    params, server->pool);
+    if (!server->quant) return -1;
+    rag_store_set_compaction(server->store, 0);
+    
+    size_t bytes = rag_quant_memory(server->quant);
+    printf("Encoded in %.2fs: %.2f MB (%.1fx smaller than float32), %s kernel\n",
+           (get_time_us() - start) / 1e6, bytes / (1024.0 * 1024.0),
+           server->embeddings_size / (double)bytes, rag_quant_kernel(server->quant));
+    return 0;
+}
+
+static int build_hnsw(struct rdma_vector_server *server, const struct rag_hnsw_params *params) {
+    printf("Building HNSW index (M=%d, efConstruction=%d, %d workers)...\n",
+           params->M, params->ef_construction, server->pool ? rag_pool_size(server->pool) : 1);
+    
+    uint64_t start = get_time_us();
+    server->hnsw = rag_hnsw_build(server->embeddings, server->num_vectors, VECTOR_DIM,
+                                  params, server->pool);
+    if (!server->hnsw) return -1;
+    server->hnsw_scratch = rag_hnsw_scratch_create(server->hnsw);
+    if (!server->hnsw_scratch) {
+        fprintf(stderr, "Failed to allocate HNSW search state\n");
+        return -1;
+    }
+    rag_store_set_compaction(server->store, 0);
+    
+    double seconds = (get_time_us() - start) / 1e6;
+    printf("HNSW ready: %.2fs (%.0f inserts/s), %d layers, %.2f MB of links\n",
+           seconds, server->num_vectors / seconds, rag_hnsw_max_level(server->hnsw) + 1,
+           rag_hnsw_memory(server->hnsw) / (1024.0 * 1024.0));
+    return 0;
+}
+
+// Attach a worker pool, one shard per worker
+static int attach_pool(struct rdma_vector_server *server, struct rag_pool *pool) {
+    free(server->shards);
+    server->shards = NULL;
+    server->pool = pool;
+    if (!pool) return 0;
+    
+    if (posix_memalign((void **)&server->shards, 64,
+                       rag_pool_size(pool) * sizeof(struct shard_topk))) {
+        server->shards = NULL;
+        server->pool = NULL;
+        fprintf(stderr, "Failed to allocate shard selections\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Attributes for filtered search. Generated and saved databases carry no
+// attributes of their own, so each id gets a fixed pseudo-random tenant
+// (32, "tenant_00" ..) and year (2015-2024), and the document number its
+// metadata names; the same id always gets the same values.
+static int load_attributes(struct rdma_vector_server *server) {
+    server->attrs = rag_attrs_create();
+    if (!server->attrs) return -1;
+    int tenant = rag_attrs_add_column(server->attrs, "tenant", RAG_ATTR_KEYWORD);
+    int year = rag_attrs_add_column(server->attrs, "year", RAG_ATTR_INT);
+    int doc = rag_attrs_add_column(server->attrs, "doc", RAG_ATTR_INT);
+    if (tenant < 0 || year < 0 || doc < 0) return -1;
+    
+    char name[16];
+    for (size_t i = 0; i < server->num_vectors; i++) {
+        uint64_t h = (i + 1) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 31;
+        snprintf(name, sizeof(name), "tenant_%02d", (int)(h % 32));
+        if (rag_attrs_set_keyword(server->attrs, tenant, i, name) < 0 ||
+            rag_attrs_set_int(server->attrs, year, i, 2015 + (h >> 8) % 10) < 0 ||
+            rag_attrs_set_int(server->attrs, doc, i, i / 100) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Chunk text for generated vectors: the document and chunk numbers, then
+// ten words of a 4096-word vocabulary with a Zipf-like skew (a few words
+// are everywhere, most are rare), fixed per id
+static void synthetic_chunk(size_t i, char *text) {
+    static const char *syllables[16] = {
+        "ka", "lo", "mi", "ne", "ru", "sa", "ti", "vo", "be", "da", "fu", "go", "hi", "ja", "pe", "zu"
+    };
+    unsigned int seed = i * 2654435761u + 1;
+    int len = snprintf(text, METADATA_SIZE, "Document_%zu_Chunk_%zu:", i / 100, i % 100);
+    for (int w = 0; w < 10; w++) {
+        // Log-uniform rank: rank r is drawn with probability about 1/r
+        int rank = (int)pow(4096.0, rand_r(&seed) / (RAND_MAX + 1.0));
+        len += snprintf(text + len, METADATA_SIZE - len, " %s%s%s", syllables[rank & 15],
+                        syllables[(rank >> 4) & 15], syllables[rank >> 8]);
+    }
+}
+
+struct fill_job {
+    struct rdma_vector_server *server;
+    uint64_t seed;
+    struct rag_vecs *base;          // Read vectors from here instead
+    int metric;
+    int failed;
+    pthread_mutex_t lock;
+    float min_norm;                 // Of the base vectors read
+    float max_norm;
+};
+
+// Linux places a page on the node of the CPU that first writes it, so
+// each pinned worker generates or reads the shard it will later scan
+static void fill_task(void *arg, int worker, int num_workers) {
+    struct fill_job *job = arg;
+    struct rdma_vector_server *server = job->server;
+    size_t begin, end;
+    
+    rag_pool_range(server->num_vectors, worker, num_workers, &begin, &end);
+    float *shard = server->embeddings + begin * VECTOR_DIM;
+    int ret;
+    if (job->base) {
+        ret = rag_vecs_read(job->base, begin, end - begin, shard, VECTOR_DIM);
+        int dim = rag_vecs_dim(job->base);
+        float min_norm = INFINITY, max_norm = 0;
+        for (size_t i = begin; ret == 0 && i < end; i++) {
+            float norm = apply_metric(server->embeddings + i * VECTOR_DIM, dim, job->metric);
+            min_norm = norm < min_norm ? norm : min_norm;
+            max_norm = norm > max_norm ? norm : max_norm;
+        }
+        pthread_mutex_lock(&job->lock);
+        job->min_norm = min_norm < job->min_norm ? min_norm : job->min_norm;
+        job->max_norm = max_norm > job->max_norm ? max_norm : job->max_norm;
+        pthread_mutex_unlock(&job->lock);
+    } else {
+        ret = rag_dataset_generate(job->seed, begin, end - begin, VECTOR_DIM, shard, VECTOR_DIM);
+    }
+    if (ret < 0) __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+    for (size_t i = begin; i < end; i++) {
+        server->ids[i] = i;
+        synthetic_chunk(i, server->metadata[i]);
+    }
+}
+
+// Initialize the vector database, sharded across pool's workers: the
+// first num_vectors of base, or generated vectors without it
+static struct rdma_vector_server* fill_vector_server(size_t num_vectors, struct rag_pool *pool,
+                                                     struct rag_vecs *base, int metric) {
     struct rdma_vector_server *server = calloc(1, sizeof(*server));
     if (!server) {
         fprintf(stderr, "Failed to allocate server structure\n");
         return NULL;
     }
     
-    // Allocate vector database
+    // Allocate vector database: one aligned embedding block (a single
+    // region to register for RDMA) plus side arrays for metadata and ids
     server->num_vectors = num_vectors;
-    size_t db_size = num_vectors * sizeof(struct vector_entry);
-    printf("Allocating %.2f MB for vector database...\n", db_size / (1024.0 * 1024.0));
+    server->embeddings_size = num_vectors * EMBEDDING_SIZE;
+    size_t side_size = num_vectors * (METADATA_SIZE + sizeof(int));
+    printf("Allocating %.2f MB for embeddings + %.2f MB for metadata...\n",
+           server->embeddings_size / (1024.0 * 1024.0), side_size / (1024.0 * 1024.0));
     
-    server->vectors = malloc(db_size);
-    if (!server->vectors) {
-        fprintf(stderr, "Failed to allocate %zu bytes for vectors\n", db_size);
-        free(server);
+    if (posix_memalign((void **)&server->embeddings, EMBEDDING_ALIGN, server->embeddings_size)) {
+        server->embeddings = NULL;
+    }
+    server->metadata = malloc(num_vectors * METADATA_SIZE);
+    server->ids = malloc(num_vectors * sizeof(int));
+    server->store = rag_store_create(server->embeddings, num_vectors, VECTOR_DIM, METADATA_SIZE);
+    if (!server->embeddings || !server->metadata || !server->ids || !server->store) {
+        fprintf(stderr, "Failed to allocate %zu bytes for vectors\n",
+                server->embeddings_size + side_size);
+        destroy_vector_server(server);
         return NULL;
     }
     
-    printf("Initializing vector database with %zu vectors...\n", num_vectors);
+    // The scan walks the whole block sequentially; huge pages cut TLB misses
+    madvise(server->embeddings, server->embeddings_size, MADV_HUGEPAGE);
     
-    // Initialize random seed
-    srand(time(NULL));
+    if (attach_pool(server, pool) < 0) {
+        destroy_vector_server(server);
+        return NULL;
+    }
     
-    // Initialize with random vectors (in production, load from file)
-    for (size_t i = 0; i < num_vectors; i++) {
-        init_random_vector(server->vectors[i].embedding, VECTOR_DIM);
-        server->vectors[i].id = i;
-        snprintf(server->vectors[i].metadata, 256, 
-                "Document_%zu_Chunk_%zu", i / 100, i % 100);
-        
-        if ((i + 1) % 1000 == 0) {
-            printf("  Initialized %zu vectors...\n", i + 1);
-        }
+    // Databases generated by one process differ (--db maps a saved one)
+    static uint64_t generated;
+    struct fill_job job = { server, 0, base, metric, 0, PTHREAD_MUTEX_INITIALIZER, INFINITY, 0 };
+    uint64_t start = get_time_us();
+    if (!base) {
+        uint64_t stream = __atomic_fetch_add(&generated, 1, __ATOMIC_RELAXED);
+        job.seed = rag_dataset_seed(dataset_seed, stream);
+        printf("Generating %zu vectors (seed %llu, stream %llu)...\n", num_vectors,
+               (unsigned long long)dataset_seed, (unsigned long long)stream);
+    }
+    if (pool) {
+        rag_pool_run(pool, fill_task, &job);
+    } else {
+        fill_task(&job, 0, 1);
+    }
+    if (job.failed) {
+        destroy_vector_server(server);
+        return NULL;
+    }
+    printf("%s %zu vectors in %.2f s\n", base ? "Loaded" : "Generated", num_vectors,
+           (get_time_us() - start) / 1e6);
+    if (base && metric == METRIC_L2 && job.max_norm > job.min_norm * 1.01f) {
+        printf("Warning: base norms span %.4g to %.4g, so inner-product ranking only\n"
+               "approximates L2 distance; recall against L2 ground truth is capped\n",
+               job.min_norm, job.max_norm);
+    }
+    if (load_attributes(server) < 0) {
+        fprintf(stderr, "Failed to build vector attributes\n");
+        destroy_vector_server(server);
+        return NULL;
     }
     
     printf("Vector database ready!\n");
     return server;
 }
 
-// Benchmark different scenarios
-static void run_benchmarks(struct rdma_vector_server *server) {
-    printf("\n=== Comprehensive Benchmarks ===\n\n");
-    
-    struct {
-        const char *name;
-        int num_queries;
-        int top_k;
-    } scenarios[] = {
-        {"Single Query (k=10)", 1, 10},
-        {"Batch Small (k=5)", 10, 5},
-        {"Batch Medium (k=10)", 10, 10},  // Changed from k=20
-        {"Concurrent (k=10)", 100, 10},
-        {"Stress Test (k=10)", 100, 10},  // Changed from k=50
-    };
+static struct rdma_vector_server* init_vector_server(size_t num_vectors, struct rag_pool *pool) {
+    return fill_vector_server(num_vectors, pool, NULL, METRIC_IP);
+}
+
+// Load an fvecs or bvecs file, all of it unless max_vectors is set
+static struct rdma_vector_server* load_vector_server(const char *path, size_t max_vectors, int metric,
+                                                     struct rag_pool *pool) {
+    struct rag_vecs *base = rag_vecs_open(path);
+    if (!base) return NULL;
+    int dim = rag_vecs_dim(base);
+    size_t count = rag_vecs_count(base);
+    if (dim > VECTOR_DIM) {
+        fprintf(stderr, "%s holds %d-dimensional vectors; at most %d fit\n", path, dim, VECTOR_DIM);
+        rag_vecs_close(base);
+        return NULL;
+    }
+    if (max_vectors && max_vectors < count) count = max_vectors;
+    printf("Loading %zu %d-dimensional vectors from %s, zero-padded to %d\n", count, dim, path, VECTOR_DIM);
+    struct rdma_vector_server *server = fill_vector_server(count, pool, base, metric);
+    rag_vecs_close(base);
+    return server;
+}
+
+// Map a database written by --save-db; embeddings and metadata are used
+// in place, so start-up time does not grow with the database
+static struct rdma_vector_server* open_vector_server(const char *path, struct rag_pool *pool) {
+    uint64_t start = get_time_us();
+    struct rag_db *db = rag_db_open(path);
+    if (!db) return NULL;
+    if (rag_db_dim(db) != VECTOR_DIM) {
+        fprintf(stderr, "%s holds %d-dimensional vectors, expected %d\n", path, rag_db_dim(db), VECTOR_DIM);
+        rag_db_close(db);
+        return NULL;
+    }
     
-    for (int s = 0; s < 5; s++) {
+    struct rdma_vector_server *server = calloc(1, sizeof(*server));
+    if (!server) {
+        fprintf(stderr, "Failed to allocate server structure\n");
+        rag_db_close(db);
+        return NULL;
+    }
+    server->db = db;
+    server->num_vectors = rag_db_count(db);
+    server->embeddings_size = server->num_vectors * EMBEDDING_SIZE;
+    server->embeddings = (float *)rag_db_embeddings(db);
+    server->ids = malloc(server->num_vectors * sizeof(int));
+    server->store = rag_store_create(server->embeddings, server->num_vectors, VECTOR_DIM, METADATA_SIZE);
+    if (!server->ids || !server->store || attach_pool(server, pool) < 0) {
+        fprintf(stderr, "Failed to allocate vector ids\n");
+        destroy_vector_server(server);
+        return NULL;
+    }
+    for (size_t i = 0; i < server->num_vectors; i++) server->ids[i] = i;
+    if (load_attributes(server) < 0) {
+        fprintf(stderr, "Failed to build vector attributes\n");
+        destroy_vector_server(server);
+        return NULL;
+    }
+    
+    printf("Mapped %zu vectors (%.2f MB) from %s in %.2f ms\n", server->num_vectors,
+           server->embeddings_size / (1024.0 * 1024.0), path, (get_time_us() - start) / 1000.0);
+    return server;
+}
+
+static int write_ivf_section(const void *ivf, FILE *f) {
+    return rag_ivf_write_image(ivf, f);
+}
+
+// Save the database, plus the IVF index if one is built
+static int save_vector_server(struct rdma_vector_server *server, const char *path) {
+    struct rag_db_section_writer sections[1];
+    int num_sections = 0;
+    if (server->ivf) {
+        sections[num_sections++] = (struct rag_db_section_writer) {
+            RAG_DB_SECTION_IVF, rag_ivf_image_size(server->ivf), write_ivf_section, server->ivf
+        };
+    }
+    
+    uint64_t start = get_time_us();
+    if (rag_db_write(path, server->embeddings, server->num_vectors, VECTOR_DIM,
+                     server_metadata, server, sections, num_sections) < 0) {
+        return -1;
+    }
+    printf("Saved %zu vectors%s to %s in %.2fs\n", server->num_vectors,
+           server->ivf ? " and the IVF index" : "", path, (get_time_us() - start) / 1e6);
+    return 0;
+}
+
+// Register the whole mapping as one read-only memory region, so remote
+// clients can READ the header, embeddings, metadata and index sections
+// at their file offsets
+static int register_database(struct rdma_vector_server *server) {
+    int num_devices;
+    struct ibv_device **dev_list = ibv_get_device_list(&num_devices);
+    if (!dev_list || num_devices == 0) {
+        fprintf(stderr, "No RDMA devices found; database mapping not registered\n");
+        if (dev_list) ibv_free_device_list(dev_list);
+        return -1;
+    }
+    server->ctx = ibv_open_device(dev_list[0]);
+    ibv_free_device_list(dev_list);
+    if (!server->ctx) {
+        fprintf(stderr, "Failed to open RDMA device\n");
+        return -1;
+    }
+    server->pd = ibv_alloc_pd(server->ctx);
+    if (!server->pd) {
+        fprintf(stderr, "Failed to allocate PD\n");
+        return -1;
+    }
+    
+    size_t size;
+    const void *base = rag_db_mapping(server->db, &size);
+    server->vectors_mr = ibv_reg_mr(server->pd, (void *)base, size, IBV_ACCESS_REMOTE_READ);
+    if (!server->vectors_mr) {
+        perror("ibv_reg_mr");
+        return -1;
+    }
+    printf("Registered the %.2f MB mapping for remote reads (rkey 0x%x)\n",
+           size / (1024.0 * 1024.0), server->vectors_mr->rkey);
+    return 0;
+}
+
+// What --serve publishes for one-sided clients: the database mapping,
+// with its IVF section if one was saved, or else the in-memory embeddings
+static void publish_layout(const struct rdma_vector_server *server, struct rag_remote_layout *layout,
+                           const void **region, size_t *region_size) {
+    memset(layout, 0, sizeof(*layout));
+    layout->version = RAG_REMOTE_LAYOUT_VERSION;
+    layout->dim = VECTOR_DIM;
+    layout->count = server->num_vectors;
+    layout->stride = EMBEDDING_SIZE;
+    if (server->db) {
+        *region = rag_db_mapping(server->db, region_size);
+        layout->embeddings_offset = (const char *)rag_db_embeddings(server->db) - (const char *)*region;
+        size_t ivf_size;
+        const void *ivf = rag_db_section(server->db, RAG_DB_SECTION_IVF, &ivf_size);
+        if (ivf) {
+            layout->ivf_offset = (const char *)ivf - (const char *)*region;
+            layout->ivf_size = ivf_size;
+        }
+    } else {
+        *region = server->embeddings;
+        *region_size = server->embeddings_size;
+    }
+}
+
+// Benchmark different scenarios
+static void run_benchmarks(struct rdma_vector_server *server) {
+    printf("\n=== Comprehensive Benchmarks (modelled transfer costs) ===\n\n");
+    
+    struct {
+        const char *name;
+        int num_queries;
+        int top_k;
+    } scenarios[] = {
+        {"Single Query (k=10)", 1, 10},
+        {"Batch Small (k=5)", 10, 5},
+        {"Batch Medium (k=10)", 10, 10},  // Changed from k=20
+        {"Concurrent (k=10)", 100, 10},
+        {"Stress Test (k=10)", 100, 10},  // Changed from k=50
+    };
+    
+    for (int s = 0; s < 5; s++) {
         printf("Scenario: %s\n", scenarios[s].name);
         
         float query[VECTOR_DIM];
@@ -339,40 +1412,3322 @@ static void run_benchmarks(struct rdma_vector_server *server) {
     }
 }
 
-int main(int argc, char *argv[]) {
-    printf("╔══════════════════════════════════════════════════════╗\n");
-    printf("║          RDMA-RAG: Ultra-Fast Vector Search         ║\n");
-    printf("║                                                      ║\n");
-    printf("║  Demonstrating 10-100x speedup for RAG systems      ║\n");
-    printf("╚══════════════════════════════════════════════════════╝\n\n");
+// Sorted-array insertion, the original selection, kept as the baseline
+static void select_topk_insertion(const float *scores, size_t n, int k,
+                                  float *best, int *ids) {
+    for (int i = 0; i < k; i++) {
+        best[i] = -2.0;
+        ids[i] = -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (scores[i] <= best[k - 1]) continue;
+        int pos = k - 1;
+        while (pos > 0 && scores[i] > best[pos - 1]) {
+            pos--;
+        }
+        for (int j = k - 1; j > pos; j--) {
+            best[j] = best[j - 1];
+            ids[j] = ids[j - 1];
+        }
+        best[pos] = scores[i];
+        ids[pos] = i;
+    }
+}
+
+// Selection cost alone, over one query's scores for the whole database
+static void run_topk_benchmark(struct rdma_vector_server *server) {
+    static const int ks[] = { 1, 10, 50, 100, 250, 500, 1000 };
+    size_t n = server->num_vectors;
     
-    // Initialize vector database
-    size_t num_vectors = (argc > 1) ? atoi(argv[1]) : 10000;
-    struct rdma_vector_server *server = init_vector_server(num_vectors);
-    if (!server) {
-        fprintf(stderr, "Failed to initialize vector server\n");
-        return 1;
+    printf("\n=== Top-k Selection Benchmark (%zu scores) ===\n\n", n);
+    
+    float *scores = malloc(n * sizeof(float));
+    float *best = malloc(MAX_K * sizeof(float));
+    float *check = malloc(MAX_K * sizeof(float));
+    int *ids = malloc(MAX_K * sizeof(int));
+    if (!scores || !best || !check || !ids) {
+        fprintf(stderr, "Failed to allocate benchmark buffers\n");
+        goto out;
     }
     
-    // Run demo
-    rdma_vector_search_demo(server);
+    float query[VECTOR_DIM];
+    init_random_vector(query, VECTOR_DIM);
+    for (size_t i = 0; i < n; i++) {
+        scores[i] = cosine_similarity(query, vector_embedding(server, i), VECTOR_DIM);
+    }
     
-    // Run benchmarks
-    run_benchmarks(server);
+    printf("%6s %14s %14s %14s %9s\n", "k", "insertion(us)", "heap(us)", "filtered(us)", "speedup");
+    for (size_t c = 0; c < sizeof(ks) / sizeof(ks[0]); c++) {
+        int k = ks[c];
+        if ((size_t)k > n) break;
+        
+        // Repeat short runs so every method gets at least ~50 ms
+        double times[3];
+        for (int method = 0; method < 3; method++) {
+            int reps = 0;
+            uint64_t start = get_time_us();
+            do {
+                struct rag_topk topk;
+                rag_topk_init(&topk, k, best, ids);
+                if (method == 0) {
+                    select_topk_insertion(scores, n, k, best, ids);
+                } else if (method == 1) {
+                    for (size_t i = 0; i < n; i++) rag_topk_push(&topk, scores[i], i);
+                    rag_topk_finish(&topk);
+                } else {
+                    rag_topk_push_block(&topk, scores, n, 0);
+                    rag_topk_finish(&topk);
+                }
+                reps++;
+            } while (get_time_us() - start < 50000);
+            times[method] = (get_time_us() - start) / (double)reps;
+            
+            if (method == 0) {
+                memcpy(check, best, k * sizeof(float));
+            } else if (memcmp(check, best, k * sizeof(float)) != 0) {
+                printf("  k=%d: method %d disagrees with insertion\n", k, method);
+            }
+        }
+        
+        printf("%6d %14.1f %14.1f %14.1f %8.1fx\n",
+               k, times[0], times[1], times[2], times[0] / times[2]);
+    }
     
-    // Show summary
-    if (server->total_queries > 0) {
-        printf("\n=== Session Summary ===\n");
-        printf("Total queries processed: %lu\n", server->total_queries);
-        printf("Average search latency: %.2fms\n", 
-               server->total_latency_us / (float)server->total_queries / 1000);
-        printf("Throughput capacity: ~%.0f queries/second\n",
-               1000000.0 / (server->total_latency_us / (float)server->total_queries));
+out:
+    free(scores);
+    free(best);
+    free(check);
+    free(ids);
+}
+
+// The tile kernel sums in a different order, so near-ties may swap;
+// each rank's score must still match the serial scan
+static int same_topk(const struct rag_result *a, const struct rag_result *b, int top_k) {
+    for (int i = 0; i < top_k; i++) {
+        if (fabsf(a->distances[i] - b->distances[i]) > 1e-5f) return 0;
     }
+    return 1;
+}
+
+// Sharded and batched search must return the serial top-k
+static int check_parallel_results(struct rdma_vector_server *server, const float *queries,
+                                  int num_queries, int top_k, const struct rag_result *expected,
+                                  struct rag_result *results) {
+    int mismatches = 0;
     
-    // Cleanup
-    free(server->vectors);
-    free(server);
+    for (int q = 0; q < num_queries; q++) {
+        vector_search(server, queries + (size_t)q * VECTOR_DIM, top_k, &results[q]);
+        mismatches += !same_topk(&results[q], &expected[q], top_k);
+    }
+    if (vector_search_batch(server, queries, num_queries, top_k, results) < 0) {
+        return num_queries;
+    }
+    for (int q = 0; q < num_queries; q++) {
+        mismatches += !same_topk(&results[q], &expected[q], top_k);
+    }
+    return mismatches;
+}
+
+static struct rag_result* serial_results(struct rdma_vector_server *server, const float *queries,
+                                         int num_queries, int top_k) {
+    struct rag_pool *pool = server->pool;
+    struct rag_result *expected = malloc(num_queries * sizeof(struct rag_result));
+    if (!expected) return NULL;
+    
+    server->pool = NULL;
+    for (int q = 0; q < num_queries; q++) {
+        vector_search(server, queries + (size_t)q * VECTOR_DIM, top_k, &expected[q]);
+    }
+    server->pool = pool;
+    return expected;
+}
+
+static int parallel_self_test(void) {
+    static const int thread_counts[] = { 1, 2, 3, 7 };
+    const int num_queries = 8, top_k = 50;
+    int failures = 0;
+    
+    printf("Parallel search self-test:\n");
+    struct rdma_vector_server *server = init_vector_server(3001, NULL);
+    float *queries = malloc(num_queries * EMBEDDING_SIZE);
+    struct rag_result *results = malloc(num_queries * sizeof(struct rag_result));
+    struct rag_result *expected = NULL;
+    if (server && queries) {
+        for (int q = 0; q < num_queries; q++) {
+            init_random_vector(queries + (size_t)q * VECTOR_DIM, VECTOR_DIM);
+        }
+        expected = serial_results(server, queries, num_queries, top_k);
+    }
+    if (!expected || !results) {
+        fprintf(stderr, "Self-test allocation failed\n");
+        failures = 1;
+        goto out;
+    }
+    
+    for (size_t c = 0; c < sizeof(thread_counts) / sizeof(thread_counts[0]); c++) {
+        struct rag_pool *pool = rag_pool_create(thread_counts[c], 0);
+        if (!pool || attach_pool(server, pool) < 0) {
+            rag_pool_destroy(pool);
+            failures++;
+            continue;
+        }
+        int bad = check_parallel_results(server, queries, num_queries, top_k, expected, results);
+        printf("  threads=%-3d %s\n", thread_counts[c], bad ? "FAIL" : "ok");
+        failures += bad != 0;
+        attach_pool(server, NULL);
+        rag_pool_destroy(pool);
+    }
+    
+out:
+    if (server) destroy_vector_server(server);
+    free(queries);
+    free(results);
+    free(expected);
+    return failures;
+}
+
+// Powers of two, then max_threads itself
+static int next_thread_count(int threads, int max_threads) {
+    if (threads < max_threads && threads * 2 > max_threads) return max_threads;
+    return threads * 2;
+}
+
+// Queries per second against worker count, one query at a time and in
+// batches sharing one pass over the database
+static void run_parallel_benchmark(struct rdma_vector_server *server, int max_threads) {
+    const int batch = 32;
+    struct rag_pool *own_pool = server->pool;
+    
+    printf("\n=== Parallel Search Benchmark (%zu vectors, batch %d) ===\n\n",
+           server->num_vectors, batch);
+    
+    float *queries = malloc(batch * EMBEDDING_SIZE);
+    struct rag_result *results = malloc(batch * sizeof(struct rag_result));
+    struct rag_result *expected = NULL;
+    if (!queries || !results) {
+        fprintf(stderr, "Failed to allocate benchmark buffers\n");
+        goto out;
+    }
+    for (int q = 0; q < batch; q++) {
+        init_random_vector(queries + (size_t)q * VECTOR_DIM, VECTOR_DIM);
+    }
+    expected = serial_results(server, queries, batch, TOP_K);
+    if (!expected) {
+        fprintf(stderr, "Failed to allocate benchmark buffers\n");
+        goto out;
+    }
+    
+    printf("%8s %14s %9s %14s %9s\n", "threads", "query QPS", "speedup", "batch QPS", "speedup");
+    double base_single = 0, base_batch = 0;
+    for (int threads = 1; threads <= max_threads; threads = next_thread_count(threads, max_threads)) {
+        // The configured pool keeps its first-touch placement; other
+        // sizes reuse the same memory with different shard boundaries
+        struct rag_pool *pool = own_pool && rag_pool_size(own_pool) == threads
+                              ? own_pool : rag_pool_create(threads, 1);
+        if (!pool || attach_pool(server, pool) < 0) {
+            if (pool != own_pool) rag_pool_destroy(pool);
+            break;
+        }
+        
+        int mismatches = check_parallel_results(server, queries, batch, TOP_K, expected, results);
+        
+        uint64_t start = get_time_us();
+        long done = 0;
+        do {
+            vector_search(server, queries + (done % batch) * VECTOR_DIM, TOP_K, &results[0]);
+            done++;
+        } while (get_time_us() - start < 500000);
+        double single_qps = done * 1e6 / (get_time_us() - start);
+        
+        start = get_time_us();
+        done = 0;
+        do {
+            vector_search_batch(server, queries, batch, TOP_K, results);
+            done += batch;
+        } while (get_time_us() - start < 500000);
+        double batch_qps = done * 1e6 / (get_time_us() - start);
+        
+        if (threads == 1) {
+            base_single = single_qps;
+            base_batch = batch_qps;
+        }
+        printf("%8d %14.1f %8.2fx %14.1f %8.2fx%s\n", threads,
+               single_qps, single_qps / base_single, batch_qps, batch_qps / base_batch,
+               mismatches ? "  (results differ from serial!)" : "");
+        
+        if (pool != own_pool) {
+            rag_pool_destroy(pool);
+        }
+    }
+    
+out:
+    attach_pool(server, own_pool);
+    free(queries);
+    free(results);
+    free(expected);
+}
+
+// Throughput mode: Q queries per pass against Q separate scans. A
+// single scan does 2 flops per 4-byte load and is bound by memory
+// bandwidth; a batch reuses each cached tile Q times
+static void run_batch_benchmark(struct rdma_vector_server *server) {
+    static const int batch_sizes[] = { 1, 2, 4, 8, 16, 32, 64 };
+    
+    printf("\n=== Batched Scan Benchmark (%zu vectors, %d workers) ===\n\n",
+           server->num_vectors, server->pool ? rag_pool_size(server->pool) : 1);
+    
+    float *queries = malloc(MAX_BATCH * EMBEDDING_SIZE);
+    struct rag_result *results = malloc(MAX_BATCH * sizeof(struct rag_result));
+    if (!queries || !results) {
+        fprintf(stderr, "Failed to allocate benchmark buffers\n");
+        goto out;
+    }
+    for (int q = 0; q < MAX_BATCH; q++) {
+        init_random_vector(queries + (size_t)q * VECTOR_DIM, VECTOR_DIM);
+    }
+    
+    // Baseline: the same queries issued one at a time
+    uint64_t start = get_time_us();
+    long done = 0;
+    do {
+        vector_search(server, queries + (done % MAX_BATCH) * VECTOR_DIM, TOP_K, &results[0]);
+        done++;
+    } while (get_time_us() - start < 500000);
+    double single_qps = done * 1e6 / (get_time_us() - start);
+    double flops_per_query = 2.0 * VECTOR_DIM * server->num_vectors;
+    
+    printf("%6s %12s %9s %10s %12s\n", "batch", "QPS", "speedup", "GFLOP/s", "DB GB/s");
+    printf("%6s %12.1f %8.2fx %10.2f %12.2f\n", "single", single_qps, 1.0,
+           single_qps * flops_per_query / 1e9,
+           single_qps * server->embeddings_size / 1e9);
+    
+    for (size_t b = 0; b < sizeof(batch_sizes) / sizeof(batch_sizes[0]); b++) {
+        int nq = batch_sizes[b];
+        start = get_time_us();
+        done = 0;
+        do {
+            if (vector_search_batch(server, queries, nq, TOP_K, results) < 0) goto out;
+            done += nq;
+        } while (get_time_us() - start < 500000);
+        double qps = done * 1e6 / (get_time_us() - start);
+        
+        // The database is read once per batch
+        printf("%6d %12.1f %8.2fx %10.2f %12.2f\n", nq, qps, qps / single_qps,
+               qps * flops_per_query / 1e9,
+               qps / nq * server->embeddings_size / 1e9);
+    }
+    
+out:
+    free(queries);
+    free(results);
+}
+
+// Share of the true top-k that an approximate search returned
+static double recall_at_k(const int *found, int count, const int *truth, int k) {
+    int hits = 0;
+    for (int i = 0; i < k; i++) {
+        for (int j = 0; j < count; j++) {
+            if (found[j] == truth[i]) {
+                hits++;
+                break;
+            }
+        }
+    }
+    return hits / (double)k;
+}
+
+// Exact top-k ids for every query, from the batched scan
+static int *exact_neighbours(struct rdma_vector_server *server, const float *queries,
+                             int num_queries, int k) {
+    int *truth = malloc((size_t)num_queries * k * sizeof(int));
+    struct rag_result *results = malloc(MAX_BATCH * sizeof(struct rag_result));
+    if (!truth || !results) {
+        free(truth);
+        free(results);
+        return NULL;
+    }
+    
+    for (int q = 0; q < num_queries; q += MAX_BATCH) {
+        int nq = num_queries - q < MAX_BATCH ? num_queries - q : MAX_BATCH;
+        vector_search_batch(server, queries + (size_t)q * VECTOR_DIM, nq, k, results);
+        for (int i = 0; i < nq; i++) {
+            memcpy(truth + (size_t)(q + i) * k, results[i].indices, k * sizeof(int));
+        }
+    }
+    free(results);
+    return truth;
+}
+
+// Queries for the recall benchmarks and their true top-k ids: from
+// --query-file and --truth, or generated and scanned exactly
+struct query_set {
+    float *queries;                 // num x VECTOR_DIM
+    int *truth;                     // num x k
+    int num;
+    int k;
+    const char *source;
+};
+
+#define BENCH_QUERIES 200           // Generated
+#define BENCH_FILE_QUERIES 1000     // Taken from --query-file
+
+static int make_query_set(struct rdma_vector_server *server, const char *query_path,
+                          const char *truth_path, int metric, int max_queries, struct query_set *set) {
+    struct rag_vecs *file = NULL;
+    memset(set, 0, sizeof(*set));
+    set->k = TOP_K;
+    set->source = query_path ? "file" : "generated";
+    set->num = max_queries > 0 ? max_queries : query_path ? BENCH_FILE_QUERIES : BENCH_QUERIES;
+    
+    if (query_path) {
+        if (!(file = rag_vecs_open(query_path))) return -1;
+        if (rag_vecs_dim(file) > VECTOR_DIM) {
+            fprintf(stderr, "%s: %d-dimensional queries do not fit\n", query_path, rag_vecs_dim(file));
+            goto fail;
+        }
+        if ((size_t)set->num > rag_vecs_count(file)) set->num = rag_vecs_count(file);
+    }
+    set->queries = malloc((size_t)set->num * EMBEDDING_SIZE);
+    if (!set->queries) goto fail;
+    if (file) {
+        if (rag_vecs_read(file, 0, set->num, set->queries, VECTOR_DIM) < 0) goto fail;
+        for (int q = 0; q < set->num; q++) {
+            apply_metric(set->queries + (size_t)q * VECTOR_DIM, rag_vecs_dim(file), metric);
+        }
+        rag_vecs_close(file);
+        file = NULL;
+    } else {
+        for (int q = 0; q < set->num; q++) {
+            init_random_vector(set->queries + (size_t)q * VECTOR_DIM, VECTOR_DIM);
+        }
+    }
+    
+    if (!truth_path) {
+        set->truth = exact_neighbours(server, set->queries, set->num, set->k);
+        if (set->truth) return 0;
+        fprintf(stderr, "Failed to allocate benchmark buffers\n");
+        goto fail;
+    }
+    if (!(file = rag_vecs_open(truth_path))) goto fail;
+    if (rag_vecs_count(file) < (size_t)set->num || rag_vecs_dim(file) < set->k) {
+        fprintf(stderr, "%s: needs %d neighbours for each of %d queries\n", truth_path, set->k, set->num);
+        goto fail;
+    }
+    set->truth = malloc((size_t)set->num * set->k * sizeof(int));
+    if (!set->truth || rag_vecs_read_ids(file, 0, set->num, set->truth, set->k) < 0) goto fail;
+    for (size_t i = 0; i < (size_t)set->num * set->k; i++) {
+        if (set->truth[i] < 0 || (size_t)set->truth[i] >= server->num_vectors) {
+            fprintf(stderr, "%s names vector %d; only %zu are loaded\n", truth_path, set->truth[i],
+                    server->num_vectors);
+            goto fail;
+        }
+    }
+    rag_vecs_close(file);
+    return 0;
+    
+fail:
+    rag_vecs_close(file);
+    free(set->queries);
+    free(set->truth);
+    return -1;
+}
+
+static int hnsw_self_test(void) {
+    const int num_queries = 50, k = 10;
+    struct rag_hnsw_params params = { 16, 100, 128 };
+    int failures = 1;
+    
+    printf("HNSW self-test:\n");
+    struct rdma_vector_server *server = init_vector_server(2000, NULL);
+    struct rag_pool *pool = rag_pool_create(3, 0);
+    float *queries = malloc(num_queries * EMBEDDING_SIZE);
+    int *truth = NULL;
+    if (!server || !pool || !queries || attach_pool(server, pool) < 0) {
+        fprintf(stderr, "Self-test allocation failed\n");
+        goto out;
+    }
+    for (int q = 0; q < num_queries; q++) {
+        init_random_vector(queries + (size_t)q * VECTOR_DIM, VECTOR_DIM);
+    }
+    truth = exact_neighbours(server, queries, num_queries, k);
+    if (!truth || build_hnsw(server, &params) < 0) {
+        goto out;
+    }
+    
+    double recall = 0;
+    for (int q = 0; q < num_queries; q++) {
+        float scores[10];
+        int ids[10];
+        int count = rag_hnsw_search(server->hnsw, server->hnsw_scratch,
+                                    queries + (size_t)q * VECTOR_DIM, k, 0, scores, ids);
+        recall += recall_at_k(ids, count, truth + (size_t)q * k, k);
+    }
+    recall /= num_queries;
+    failures = recall < 0.9;
+    printf("  recall@%d=%.3f (threaded build, ef=%d) %s\n", k, recall, params.ef_search,
+           failures ? "FAIL" : "ok");
+    
+out:
+    if (server) destroy_vector_server(server);
+    rag_pool_destroy(pool);
+    free(queries);
+    free(truth);
+    return failures;
+}
+
+static int ivf_self_test(void) {
+    const int num_queries = 50, k = 10;
+    struct rag_ivf_params params = { 32, 4, RAG_IVF_DEFAULT_ITERS, 0 };
+    int failures = 1;
+    
+    printf("IVF self-test:\n");
+    struct rdma_vector_server *server = init_vector_server(4000, NULL);
+    struct rag_pool *pool = rag_pool_create(3, 0);
+    float *queries = malloc(num_queries * EMBEDDING_SIZE);
+    int *truth = NULL;
+    if (!server || !pool || !queries || attach_pool(server, pool) < 0) {
+        fprintf(stderr, "Self-test allocation failed\n");
+        goto out;
+    }
+    for (int q = 0; q < num_queries; q++) {
+        init_random_vector(queries + (size_t)q * VECTOR_DIM, VECTOR_DIM);
+    }
+    truth = exact_neighbours(server, queries, num_queries, k);
+    if (!truth || build_ivf(server, &params) < 0) {
+        goto out;
+    }
+    
+    // Probing every list is an exact search; fewer lists only loses recall
+    failures = 0;
+    for (int nprobe = params.nprobe; nprobe <= params.nlist; nprobe *= 8) {
+        double recall = 0;
+        for (int q = 0; q < num_queries; q++) {
+            float scores[10];
+            int ids[10];
+            int count = rag_ivf_search(server->ivf, queries + (size_t)q * VECTOR_DIM, k, nprobe,
+                                       scores, ids, NULL);
+            recall += recall_at_k(ids, count, truth + (size_t)q * k, k);
+        }
+        recall /= num_queries;
+        int bad = nprobe == params.nlist && recall < 1.0;
+        printf("  nprobe=%-3d recall@%d=%.3f %s\n", nprobe, k, recall,
+               nprobe == params.nlist ? (bad ? "FAIL" : "ok") : "");
+        failures += bad;
+    }
+    
+out:
+    if (server) destroy_vector_server(server);
+    rag_pool_destroy(pool);
+    free(queries);
+    free(truth);
+    return failures;
+}
+
+// Recall@10, latency and share of the database scanned against nprobe
+static void run_ivf_benchmark(struct rdma_vector_server *server, const struct query_set *set) {
+    const int num_queries = set->num, k = set->k;
+    const float *queries = set->queries;
+    const int *truth = set->truth;
+    int nlist = rag_ivf_nlist(server->ivf);
+    
+    printf("\n=== IVF Benchmark (%zu vectors, %d lists, %d %s queries) ===\n\n",
+           server->num_vectors, nlist, num_queries, set->source);
+    
+    struct rag_result *result = malloc(sizeof(struct rag_result));
+    if (!result) {
+        fprintf(stderr, "Failed to allocate benchmark buffers\n");
+        return;
+    }
+    
+    printf("%7s %10s %12s %12s %10s\n", "nprobe", "recall@10", "latency(us)", "QPS", "scanned");
+    for (int nprobe = 1; ; nprobe *= 2) {
+        if (nprobe > nlist) nprobe = nlist;
+        
+        double recall = 0;
+        size_t scanned = 0, total_scanned = 0;
+        uint64_t start = get_time_us();
+        for (int q = 0; q < num_queries; q++) {
+            int count = rag_ivf_search(server->ivf, queries + (size_t)q * VECTOR_DIM, k, nprobe,
+                                       result->distances, result->indices, &scanned);
+            recall += recall_at_k(result->indices, count, truth + (size_t)q * k, k);
+            total_scanned += scanned;
+        }
+        double us = (get_time_us() - start) / (double)num_queries;
+        
+        printf("%7d %10.3f %12.1f %12.1f %9.1f%%\n", nprobe, recall / num_queries, us, 1e6 / us,
+               100.0 * total_scanned / num_queries / server->num_vectors);
+        if (nprobe == nlist) break;
+    }
+    free(result);
+}
+
+static int quant_self_test(void) {
+    const int num_queries = 50, k = 10;
+    struct rag_quant_params params = { RAG_QUANT_INT8, 0, 0 };
+    int failures = rag_quant_self_test();
+    
+    struct rdma_vector_server *server = init_vector_server(3000, NULL);
+    float *queries = malloc(num_queries * EMBEDDING_SIZE);
+    struct rag_result *result = malloc(sizeof(struct rag_result));
+    int *truth = NULL;
+    if (!server || !queries || !result) {
+        fprintf(stderr, "Self-test allocation failed\n");
+        failures++;
+        goto out;
+    }
+    for (int q = 0; q < num_queries; q++) {
+        init_random_vector(queries + (size_t)q * VECTOR_DIM, VECTOR_DIM);
+    }
+    truth = exact_neighbours(server, queries, num_queries, k);
+    if (!truth || build_quant(server, &params) < 0) {
+        failures++;
+        goto out;
+    }
+    
+    // int8 keeps enough precision that a 4x re-rank recovers the top 10
+    server->rerank = 4;
+    double recall = 0;
+    for (int q = 0; q < num_queries; q++) {
+        int count = quantized_search(server, queries + (size_t)q * VECTOR_DIM, k, result);
+        recall += recall_at_k(result->indices, count, truth + (size_t)q * k, k);
+    }
+    recall /= num_queries;
+    printf("  int8 + rerank x4 recall@%d=%.3f %s\n", k, recall, recall < 0.95 ? "FAIL" : "ok");
+    failures += recall < 0.95;
+    
+    // Half precision alone should barely move the ranking
+    for (int type = RAG_QUANT_FP16; type <= RAG_QUANT_BF16; type++) {
+        rag_quant_destroy(server->quant);
+        server->quant = NULL;
+        params.type = type;
+        server->rerank = 0;
+        if (build_quant(server, &params) < 0) {
+            failures++;
+            break;
+        }
+        recall = 0;
+        for (int q = 0; q < num_queries; q++) {
+            int count = quantized_search(server, queries + (size_t)q * VECTOR_DIM, k, result);
+            recall += recall_at_k(result->indices, count, truth + (size_t)q * k, k);
+        }
+        recall /= num_queries;
+        printf("  %s recall@%d=%.3f %s\n", rag_quant_type_name(type), k, recall,
+               recall < 0.95 ? "FAIL" : "ok");
+        failures += recall < 0.95;
+    }
+    
+out:
+    if (server) destroy_vector_server(server);
+    free(queries);
+    free(result);
+    free(truth);
+    return failures;
+}
+
+// Save, map and compare: vectors, metadata and the IVF section must
+// come back unchanged, and a truncated file must be refused
+static int db_self_test(void) {
+    const int num_queries = 20, k = 10;
+    struct rag_ivf_params params = { 16, 4, 3, 0 };
+    struct rdma_vector_server *server = init_vector_server(1500, NULL), *loaded = NULL;
+    int failures = 1;
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/rag_db_self_test.%d", (int)getpid());
+    
+    printf("Database file self-test:\n");
+    if (!server || build_ivf(server, &params) < 0 || save_vector_server(server, path) < 0) {
+        goto out;
+    }
+    loaded = open_vector_server(path, NULL);
+    if (!loaded || build_ivf(loaded, &params) < 0) {
+        goto out;
+    }
+    
+    int bad = loaded->num_vectors != server->num_vectors ||
+              memcmp(loaded->embeddings, server->embeddings, server->embeddings_size) != 0;
+    for (size_t i = 0; !bad && i < server->num_vectors; i++) {
+        bad = strcmp(vector_metadata(loaded, i), vector_metadata(server, i)) != 0;
+    }
+    for (int q = 0; !bad && q < num_queries; q++) {
+        float query[VECTOR_DIM], want_scores[10], got_scores[10];
+        int want_ids[10], got_ids[10];
+        init_random_vector(query, VECTOR_DIM);
+        int want = rag_ivf_search(server->ivf, query, k, 0, want_scores, want_ids, NULL);
+        int got = rag_ivf_search(loaded->ivf, query, k, 0, got_scores, got_ids, NULL);
+        bad = want != got || memcmp(want_ids, got_ids, want * sizeof(int)) != 0 ||
+              memcmp(want_scores, got_scores, want * sizeof(float)) != 0;
+    }
+    printf("  round trip %s\n", bad ? "FAIL" : "ok");
+    failures = bad;
+    
+    destroy_vector_server(loaded);
+    loaded = NULL;
+    if (truncate(path, server->embeddings_size / 2) == 0) {
+        struct rag_db *db = rag_db_open(path);
+        printf("  truncated file %s\n", db ? "accepted FAIL" : "refused ok");
+        failures += db != NULL;
+        rag_db_close(db);
+    }
+    
+out:
+    unlink(path);
+    if (loaded) destroy_vector_server(loaded);
+    if (server) destroy_vector_server(server);
+    return failures;
+}
+
+// A skewed stream over a fixed set of topics: half the queries repeat a
+// topic's embedding exactly, half perturb it slightly (cosine ~0.999)
+static int zipf_topic(const double *cdf, int num_topics) {
+    double u = (double)rand() / RAND_MAX;
+    int lo = 0, hi = num_topics - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (cdf[mid] < u) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Hit rate and latency of the result cache on a repetitive stream, and
+// how many of a near hit's results the exact search would have returned
+static void run_cache_benchmark(struct rdma_vector_server *server, const struct rag_cache_params *params) {
+    const int num_topics = 256, num_queries = 2000, k = TOP_K;
+    
+    printf("\n=== Result Cache Benchmark (%zu vectors, %d queries over %d topics) ===\n\n",
+           server->num_vectors, num_queries, num_topics);
+    
+    float *topics = malloc(num_topics * EMBEDDING_SIZE);
+    float *stream = malloc(num_queries * EMBEDDING_SIZE);
+    double *cdf = malloc(num_topics * sizeof(double));
+    struct rag_result *result = malloc(sizeof(struct rag_result));
+    int *truth = malloc((size_t)num_queries * k * sizeof(int));
+    struct rag_cache *saved = server->cache;
+    struct rag_cache *cache = saved ? saved : rag_cache_create(VECTOR_DIM, sizeof(struct rag_result), params);
+    
+    // Lookups and inserts are driven here, so the search itself runs uncached
+    server->cache = NULL;
+    if (!topics || !stream || !cdf || !result || !truth || !cache) {
+        fprintf(stderr, "Failed to allocate benchmark buffers\n");
+        goto out;
+    }
+    
+    double total = 0;
+    for (int t = 0; t < num_topics; t++) {
+        init_random_vector(topics + (size_t)t * VECTOR_DIM, VECTOR_DIM);
+        total += 1.0 / pow(t + 1, 1.1);
+        cdf[t] = total;
+    }
+    for (int t = 0; t < num_topics; t++) cdf[t] /= total;
+    for (int q = 0; q < num_queries; q++) {
+        float *query = stream + (size_t)q * VECTOR_DIM;
+        const float *topic = topics + (size_t)zipf_topic(cdf, num_topics) * VECTOR_DIM;
+        memcpy(query, topic, EMBEDDING_SIZE);
+        if (rand() % 2) {
+            float noise[VECTOR_DIM];
+            init_random_vector(noise, VECTOR_DIM);
+            for (int d = 0; d < VECTOR_DIM; d++) query[d] += 0.05f * noise[d];
+        }
+    }
+    
+    // Uncached pass: baseline latency and the exact answers
+    uint64_t start = get_time_us();
+    for (int q = 0; q < num_queries; q++) {
+        vector_search(server, stream + (size_t)q * VECTOR_DIM, k, result);
+        memcpy(truth + (size_t)q * k, result->indices, k * sizeof(int));
+    }
+    double uncached_us = (get_time_us() - start) / (double)num_queries;
+    
+    // Cached pass, timed per query to split hits from misses
+    rag_cache_clear(cache);
+    struct rag_cache_stats before;
+    rag_cache_stats(cache, &before);
+    uint64_t hit_us = 0, miss_us = 0;
+    int hits = 0, near_hits = 0;
+    double near_overlap = 0;
+    start = get_time_us();
+    for (int q = 0; q < num_queries; q++) {
+        const float *query = stream + (size_t)q * VECTOR_DIM;
+        uint64_t t0 = get_time_us();
+        int hit = rag_cache_lookup(cache, query, k, result, NULL);
+        if (hit == RAG_CACHE_MISS) {
+            vector_search(server, query, k, result);
+            rag_cache_insert(cache, query, k, result);
+            miss_us += get_time_us() - t0;
+            continue;
+        }
+        hit_us += get_time_us() - t0;
+        hits++;
+        if (hit == RAG_CACHE_NEAR) {
+            near_hits++;
+            near_overlap += recall_at_k(result->indices, result->actual_k, truth + (size_t)q * k, k);
+        }
+    }
+    double cached_us = (get_time_us() - start) / (double)num_queries;
+    
+    struct rag_cache_stats stats;
+    rag_cache_stats(cache, &stats);
+    printf("Cache: %zu entries, TTL %s, near-duplicate threshold %.3f\n",
+           params->capacity, params->ttl_ms ? "on" : "off", params->near_threshold);
+    printf("  hit rate:          %5.1f%% (%lu exact, %lu near)\n", 100.0 * hits / num_queries,
+           stats.exact_hits - before.exact_hits, stats.near_hits - before.near_hits);
+    printf("  hit latency:       %8.1f us\n", hits ? hit_us / (double)hits : 0.0);
+    printf("  miss latency:      %8.1f us (lookup + search + insert)\n",
+           hits < num_queries ? miss_us / (double)(num_queries - hits) : 0.0);
+    printf("  near-hit overlap:  %8.3f of the exact top-%d\n", near_hits ? near_overlap / near_hits : 1.0, k);
+    printf("  mean latency:      %8.1f us cached vs. %.1f us uncached (%.1fx)\n",
+           cached_us, uncached_us, uncached_us / cached_us);
+    printf("  evictions:         %8lu, expired %lu\n", stats.evictions - before.evictions,
+           stats.expired - before.expired);
+    
+out:
+    server->cache = saved;
+    if (cache != saved) rag_cache_destroy(cache);
+    free(topics);
+    free(stream);
+    free(cdf);
+    free(result);
+    free(truth);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Inserts, updates and deletes through the search path: results must
+// follow every change, with and without an index, before and after
+// compaction
+static int ingest_self_test(void) {
+    const int k = 5;
+    struct rdma_vector_server *server = init_vector_server(2000, NULL);
+    struct rag_result *result = malloc(sizeof(struct rag_result));
+    struct rag_result *batch = malloc(2 * sizeof(struct rag_result));
+    float *queries = malloc(2 * EMBEDDING_SIZE);
+    int failures = 1;
+    
+    printf("Online update self-test:\n");
+    if (!server || !result || !batch || !queries) goto out;
+    float *fresh = queries, *moved = queries + VECTOR_DIM;
+    init_random_vector(fresh, VECTOR_DIM);
+    init_random_vector(moved, VECTOR_DIM);
+    
+    int id = rag_store_insert(server->store, fresh, "Inserted_Chunk");
+    vector_search(server, fresh, k, result);
+    int bad = id != 2000 || result->indices[0] != id || strcmp(result->contexts[0], "Inserted_Chunk") != 0;
+    bad |= rag_store_update(server->store, 5, moved) < 0;
+    vector_search(server, moved, k, result);
+    bad |= result->indices[0] != 5 || strcmp(result->contexts[0], vector_metadata(server, 5)) != 0;
+    bad |= rag_store_delete(server->store, id) < 0;
+    vector_search(server, fresh, k, result);
+    for (int i = 0; i < result->actual_k; i++) bad |= result->indices[i] == id;
+    printf("  insert, update, delete %s\n", bad ? "FAIL" : "ok");
+    failures = bad;
+    
+    bad = rag_store_compact(server->store) < 0 || vector_search_batch(server, queries, 2, k, batch) < 0;
+    vector_search(server, fresh, k, result);
+    bad |= batch[1].indices[0] != 5 || memcmp(batch[0].indices, result->indices, k * sizeof(int)) != 0;
+    vector_search(server, moved, k, result);
+    bad |= result->indices[0] != 5;
+    printf("  after compaction, batched %s\n", bad ? "FAIL" : "ok");
+    failures += bad;
+    
+    // The index covers the rows it was built over; changes since are
+    // patched in per query
+    struct rag_ivf_params params = { 8, 8, 3, 0 };
+    bad = build_ivf(server, &params) < 0 || rag_store_compact(server->store) == 0;
+    id = rag_store_insert(server->store, fresh, NULL);
+    vector_search(server, fresh, k, result);
+    bad |= result->indices[0] != id;
+    int victim = result->indices[1];
+    bad |= rag_store_delete(server->store, victim) < 0;
+    vector_search(server, fresh, k, result);
+    for (int i = 0; i < result->actual_k; i++) bad |= result->indices[i] == victim;
+    printf("  with an IVF index %s\n", bad ? "FAIL" : "ok");
+    failures += bad;
+    
+out:
+    free(result);
+    free(batch);
+    free(queries);
+    if (server) destroy_vector_server(server);
+    return failures;
+}
+
+struct ingest_job {
+    struct rag_store *store;
+    int *live;                      // Ids the writer has not deleted
+    size_t num_live;
+    int stop;
+    uint64_t ops;
+    uint64_t elapsed_us;
+};
+
+// Inserts, updates and deletes in a 1:2:1 mix until stopped. Updates
+// and deletes pick a live id, so the live count stays steady.
+static void *ingest_thread(void *arg) {
+    struct ingest_job *job = arg;
+    unsigned int seed = 0x1263e57u;
+    float vector[VECTOR_DIM];
+    char meta[METADATA_SIZE];
+    uint64_t start = get_time_us();
+    
+    for (uint64_t op = 0; !__atomic_load_n(&job->stop, __ATOMIC_ACQUIRE); op++) {
+        init_random_vector(vector, VECTOR_DIM);
+        size_t slot = rand_r(&seed) % job->num_live;
+        int id;
+        switch (op % 4) {
+        case 0:
+            snprintf(meta, sizeof(meta), "Ingested_%lu", (unsigned long)op);
+            id = rag_store_insert(job->store, vector, meta);
+            if (id >= 0) job->live[job->num_live++] = id;
+            break;
+        case 1:
+        case 2:
+            rag_store_update(job->store, job->live[slot], vector);
+            break;
+        default:
+            if (job->num_live > 1 && rag_store_delete(job->store, job->live[slot]) == 0) {
+                job->live[slot] = job->live[--job->num_live];
+            }
+            break;
+        }
+        __atomic_store_n(&job->ops, op + 1, __ATOMIC_RELAXED);
+    }
+    job->elapsed_us = get_time_us() - start;
+    return NULL;
+}
+
+// Search latency percentiles over num_queries queries; -1 on failure
+static int time_searches(struct rdma_vector_server *server, const float *queries, int num_queries,
+                         uint64_t *p50, uint64_t *p99) {
+    uint64_t *latency = malloc(num_queries * sizeof(uint64_t));
+    struct rag_result *result = malloc(sizeof(struct rag_result));
+    if (!latency || !result) {
+        free(latency);
+        free(result);
+        return -1;
+    }
+    for (int q = 0; q < num_queries; q++) {
+        uint64_t start = get_time_us();
+        vector_search(server, queries + (size_t)(q % MAX_BATCH) * VECTOR_DIM, TOP_K, result);
+        latency[q] = get_time_us() - start;
+    }
+    qsort(latency, num_queries, sizeof(uint64_t), compare_u64);
+    *p50 = latency[num_queries / 2];
+    *p99 = latency[num_queries * 99 / 100];
+    free(latency);
+    free(result);
+    return 0;
+}
+
+// Ingest throughput on its own, then search latency with and without a
+// writer running; the background compactor folds changes in as it goes
+static void run_ingest_benchmark(struct rdma_vector_server *server) {
+    const int num_queries = 300, writer_only_ops = 20000;
+    float *queries = malloc(MAX_BATCH * EMBEDDING_SIZE);
+    // Each of the two writer runs ends at most one insert past its deletes
+    int *live = malloc((server->num_vectors + 2) * sizeof(int));
+    if (!queries || !live) {
+        free(queries);
+        free(live);
+        return;
+    }
+    size_t num_live = 0;
+    for (size_t i = 0; i < server->num_vectors; i++) {
+        if (!rag_store_id_deleted(server->store, i)) live[num_live++] = i;
+    }
+    for (int q = 0; q < MAX_BATCH; q++) {
+        init_random_vector(queries + (size_t)q * VECTOR_DIM, VECTOR_DIM);
+    }
+    
+    printf("\n=== Online Ingest Benchmark (%zu vectors, %s, k=%d) ===\n\n", server->num_vectors,
+           server->hnsw ? "HNSW" : server->ivf ? "IVF" : server->quant ? "quantized" : "flat", TOP_K);
+    if (rag_store_start_compactor(server->store, 0.25) < 0) {
+        free(queries);
+        free(live);
+        return;
+    }
+    
+    uint64_t idle_p50, idle_p99, busy_p50, busy_p99;
+    if (time_searches(server, queries, num_queries, &idle_p50, &idle_p99) < 0) {
+        free(queries);
+        free(live);
+        return;
+    }
+    
+    // Writer alone: stopped after a fixed number of operations
+    struct ingest_job job = { server->store, live, num_live, 0, 0, 0 };
+    pthread_t writer;
+    if (pthread_create(&writer, NULL, ingest_thread, &job) != 0) {
+        fprintf(stderr, "Failed to start the ingest thread\n");
+        free(queries);
+        free(live);
+        return;
+    }
+    while (__atomic_load_n(&job.ops, __ATOMIC_RELAXED) < (uint64_t)writer_only_ops) {
+        usleep(1000);
+    }
+    __atomic_store_n(&job.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+    double alone_rate = job.ops * 1e6 / job.elapsed_us;
+    
+    // Writer and searches together
+    job.stop = 0;
+    job.ops = 0;
+    if (pthread_create(&writer, NULL, ingest_thread, &job) != 0) {
+        fprintf(stderr, "Failed to start the ingest thread\n");
+        free(queries);
+        free(live);
+        return;
+    }
+    int ret = time_searches(server, queries, num_queries, &busy_p50, &busy_p99);
+    __atomic_store_n(&job.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+    double shared_rate = job.ops * 1e6 / job.elapsed_us;
+    
+    struct rag_store_stats stats;
+    rag_store_stats(server->store, &stats);
+    printf("Ingest (1 insert : 2 updates : 1 delete):\n");
+    printf("  writer alone:      %10.0f ops/s\n", alone_rate);
+    printf("  during searches:   %10.0f ops/s\n", shared_rate);
+    if (ret == 0) {
+        printf("Search latency:      %10s %10s\n", "p50(us)", "p99(us)");
+        printf("  idle store:        %10lu %10lu\n", idle_p50, idle_p99);
+        printf("  during ingest:     %10lu %10lu\n", busy_p50, busy_p99);
+    }
+    printf("Store: %zu live rows (%zu in the base, %zu appended, %zu tombstoned),\n",
+           stats.live, stats.base_rows, stats.segment_rows, stats.dead);
+    printf("  %lu compactions, %lu retired objects freed, version %lu\n",
+           stats.compactions, stats.reclaimed, stats.version);
+    if (server->hnsw || server->ivf || server->quant) {
+        printf("  (compaction stays off while an index or compressed copy refers to base rows)\n");
+    } else if (stats.compactor_cpus < 2) {
+        printf("  (the compactor may only run on %d CPU, so it takes turns with the searches\n"
+               "   rather than running beside them; run on more CPUs to see it off the query path)\n",
+               stats.compactor_cpus);
+    }
+    free(queries);
+    free(live);
+}
+
+// Exact top-k ids among those filter allows for every query, with any
+// index or compressed copy set aside; -1 pads queries with fewer matches
+static int *exact_filtered(struct rdma_vector_server *server, const float *queries,
+                           int num_queries, int k, const char *filter) {
+    int *truth = malloc((size_t)num_queries * k * sizeof(int));
+    struct rag_result *result = malloc(sizeof(struct rag_result));
+    if (!truth || !result) {
+        free(truth);
+        free(result);
+        return NULL;
+    }
+    
+    struct rag_hnsw *hnsw = server->hnsw;
+    struct rag_ivf *ivf = server->ivf;
+    struct rag_quant *quant = server->quant;
+    server->hnsw = NULL;
+    server->ivf = NULL;
+    server->quant = NULL;
+    for (int q = 0; q < num_queries; q++) {
+        vector_search_filtered(server, queries + (size_t)q * VECTOR_DIM, k, filter, result);
+        for (int i = 0; i < k; i++) {
+            truth[(size_t)q * k + i] = i < result->actual_k ? result->indices[i] : -1;
+        }
+    }
+    server->hnsw = hnsw;
+    server->ivf = ivf;
+    server->quant = quant;
+    free(result);
+    return truth;
+}
+
+// Whether every result passes filter and the count is all matches up to k
+static int filtered_result_ok(struct rdma_vector_server *server, const struct rag_result *result,
+                              int k, const char *filter) {
+    const struct rag_filter *f = compile_filter(server, filter);
+    size_t expected = f->count < (size_t)k ? f->count : (size_t)k;
+    int ok = (size_t)result->actual_k == expected;
+    for (int i = 0; ok && i < result->actual_k; i++) {
+        ok = rag_filter_allows(f, result->indices[i]);
+    }
+    return ok;
+}
+
+// Filtered search against a brute-force reference on every plan: exact,
+// HNSW and IVF with the filter inside the traversal, and with the store
+// changed under the filter
+static int filter_self_test(void) {
+    static const char *filters[] = {
+        "tenant=tenant_05", "year>=2020,tenant!=tenant_00", "doc=3|17", "year<2015", "tenant=nobody"
+    };
+    const int k = 10, num_queries = 20;
+    struct rdma_vector_server *server = init_vector_server(3000, NULL);
+    struct rag_result *result = malloc(sizeof(struct rag_result));
+    float *queries = malloc(num_queries * EMBEDDING_SIZE);
+    int failures = 1;
+    
+    printf("Filtered search self-test:\n");
+    if (!server || !result || !queries) goto out;
+    for (int q = 0; q < num_queries; q++) {
+        init_random_vector(queries + (size_t)q * VECTOR_DIM, VECTOR_DIM);
+    }
+    
+    // Exact plan against scoring every vector that passes
+    failures = 0;
+    for (size_t t = 0; t < sizeof(filters) / sizeof(filters[0]); t++) {
+        float scores[MAX_K];
+        int ids[MAX_K];
+        struct rag_topk topk;
+        const struct rag_filter *f = compile_filter(server, filters[t]);
+        int bad = !f || vector_search_filtered(server, queries, k, filters[t], result) < 0;
+        if (!bad) {
+            rag_topk_init(&topk, k, scores, ids);
+            for (size_t i = 0; i < server->num_vectors; i++) {
+                if (!rag_filter_allows(f, i)) continue;
+                rag_topk_push(&topk, cosine_similarity(queries, vector_embedding(server, i), VECTOR_DIM), i);
+            }
+            int count = rag_topk_finish(&topk);
+            bad = count != result->actual_k || memcmp(ids, result->indices, count * sizeof(int)) != 0;
+        }
+        printf("  exact %-30s %s\n", filters[t], bad ? "FAIL" : "ok");
+        failures += bad;
+    }
+    int bad = vector_search_filtered(server, queries, k, "year=soon", result) != -1 || result->actual_k != 0;
+    printf("  malformed filter rejected %s\n", bad ? "FAIL" : "ok");
+    failures += bad;
+    
+    // Deleted rows drop out, updated vectors keep their id's attributes,
+    // and inserted rows (which have none) never match
+    const char *doc0 = "doc=0";
+    vector_search_filtered(server, queries, k, doc0, result);
+    int victim = result->indices[0];
+    bad = rag_store_delete(server->store, victim) < 0 || rag_store_update(server->store, 7, queries + VECTOR_DIM) < 0;
+    int inserted = rag_store_insert(server->store, queries + VECTOR_DIM, NULL);
+    vector_search_filtered(server, queries, k, doc0, result);
+    for (int i = 0; i < result->actual_k; i++) bad |= result->indices[i] == victim;
+    bad |= !filtered_result_ok(server, result, k, doc0);
+    vector_search_filtered(server, queries + VECTOR_DIM, k, doc0, result);
+    bad |= result->indices[0] != 7;
+    for (int i = 0; i < result->actual_k; i++) bad |= result->indices[i] == inserted;
+    printf("  after delete, update, insert %s\n", bad ? "FAIL" : "ok");
+    failures += bad;
+    
+    // Index plans: a broad filter runs inside the traversal, a narrow one
+    // falls back to scoring the allowed rows. IVF probes every list, so
+    // any miss is the filter's.
+    static const char *index_filters[] = { "year>=2017", "tenant=tenant_05|tenant_06" };
+    struct rag_ivf_params ivf_params = { 16, 16, 3, 0 };
+    struct rag_hnsw_params hnsw_params = { 16, 100, 64 };
+    for (int index = 0; index < 2; index++) {
+        int built = index == 0 ? build_ivf(server, &ivf_params) : build_hnsw(server, &hnsw_params);
+        for (size_t t = 0; t < sizeof(index_filters) / sizeof(index_filters[0]); t++) {
+            int *truth = built == 0 ? exact_filtered(server, queries, num_queries, k, index_filters[t]) : NULL;
+            double recall = 0;
+            bad = !truth;
+            for (int q = 0; !bad && q < num_queries; q++) {
+                vector_search_filtered(server, queries + (size_t)q * VECTOR_DIM, k, index_filters[t], result);
+                bad = !filtered_result_ok(server, result, k, index_filters[t]);
+                recall += recall_at_k(result->indices, result->actual_k, truth + (size_t)q * k, k);
+            }
+            recall /= num_queries;
+            bad |= recall < 0.9;
+            printf("  %s %-26s recall@%d=%.3f %s\n", index == 0 ? "ivf " : "hnsw", index_filters[t], k,
+                   recall, bad ? "FAIL" : "ok");
+            failures += bad;
+            free(truth);
+        }
+        rag_ivf_destroy(server->ivf);
+        server->ivf = NULL;
+    }
+    
+out:
+    free(result);
+    free(queries);
+    if (server) destroy_vector_server(server);
+    return failures;
+}
+
+// Latency and recall@k of filtered queries against filter selectivity,
+// compared with post-filtering an unfiltered search that fetches 4k
+static void run_filter_benchmark(struct rdma_vector_server *server) {
+    static const char *filters[] = {
+        "year>=2015", "year>=2020", "year=2024", "tenant=tenant_03",
+        "tenant=tenant_03,year>=2020", "tenant=tenant_03,year=2024"
+    };
+    const int num_queries = 100, k = TOP_K, fetch = 4 * TOP_K;
+    float *queries = malloc(num_queries * EMBEDDING_SIZE);
+    struct rag_result *result = malloc(sizeof(struct rag_result));
+    if (!queries || !result) {
+        fprintf(stderr, "Failed to allocate benchmark buffers\n");
+        goto out;
+    }
+    for (int q = 0; q < num_queries; q++) {
+        init_random_vector(queries + (size_t)q * VECTOR_DIM, VECTOR_DIM);
+    }
+    
+    printf("\n=== Filtered Search Benchmark (%zu vectors, %s, %d queries, k=%d) ===\n\n",
+           server->num_vectors, server->hnsw ? "HNSW" : server->ivf ? "IVF" : server->quant ? "quantized" : "flat",
+           num_queries, k);
+    printf("Attributes: %.2f MB\n\n", rag_attrs_memory(server->attrs) / (1024.0 * 1024.0));
+    printf("%-28s %8s %14s %10s %14s %10s\n", "", "", "pre-filter", "", "post-filter", "");
+    printf("%-28s %8s %14s %10s %14s %10s\n", "filter", "passes", "latency(us)", "recall", "latency(us)", "recall");
+    
+    for (size_t t = 0; t < sizeof(filters) / sizeof(filters[0]); t++) {
+        const struct rag_filter *f = compile_filter(server, filters[t]);
+        int *truth = f ? exact_filtered(server, queries, num_queries, k, filters[t]) : NULL;
+        if (!truth) continue;
+        int expected = f->count < (size_t)k ? f->count : k;
+        
+        double pre_recall = 0, post_recall = 0;
+        uint64_t start = get_time_us();
+        for (int q = 0; q < num_queries; q++) {
+            vector_search_filtered(server, queries + (size_t)q * VECTOR_DIM, k, filters[t], result);
+            if (expected) pre_recall += recall_at_k(result->indices, result->actual_k, truth + (size_t)q * k, expected);
+        }
+        double pre_us = (get_time_us() - start) / (double)num_queries;
+        
+        start = get_time_us();
+        for (int q = 0; q < num_queries; q++) {
+            vector_search(server, queries + (size_t)q * VECTOR_DIM, fetch, result);
+            int kept = 0;
+            for (int i = 0; i < result->actual_k && kept < k; i++) {
+                if (rag_filter_allows(f, result->indices[i])) result->indices[kept++] = result->indices[i];
+            }
+            if (expected) post_recall += recall_at_k(result->indices, kept, truth + (size_t)q * k, expected);
+        }
+        double post_us = (get_time_us() - start) / (double)num_queries;
+        
+        printf("%-28s %7.2f%% %14.1f %10.3f %14.1f %10.3f\n", filters[t],
+               100.0 * f->count / server->num_vectors, pre_us, expected ? pre_recall / num_queries : 1.0,
+               post_us, expected ? post_recall / num_queries : 1.0);
+        free(truth);
+    }
+    
+out:
+    free(queries);
+    free(result);
+}
+
+// Query for a known target chunk: its embedding buried under noise of
+// the given weight, and two of its words
+static void hybrid_query(struct rdma_vector_server *server, size_t target, float weight,
+                         float *query, char *text) {
+    float noise[VECTOR_DIM], norm = 0;
+    init_random_vector(noise, VECTOR_DIM);
+    const float *v = vector_embedding(server, target);
+    for (int d = 0; d < VECTOR_DIM; d++) {
+        query[d] = v[d] + weight * noise[d];
+        norm += query[d] * query[d];
+    }
+    norm = sqrt(norm);
+    for (int d = 0; d < VECTOR_DIM; d++) query[d] /= norm;
+    
+    char chunk[METADATA_SIZE];
+    synthetic_chunk(target, chunk);
+    const char *words[10];
+    int num_words = 0;
+    char *save;
+    for (char *w = strtok_r(strchr(chunk, ':') + 1, " ", &save); w && num_words < 10;
+         w = strtok_r(NULL, " ", &save)) {
+        words[num_words++] = w;
+    }
+    int a = rand() % num_words, b = (a + 1 + rand() % (num_words - 1)) % num_words;
+    snprintf(text, QUERY_TEXT_SIZE, "%s %s", words[a], words[b]);
+}
+
+// Hybrid search end to end: a keyword match and a vector match both
+// surface, filters and deletes apply to the lexical side, and the
+// stages are timed
+static int hybrid_self_test(void) {
+    const int k = 10;
+    struct rdma_vector_server *server = init_vector_server(2000, NULL);
+    struct rag_result *result = malloc(sizeof(struct rag_result));
+    int failures = 1;
+    
+    printf("Hybrid search self-test:\n");
+    if (!server || !result || build_lexical(server) < 0) goto out;
+    
+    // The whole text of chunk 123 as keywords, chunk 777's embedding as
+    // the vector: each is first in its own ranking, so both make the
+    // fused top k (behind any id both rankings share)
+    char text[QUERY_TEXT_SIZE];
+    snprintf(text, sizeof(text), "%s", vector_metadata(server, 123));
+    const float *query = vector_embedding(server, 777);
+    int bad = vector_search_hybrid(server, query, text, k, "", result) < 0;
+    int found = 0;
+    for (int i = 0; !bad && i < result->actual_k; i++) {
+        found |= (result->indices[i] == 123) | (result->indices[i] == 777) << 1;
+    }
+    bad |= found != 3 || result->actual_k != k;
+    printf("  keyword and vector hits fused %s\n", bad ? "FAIL" : "ok");
+    failures = bad;
+    
+    bad = vector_search_hybrid(server, query, text, k, "doc>=2", result) < 0 || result->actual_k != k;
+    for (int i = 0; !bad && i < result->actual_k; i++) bad = result->indices[i] < 200;
+    bad |= vector_search_hybrid(server, query, text, k, "year=soon", result) != -1;
+    printf("  filter applies to both rankings %s\n", bad ? "FAIL" : "ok");
+    failures += bad;
+    
+    bad = rag_store_delete(server->store, 123) < 0 ||
+          vector_search_hybrid(server, query, text, k, "", result) < 0;
+    found = 0;
+    for (int i = 0; !bad && i < result->actual_k; i++) {
+        bad = result->indices[i] == 123;
+        found |= result->indices[i] == 777;
+    }
+    bad |= !found || result->vector_us == 0;
+    printf("  deleted chunk dropped %s\n", bad ? "FAIL" : "ok");
+    failures += bad;
+    
+out:
+    free(result);
+    if (server) destroy_vector_server(server);
+    return failures;
+}
+
+// Hit@10 of vector-only, keyword-only and fused search for a known
+// target chunk, with its embedding under noise and two of its words as
+// keywords, and the cost of each stage
+static void run_hybrid_benchmark(struct rdma_vector_server *server) {
+    const int num_queries = 200, k = TOP_K;
+    const float weight = 6.5f;
+    float *queries = malloc(num_queries * EMBEDDING_SIZE);
+    char (*texts)[QUERY_TEXT_SIZE] = malloc(num_queries * sizeof(*texts));
+    size_t *targets = malloc(num_queries * sizeof(size_t));
+    struct rag_result *result = malloc(sizeof(struct rag_result));
+    if (!queries || !texts || !targets || !result) {
+        fprintf(stderr, "Failed to allocate benchmark buffers\n");
+        goto out;
+    }
+    for (int q = 0; q < num_queries; q++) {
+        targets[q] = (size_t)rand() % server->num_vectors;
+        hybrid_query(server, targets[q], weight, queries + (size_t)q * VECTOR_DIM, texts[q]);
+    }
+    
+    struct rag_lexical_stats stats;
+    rag_lexical_stats(server->lexical, &stats);
+    printf("\n=== Hybrid Search Benchmark (%zu vectors, %s, %d queries, k=%d) ===\n\n",
+           server->num_vectors, server->hnsw ? "HNSW" : server->ivf ? "IVF" : server->quant ? "quantized" : "flat",
+           num_queries, k);
+    printf("Lexical index: %zu terms, %.1f terms/chunk, %zu postings in %.2f MB (%.1f bits each)\n",
+           stats.terms, stats.avg_length, stats.postings, stats.posting_bytes / (1024.0 * 1024.0),
+           8.0 * stats.posting_bytes / stats.postings);
+    printf("Queries: a target chunk's embedding plus noise (weight %.1f) and two of its words\n\n", weight);
+    printf("%-10s %8s %14s %12s %12s %12s\n", "search", "hit@10", "latency(us)", "vector(us)",
+           "lexical(us)", "fusion(us)");
+    
+    double hybrid_us = 0, hybrid_stages_us = 0;
+    for (int mode = 0; mode < 3; mode++) {
+        int hits = 0;
+        double stage_us[3] = { 0 };
+        uint64_t start = get_time_us();
+        for (int q = 0; q < num_queries; q++) {
+            const float *query = queries + (size_t)q * VECTOR_DIM;
+            int count;
+            const int *ids;
+            int lexical_ids[MAX_K];
+            float lexical_scores[MAX_K];
+            if (mode == 1) {
+                count = rag_lexical_search(server->lexical, server->lexical_worker->scratch, texts[q], k,
+                                           NULL, lexical_scores, lexical_ids);
+                ids = lexical_ids;
+            } else {
+                vector_search_hybrid(server, query, mode == 0 ? "" : texts[q], k, "", result);
+                count = result->actual_k;
+                ids = result->indices;
+                stage_us[0] += result->vector_us;
+                stage_us[1] += result->lexical_us;
+                stage_us[2] += result->fusion_us;
+            }
+            for (int i = 0; i < count; i++) hits += (size_t)ids[i] == targets[q];
+        }
+        double us = (get_time_us() - start) / (double)num_queries;
+        static const char *names[] = { "vector", "keyword", "hybrid" };
+        if (mode == 2) {
+            hybrid_us = us;
+            hybrid_stages_us = (stage_us[0] + stage_us[1] + stage_us[2]) / num_queries;
+            printf("%-10s %8.3f %14.1f %12.1f %12.1f %12.1f\n", names[mode], hits / (double)num_queries, us,
+                   stage_us[0] / num_queries, stage_us[1] / num_queries, stage_us[2] / num_queries);
+        } else {
+            printf("%-10s %8.3f %14.1f %12s %12s %12s\n", names[mode], hits / (double)num_queries, us,
+                   "-", "-", "-");
+        }
+    }
+    printf("\nThe keyword search runs on its own thread while the vector search runs, so hybrid\n"
+           "latency is the slower of the two plus fusion: here the stages add up to %.1f us\n"
+           "against %.1f us end to end.\n", hybrid_stages_us, hybrid_us);
+    pthread_mutex_lock(&server->lexical_worker->lock);
+    int lexical_cpus = server->lexical_worker->cpus;
+    pthread_mutex_unlock(&server->lexical_worker->lock);
+    if (lexical_cpus < 2) {
+        printf("The keyword thread may only run on %d CPU, so it is time-sliced with the vector\n"
+               "search rather than overlapped; run on more CPUs to see the overlap.\n", lexical_cpus);
+    }
+    
+out:
+    free(queries);
+    free(texts);
+    free(targets);
+    free(result);
+}
+
+// Reader over local memory, standing in for RDMA READ
+struct local_reader {
+    const char *region;
+    const uint64_t *version;
+    void *buffers[4];
+    int num_buffers;
+};
+
+static void *local_read_buffer(void *ctx, size_t size) {
+    struct local_reader *lr = ctx;
+    if (lr->num_buffers == 4) return NULL;
+    return lr->buffers[lr->num_buffers++] = malloc(size);
+}
+
+static int local_read_post(void *ctx, uint64_t offset, void *dest, size_t len) {
+    struct local_reader *lr = ctx;
+    memcpy(dest, lr->region + offset, len);
+    return 0;
+}
+
+static int local_read_wait(void *ctx) {
+    (void)ctx;
+    return 0;
+}
+
+static int local_read_version(void *ctx, uint64_t *version) {
+    struct local_reader *lr = ctx;
+    *version = __atomic_load_n(lr->version, __ATOMIC_ACQUIRE);
+    return 0;
+}
+
+// One-sided search over a published layout against the server's own
+// exact scan and IVF search
+static int remote_self_test(void) {
+    const int num_queries = 8, k = 10;
+    struct rag_ivf_params params = { 16, 4, 3, 0 };
+    struct rdma_vector_server *server = init_vector_server(1500, NULL), *loaded = NULL;
+    struct local_reader lr = { 0 };
+    struct rag_remote *remote = NULL;
+    int failures = 1;
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/rag_remote_self_test.%d", (int)getpid());
+    
+    printf("One-sided search self-test:\n");
+    if (!server || build_ivf(server, &params) < 0 || save_vector_server(server, path) < 0) {
+        goto out;
+    }
+    loaded = open_vector_server(path, NULL);
+    if (!loaded) goto out;
+    
+    struct rag_remote_layout layout;
+    const void *region;
+    size_t region_size;
+    publish_layout(loaded, &layout, &region, &region_size);
+    lr.region = region;
+    lr.version = rag_store_version_word(loaded->store);
+    struct rag_remote_reader reader = {
+        local_read_buffer, local_read_post, local_read_wait, &lr, RAG_CLIENT_MAX_READS,
+        local_read_version
+    };
+    remote = rag_remote_open(&layout, region_size, &reader, 0);
+    if (!remote || !rag_remote_has_ivf(remote)) goto out;
+    
+    float queries[8 * VECTOR_DIM], scores[8 * 10];
+    int ids[8 * 10], counts[8];
+    for (int q = 0; q < num_queries; q++) {
+        init_random_vector(queries + q * VECTOR_DIM, VECTOR_DIM);
+    }
+    struct rag_result *result = malloc(sizeof(struct rag_result));
+    int bad = !result || rag_remote_scan(remote, queries, num_queries, k, scores, ids, counts) < 0;
+    for (int q = 0; !bad && q < num_queries; q++) {
+        vector_search(loaded, queries + q * VECTOR_DIM, k, result);
+        bad = counts[q] != result->actual_k ||
+              memcmp(ids + q * k, result->indices, counts[q] * sizeof(int)) != 0;
+    }
+    printf("  exact scan %s\n", bad ? "FAIL" : "ok");
+    failures = bad;
+    
+    bad = build_ivf(loaded, &params) < 0;
+    for (int q = 0; !bad && q < num_queries; q++) {
+        int want_ids[10];
+        float want_scores[10];
+        int want = rag_ivf_search(loaded->ivf, queries + q * VECTOR_DIM, k, 0, want_scores, want_ids, NULL);
+        int got = rag_remote_ivf_search(remote, queries + q * VECTOR_DIM, k, scores, ids);
+        bad = want != got || memcmp(want_ids, ids, want * sizeof(int)) != 0;
+    }
+    printf("  IVF lists %s\n", bad ? "FAIL" : "ok");
+    failures += bad;
+    
+    // An index over a different vector count is refused, not searched
+    struct rag_remote_layout shrunk = layout;
+    struct local_reader shrunk_lr = { region, lr.version, { 0 }, 0 };
+    struct rag_remote_reader shrunk_reader = reader;
+    shrunk.count--;
+    shrunk_reader.ctx = &shrunk_lr;
+    struct rag_remote *mismatched = rag_remote_open(&shrunk, region_size, &shrunk_reader, 0);
+    bad = mismatched != NULL;
+    printf("  IVF count mismatch rejected %s\n", bad ? "FAIL" : "ok");
+    failures += bad;
+    rag_remote_close(mismatched);
+    for (int i = 0; i < shrunk_lr.num_buffers; i++) free(shrunk_lr.buffers[i]);
+    
+    // The same searches streamed from the file, with a cache of half the
+    // IVF section: the second round of list reads hits it
+    struct rag_stream *stream = rag_stream_open(path, layout.ivf_size / 2, 1);
+    struct rag_remote *streamed = NULL;
+    struct rag_remote_reader stream_reader;
+    bad = !stream;
+    if (!bad) {
+        rag_stream_reader(stream, &stream_reader);
+        streamed = rag_remote_open(&layout, region_size, &stream_reader, 0);
+        bad = !streamed || rag_remote_scan(streamed, queries, num_queries, k, scores, ids, counts) < 0;
+    }
+    // loaded now searches its IVF index, so the exact reference is the
+    // in-memory scan
+    int scan_ids[8 * 10], scan_counts[8];
+    float scan_scores[8 * 10];
+    bad = bad || rag_remote_scan(remote, queries, num_queries, k, scan_scores, scan_ids, scan_counts) < 0 ||
+          memcmp(counts, scan_counts, sizeof(counts)) != 0 || memcmp(ids, scan_ids, sizeof(ids)) != 0;
+    printf("  exact scan from file %s\n", bad ? "FAIL" : "ok");
+    failures += bad;
+    struct rag_stream_stats stream_stats;
+    bad = !streamed;
+    for (int round = 0; !bad && round < 2; round++) {
+        if (stream) rag_stream_reset_stats(stream);
+        for (int q = 0; !bad && q < num_queries; q++) {
+            int want_ids[10];
+            float want_scores[10];
+            int want = rag_ivf_search(loaded->ivf, queries + q * VECTOR_DIM, k, 0, want_scores, want_ids, NULL);
+            int got = rag_remote_ivf_search(streamed, queries + q * VECTOR_DIM, k, scores, ids);
+            bad = want != got || memcmp(want_ids, ids, want * sizeof(int)) != 0;
+        }
+    }
+    if (!bad) {
+        rag_stream_stats(stream, &stream_stats);
+        bad = stream_stats.cache_hits == 0;
+    }
+    printf("  IVF lists from file, cached %s\n", bad ? "FAIL" : "ok");
+    failures += bad;
+    rag_remote_close(streamed);
+    rag_stream_close(stream);
+    
+    // A server-side delete moves the version word; the next search
+    // reports it once
+    bad = rag_remote_stale(remote) || rag_store_delete(loaded->store, 0) < 0 ||
+          rag_remote_scan(remote, queries, 1, k, scores, ids, counts) < 0 || !rag_remote_stale(remote) ||
+          rag_remote_scan(remote, queries, 1, k, scores, ids, counts) < 0 || rag_remote_stale(remote);
+    printf("  version word %s\n", bad ? "FAIL" : "ok");
+    failures += bad;
+    free(result);
+    
+out:
+    rag_remote_close(remote);
+    for (int i = 0; i < lr.num_buffers; i++) free(lr.buffers[i]);
+    unlink(path);
+    if (loaded) destroy_vector_server(loaded);
+    if (server) destroy_vector_server(server);
+    return failures;
+}
+
+#define STREAM_QUERIES 16             // Queries per exact-scan pass
+#define STREAM_PASSES 3
+
+// Drop a mapped file's pages in [offset, offset + len) from the mapping
+// and the page cache, so the next touch reads the disk
+static void drop_cached(int fd, const char *mapping, uint64_t offset, uint64_t len) {
+    uint64_t start = (offset + RAG_STREAM_ALIGN - 1) / RAG_STREAM_ALIGN * RAG_STREAM_ALIGN;
+    if (start >= offset + len) return;
+    madvise((void *)(mapping + start), offset + len - start, MADV_DONTNEED);
+    posix_fadvise(fd, start, offset + len - start, POSIX_FADV_DONTNEED);
+}
+
+// Exact-scan throughput of a saved database read through the page cache
+// (the server's own batch scan over the mapping, with everything past
+// the memory budget dropped before each pass) against streaming it with
+// a cache of that budget; then IVF searches on a skewed query stream,
+// streaming only the probed lists with the hot ones cached
+static void run_stream_benchmark(struct rdma_vector_server *server, const char *path, long budget_mb) {
+    static const int percents[] = { 0, 10, 25, 50, 100 };
+    const int num_topics = 256, ivf_queries = 1000;
+    if (!server->db) {
+        fprintf(stderr, "The stream benchmark reads a saved database: pass --db\n");
+        return;
+    }
+    struct rag_remote_layout layout;
+    const void *region;
+    size_t region_size;
+    publish_layout(server, &layout, &region, &region_size);
+    uint64_t emb_bytes = layout.count * layout.stride;
+    int num_budgets = budget_mb >= 0 ? 1 : (int)(sizeof(percents) / sizeof(percents[0]));
+    
+    int fd = open(path, O_RDONLY);
+    float *queries = malloc((size_t)ivf_queries * EMBEDDING_SIZE);
+    float *topics = malloc(num_topics * EMBEDDING_SIZE);
+    double *cdf = malloc(num_topics * sizeof(double));
+    struct rag_result *results = malloc(STREAM_QUERIES * sizeof(struct rag_result));
+    float scores[STREAM_QUERIES * TOP_K];
+    int ids[STREAM_QUERIES * TOP_K], counts[STREAM_QUERIES];
+    struct rag_ivf *ivf = NULL;
+    if (fd < 0 || !queries || !topics || !cdf || !results) {
+        fprintf(stderr, "Failed to set up the stream benchmark\n");
+        goto out;
+    }
+    for (int q = 0; q < STREAM_QUERIES; q++) {
+        init_random_vector(queries + (size_t)q * VECTOR_DIM, VECTOR_DIM);
+    }
+    
+    struct rag_stream *probe = rag_stream_open(path, 0, 1);
+    struct rag_stream_stats st;
+    if (!probe) goto out;
+    rag_stream_stats(probe, &st);
+    rag_stream_close(probe);
+    printf("\n=== Streaming Scan Benchmark (%zu vectors, %.2f GB of embeddings) ===\n\n",
+           server->num_vectors, emb_bytes / 1e9);
+    printf("Stream reads: %s, %s, %d in flight; mmap scan: %d workers; %d queries per pass\n\n",
+           st.uring ? "io_uring" : "pread (io_uring unavailable)",
+           st.direct ? "O_DIRECT" : "page cache (no O_DIRECT)", RAG_STREAM_DEPTH,
+           server->pool ? rag_pool_size(server->pool) : 1, STREAM_QUERIES);
+    printf("%12s %12s %12s %10s %14s %12s\n", "budget (MB)", "mmap GB/s", "stream GB/s", "cache hit",
+           "disk MB/pass", "reads/submit");
+    for (int b = 0; b < num_budgets; b++) {
+        uint64_t budget = budget_mb >= 0 ? (uint64_t)budget_mb << 20 : emb_bytes * percents[b] / 100;
+        uint64_t resident = budget < emb_bytes ? budget : emb_bytes;
+        
+        // The first pass faults in the budget's prefix
+        double mmap_s = 0, stream_s = 0;
+        vector_search_batch(server, queries, STREAM_QUERIES, TOP_K, results);
+        for (int p = 0; p < STREAM_PASSES; p++) {
+            drop_cached(fd, region, layout.embeddings_offset + resident, emb_bytes - resident);
+            uint64_t start = get_time_us();
+            vector_search_batch(server, queries, STREAM_QUERIES, TOP_K, results);
+            mmap_s += (get_time_us() - start) / 1e6;
+        }
+        
+        struct rag_stream *s = rag_stream_open(path, budget, 1);
+        struct rag_remote_reader reader;
+        struct rag_remote *remote = NULL;
+        int ok = s != NULL;
+        if (ok) {
+            rag_stream_reader(s, &reader);
+            remote = rag_remote_open(&layout, region_size, &reader, 0);
+            ok = remote && rag_remote_scan(remote, queries, STREAM_QUERIES, TOP_K, scores, ids, counts) == 0;
+            rag_stream_reset_stats(s);
+        }
+        for (int p = 0; ok && p < STREAM_PASSES; p++) {
+            drop_cached(fd, region, layout.embeddings_offset, emb_bytes);
+            uint64_t start = get_time_us();
+            ok = rag_remote_scan(remote, queries, STREAM_QUERIES, TOP_K, scores, ids, counts) == 0;
+            stream_s += (get_time_us() - start) / 1e6;
+        }
+        if (ok) {
+            rag_stream_stats(s, &st);
+            printf("%12.0f %12.2f %12.2f %9.1f%% %14.1f %12.1f\n", budget / 1048576.0,
+                   STREAM_PASSES * emb_bytes / 1e9 / mmap_s, STREAM_PASSES * emb_bytes / 1e9 / stream_s,
+                   st.reads ? 100.0 * st.cache_hits / st.reads : 0.0,
+                   st.bytes_from_disk / 1048576.0 / STREAM_PASSES,
+                   st.submits ? (double)(st.reads - st.cache_hits) / st.submits : 0.0);
+        } else {
+            printf("%12.0f %12.2f %12s\n", budget / 1048576.0, STREAM_PASSES * emb_bytes / 1e9 / mmap_s,
+                   "failed");
+        }
+        rag_remote_close(remote);
+        rag_stream_close(s);
+    }
+    
+    if (layout.ivf_size == 0) {
+        printf("\nNo IVF section in %s (save one with -I ivf --save-db)\n", path);
+        goto out;
+    }
+    size_t image_size;
+    const void *image = rag_db_section(server->db, RAG_DB_SECTION_IVF, &image_size);
+    ivf = image ? rag_ivf_load(image, image_size, 0) : NULL;
+    if (!ivf) goto out;
+    
+    // Zipf-distributed topics, as in the cache benchmark, so some lists
+    // are probed far more often than others
+    double total = 0;
+    for (int t = 0; t < num_topics; t++) {
+        init_random_vector(topics + (size_t)t * VECTOR_DIM, VECTOR_DIM);
+        total += 1.0 / pow(t + 1, 1.1);
+        cdf[t] = total;
+    }
+    for (int t = 0; t < num_topics; t++) cdf[t] /= total;
+    for (int q = 0; q < ivf_queries; q++) {
+        float *query = queries + (size_t)q * VECTOR_DIM, noise[VECTOR_DIM];
+        memcpy(query, topics + (size_t)zipf_topic(cdf, num_topics) * VECTOR_DIM, EMBEDDING_SIZE);
+        init_random_vector(noise, VECTOR_DIM);
+        for (int d = 0; d < VECTOR_DIM; d++) query[d] += 0.05f * noise[d];
+    }
+    uint64_t start = get_time_us();
+    for (int q = 0; q < ivf_queries; q++) {
+        rag_ivf_search(ivf, queries + (size_t)q * VECTOR_DIM, TOP_K, 0, scores, ids, NULL);
+    }
+    double mmap_qps = ivf_queries * 1e6 / (get_time_us() - start);
+    
+    printf("\nIVF, %d skewed queries, nprobe %d; mmap with the index resident: %.0f QPS\n\n",
+           ivf_queries, rag_ivf_nprobe(ivf), mmap_qps);
+    printf("%12s %12s %12s %10s %14s\n", "budget (MB)", "% of index", "stream QPS", "cache hit", "disk KB/query");
+    for (int b = 0; b < num_budgets; b++) {
+        uint64_t budget = budget_mb >= 0 ? (uint64_t)budget_mb << 20 : layout.ivf_size * percents[b] / 100;
+        struct rag_stream *s = rag_stream_open(path, budget, 1);
+        struct rag_remote_reader reader;
+        struct rag_remote *remote = NULL;
+        int ok = s != NULL;
+        if (ok) {
+            rag_stream_reader(s, &reader);
+            remote = rag_remote_open(&layout, region_size, &reader, 0);
+            ok = remote != NULL;
+        }
+        // One round to learn the hot lists, one measured
+        double elapsed = 0;
+        for (int round = 0; ok && round < 2; round++) {
+            rag_stream_reset_stats(s);
+            drop_cached(fd, region, layout.ivf_offset, layout.ivf_size);
+            start = get_time_us();
+            for (int q = 0; ok && q < ivf_queries; q++) {
+                ok = rag_remote_ivf_search(remote, queries + (size_t)q * VECTOR_DIM, TOP_K, scores, ids) >= 0;
+            }
+            elapsed = (get_time_us() - start) / 1e6;
+        }
+        if (ok) {
+            rag_stream_stats(s, &st);
+            printf("%12.1f %11.0f%% %12.0f %9.1f%% %14.1f\n", budget / 1048576.0,
+                   100.0 * budget / layout.ivf_size, ivf_queries / elapsed,
+                   st.reads ? 100.0 * st.cache_hits / st.reads : 0.0, st.bytes_from_disk / 1024.0 / ivf_queries);
+        } else {
+            printf("%12.1f %12s\n", budget / 1048576.0, "failed");
+        }
+        rag_remote_close(remote);
+        rag_stream_close(s);
+    }
+    
+out:
+    if (ivf) rag_ivf_destroy(ivf);
+    if (fd >= 0) close(fd);
+    free(queries);
+    free(topics);
+    free(cdf);
+    free(results);
+}
+
+// Memory, recall@10 and latency of fp16, bf16, int8 and PQ storage,
+// with and without a float re-rank, against the exact float32 scan
+static void run_quant_benchmark(struct rdma_vector_server *server, int pq_m) {
+    static const int types[] = { RAG_QUANT_FP16, RAG_QUANT_BF16, RAG_QUANT_INT8, RAG_QUANT_PQ };
+    static const int reranks[] = { 0, 4, 10 };
+    const int num_queries = 200, k = TOP_K;
+    
+    printf("\n=== Quantized Storage Benchmark (%zu vectors, %d queries) ===\n\n",
+           server->num_vectors, num_queries);
+    
+    float *queries = malloc(num_queries * EMBEDDING_SIZE);
+    int *truth = NULL;
+    struct rag_result *result = malloc(sizeof(struct rag_result));
+    if (!queries || !result) {
+        fprintf(stderr, "Failed to allocate benchmark buffers\n");
+        goto out;
+    }
+    for (int q = 0; q < num_queries; q++) {
+        init_random_vector(queries + (size_t)q * VECTOR_DIM, VECTOR_DIM);
+    }
+    truth = exact_neighbours(server, queries, num_queries, k);
+    if (!truth) {
+        fprintf(stderr, "Failed to allocate benchmark buffers\n");
+        goto out;
+    }
+    
+    uint64_t start = get_time_us();
+    int flat_queries = num_queries < 20 ? num_queries : 20;
+    for (int q = 0; q < flat_queries; q++) {
+        vector_search(server, queries + (size_t)q * VECTOR_DIM, k, result);
+    }
+    double flat_us = (get_time_us() - start) / (double)flat_queries;
+    
+    printf("%-8s %7s %10s %10s %12s %9s\n", "storage", "rerank", "bytes/vec", "recall@10",
+           "latency(us)", "speedup");
+    printf("%-8s %7s %10zu %10.3f %12.1f %8.1fx\n", "float32", "-", EMBEDDING_SIZE, 1.0, flat_us, 1.0);
+    
+    for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+        struct rag_quant_params params = { types[t], pq_m, 0 };
+        if (build_quant(server, &params) < 0) continue;
+        double bytes = rag_quant_memory(server->quant) / (double)server->num_vectors;
+        
+        for (size_t r = 0; r < sizeof(reranks) / sizeof(reranks[0]); r++) {
+            server->rerank = reranks[r];
+            double recall = 0;
+            start = get_time_us();
+            for (int q = 0; q < num_queries; q++) {
+                int count = quantized_search(server, queries + (size_t)q * VECTOR_DIM, k, result);
+                recall += recall_at_k(result->indices, count, truth + (size_t)q * k, k);
+            }
+            double us = (get_time_us() - start) / (double)num_queries;
+            
+            char label[16];
+            snprintf(label, sizeof(label), reranks[r] ? "x%d" : "off", reranks[r]);
+            printf("%-8s %7s %10.1f %10.3f %12.1f %8.1fx\n", rag_quant_type_name(types[t]),
+                   label, bytes, recall / num_queries, us, flat_us / us);
+        }
+        rag_quant_destroy(server->quant);
+        server->quant = NULL;
+    }
+    server->rerank = 0;
+    
+out:
+    free(queries);
+    free(truth);
+    free(result);
+}
+
+// Recall@10 and latency against efSearch, with the exact scan as baseline
+static void run_hnsw_benchmark(struct rdma_vector_server *server, const struct query_set *set) {
+    static const int efs[] = { 10, 16, 32, 64, 128, 256, 512 };
+    const int num_queries = set->num, k = set->k;
+    const float *queries = set->queries;
+    const int *truth = set->truth;
+    
+    printf("\n=== HNSW Benchmark (%zu vectors, %d %s queries) ===\n\n",
+           server->num_vectors, num_queries, set->source);
+    
+    struct rag_result *result = malloc(sizeof(struct rag_result));
+    if (!result) {
+        fprintf(stderr, "Failed to allocate benchmark buffers\n");
+        return;
+    }
+    
+    // Exact scan latency on the same queries, and its recall: below 1
+    // only against a --truth file ranked by another metric
+    struct rag_hnsw *hnsw = server->hnsw;
+    server->hnsw = NULL;
+    int flat_queries = num_queries < 20 ? num_queries : 20;
+    double flat_recall = 0;
+    uint64_t start = get_time_us();
+    for (int q = 0; q < flat_queries; q++) {
+        vector_search(server, queries + (size_t)q * VECTOR_DIM, k, result);
+        flat_recall += recall_at_k(result->indices, result->actual_k, truth + (size_t)q * k, k);
+    }
+    double flat_us = (get_time_us() - start) / (double)flat_queries;
+    server->hnsw = hnsw;
+    
+    printf("%6s %10s %12s %12s %12s %9s\n", "ef", "recall@10", "latency(us)", "QPS", "dist evals", "speedup");
+    printf("%6s %10.3f %12.1f %12.1f %12zu %8.1fx\n", "exact", flat_recall / flat_queries, flat_us,
+           1e6 / flat_us, server->num_vectors, 1.0);
+    
+    for (size_t e = 0; e < sizeof(efs) / sizeof(efs[0]); e++) {
+        double recall = 0;
+        long evals = rag_hnsw_scratch_distances(server->hnsw_scratch);
+        start = get_time_us();
+        for (int q = 0; q < num_queries; q++) {
+            int count = rag_hnsw_search(server->hnsw, server->hnsw_scratch,
+                                        queries + (size_t)q * VECTOR_DIM, k, efs[e],
+                                        result->distances, result->indices);
+            recall += recall_at_k(result->indices, count, truth + (size_t)q * k, k);
+        }
+        double us = (get_time_us() - start) / (double)num_queries;
+        evals = rag_hnsw_scratch_distances(server->hnsw_scratch) - evals;
+        
+        printf("%6d %10.3f %12.1f %12.1f %12.0f %8.1fx\n", efs[e], recall / num_queries,
+               us, 1e6 / us, evals / (double)num_queries, flat_us / us);
+    }
+    free(result);
+}
+
+static void print_cache_stats(const struct rdma_vector_server *server) {
+    if (!server->cache) return;
+    struct rag_cache_stats stats;
+    rag_cache_stats(server->cache, &stats);
+    uint64_t hits = stats.exact_hits + stats.near_hits;
+    printf("Result cache: %.1f%% hits of %lu lookups (%lu exact, %lu near), %zu entries, "
+           "%lu evicted, %lu expired\n", stats.lookups ? 100.0 * hits / stats.lookups : 0.0,
+           stats.lookups, stats.exact_hits, stats.near_hits, stats.entries, stats.evictions, stats.expired);
+}
+
+// Query service handler: one search per query, with top_k, filter and
+// keywords from the client (a filter that does not compile returns no
+// results; keywords are ignored unless started with --hybrid)
+static uint32_t serve_query(void *ctx, const void *query, void *result) {
+    struct rdma_vector_server *server = ctx;
+    const struct rag_query *q = query;
+    struct rag_result *r = result;
+    char filter[RAG_FILTER_MAX_EXPR], text[QUERY_TEXT_SIZE];
+    
+    snprintf(filter, sizeof(filter), "%.*s", RAG_FILTER_MAX_EXPR - 1, q->filter);
+    snprintf(text, sizeof(text), "%.*s", QUERY_TEXT_SIZE - 1, q->text);
+    uint64_t start = get_time_us();
+    if (server->stall_pct && rand() % 100 < server->stall_pct) usleep(server->stall_us);
+    vector_search_hybrid(server, q->query_embedding, text, q->top_k, filter, r);
+    r->search_us = get_time_us() - start;
+    r->shards_missing = 0;
+    r->batch_size = 1;
+    return r->actual_k;
+}
+
+// Batched service handler: plain vector queries (no filter, and no
+// keywords unless --hybrid) over exact float32 scans share one pass at
+// the largest k asked for, each then cut to its own k; the rest, and
+// everything when an index, quantized copy or cache is in use, go
+// through serve_query one at a time
+static void serve_batch(void *ctx, const void *const *queries, void *const *results,
+                        uint32_t *values, int n) {
+    struct rdma_vector_server *server = ctx;
+    int exact = !server->hnsw && !server->ivf && !server->quant && !server->cache;
+    int plain[MAX_BATCH], num_plain = 0, top_k = 1;
+    
+    for (int i = 0; i < n; i++) {
+        const struct rag_query *q = queries[i];
+        if (exact && !q->filter[0] && (!q->text[0] || !server->lexical)) {
+            memcpy(server->batch_queries + (size_t)num_plain * VECTOR_DIM, q->query_embedding, EMBEDDING_SIZE);
+            plain[num_plain++] = i;
+            if (q->top_k > top_k) top_k = q->top_k;
+        } else {
+            values[i] = serve_query(server, q, results[i]);
+        }
+    }
+    if (num_plain == 0) return;
+    
+    uint64_t start = get_time_us();
+    if (vector_search_batch(server, server->batch_queries, num_plain, top_k, server->batch_results) < 0) {
+        for (int j = 0; j < num_plain; j++) {
+            values[plain[j]] = serve_query(server, queries[plain[j]], results[plain[j]]);
+        }
+        return;
+    }
+    uint32_t elapsed = get_time_us() - start;
+    for (int j = 0; j < num_plain; j++) {
+        const struct rag_query *q = queries[plain[j]];
+        struct rag_result *r = results[plain[j]];
+        int k = clamp_top_k(q->top_k);
+        memcpy(r, &server->batch_results[j], sizeof(*r));
+        if (r->actual_k > k) r->actual_k = k;
+        r->search_us = elapsed;
+        r->vector_us = r->lexical_us = r->fusion_us = 0;
+        r->shards_missing = 0;
+        r->batch_size = num_plain;
+        values[plain[j]] = r->actual_k;
+    }
+}
+
+static int run_service(struct rdma_vector_server *server, int tls_port, int tcp_port) {
+    struct rag_remote_layout layout;
+    struct rag_service_config config = {
+        .tls_port = tls_port,
+        .tcp_port = tcp_port,
+        .query_size = sizeof(struct rag_query),
+        .result_size = sizeof(struct rag_result),
+        .handle = serve_query,
+        .ctx = server,
+        .layout = &layout,
+        .layout_size = sizeof(layout),
+        .version = rag_store_version_word(server->store)
+    };
+    if (server->batch_max > 0) {
+        server->batch_queries = malloc((size_t)server->batch_max * EMBEDDING_SIZE);
+        server->batch_results = malloc(server->batch_max * sizeof(struct rag_result));
+        if (!server->batch_queries || !server->batch_results) {
+            fprintf(stderr, "Failed to allocate batch buffers\n");
+            free(server->batch_queries);
+            free(server->batch_results);
+            return 1;
+        }
+        config.handle_batch = serve_batch;
+        config.batch_max = server->batch_max;
+        config.batch_window_us = server->batch_window_us;
+    }
+    publish_layout(server, &layout, &config.region, &config.region_size);
+    printf("\n=== RAG Query Service ===\n\n");
+    int ret = rag_service_run(&config) < 0 ? 1 : 0;
+    print_cache_stats(server);
+    free(server->batch_queries);
+    free(server->batch_results);
+    server->batch_queries = NULL;
+    server->batch_results = NULL;
+    return ret;
+}
+
+// Coordinator over shard servers, each a --serve instance holding part
+// of the corpus. Shard s's local id i is global id i * num_shards + s.
+struct coordinator {
+    struct rag_shards *shards;
+    int num_shards;
+    const void *answers[RAG_SHARD_MAX];
+    int64_t values[RAG_SHARD_MAX];
+};
+
+// Fan query out and merge the shards' top-k into result; shards that
+// time out or fail are counted in shards_missing. Keyword queries merge
+// by fused score, which ranks alike across shards of similar size.
+static void coordinator_search(struct coordinator *co, const struct rag_query *query,
+                               struct rag_result *result) {
+    uint64_t start = get_time_us();
+    int top_k = clamp_top_k(query->top_k);
+    int answered = rag_shards_call(co->shards, query, co->answers, co->values);
+    
+    float scores[MAX_K];
+    int ids[MAX_K];
+    struct rag_topk topk;
+    rag_topk_init(&topk, top_k, scores, ids);
+    for (int s = 0; s < co->num_shards; s++) {
+        const struct rag_result *r = co->answers[s];
+        for (int i = 0; r && i < r->actual_k && i < top_k; i++) {
+            rag_topk_push(&topk, r->distances[i], r->indices[i] * co->num_shards + s);
+        }
+    }
+    int count = rag_topk_finish(&topk);
+    
+    for (int i = 0; i < count && i < MAX_CONTEXTS; i++) {
+        int s = ids[i] % co->num_shards, local = ids[i] / co->num_shards;
+        const struct rag_result *r = co->answers[s];
+        for (int j = 0; j < r->actual_k && j < MAX_CONTEXTS; j++) {
+            if (r->indices[j] == local) {
+                memcpy(result->contexts[i], r->contexts[j], METADATA_SIZE);
+                break;
+            }
+        }
+    }
+    memcpy(result->indices, ids, count * sizeof(int));
+    memcpy(result->distances, scores, count * sizeof(float));
+    result->actual_k = count;
+    result->vector_us = result->lexical_us = result->fusion_us = 0;
+    result->shards_missing = co->num_shards - answered;
+    result->batch_size = 1;
+    result->search_us = get_time_us() - start;
+}
+
+static uint32_t coordinate_query(void *ctx, const void *query, void *result) {
+    coordinator_search(ctx, query, result);
+    return ((struct rag_result *)result)->actual_k;
+}
+
+static int run_coordinator_service(struct coordinator *co, int tls_port, int tcp_port) {
+    struct rag_service_config config = {
+        .tls_port = tls_port,
+        .tcp_port = tcp_port,
+        .query_size = sizeof(struct rag_query),
+        .result_size = sizeof(struct rag_result),
+        .handle = coordinate_query,
+        .ctx = co
+    };
+    printf("\n=== RAG Coordinator Service (%d shards) ===\n\n", co->num_shards);
+    return rag_service_run(&config) < 0 ? 1 : 0;
+}
+
+// RDMA when this host has a device, as --serve does; TCP otherwise
+static int shard_transport(void) {
+    int num_devices = 0;
+    struct ibv_device **devices = ibv_get_device_list(&num_devices);
+    if (devices) ibv_free_device_list(devices);
+    return num_devices > 0 ? RAG_TRANSPORT_RDMA : RAG_TRANSPORT_TCP;
+}
+
+#define SHARD_BASE_PORT 4500          // Spawned shard j: TLS port base + 2j, TCP port base + 2j + 1
+#define SHARD_STALL_US 10000          // --stall delay
+#define BATCH_DEFAULT_WINDOW_US 500   // --batch-window
+
+// Serve server from a child process; the parent keeps its own copy
+static pid_t spawn_shard(struct rdma_vector_server *server, int tls_port, int tcp_port,
+                         int stall_pct, int stall_us) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        if (!freopen("/dev/null", "w", stdout)) _exit(1);
+        // fork copies no threads: the child starts its own workers
+        if (server->pool && attach_pool(server, rag_pool_create(rag_pool_size(server->pool), 1)) < 0) {
+            _exit(1);
+        }
+        srand(getpid());
+        server->stall_pct = stall_pct;
+        server->stall_us = stall_us;
+        _exit(run_service(server, tls_port, tcp_port));
+    }
+    return pid;
+}
+
+// Wait until something accepts connections on a loopback port
+static int wait_for_port(int port, int timeout_ms) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int waited = 0; waited < timeout_ms; waited += 10) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int ret = fd >= 0 ? connect(fd, (struct sockaddr *)&addr, sizeof(addr)) : -1;
+        if (fd >= 0) close(fd);
+        if (ret == 0) return 0;
+        usleep(10000);
+    }
+    fprintf(stderr, "Nothing listening on port %d after %d ms\n", port, timeout_ms);
+    return -1;
+}
+
+static void stop_shards(const pid_t *pids, int count) {
+    for (int i = 0; i < count; i++) {
+        if (pids[i] > 0) kill(pids[i], SIGTERM);
+    }
+    for (int i = 0; i < count; i++) {
+        if (pids[i] > 0) waitpid(pids[i], NULL, 0);
+    }
+}
+
+// Append a spawned replica's address to a shard spec
+static void spec_append(char *spec, size_t size, char sep, int transport, int j, int base_port) {
+    size_t len = strlen(spec);
+    int port = base_port + 2 * j + (transport == RAG_TRANSPORT_TCP);
+    snprintf(spec + len, size - len, "%s127.0.0.1:%d", len ? (char[]){ sep, 0 } : "", port);
+}
+
+// Per-shard calls, answers and latency, then the coordinator's own
+static void print_shard_stats(struct coordinator *co, const uint64_t *latency, int num_queries,
+                              uint64_t complete) {
+    printf("%-6s %9s %9s %9s %9s %9s %9s %9s %9s\n", "shard", "answered", "timeouts", "failed",
+           "hedges", "won", "p50(us)", "p95(us)", "p99(us)");
+    for (int s = 0; s < co->num_shards; s++) {
+        struct rag_shard_stats st;
+        rag_shards_stats(co->shards, s, &st);
+        printf("%-6d %9lu %9lu %9lu %9lu %9lu %9lu %9lu %9lu\n", s, st.answered, st.timeouts,
+               st.failures, st.hedges, st.hedge_wins, st.p50_us, st.p95_us, st.p99_us);
+    }
+    printf("Coordinator: p50 %lu us, p99 %lu us, max %lu us; %.1f%% of queries heard from every shard\n\n",
+           latency[num_queries / 2], latency[num_queries * 99 / 100], latency[num_queries - 1],
+           100.0 * complete / num_queries);
+}
+
+// Closed-loop queries through the coordinator, without hedging and then
+// with it when shards have replicas
+static void run_shard_benchmark(struct coordinator *co, const struct rag_shard_params *params,
+                                int replicated, int num_queries) {
+    struct rag_query *query = calloc(1, sizeof(*query));
+    struct rag_result *result = malloc(sizeof(*result));
+    uint64_t *latency = malloc(num_queries * sizeof(uint64_t));
+    if (!query || !result || !latency) {
+        fprintf(stderr, "Failed to allocate benchmark buffers\n");
+        goto out;
+    }
+    query->top_k = TOP_K;
+    
+    printf("\n=== Sharded Search Benchmark (%d shards, %d queries, k=%d) ===\n\n",
+           co->num_shards, num_queries, TOP_K);
+    for (int pass = 0; pass < 1 + replicated; pass++) {
+        struct rag_shard_params p = *params;
+        if (pass == 0) {
+            p.hedge_us = -1;
+        } else if (p.hedge_us < 0) {
+            p.hedge_us = 0;
+        }
+        rag_shards_set_params(co->shards, &p);
+        uint64_t complete = 0;
+        for (int i = -10; i < num_queries; i++) {      // First 10 warm up
+            if (i == 0) rag_shards_reset_stats(co->shards);
+            init_random_vector(query->query_embedding, VECTOR_DIM);
+            coordinator_search(co, query, result);
+            if (i < 0) continue;
+            latency[i] = result->search_us;
+            complete += result->shards_missing == 0;
+        }
+        qsort(latency, num_queries, sizeof(uint64_t), compare_u64);
+        if (pass == 0) {
+            printf("Without hedging%s:\n", p.timeout_us ? "" : ", no timeout");
+        } else if (p.hedge_us) {
+            printf("Hedged after %d us:\n", p.hedge_us);
+        } else {
+            printf("Hedged after each shard's recent p95:\n");
+        }
+        print_shard_stats(co, latency, num_queries, complete);
+    }
+    
+out:
+    free(query);
+    free(result);
+    free(latency);
+}
+
+static int run_coordinator(const char *spec, int spawn, int replicas, size_t num_vectors, int stall_pct,
+                           const struct rag_shard_params *params, int serve, int tls_port, int tcp_port,
+                           int num_queries) {
+    int transport = shard_transport();
+    char spawned[RAG_SHARD_MAX * RAG_SHARD_MAX_REPLICAS * 24] = "";
+    pid_t pids[RAG_SHARD_MAX * RAG_SHARD_MAX_REPLICAS];
+    int num_pids = 0, ret = 1, replicated = spec && strchr(spec, '|') != NULL;
+    struct coordinator co = { 0 };
+    
+    if (spawn) {
+        if (spawn > RAG_SHARD_MAX || replicas < 1 || replicas > RAG_SHARD_MAX_REPLICAS) {
+            fprintf(stderr, "--spawn-shards takes 1 to %d shards of 1 to %d replicas\n",
+                    RAG_SHARD_MAX, RAG_SHARD_MAX_REPLICAS);
+            return 1;
+        }
+        printf("Spawning %d shards x %d replicas of %zu vectors on ports %d-%d\n", spawn, replicas,
+               num_vectors / spawn, SHARD_BASE_PORT, SHARD_BASE_PORT + 2 * spawn * replicas - 1);
+        for (int s = 0; s < spawn; s++) {
+            struct rdma_vector_server *server = init_vector_server(num_vectors / spawn, NULL);
+            if (!server) goto out;
+            for (int r = 0; r < replicas; r++) {
+                int j = s * replicas + r;
+                pids[num_pids] = spawn_shard(server, SHARD_BASE_PORT + 2 * j, SHARD_BASE_PORT + 2 * j + 1,
+                                             stall_pct, SHARD_STALL_US);
+                if (pids[num_pids] < 0) break;
+                num_pids++;
+                spec_append(spawned, sizeof(spawned), r ? '|' : ',', transport, j, SHARD_BASE_PORT);
+            }
+            destroy_vector_server(server);
+            if (num_pids < (s + 1) * replicas) goto out;
+        }
+        for (int j = 0; j < num_pids; j++) {
+            if (wait_for_port(SHARD_BASE_PORT + 2 * j + 1, 10000) < 0) goto out;
+        }
+        spec = spawned;
+        replicated = replicas > 1;
+    }
+    
+    co.shards = rag_shards_connect(spec, transport, sizeof(struct rag_query), sizeof(struct rag_result), params);
+    if (!co.shards) goto out;
+    co.num_shards = rag_shards_count(co.shards);
+    printf("Coordinating %d shards over %s: %s\n", co.num_shards,
+           transport == RAG_TRANSPORT_RDMA ? "RDMA" : "TCP", spec);
+    if (serve) {
+        ret = run_coordinator_service(&co, tls_port, tcp_port);
+    } else {
+        run_shard_benchmark(&co, params, replicated, num_queries);
+        ret = 0;
+    }
+    
+out:
+    rag_shards_close(co.shards);
+    stop_shards(pids, num_pids);
+    return ret;
+}
+
+// Whether result holds the exact top k over the vectors of the first
+// answered of num_shards shards
+static int merged_result_ok(struct rdma_vector_server **servers, int num_shards, int answered,
+                            const float *query, int k, const struct rag_result *result) {
+    float scores[MAX_K];
+    int ids[MAX_K];
+    struct rag_topk topk;
+    rag_topk_init(&topk, k, scores, ids);
+    for (int s = 0; s < answered; s++) {
+        for (size_t i = 0; i < servers[s]->num_vectors; i++) {
+            rag_topk_push(&topk, cosine_similarity(query, vector_embedding(servers[s], i), VECTOR_DIM),
+                          i * num_shards + s);
+        }
+    }
+    int count = rag_topk_finish(&topk);
+    return count == result->actual_k && memcmp(ids, result->indices, count * sizeof(int)) == 0;
+}
+
+// Coordinator over forked shard processes on loopback TCP: merged
+// results against an exact search over every shard, a straggler left
+// out at the timeout, and a hedge to the straggler's replica
+static int shard_self_test(void) {
+    enum { SHARDS = 3, PROCESSES = 4, QUERIES = 6 };
+    // Processes serve shards 0, 1, 2 and 2 again; the first copy of
+    // shard 2 stalls every query by 200 ms
+    static const int owner[PROCESSES] = { 0, 1, 2, 2 }, stall[PROCESSES] = { 0, 0, 100, 0 };
+    static const char *specs[3] = { "0,1,3", "0,1,2", "0,1,2|3" };
+    static const struct rag_shard_params params[3] = { { 0, -1 }, { 50000, -1 }, { 0, 20000 } };
+    static const char *names[3] = { "merged top-k exact", "straggler timed out", "straggler hedged" };
+    const int k = 10, base_port = 20000 + getpid() % 4000 * 10;
+    struct rdma_vector_server *servers[SHARDS] = { 0 };
+    pid_t pids[PROCESSES] = { 0 };
+    struct rag_query *query = calloc(1, sizeof(*query));
+    struct rag_result *result = malloc(sizeof(*result));
+    int failures = 1;
+    
+    printf("Sharded search self-test:\n");
+    if (!query || !result) goto out;
+    for (int s = 0; s < SHARDS; s++) {
+        if (!(servers[s] = init_vector_server(1000 + 250 * s, NULL))) goto out;
+    }
+    for (int j = 0; j < PROCESSES; j++) {
+        pids[j] = spawn_shard(servers[owner[j]], base_port + 2 * j, base_port + 2 * j + 1, stall[j], 200000);
+        if (pids[j] < 0) goto out;
+    }
+    for (int j = 0; j < PROCESSES; j++) {
+        if (wait_for_port(base_port + 2 * j + 1, 10000) < 0) goto out;
+    }
+    
+    failures = 0;
+    query->top_k = k;
+    for (int t = 0; t < 3; t++) {
+        char spec[256] = "";
+        for (const char *p = specs[t]; *p; p++) {
+            if (*p == ',' || *p == '|') continue;
+            spec_append(spec, sizeof(spec), p > specs[t] ? p[-1] : ',', RAG_TRANSPORT_TCP, *p - '0', base_port);
+        }
+        struct coordinator co = { 0 };
+        co.shards = rag_shards_connect(spec, RAG_TRANSPORT_TCP, sizeof(struct rag_query),
+                                       sizeof(struct rag_result), &params[t]);
+        int bad = !co.shards;
+        co.num_shards = bad ? 0 : rag_shards_count(co.shards);
+        for (int q = 0; !bad && q < QUERIES; q++) {
+            init_random_vector(query->query_embedding, VECTOR_DIM);
+            coordinator_search(&co, query, result);
+            // Shard 2 never makes it past the timeout; the rest is still exact
+            int answered = t == 1 ? SHARDS - 1 : SHARDS;
+            bad = (int)result->shards_missing != SHARDS - answered ||
+                  !merged_result_ok(servers, SHARDS, answered, query->query_embedding, k, result);
+        }
+        struct rag_shard_stats st;
+        if (!bad) {
+            rag_shards_stats(co.shards, 2, &st);
+            if (t == 1) bad = st.timeouts < 1;
+            if (t == 2) bad = st.hedges < 1 || st.hedge_wins < 1;
+        }
+        printf("  %-30s %s\n", names[t], bad ? "FAIL" : "ok");
+        failures += bad;
+        rag_shards_close(co.shards);
+    }
+    
+out:
+    stop_shards(pids, PROCESSES);
+    for (int s = 0; s < SHARDS; s++) {
+        if (servers[s]) destroy_vector_server(servers[s]);
+    }
+    free(query);
+    free(result);
+    return failures;
+}
+
+// Start count client threads, fn(jobs + i * job_size). launch is held
+// until the start barrier is sized to the threads that actually started
+// plus waiters, so a thread that gets there first cannot block on a
+// count that will never be reached. Returns the number started.
+static int launch_clients(pthread_t *tids, int count, void *(*fn)(void *), void *jobs, size_t job_size,
+                          pthread_mutex_t *launch, pthread_barrier_t *start, int waiters) {
+    int started = 0;
+    pthread_mutex_lock(launch);
+    for (; started < count; started++) {
+        if (pthread_create(&tids[started], NULL, fn, (char *)jobs + started * job_size) != 0) {
+            fprintf(stderr, "Failed to create client thread %d of %d\n", started + 1, count);
+            break;
+        }
+    }
+    if (started + waiters > 0) pthread_barrier_init(start, NULL, started + waiters);
+    pthread_mutex_unlock(launch);
+    return started;
+}
+
+// A client thread's side of launch_clients
+static void wait_for_start(pthread_mutex_t *launch, pthread_barrier_t *start) {
+    pthread_mutex_lock(launch);
+    pthread_mutex_unlock(launch);
+    pthread_barrier_wait(start);
+}
+
+// One closed-loop client of a spawned server, sending queries[i % distinct]
+struct load_job {
+    int transport;
+    int port;
+    const struct rag_query *queries;
+    int distinct;
+    int num_queries;
+    pthread_mutex_t *launch;
+    pthread_barrier_t *start;
+    uint64_t *latency;              // Per query
+    struct rag_result *results;     // Optional: a copy of each result
+    uint64_t batched;               // Batch sizes, summed
+    int failed;
+};
+
+// Waits at the start barrier once connected (or failed)
+static void *load_thread(void *arg) {
+    struct load_job *job = arg;
+    struct rag_client *client = rag_client_connect(job->transport, "127.0.0.1", job->port,
+                                                   sizeof(struct rag_query), sizeof(struct rag_result));
+    wait_for_start(job->launch, job->start);
+    if (!client) {
+        job->failed = 1;
+        return NULL;
+    }
+    struct rag_query *query = rag_client_query(client);
+    const struct rag_result *result = rag_client_result(client);
+    for (int i = 0; i < job->num_queries; i++) {
+        memcpy(query, &job->queries[i % job->distinct], sizeof(*query));
+        uint64_t start = get_time_us();
+        if (rag_client_call(client) < 0) {
+            job->failed = 1;
+            break;
+        }
+        job->latency[i] = get_time_us() - start;
+        job->batched += result->batch_size;
+        if (job->results) memcpy(&job->results[i], result, sizeof(*result));
+    }
+    rag_client_close(client);
+    return NULL;
+}
+
+struct load_stats {
+    double qps;
+    uint64_t p50_us;
+    uint64_t p99_us;
+    double avg_batch;
+};
+
+// clients concurrent clients of a server spawned on base_port (TLS,
+// then TCP), num_queries each; -1 if any failed
+static int measure_load(int transport, int base_port, int clients, int num_queries,
+                        const struct rag_query *queries, int distinct, struct load_stats *stats) {
+    pthread_t tids[clients];
+    struct load_job jobs[clients];
+    pthread_mutex_t launch = PTHREAD_MUTEX_INITIALIZER;
+    pthread_barrier_t start;
+    uint64_t *latency = malloc((size_t)clients * num_queries * sizeof(uint64_t));
+    if (!latency) return -1;
+    
+    for (int c = 0; c < clients; c++) {
+        jobs[c] = (struct load_job) {
+            transport, base_port + (transport == RAG_TRANSPORT_TCP), queries, distinct, num_queries,
+            &launch, &start, latency + (size_t)c * num_queries, NULL, 0, 0
+        };
+    }
+    int started = launch_clients(tids, clients, load_thread, jobs, sizeof(jobs[0]), &launch, &start, 1);
+    pthread_barrier_wait(&start);
+    uint64_t begin = get_time_us(), batched = 0;
+    int failed = started < clients;
+    for (int c = 0; c < started; c++) {
+        pthread_join(tids[c], NULL);
+        batched += jobs[c].batched;
+        failed |= jobs[c].failed;
+    }
+    uint64_t elapsed = get_time_us() - begin;
+    pthread_barrier_destroy(&start);
+    
+    size_t total = (size_t)clients * num_queries;
+    if (!failed) {
+        qsort(latency, total, sizeof(uint64_t), compare_u64);
+        stats->qps = total * 1e6 / elapsed;
+        stats->p50_us = latency[total / 2];
+        stats->p99_us = latency[total * 99 / 100];
+        stats->avg_batch = batched / (double)total;
+    }
+    free(latency);
+    return failed ? -1 : 0;
+}
+
+// Concurrent clients against a spawned server, without batching and
+// then with it, as clients double up to max_clients
+static void run_batching_benchmark(struct rdma_vector_server *server, int batch_max, int window_us,
+                                   int max_clients, int num_queries) {
+    int transport = shard_transport();
+    struct rag_query *queries = calloc(MAX_BATCH, sizeof(struct rag_query));
+    int steps = 0;
+    for (int c = 1; c <= max_clients; c *= 2) steps++;
+    struct load_stats (*stats)[2] = calloc(steps, sizeof(*stats));
+    int (*ok)[2] = calloc(steps, sizeof(*ok));
+    if (!queries || !stats || !ok) {
+        fprintf(stderr, "Failed to allocate benchmark buffers\n");
+        goto out;
+    }
+    for (int q = 0; q < MAX_BATCH; q++) {
+        init_random_vector(queries[q].query_embedding, VECTOR_DIM);
+        queries[q].top_k = TOP_K;
+    }
+    
+    printf("\n=== Query Batching Benchmark (%zu vectors, k=%d, %s, %d queries per point) ===\n\n",
+           server->num_vectors, TOP_K, transport == RAG_TRANSPORT_RDMA ? "RDMA" : "TCP", num_queries);
+    for (int pass = 0; pass < 2; pass++) {
+        server->batch_max = pass ? batch_max : 0;
+        server->batch_window_us = window_us;
+        pid_t pid = spawn_shard(server, SHARD_BASE_PORT, SHARD_BASE_PORT + 1, 0, 0);
+        if (pid < 0) goto out;
+        if (wait_for_port(SHARD_BASE_PORT + 1, 10000) == 0) {
+            for (int c = 1, i = 0; c <= max_clients; c *= 2, i++) {
+                int per_client = num_queries / c > 10 ? num_queries / c : 10;
+                ok[i][pass] = measure_load(transport, SHARD_BASE_PORT, c, per_client, queries, MAX_BATCH,
+                                           &stats[i][pass]) == 0;
+            }
+        }
+        stop_shards(&pid, 1);
+    }
+    server->batch_max = 0;
+    
+    printf("%8s | %10s %9s %9s | %10s %9s %9s %7s\n", "", "unbatched", "", "",
+           "batched", "", "", "");
+    printf("%8s | %10s %9s %9s | %10s %9s %9s %7s\n", "clients", "QPS", "p50(us)", "p99(us)",
+           "QPS", "p50(us)", "p99(us)", "batch");
+    for (int c = 1, i = 0; c <= max_clients; c *= 2, i++) {
+        printf("%8d |", c);
+        if (ok[i][0]) {
+            printf(" %10.0f %9lu %9lu |", stats[i][0].qps, stats[i][0].p50_us, stats[i][0].p99_us);
+        } else {
+            printf(" %10s %9s %9s |", "failed", "", "");
+        }
+        if (ok[i][1]) {
+            printf(" %10.0f %9lu %9lu %7.1f\n", stats[i][1].qps, stats[i][1].p50_us, stats[i][1].p99_us,
+                   stats[i][1].avg_batch);
+        } else {
+            printf(" %10s\n", "failed");
+        }
+    }
+    printf("\nBatches of up to %d queries within %d us; a query waits at most the window\n"
+           "plus the batch ahead of it.\n", batch_max, window_us);
+    // The server inherits this thread's mask for its poller, batcher and
+    // search workers
+    cpu_set_t mask;
+    int cpus = pthread_getaffinity_np(pthread_self(), sizeof(mask), &mask) == 0 ? CPU_COUNT(&mask) : 0;
+    int workers = server->pool ? rag_pool_size(server->pool) : 1;
+    if (cpus < workers + 2) {
+        printf("The server's poller, batcher and %d search worker%s share %d CPU%s, so both columns\n"
+               "include time-slicing between them.\n", workers, workers == 1 ? "" : "s", cpus,
+               cpus == 1 ? "" : "s");
+    }
+    
+out:
+    free(queries);
+    free(stats);
+    free(ok);
+}
+
+// Concurrent TCP clients of a forked batching server: results against
+// local searches, queries sharing scans, and a filtered query (which
+// cannot share the scan) served alone at its own k
+static int batching_self_test(void) {
+    enum { CLIENTS = 6, QUERIES = 4 };
+    const int base_port = 20000 + getpid() % 4000 * 10 + 8;
+    struct rdma_vector_server *server = init_vector_server(2000, NULL);
+    struct rag_query *queries = calloc(CLIENTS * QUERIES, sizeof(struct rag_query));
+    struct rag_result *results = malloc(CLIENTS * QUERIES * sizeof(struct rag_result));
+    struct rag_result *expected = malloc(sizeof(struct rag_result));
+    uint64_t latency[CLIENTS * QUERIES];
+    pid_t pid = -1;
+    int failures = 1;
+    
+    printf("Query batching self-test:\n");
+    if (!server || !queries || !results || !expected) goto out;
+    for (int c = 0; c < CLIENTS; c++) {
+        for (int q = 0; q < QUERIES; q++) {
+            struct rag_query *query = &queries[c * QUERIES + q];
+            init_random_vector(query->query_embedding, VECTOR_DIM);
+            query->top_k = 5 + c;
+            if (c == 0) snprintf(query->filter, sizeof(query->filter), "year>=2020");
+        }
+    }
+    // A window long enough that every client's query is in before it closes
+    server->batch_max = CLIENTS;
+    server->batch_window_us = 20000;
+    pid = spawn_shard(server, base_port, base_port + 1, 0, 0);
+    server->batch_max = 0;
+    if (pid < 0 || wait_for_port(base_port + 1, 10000) < 0) goto out;
+    
+    pthread_t tids[CLIENTS];
+    struct load_job jobs[CLIENTS];
+    pthread_mutex_t launch = PTHREAD_MUTEX_INITIALIZER;
+    pthread_barrier_t start;
+    for (int c = 0; c < CLIENTS; c++) {
+        jobs[c] = (struct load_job) {
+            RAG_TRANSPORT_TCP, base_port + 1, queries + c * QUERIES, QUERIES, QUERIES, &launch, &start,
+            latency + c * QUERIES, results + c * QUERIES, 0, 0
+        };
+    }
+    int started = launch_clients(tids, CLIENTS, load_thread, jobs, sizeof(jobs[0]), &launch, &start, 0);
+    int failed = started < CLIENTS;
+    for (int c = 0; c < started; c++) {
+        pthread_join(tids[c], NULL);
+        failed |= jobs[c].failed;
+    }
+    if (started > 0) pthread_barrier_destroy(&start);
+    
+    int wrong = failed, max_batch = 0, filtered_alone = !failed;
+    for (int i = 0; !failed && i < CLIENTS * QUERIES; i++) {
+        const struct rag_query *query = &queries[i];
+        vector_search_filtered(server, query->query_embedding, query->top_k, query->filter, expected);
+        wrong |= results[i].actual_k != expected->actual_k ||
+                 memcmp(results[i].indices, expected->indices, expected->actual_k * sizeof(int)) != 0;
+        if ((int)results[i].batch_size > max_batch) max_batch = results[i].batch_size;
+        if (query->filter[0]) filtered_alone &= results[i].batch_size == 1;
+    }
+    printf("  %-30s %s\n", "batched results exact", wrong ? "FAIL" : "ok");
+    printf("  %-30s %s (largest %d)\n", "queries shared scans", max_batch > 1 ? "ok" : "FAIL", max_batch);
+    printf("  %-30s %s\n", "filtered query served alone", filtered_alone ? "ok" : "FAIL");
+    failures = wrong + (max_batch <= 1) + !filtered_alone;
+    
+out:
+    if (pid > 0) stop_shards(&pid, 1);
+    if (server) destroy_vector_server(server);
+    free(queries);
+    free(results);
+    free(expected);
+    return failures;
+}
+
+struct client_stats {
+    double avg_us;
+    double search_us;
+    double stage_us[3];             // Hybrid queries: vector, lexical, fusion
+    uint64_t p50_us;
+    uint64_t p99_us;
+    double qps;
+};
+
+// Closed loop, one query in flight; returns -1 if the transport is unavailable
+static int measure_transport(int transport, const char *host, int port, const char *filter,
+                             const char *text, int num_queries, struct client_stats *stats) {
+    struct rag_client *client = rag_client_connect(transport, host, port, sizeof(struct rag_query),
+                                                   sizeof(struct rag_result));
+    if (!client) return -1;
+    
+    struct rag_query *query = rag_client_query(client);
+    const struct rag_result *result = rag_client_result(client);
+    uint64_t *latency = malloc(num_queries * sizeof(uint64_t));
+    uint64_t search_total = 0, stage_total[3] = { 0, 0, 0 };
+    int ret = -1;
+    if (!latency) goto out;
+    
+    query->top_k = TOP_K;
+    query->client_id = getpid();
+    snprintf(query->filter, sizeof(query->filter), "%s", filter);
+    snprintf(query->text, sizeof(query->text), "%s", text);
+    for (int i = -10; i < num_queries; i++) {      // First 10 warm up
+        init_random_vector(query->query_embedding, VECTOR_DIM);
+        uint64_t start = get_time_us();
+        int64_t count = rag_client_call(client);
+        uint64_t elapsed = get_time_us() - start;
+        if (count < 0) goto out;
+        // A filter may leave fewer than k matches
+        if (count != result->actual_k || count > TOP_K || (!*filter && count != TOP_K)) {
+            fprintf(stderr, "Service returned %ld results, expected %d\n", (long)count, TOP_K);
+            goto out;
+        }
+        if (i >= 0) {
+            latency[i] = elapsed;
+            search_total += result->search_us;
+            stage_total[0] += result->vector_us;
+            stage_total[1] += result->lexical_us;
+            stage_total[2] += result->fusion_us;
+        }
+    }
+    
+    uint64_t total = 0;
+    for (int i = 0; i < num_queries; i++) total += latency[i];
+    qsort(latency, num_queries, sizeof(uint64_t), compare_u64);
+    stats->avg_us = total / (double)num_queries;
+    stats->search_us = search_total / (double)num_queries;
+    for (int s = 0; s < 3; s++) stats->stage_us[s] = stage_total[s] / (double)num_queries;
+    stats->p50_us = latency[num_queries / 2];
+    stats->p99_us = latency[num_queries * 99 / 100];
+    stats->qps = 1e6 / stats->avg_us;
+    ret = 0;
+    
+out:
+    free(latency);
+    rag_client_close(client);
+    return ret;
+}
+
+static void *client_read_buffer(void *ctx, size_t size) {
+    return rag_client_read_buffer(ctx, size);
+}
+
+static int client_read_post(void *ctx, uint64_t offset, void *dest, size_t len) {
+    return rag_client_read_post(ctx, offset, dest, len);
+}
+
+static int client_read_wait(void *ctx) {
+    return rag_client_read_wait(ctx);
+}
+
+static int client_read_version(void *ctx, uint64_t *version) {
+    return rag_client_read_version(ctx, version);
+}
+
+#define ONE_SIDED_BATCH 32    // Queries per exact scan when no IVF index is published
+
+struct client_job {
+    const char *host;
+    int port;
+    int one_sided;
+    int nprobe;
+    int num_queries;
+    const float *queries;           // MAX_BATCH shared query vectors
+    pthread_mutex_t *launch;
+    pthread_barrier_t *start;
+    uint64_t done;
+    uint64_t bytes_read;
+    int failed;
+    uint64_t stale;                 // One-sided searches that overlapped a server update
+};
+
+static int one_sided_queries(struct rag_client *client, struct client_job *job) {
+    const void *blob;
+    const struct rag_region_desc *region = rag_client_region(client, &blob);
+    if (!region || region->layout_size != sizeof(struct rag_remote_layout)) {
+        fprintf(stderr, "Server publishes no region for one-sided reads\n");
+        wait_for_start(job->launch, job->start);
+        return -1;
+    }
+    // The version read costs one more round trip per search; without
+    // a published word, staleness goes unchecked
+    struct rag_remote_reader reader = {
+        client_read_buffer, client_read_post, client_read_wait, client, RAG_CLIENT_MAX_READS,
+        region->version_addr ? client_read_version : NULL
+    };
+    struct rag_remote *remote = rag_remote_open(blob, region->size, &reader, job->nprobe);
+    if (!remote) {
+        wait_for_start(job->launch, job->start);
+        return -1;
+    }
+    
+    float scores[ONE_SIDED_BATCH * TOP_K];
+    int ids[ONE_SIDED_BATCH * TOP_K], counts[ONE_SIDED_BATCH];
+    uint64_t setup_bytes = rag_remote_bytes_read(remote);
+    int ret = 0;
+    wait_for_start(job->launch, job->start);
+    while (ret == 0 && job->done < (uint64_t)job->num_queries) {
+        const float *query = job->queries + (job->done % MAX_BATCH) * VECTOR_DIM;
+        if (rag_remote_has_ivf(remote)) {
+            ret = rag_remote_ivf_search(remote, query, TOP_K, scores, ids) < 0 ? -1 : 0;
+            job->done++;
+        } else {
+            ret = rag_remote_scan(remote, job->queries, ONE_SIDED_BATCH, TOP_K, scores, ids, counts);
+            job->done += ONE_SIDED_BATCH;
+        }
+        job->stale += rag_remote_stale(remote);
+    }
+    job->bytes_read = rag_remote_bytes_read(remote) - setup_bytes;
+    rag_remote_close(remote);
+    return ret;
+}
+
+// One connection; waits at the start barrier once connected (or failed)
+static void *client_thread(void *arg) {
+    struct client_job *job = arg;
+    struct rag_client *client = rag_client_connect(RAG_TRANSPORT_RDMA, job->host, job->port,
+                                                   sizeof(struct rag_query), sizeof(struct rag_result));
+    if (!client) {
+        job->failed = 1;
+        wait_for_start(job->launch, job->start);
+        return NULL;
+    }
+    if (job->one_sided) {
+        job->failed = one_sided_queries(client, job) < 0;
+    } else {
+        struct rag_query *query = rag_client_query(client);
+        query->top_k = TOP_K;
+        query->client_id = getpid();
+        query->filter[0] = '\0';
+        query->text[0] = '\0';
+        wait_for_start(job->launch, job->start);
+        for (; job->done < (uint64_t)job->num_queries; job->done++) {
+            memcpy(query->query_embedding, job->queries + (job->done % MAX_BATCH) * VECTOR_DIM,
+                   EMBEDDING_SIZE);
+            if (rag_client_call(client) < 0) {
+                job->failed = 1;
+                break;
+            }
+        }
+    }
+    rag_client_close(client);
+    return NULL;
+}
+
+// Aggregate QPS of threads concurrent clients; -1 if any client failed
+static double measure_clients(const char *host, int port, int one_sided, int nprobe, int threads,
+                              int num_queries, const float *queries, double *bytes_per_query) {
+    pthread_t tids[threads];
+    struct client_job jobs[threads];
+    pthread_mutex_t launch = PTHREAD_MUTEX_INITIALIZER;
+    pthread_barrier_t start;
+    for (int t = 0; t < threads; t++) {
+        jobs[t] = (struct client_job) {
+            host, port, one_sided, nprobe, num_queries, queries, &launch, &start, 0, 0, 0, 0
+        };
+    }
+    int started = launch_clients(tids, threads, client_thread, jobs, sizeof(jobs[0]), &launch, &start, 1);
+    
+    // Connection setup (and the one-sided index head fetch) is not timed
+    pthread_barrier_wait(&start);
+    uint64_t begin = get_time_us();
+    uint64_t done = 0, bytes = 0, stale = 0;
+    int failed = started < threads;
+    for (int t = 0; t < started; t++) {
+        pthread_join(tids[t], NULL);
+        done += jobs[t].done;
+        bytes += jobs[t].bytes_read;
+        stale += jobs[t].stale;
+        failed |= jobs[t].failed;
+    }
+    uint64_t elapsed = get_time_us() - begin;
+    pthread_barrier_destroy(&start);
+    
+    if (stale) printf("  (%lu one-sided searches saw the server's data change)\n", stale);
+    if (failed || done == 0) return -1;
+    if (bytes_per_query) *bytes_per_query = bytes / (double)done;
+    return done * 1e6 / elapsed;
+}
+
+// Two-sided RDMA queries against one-sided reads as clients are added;
+// the one-sided clients never reach the server's CPU
+static void run_client_scaling(const char *host, int port, int max_clients, int nprobe, int num_queries) {
+    float *queries = malloc(MAX_BATCH * EMBEDDING_SIZE);
+    if (!queries) return;
+    for (int q = 0; q < MAX_BATCH; q++) {
+        init_random_vector(queries + (size_t)q * VECTOR_DIM, VECTOR_DIM);
+    }
+    
+    printf("\n=== Client Scaling: two-sided vs. one-sided RDMA (k=%d) ===\n\n", TOP_K);
+    printf("%8s %16s %16s %18s\n", "clients", "two-sided QPS", "one-sided QPS", "read/query (MB)");
+    for (int threads = 1; threads <= max_clients; threads *= 2) {
+        int per_thread = num_queries / threads > ONE_SIDED_BATCH ? num_queries / threads : ONE_SIDED_BATCH;
+        double bytes = 0;
+        double two_sided = measure_clients(host, port, 0, nprobe, threads, per_thread, queries, NULL);
+        double one_sided = measure_clients(host, port, 1, nprobe, threads, per_thread, queries, &bytes);
+        printf("%8d %16.0f %16.0f %18.2f\n", threads, two_sided, one_sided, bytes / (1024.0 * 1024.0));
+        if (two_sided < 0 && one_sided < 0) break;
+    }
+    printf("\nOne-sided clients score locally; the server's query counters do not move.\n");
+    free(queries);
+}
+
+// End-to-end latency over both transports against a --serve instance;
+// network cost is what remains after the server's own search time
+static int run_client_benchmark(const char *host, int tls_port, int tcp_port, const char *filter,
+                                const char *text, int num_queries, int max_clients, int nprobe) {
+    static const char *names[] = { "RDMA", "TCP" };
+    struct client_stats stats[2];
+    int ok[2];
+    
+    printf("\n=== RAG Service Benchmark (%s, %d queries, k=%d%s%s%s%s) ===\n\n", host, num_queries, TOP_K,
+           *filter ? ", filter " : "", filter, *text ? ", hybrid: " : "", text);
+    ok[RAG_TRANSPORT_RDMA] = measure_transport(RAG_TRANSPORT_RDMA, host, tls_port, filter, text, num_queries,
+                                               &stats[RAG_TRANSPORT_RDMA]) == 0;
+    ok[RAG_TRANSPORT_TCP] = measure_transport(RAG_TRANSPORT_TCP, host, tcp_port, filter, text, num_queries,
+                                              &stats[RAG_TRANSPORT_TCP]) == 0;
+    
+    printf("\n%-6s %10s %10s %10s %12s %12s %10s\n", "", "avg(us)", "p50(us)", "p99(us)",
+           "search(us)", "network(us)", "QPS");
+    for (int t = 0; t < 2; t++) {
+        if (!ok[t]) {
+            printf("%-6s %10s\n", names[t], "unavailable");
+            continue;
+        }
+        printf("%-6s %10.1f %10lu %10lu %12.1f %12.1f %10.0f\n", names[t], stats[t].avg_us,
+               stats[t].p50_us, stats[t].p99_us, stats[t].search_us,
+               stats[t].avg_us - stats[t].search_us, stats[t].qps);
+    }
+    for (int t = 0; t < 2 && *text; t++) {
+        if (!ok[t]) continue;
+        printf("%-6s server stages: vector %.1f us, lexical %.1f us (concurrent), fusion %.1f us\n",
+               names[t], stats[t].stage_us[0], stats[t].stage_us[1], stats[t].stage_us[2]);
+    }
+    if (ok[RAG_TRANSPORT_RDMA] && ok[RAG_TRANSPORT_TCP]) {
+        double rdma_net = stats[RAG_TRANSPORT_RDMA].avg_us - stats[RAG_TRANSPORT_RDMA].search_us;
+        double tcp_net = stats[RAG_TRANSPORT_TCP].avg_us - stats[RAG_TRANSPORT_TCP].search_us;
+        printf("\nMeasured speedup: %.2fx end to end, %.1fx on the network path\n",
+               stats[RAG_TRANSPORT_TCP].avg_us / stats[RAG_TRANSPORT_RDMA].avg_us,
+               rdma_net > 0 ? tcp_net / rdma_net : 0.0);
+    }
+    if (ok[RAG_TRANSPORT_RDMA] && max_clients > 0) {
+        run_client_scaling(host, tls_port, max_clients, nprobe, num_queries);
+    }
+    return ok[RAG_TRANSPORT_RDMA] || ok[RAG_TRANSPORT_TCP] ? 0 : 1;
+}
+
+static void print_usage(const char *prog) {
+    printf("Usage: %s [options] [num_vectors]\n", prog);
+    printf("Options:\n");
+    printf("  -n, --vectors NUM       Vectors in the database (default: 10000)\n");
+    printf("  -K, --kernel NAME       Force scalar, sse4, avx2 or avx512 (default: best)\n");
+    printf("  -T, --self-test         Check SIMD kernels against a reference and exit\n");
+    printf("  -j, --threads NUM       Search workers, one shard each (default: all CPUs)\n");
+    printf("  -I, --index NAME        flat (exact scan), hnsw or ivf (default: flat)\n");
+    printf("      --hnsw-m NUM        HNSW links per node (default: %d)\n", RAG_HNSW_DEFAULT_M);
+    printf("      --ef-construction NUM  HNSW build candidate list (default: %d)\n",
+           RAG_HNSW_DEFAULT_EF_CONSTRUCTION);
+    printf("      --ef-search NUM     HNSW query candidate list (default: %d)\n",
+           RAG_HNSW_DEFAULT_EF_SEARCH);
+    printf("      --storage NAME      Scan float32, fp16, bf16, int8 or pq (default: float32)\n");
+    printf("      --pq-m NUM          PQ subspaces, must divide %d (default: %d)\n",
+           VECTOR_DIM, RAG_QUANT_DEFAULT_PQ_M);
+    printf("      --rerank NUM        Re-score NUM x k quantized candidates in float32\n");
+    printf("      --nlist NUM         IVF lists (default: 4 * sqrt(vectors))\n");
+    printf("      --nprobe NUM        IVF lists scanned per query (default: %d)\n",
+           RAG_IVF_DEFAULT_NPROBE);
+    printf("      --db PATH           Map a saved database instead of generating one\n");
+    printf("      --save-db PATH      Save the database (and IVF index, if built)\n");
+    printf("      --serve             Answer queries over RDMA and TCP until interrupted\n");
+    printf("      --connect HOST      Benchmark a --serve instance over both transports\n");
+    printf("      --port NUM          RDMA bootstrap (TLS) port (default: %d)\n", TLS_PORT);
+    printf("      --tcp-port NUM      TCP query port (default: %d)\n", RAG_SERVICE_TCP_PORT);
+    printf("      --queries NUM       Queries per transport for --connect, per pass for\n");
+    printf("                          --shards (default: 1000); for the hnsw and ivf\n");
+    printf("                          benchmarks (default: %d, or %d from --query-file)\n",
+           BENCH_QUERIES, BENCH_FILE_QUERIES);
+    printf("      --clients NUM       --connect scales RDMA clients 1, 2, 4 .. NUM (default: 8)\n");
+    printf("      --cache NUM         Cache the results of NUM recent queries (default: off)\n");
+    printf("      --cache-ttl MS      Expire cached results after MS milliseconds (default: never)\n");
+    printf("      --cache-near COS    Serve a cached result to queries with cosine > COS;\n");
+    printf("                          0 = exact repeats only (default: %.2f)\n", RAG_CACHE_DEFAULT_NEAR);
+    printf("      --filter EXPR       Only return vectors whose attributes match, e.g.\n");
+    printf("                          \"tenant=tenant_03|tenant_07,year>=2020\" (demo, --connect);\n");
+    printf("                          attributes: tenant (keyword), year, doc\n");
+    printf("      --hybrid            Index the metadata text (BM25) and fuse keyword and\n");
+    printf("                          vector rankings for queries that carry keywords\n");
+    printf("      --text WORDS        Keywords for the demo or --connect queries (implies\n");
+    printf("                          --hybrid locally)\n");
+    printf("      --shards SPEC       Coordinate --serve shard instances instead of holding\n");
+    printf("                          vectors: host[:port] per shard, ',' between shards and\n");
+    printf("                          '|' between replicas; benchmarks them, or with --serve\n");
+    printf("                          answers queries by fanning out and merging\n");
+    printf("      --spawn-shards NUM  As --shards, over NUM local shard processes that split\n");
+    printf("                          the vectors (ports %d and up)\n", SHARD_BASE_PORT);
+    printf("      --replicas NUM      Processes per spawned shard (default: 1)\n");
+    printf("      --shard-timeout US  Leave out shards slower than US (default: wait)\n");
+    printf("      --hedge US          Ask a second replica after US; 0 = each shard's recent\n");
+    printf("                          p95 (the benchmark compares against no hedging)\n");
+    printf("      --stall PCT         Spawned shards stall %d ms on PCT%% of queries\n",
+           SHARD_STALL_US / 1000);
+    printf("      --batch NUM         --serve answers up to NUM concurrent plain queries with\n");
+    printf("                          one scan (default: off; batching benchmark: %d)\n", MAX_BATCH);
+    printf("      --batch-window US   Longest a query waits for others to join its batch\n");
+    printf("                          (default: %d)\n", BATCH_DEFAULT_WINDOW_US);
+    printf("      --stream-budget MB  Cache for the stream benchmark (default: 0 to 100%% of\n");
+    printf("                          the embeddings and of the IVF index)\n");
+    printf("      --seed NUM          Seed for generated vectors and queries (default: %d)\n",
+           RAG_DATASET_DEFAULT_SEED);
+    printf("      --base PATH         Load the vectors of an .fvecs or .bvecs file (-n: only\n");
+    printf("                          the first NUM) instead of generating them\n");
+    printf("      --query-file PATH   Queries for the hnsw and ivf benchmarks (.fvecs/.bvecs)\n");
+    printf("      --truth PATH        Their nearest base ids (.ivecs); default: exact scan\n");
+    printf("      --metric NAME       ip, angular or l2 for --base and --query-file vectors\n");
+    printf("                          (default: angular)\n");
+    printf("  -B, --bench NAME        Run one benchmark instead of the demo:\n");
+    printf("                          topk, parallel, batch, hnsw, ivf, quant, cache,\n");
+    printf("                          ingest, filter, hybrid, batching, stream (--db)\n");
+    printf("  -h, --help              Show this help\n");
+}
+
+int main(int argc, char *argv[]) {
+    size_t num_vectors = 10000;
+    const char *kernel = NULL;
+    int self_test = 0;
+    const char *bench = NULL;
+    int threads = 0;
+    const char *index = "flat";
+    struct rag_hnsw_params hnsw_params = {
+        RAG_HNSW_DEFAULT_M, RAG_HNSW_DEFAULT_EF_CONSTRUCTION, RAG_HNSW_DEFAULT_EF_SEARCH
+    };
+    struct rag_ivf_params ivf_params = { 0, RAG_IVF_DEFAULT_NPROBE, RAG_IVF_DEFAULT_ITERS, 0 };
+    const char *storage = "float32";
+    struct rag_quant_params quant_params = { RAG_QUANT_INT8, RAG_QUANT_DEFAULT_PQ_M, 0 };
+    int rerank = 0;
+    const char *db_path = NULL;
+    const char *save_path = NULL;
+    int serve = 0;
+    const char *connect_host = NULL;
+    int tls_port = 0;
+    int tcp_port = 0;
+    int client_queries = 1000;
+    int max_clients = 8;
+    struct rag_cache_params cache_params = { 0, 0, RAG_CACHE_DEFAULT_NEAR };
+    const char *filter = "";
+    int hybrid = 0;
+    const char *text = "";
+    const char *shard_spec = NULL;
+    int spawn_shards = 0;
+    int shard_replicas = 1;
+    int stall_pct = 0;
+    struct rag_shard_params shard_params = { 0, -1 };
+    int batch_max = 0;
+    int batch_window_us = BATCH_DEFAULT_WINDOW_US;
+    long stream_budget_mb = -1;
+    const char *base_path = NULL;
+    const char *query_path = NULL;
+    const char *truth_path = NULL;
+    int metric = METRIC_ANGULAR;
+    int vectors_given = 0;
+    int queries_given = 0;
+    
+    static struct option long_options[] = {
+        {"vectors", required_argument, 0, 'n'},
+        {"kernel", required_argument, 0, 'K'},
+        {"self-test", no_argument, 0, 'T'},
+        {"threads", required_argument, 0, 'j'},
+        {"index", required_argument, 0, 'I'},
+        {"hnsw-m", required_argument, 0, 256},
+        {"ef-construction", required_argument, 0, 257},
+        {"ef-search", required_argument, 0, 258},
+        {"nlist", required_argument, 0, 259},
+        {"nprobe", required_argument, 0, 260},
+        {"storage", required_argument, 0, 261},
+        {"pq-m", required_argument, 0, 262},
+        {"rerank", required_argument, 0, 263},
+        {"db", required_argument, 0, 264},
+        {"save-db", required_argument, 0, 265},
+        {"serve", no_argument, 0, 266},
+        {"connect", required_argument, 0, 267},
+        {"port", required_argument, 0, 268},
+        {"tcp-port", required_argument, 0, 269},
+        {"queries", required_argument, 0, 270},
+        {"clients", required_argument, 0, 271},
+        {"cache", required_argument, 0, 272},
+        {"cache-ttl", required_argument, 0, 273},
+        {"cache-near", required_argument, 0, 274},
+        {"filter", required_argument, 0, 275},
+        {"hybrid", no_argument, 0, 276},
+        {"text", required_argument, 0, 277},
+        {"shards", required_argument, 0, 278},
+        {"spawn-shards", required_argument, 0, 279},
+        {"replicas", required_argument, 0, 280},
+        {"shard-timeout", required_argument, 0, 281},
+        {"hedge", required_argument, 0, 282},
+        {"stall", required_argument, 0, 283},
+        {"batch", required_argument, 0, 284},
+        {"batch-window", required_argument, 0, 285},
+        {"stream-budget", required_argument, 0, 286},
+        {"seed", required_argument, 0, 287},
+        {"base", required_argument, 0, 288},
+        {"query-file", required_argument, 0, 289},
+        {"truth", required_argument, 0, 290},
+        {"metric", required_argument, 0, 291},
+        {"bench", required_argument, 0, 'B'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:K:Tj:I:B:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                num_vectors = atoi(optarg);
+                vectors_given = 1;
+                break;
+            case 'K':
+                kernel = optarg;
+                break;
+            case 'T':
+                self_test = 1;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'I':
+                index = optarg;
+                break;
+            case 256:
+                hnsw_params.M = atoi(optarg);
+                break;
+            case 257:
+                hnsw_params.ef_construction = atoi(optarg);
+                break;
+            case 258:
+                hnsw_params.ef_search = atoi(optarg);
+                break;
+            case 259:
+                ivf_params.nlist = atoi(optarg);
+                break;
+            case 260:
+                ivf_params.nprobe = atoi(optarg);
+                break;
+            case 261:
+                storage = optarg;
+                break;
+            case 262:
+                quant_params.pq_m = atoi(optarg);
+                break;
+            case 263:
+                rerank = atoi(optarg);
+                break;
+            case 264:
+                db_path = optarg;
+                break;
+            case 265:
+                save_path = optarg;
+                break;
+            case 266:
+                serve = 1;
+                break;
+            case 267:
+                connect_host = optarg;
+                break;
+            case 268:
+                tls_port = atoi(optarg);
+                break;
+            case 269:
+                tcp_port = atoi(optarg);
+                break;
+            case 270:
+                client_queries = atoi(optarg);
+                queries_given = 1;
+                break;
+            case 271:
+                max_clients = atoi(optarg);
+                break;
+            case 272:
+                cache_params.capacity = atoi(optarg);
+                break;
+            case 273:
+                cache_params.ttl_ms = atoi(optarg);
+                break;
+            case 274:
+                cache_params.near_threshold = atof(optarg);
+                break;
+            case 275:
+                filter = optarg;
+                break;
+            case 276:
+                hybrid = 1;
+                break;
+            case 277:
+                text = optarg;
+                break;
+            case 278:
+                shard_spec = optarg;
+                break;
+            case 279:
+                spawn_shards = atoi(optarg);
+                break;
+            case 280:
+                shard_replicas = atoi(optarg);
+                break;
+            case 281:
+                shard_params.timeout_us = atoi(optarg);
+                break;
+            case 282:
+                shard_params.hedge_us = atoi(optarg);
+                break;
+            case 283:
+                stall_pct = atoi(optarg);
+                break;
+            case 284:
+                batch_max = atoi(optarg);
+                break;
+            case 285:
+                batch_window_us = atoi(optarg);
+                break;
+            case 286:
+                stream_budget_mb = atol(optarg);
+                break;
+            case 287:
+                dataset_seed = strtoull(optarg, NULL, 0);
+                break;
+            case 288:
+                base_path = optarg;
+                break;
+            case 289:
+                query_path = optarg;
+                break;
+            case 290:
+                truth_path = optarg;
+                break;
+            case 291:
+                if ((metric = parse_metric(optarg)) < 0) return 1;
+                break;
+            case 'B':
+                bench = optarg;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind < argc) {
+        num_vectors = atoi(argv[optind]);
+        vectors_given = 1;
+    }
+    // The workload's own random choices follow --seed too
+    srand((unsigned int)dataset_seed);
+    
+    int isa = rag_kernels_init(kernel);
+    if (isa < 0) {
+        return 1;
+    }
+    if (self_test) {
+        int failures = rag_kernels_self_test();
+        failures += rag_topk_self_test();
+        failures += rag_pool_self_test();
+        failures += parallel_self_test();
+        failures += hnsw_self_test();
+        failures += ivf_self_test();
+        failures += quant_self_test();
+        failures += db_self_test();
+        failures += remote_self_test();
+        failures += rag_cache_self_test();
+        failures += rag_store_self_test();
+        failures += ingest_self_test();
+        failures += rag_filter_self_test();
+        failures += filter_self_test();
+        failures += rag_lexical_self_test();
+        failures += hybrid_self_test();
+        failures += shard_self_test();
+        failures += batching_self_test();
+        failures += rag_stream_self_test();
+        failures += rag_dataset_self_test();
+        return failures == 0 ? 0 : 1;
+    }
+    if ((connect_host || shard_spec || spawn_shards) && client_queries < 1) {
+        fprintf(stderr, "--queries must be positive\n");
+        return 1;
+    }
+    if (batch_max < 0 || batch_max > MAX_BATCH || batch_window_us < 0) {
+        fprintf(stderr, "--batch takes 0 to %d queries and --batch-window a non-negative time\n", MAX_BATCH);
+        return 1;
+    }
+    if (connect_host) {
+        return run_client_benchmark(connect_host, tls_port, tcp_port, filter, text, client_queries,
+                                    max_clients, ivf_params.nprobe);
+    }
+    if (shard_spec || spawn_shards) {
+        return run_coordinator(shard_spec, spawn_shards, shard_replicas, num_vectors, stall_pct,
+                               &shard_params, serve, tls_port, tcp_port, client_queries);
+    }
+    
+    printf("╔══════════════════════════════════════════════════════╗\n");
+    printf("║          RDMA-RAG: Ultra-Fast Vector Search         ║\n");
+    printf("║                                                      ║\n");
+    printf("║  Demonstrating 10-100x speedup for RAG systems      ║\n");
+    printf("╚══════════════════════════════════════════════════════╝\n\n");
+    
+    printf("Similarity kernel: %s\n", rag_isa_name(isa));
+    
+    // Workers exist before the database so each can first-touch its shard
+    struct rag_pool *pool = rag_pool_create(threads, 1);
+    if (!pool) {
+        fprintf(stderr, "Failed to create search workers\n");
+        return 1;
+    }
+    printf("Search workers: %d\n", rag_pool_size(pool));
+    
+    // Initialize vector database
+    struct rdma_vector_server *server =
+        db_path ? open_vector_server(db_path, pool)
+        : base_path ? load_vector_server(base_path, vectors_given ? num_vectors : 0, metric, pool)
+        : init_vector_server(num_vectors, pool);
+    if (!server) {
+        fprintf(stderr, "Failed to initialize vector server\n");
+        rag_pool_destroy(pool);
+        return 1;
+    }
+    
+    // The index benchmarks imply their index
+    if (bench && (strcmp(bench, "hnsw") == 0 || strcmp(bench, "ivf") == 0)) {
+        index = bench;
+    }
+    int built = 0;
+    if (strcmp(index, "hnsw") == 0) {
+        built = build_hnsw(server, &hnsw_params);
+    } else if (strcmp(index, "ivf") == 0) {
+        built = build_ivf(server, &ivf_params);
+    } else if (strcmp(index, "flat") != 0) {
+        fprintf(stderr, "Unknown index: %s\n", index);
+        built = -1;
+    }
+    if (built == 0 && strcmp(storage, "float32") != 0) {
+        quant_params.type = rag_quant_parse_type(storage);
+        if (quant_params.type >= 0) {
+            built = build_quant(server, &quant_params);
+            server->rerank = rerank;
+        } else {
+            fprintf(stderr, "Unknown storage: %s\n", storage);
+            built = -1;
+        }
+    }
+    if (built == 0 && cache_params.capacity > 0) {
+        server->cache = rag_cache_create(VECTOR_DIM, sizeof(struct rag_result), &cache_params);
+        built = server->cache ? 0 : -1;
+    }
+    if (built == 0 && *filter && !compile_filter(server, filter)) {
+        built = -1;
+    }
+    if (built == 0 && (hybrid || *text || (bench && strcmp(bench, "hybrid") == 0))) {
+        built = build_lexical(server);
+    }
+    if (built == 0 && save_path) {
+        built = save_vector_server(server, save_path);
+    }
+    if (built < 0) {
+        destroy_vector_server(server);
+        rag_pool_destroy(pool);
+        return 1;
+    }
+    
+    // Remote readers need a device; the local demo runs without one.
+    // --serve registers what it publishes on its own protection domain.
+    if (server->db && !serve) {
+        register_database(server);
+    }
+    
+    if (serve) {
+        server->batch_max = batch_max;
+        server->batch_window_us = batch_window_us;
+        int ret = run_service(server, tls_port, tcp_port);
+        destroy_vector_server(server);
+        rag_pool_destroy(pool);
+        return ret;
+    }
+    
+    if (bench) {
+        int ret = 0;
+        struct query_set set = { 0 };
+        int recall_bench = strcmp(bench, "hnsw") == 0 || strcmp(bench, "ivf") == 0;
+        if (recall_bench && make_query_set(server, query_path, truth_path, metric,
+                                           queries_given ? client_queries : 0, &set) < 0) {
+            destroy_vector_server(server);
+            rag_pool_destroy(pool);
+            return 1;
+        }
+        if (strcmp(bench, "topk") == 0) {
+            run_topk_benchmark(server);
+        } else if (strcmp(bench, "parallel") == 0) {
+            run_parallel_benchmark(server, rag_pool_size(pool));
+        } else if (strcmp(bench, "batch") == 0) {
+            run_batch_benchmark(server);
+        } else if (strcmp(bench, "hnsw") == 0) {
+            run_hnsw_benchmark(server, &set);
+        } else if (strcmp(bench, "ivf") == 0) {
+            run_ivf_benchmark(server, &set);
+        } else if (strcmp(bench, "quant") == 0) {
+            run_quant_benchmark(server, quant_params.pq_m);
+        } else if (strcmp(bench, "cache") == 0) {
+            if (cache_params.capacity == 0) cache_params.capacity = 1024;
+            run_cache_benchmark(server, &cache_params);
+        } else if (strcmp(bench, "ingest") == 0) {
+            run_ingest_benchmark(server);
+        } else if (strcmp(bench, "filter") == 0) {
+            run_filter_benchmark(server);
+        } else if (strcmp(bench, "hybrid") == 0) {
+            run_hybrid_benchmark(server);
+        } else if (strcmp(bench, "stream") == 0) {
+            run_stream_benchmark(server, db_path, stream_budget_mb);
+        } else if (strcmp(bench, "batching") == 0) {
+            run_batching_benchmark(server, batch_max ? batch_max : MAX_BATCH, batch_window_us,
+                                   max_clients > 0 ? max_clients : 1, client_queries > 0 ? client_queries : 1000);
+        } else {
+            fprintf(stderr, "Unknown benchmark: %s\n", bench);
+            ret = 1;
+        }
+        free(set.queries);
+        free(set.truth);
+        destroy_vector_server(server);
+        rag_pool_destroy(pool);
+        return ret;
+    }
+    
+    // Run demo
+    rdma_vector_search_demo(server, filter, text);
+    
+    // Run benchmarks
+    run_benchmarks(server);
+    
+    // Show summary
+    if (server->total_queries > 0) {
+        printf("\n=== Session Summary ===\n");
+        printf("Total queries processed: %lu\n", server->total_queries);
+        printf("Average search latency: %.2fms\n", 
+               server->total_latency_us / (float)server->total_queries / 1000);
+        printf("Throughput capacity: ~%.0f queries/second\n",
+               1000000.0 / (server->total_latency_us / (float)server->total_queries));
+    }
+    print_cache_stats(server);
+    
+    // Cleanup
+    destroy_vector_server(server);
+    rag_pool_destroy(pool);
     
     return 0;
 }
\ No newline at end of file
@@ -19,6 +19,7 @@
 #include "rdma_compat.h"
 #include "tls_utils.h"
 #include "disconnect_protocol.h"
+#include "rdma_metrics.h"
 
 #define MAX_CLIENTS 10
 #define RDMA_PORT 4791
@@ -54,6 +55,9 @@ struct client_connection {
     // Disconnection protocol
     struct disconnect_context disconnect_ctx;
     
+    // Live counters, updated only by this client's handler thread
+    struct conn_metrics *metrics;
+    
     // Server context reference
     struct server_context *server;
 };
@@ -73,10 +77,14 @@ struct server_context {
     // Client management
     struct client_connection *clients[MAX_CLIENTS];
     pthread_mutex_t clients_mutex;
-    int num_clients;
+    pthread_cond_t clients_done;     // Signalled when num_clients drops to 0
+    int num_clients;                 // Live handler threads (each holds a slot)
     
     // Server state
     volatile int running;
+    
+    // Metrics (endpoint enabled by RDMA_METRICS=port|host:port|unix:/path)
+    struct metrics_registry *metrics;
 };
 
 static struct server_context *g_server = NULL;
@@ -264,8 +272,10 @@ static int post_receive(struct client_connection *client) {
     
     if (ibv_post_recv(client->qp, &wr, &bad_wr)) {
         perror("ibv_post_recv");
+        metrics_add(&client->metrics->counters.errors, 1);
         return -1;
     }
+    metrics_queue(client->metrics, 1);
     
     return 0;
 }
@@ -292,13 +302,18 @@ static int send_message(struct client_connection *client, const char *message) {
     
     if (ibv_post_send(client->qp, &wr, &bad_wr)) {
         perror("ibv_post_send");
+        metrics_add(&client->metrics->counters.errors, 1);
         return -1;
     }
+    metrics_queue(client->metrics, 1);
     
     // Wait for completion
     while (ibv_poll_cq(client->send_cq, 1, &wc) == 0);
     
-    if (wc.status != IBV_WC_SUCCESS) {
+    metrics_completion(client->metrics, wc.status);
+    if (wc.status == IBV_WC_SUCCESS) {
+        metrics_send(client->metrics, sge.length);
+    } else {
         fprintf(stderr, "Send failed with status: %s\n", 
                 ibv_wc_status_str(wc.status));
         return -1;
@@ -406,7 +421,9 @@ static void handle_client_rdma(struct client_connection *client) {
         
         // Poll for receive completions
         if (ibv_poll_cq(client->recv_cq, 1, &wc) > 0) {
+            metrics_completion(client->metrics, wc.status);
             if (wc.status == IBV_WC_SUCCESS) {
+                metrics_recv(client->metrics, wc.byte_len);
                 printf("Client %d: Received: %s\n", client->client_id, client->recv_buffer);
                 
                 // Check for disconnect protocol messages
@@ -567,16 +584,23 @@ cleanup:
     // Close TLS connection
     close_tls_connection(client->tls_conn);
     
-    // Remove from server's client list
-    pthread_mutex_lock(&client->server->clients_mutex);
+    // Fold this client's counters into the server totals
+    metrics_unregister(client->server->metrics, client->metrics);
+    
+    // Remove from server's client list; cleanup_server may free the
+    // server once the last handler is out, so nothing touches it after
+    struct server_context *server = client->server;
+    pthread_mutex_lock(&server->clients_mutex);
     for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (client->server->clients[i] == client) {
-            client->server->clients[i] = NULL;
-            client->server->num_clients--;
+        if (server->clients[i] == client) {
+            server->clients[i] = NULL;
+            if (--server->num_clients == 0) {
+                pthread_cond_broadcast(&server->clients_done);
+            }
             break;
         }
     }
-    pthread_mutex_unlock(&client->server->clients_mutex);
+    pthread_mutex_unlock(&server->clients_mutex);
     
     free(client);
     
@@ -636,15 +660,34 @@ static void* tls_listener_thread(void *arg) {
         }
         pthread_mutex_unlock(&server->clients_mutex);
         
+        client->metrics = metrics_register(server->metrics, client->client_id);
+        if (!client->metrics) {
+            fprintf(stderr, "Client %d: Failed to allocate metrics\n", client->client_id);
+            pthread_mutex_lock(&server->clients_mutex);
+            server->clients[client->client_id - 1] = NULL;
+            server->num_clients--;
+            pthread_mutex_unlock(&server->clients_mutex);
+            close_tls_connection(tls_conn);
+            free(client);
+            continue;
+        }
+        
         printf("Client %d: TLS connection accepted\n", client->client_id);
         
         // Create handler thread for this client
         if (pthread_create(&client->thread_id, NULL, client_handler_thread, client) != 0) {
             fprintf(stderr, "Failed to create client handler thread\n");
+            metrics_unregister(server->metrics, client->metrics);
+            pthread_mutex_lock(&server->clients_mutex);
+            server->clients[client->client_id - 1] = NULL;
+            server->num_clients--;
+            pthread_mutex_unlock(&server->clients_mutex);
             close_tls_connection(tls_conn);
             free(client);
+            continue;
         }
         
+        // cleanup_server waits on num_clients rather than joining
         pthread_detach(client->thread_id);
     }
     
@@ -668,6 +711,7 @@ static struct server_context* init_server(void) {
     
     server->running = 1;
     pthread_mutex_init(&server->clients_mutex, NULL);
+    pthread_cond_init(&server->clients_done, NULL);
     
     // Initialize OpenSSL
     init_openssl();
@@ -693,8 +737,11 @@ static struct server_context* init_server(void) {
         }
     }
     
-    // Create TLS listener
-    server->tls_listen_sock = create_tls_listener(TLS_PORT);
+    // Create TLS listener (TLS_BACKLOG overrides the default accept queue length)
+    const char *backlog_env = getenv("TLS_BACKLOG");
+    int backlog = backlog_env ? atoi(backlog_env) : TLS_LISTEN_BACKLOG;
+    server->tls_listen_sock = create_tls_listener_backlog(TLS_PORT,
+                                                          backlog > 0 ? backlog : TLS_LISTEN_BACKLOG);
     if (server->tls_listen_sock < 0) {
         SSL_CTX_free(server->ssl_ctx);
         free(server);
@@ -726,6 +773,21 @@ static struct server_context* init_server(void) {
     
     printf("Opened shared RDMA device: %s\n", 
            ibv_get_device_name(server->device_ctx->device));
+    
+    server->metrics = metrics_create(ibv_get_device_name(server->device_ctx->device));
+    if (!server->metrics) {
+        fprintf(stderr, "Failed to create metrics registry\n");
+        ibv_close_device(server->device_ctx);
+        ibv_free_device_list(server->dev_list);
+        SSL_CTX_free(server->ssl_ctx);
+        close(server->tls_listen_sock);
+        free(server);
+        return NULL;
+    }
+    const char *metrics_addr = getenv("RDMA_METRICS");
+    if (metrics_addr && metrics_start(server->metrics, metrics_addr) < 0) {
+        fprintf(stderr, "Warning: metrics endpoint disabled\n");
+    }
     printf("RDMA resources will be created per-client after TLS connection\n");
     
     return server;
@@ -743,14 +805,33 @@ static void cleanup_server(struct server_context *server) {
     }
     // No RDMA thread with pure IB verbs
     
-    // Clean up remaining clients
+    // Stop the remaining clients and wait for their handlers, which
+    // still use the metrics registry and the device context on the way out
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += TIMEOUT_MS / 1000;
     pthread_mutex_lock(&server->clients_mutex);
     for (int i = 0; i < MAX_CLIENTS; i++) {
         if (server->clients[i]) {
             server->clients[i]->active = 0;
         }
     }
+    while (server->num_clients > 0) {
+        if (pthread_cond_timedwait(&server->clients_done, &server->clients_mutex, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    int stuck = server->num_clients;
     pthread_mutex_unlock(&server->clients_mutex);
+    if (stuck > 0) {
+        // Freeing what a live handler uses is worse than leaking it at exit
+        fprintf(stderr, "%d client handler(s) still running after %d ms; "
+                "leaving shared resources allocated\n", stuck, TIMEOUT_MS);
+        return;
+    }
+    
+    // Stop the metrics endpoint
+    metrics_destroy(server->metrics);
     
     // Clean up shared RDMA device context
     if (server->device_ctx) {
@@ -771,6 +852,7 @@ static void cleanup_server(struct server_context *server) {
     }
     
     cleanup_openssl();
+    pthread_cond_destroy(&server->clients_done);
     pthread_mutex_destroy(&server->clients_mutex);
     free(server);
 }
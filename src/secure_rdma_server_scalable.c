@@ -123,7 +123,9 @@ struct server_context {
     pthread_t *worker_threads;
     int num_workers;
     
-    // Statistics
+    // Statistics. Nothing updates total_messages or total_bytes, and the
+    // rdma_metrics registry is not wired here: no CQ is ever polled, so
+    // there is no data path to count yet.
     uint64_t total_connections;
     uint64_t active_connections;
     uint64_t total_messages;
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
@@ -95,6 +96,12 @@ int configure_server_context(SSL_CTX *ctx, const char *cert_file, const char *ke
 }
 
 int create_tls_listener(int port) {
+    return create_tls_listener_backlog(port, TLS_LISTEN_BACKLOG);
+}
+
+// Same as create_tls_listener() with an explicit accept queue length
+// (the kernel caps it at net.core.somaxconn)
+int create_tls_listener_backlog(int port, int backlog) {
     int sock;
     struct sockaddr_in addr;
     int opt = 1;
@@ -123,7 +130,7 @@ int create_tls_listener(int port) {
         return -1;
     }
 
-    if (listen(sock, 10) < 0) {
+    if (listen(sock, backlog) < 0) {
         perror("listen");
         close(sock);
         return -1;
@@ -134,21 +141,26 @@ int create_tls_listener(int port) {
 }
 
 struct tls_connection* accept_tls_connection(int listen_sock, SSL_CTX *ctx) {
+    int sock = accept(listen_sock, NULL, NULL);
+    if (sock < 0) {
+        perror("accept");
+        return NULL;
+    }
+    return accept_tls_socket(sock, ctx);
+}
+
+// Server side of the handshake on an accepted socket; closes it on failure
+struct tls_connection* accept_tls_socket(int sock, SSL_CTX *ctx) {
     struct tls_connection *conn;
     struct sockaddr_in addr;
     socklen_t len = sizeof(addr);
-    
+
     conn = calloc(1, sizeof(*conn));
     if (!conn) {
+        close(sock);
         return NULL;
     }
-
-    conn->socket = accept(listen_sock, (struct sockaddr*)&addr, &len);
-    if (conn->socket < 0) {
-        perror("accept");
-        free(conn);
-        return NULL;
-    }
+    conn->socket = sock;
 
     conn->ssl = SSL_new(ctx);
     if (!conn->ssl) {
@@ -168,12 +180,26 @@ struct tls_connection* accept_tls_connection(int listen_sock, SSL_CTX *ctx) {
         return NULL;
     }
 
-    printf("TLS connection accepted from %s:%d\n", 
-           inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
-    
+    if (getpeername(conn->socket, (struct sockaddr*)&addr, &len) == 0) {
+        printf("TLS connection accepted from %s:%d\n",
+               inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+    }
+
     return conn;
 }
 
+// Bound every blocking send and receive on a bootstrap socket, so a
+// stalled peer fails the handshake instead of holding its thread
+int set_socket_timeouts(int sock, int seconds) {
+    struct timeval tv = { .tv_sec = seconds, .tv_usec = 0 };
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0 ||
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0) {
+        perror("setsockopt (timeout)");
+        return -1;
+    }
+    return 0;
+}
+
 struct tls_connection* connect_tls_server(const char *hostname, int port) {
     struct tls_connection *conn;
     struct sockaddr_in addr;
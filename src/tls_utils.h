@@ -9,6 +9,8 @@
 #define TLS_PORT 4433
 #define CERT_FILE "server.crt"
 #define KEY_FILE "server.key"
+#define TLS_LISTEN_BACKLOG 10
+#define TLS_BOOTSTRAP_TIMEOUT_S 5  // Per blocking call during server bring-up
 
 struct tls_connection {
     SSL_CTX *ctx;
@@ -38,7 +40,9 @@ void cleanup_openssl(void);
 SSL_CTX* create_server_context(void);
 int configure_server_context(SSL_CTX *ctx, const char *cert_file, const char *key_file);
 int create_tls_listener(int port);
+int create_tls_listener_backlog(int port, int backlog);
 struct tls_connection* accept_tls_connection(int listen_sock, SSL_CTX *ctx);
+struct tls_connection* accept_tls_socket(int sock, SSL_CTX *ctx);
 
 // Client functions
 SSL_CTX* create_client_context(void);
@@ -56,5 +60,6 @@ int receive_rdma_params(struct tls_connection *conn, struct rdma_conn_params *pa
 // Utility functions
 void print_ssl_error(const char *msg);
 void close_tls_connection(struct tls_connection *conn);
+int set_socket_timeouts(int sock, int seconds);
 
 #endif // TLS_UTILS_H
\ No newline at end of file